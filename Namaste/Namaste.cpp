@@ -4,9 +4,21 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
 
 #include "geometry.h"
-#include "transform.h"
+#include "parallel.h"
+#include "parser.h"
+#include "scenecache.h"
+#include "trianglemesh.h"
+#include "widebvh.h"
+#include "benchmark.h"
+#include "film.h"
+#include "renderer.h"
+#include "sampler.h"
+#include "stats.h"
 
 struct Options
 {
@@ -14,63 +26,305 @@ struct Options
 	{
 		nCores = 0;
 		quickRender = quiet = verbose = openWindow = false;
+		useSceneCache = true;
+		compressBVH = false;
+		adaptiveSampling = false;
+		runBenchmarks = false;
 		imageFile = "";
 	}
 
 	int nCores;
 	bool quickRender;
+	// --quiet leaves only errors, and wins over --verbose
 	bool quiet, verbose;
 	bool openWindow;
+	bool useSceneCache;
+	bool compressBVH;
+	bool adaptiveSampling;
+	bool runBenchmarks;
 	std::string imageFile;
 };
 
 void pbrtInit(const Options &options)
 {
+	// nCores == 0 means one thread per hardware thread
+	namaste::parallel::parallelInit(options.nCores);
 }
 
 void pbrtCleanup()
 {
+	namaste::parallel::parallelCleanup();
 }
 
-bool parseFile(const std::string &filename)
+// Looks at the middle of the scene from a fixed corner, far enough back to
+// take all of it in; scenes don't have cameras of their own yet
+struct PreviewCamera
 {
-	std::cout << filename << std::endl;
-	return true;
+	PreviewCamera(const namaste::geom::BBox &aBound, int aWidth, int aHeight)
+	{
+		using namespace namaste::geom;
+		Point center;
+		float radius;
+		aBound.boundingSphere(&center, &radius);
+		const float fieldOfView = 45.0f;
+		tanHalfAngle = tanf(0.5f * fieldOfView * 3.14159265f / 180.0f);
+		forward = normalize(Vector(-1.0f, -1.0f, -1.0f));
+		right = normalize(cross(forward, Vector(0.0f, 0.0f, 1.0f)));
+		up = cross(right, forward);
+		origin = center - forward * (1.05f * radius / tanHalfAngle);
+		invWidth = 1.0f / aWidth;
+		invHeight = 1.0f / aHeight;
+		aspect = static_cast<float>(aWidth) / aHeight;
+	}
+
+	namaste::geom::Ray generateRay(float filmX, float filmY) const
+	{
+		float sx = (2.0f * filmX * invWidth - 1.0f) * tanHalfAngle * aspect;
+		float sy = (1.0f - 2.0f * filmY * invHeight) * tanHalfAngle;
+		return namaste::geom::Ray(origin, normalize(forward + right * sx + up * sy), 0.0f, INFINITY, 0.0f, 0);
+	}
+
+	namaste::geom::Point origin;
+	namaste::geom::Vector forward, right, up;
+	float tanHalfAngle, aspect;
+	float invWidth, invHeight;
+};
+
+void printParseStats(const namaste::scene::SceneParser &parser, const namaste::scene::Scene &scene)
+{
+	double megabytes = parser.bytesParsed / (1024.0 * 1024.0);
+	std::cout << "Parsed " << megabytes << " MB in " << parser.parseSeconds << " s ("
+		<< (parser.parseSeconds > 0.0 ? megabytes / parser.parseSeconds : 0.0) << " MB/s): "
+		<< scene.geometry.meshes.size() << " meshes, " << scene.geometry.triangleCount() << " triangles" << std::endl;
 }
 
 int main(int argc, char *argv[])
 {
 	Options options;
 	std::vector<std::string> filenames;
-	pbrtInit(options);
 
-	using namespace namaste::geom;
+	// Process command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--ncores" && i + 1 < argc)
+		{
+			options.nCores = atoi(argv[++i]);
+		}
+		else if (arg == "--outfile" && i + 1 < argc)
+		{
+			options.imageFile = argv[++i];
+		}
+		else if (arg == "--quick")
+		{
+			options.quickRender = true;
+		}
+		else if (arg == "--quiet")
+		{
+			options.quiet = true;
+		}
+		else if (arg == "--verbose")
+		{
+			options.verbose = true;
+		}
+		else if (arg == "--nocache")
+		{
+			options.useSceneCache = false;
+		}
+		else if (arg == "--compressbvh")
+		{
+			options.compressBVH = true;
+		}
+		else if (arg == "--adaptive")
+		{
+			options.adaptiveSampling = true;
+		}
+		else if (arg == "--bench")
+		{
+			options.runBenchmarks = true;
+		}
+		else if (arg == "--help" || arg == "-h")
+		{
+			std::cout << "usage: namaste [--ncores n] [--outfile filename] [--quick] [--quiet] [--verbose] [--nocache] [--compressbvh] [--adaptive] [--bench] [<filename.pbrt> ...]" << std::endl;
+			return 0;
+		}
+		else
+		{
+			filenames.push_back(arg);
+		}
+	}
+	if (options.quiet)
+	{
+		options.verbose = false;
+	}
 
-	Vector v1(1.0f, 0.0f, 0.0f);	// x-axis
-	Vector v2, v3;
-	coordinateSystem(v1, &v2, &v3);
+	pbrtInit(options);
 
-	std::cout << v2 << " " << v3 << std::endl;
+	if (options.runBenchmarks)
+	{
+		// Results go to stdout as JSON Lines; --quick runs a reduced suite
+		namaste::bench::runBenchmarks(std::cout, namaste::parallel::globalThreadPool(), options.quickRender);
+		pbrtCleanup();
+		return 0;
+	}
 
-	Matrix4x4 m;
-	std::cout << m;
+	using namespace namaste::geom;
 
+	namaste::scene::Scene scene;
+	namaste::scene::SceneParser parser(scene);
+	parser.logWarnings = !options.quiet;
+	namaste::scene::SceneCache cache;
+	std::string cacheFile;
+	bool loadedFromCache = false, writeCache = false;
 	if (filenames.size() == 0)
 	{
 		// Parse scene from standard input
+		if (!parser.parseStream(stdin))
+		{
+			std::cerr << "Couldn't read scene from standard input" << std::endl;
+		}
 	}
 	else
 	{
-		// Parse scene from input file(s)
-		for (auto it = filenames.cbegin(); it < filenames.cend(); ++it)
+		// Scenes that were rendered before are loaded from the cache written
+		// next to the first scene file, unless any of their sources changed
+		cacheFile = filenames[0] + ".cache";
+		auto start = std::chrono::steady_clock::now();
+		loadedFromCache = options.useSceneCache && cache.open(cacheFile) && cache.isValidFor(filenames);
+		if (loadedFromCache)
 		{
-			if (!parseFile(*it))
+			scene.options = cache.options();
+			if (options.verbose)
+			{
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::cout << "Loaded scene cache " << cacheFile << " in " << seconds << " s: "
+					<< cache.geometry().meshCount << " meshes, " << cache.geometry().triangleCount() << " triangles" << std::endl;
+			}
+		}
+		else
+		{
+			cache.close();
+
+			// Parse scene from input file(s), concurrently on the global pool
+			std::vector<std::string> failed;
+			parser.parseFiles(filenames, *namaste::parallel::globalThreadPool(), &failed);
+			for (auto it = failed.cbegin(); it < failed.cend(); ++it)
 			{
 				std::cerr << "Couldn't open scene file: " << *it << std::endl;
 			}
+
+			// Only complete scenes are worth caching
+			writeCache = options.useSceneCache && failed.empty() && parser.errorCount == 0;
+		}
+	}
+
+	if (options.verbose && !loadedFromCache)
+	{
+		printParseStats(parser, scene);
+	}
+
+	// The triangles and their BVH, straight from the cache if possible
+	namaste::shape::TriangleMesh mesh(loadedFromCache ? cache.geometry() : scene.geometry.view());
+	auto bvhStart = std::chrono::steady_clock::now();
+	namaste::accel::BVHAccel bvh = loadedFromCache && cache.hasBVH() ? cache.loadBVH() :
+		namaste::accel::BVHAccel(mesh.triangleBounds(), 4, namaste::parallel::globalThreadPool());
+	double bvhSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvhStart).count();
+
+	if (writeCache && !namaste::scene::writeSceneCache(cacheFile, scene, filenames, parser.sourceFiles, &bvh) && options.verbose)
+	{
+		std::cerr << "Couldn't write scene cache: " << cacheFile << std::endl;
+	}
+
+	if (options.verbose && mesh.triangleCount() > 0)
+	{
+		double bvhBytes = static_cast<double>(bvh.nodes.size() * sizeof(namaste::accel::LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t));
+		std::cout << "BVH: " << bvh.nodes.size() << " nodes in " << bvhSeconds << " s; "
+			<< mesh.bytesPerTriangle() << " bytes/triangle of geometry + " << bvhBytes / mesh.triangleCount() << " of BVH" << std::endl;
+	}
+
+	// Optionally trade the binary tree for a 4-wide one with quantized child
+	// bounds, which takes about half the memory and traverses faster
+	std::unique_ptr<namaste::accel::WideBVH> wideBVH;
+	if (options.compressBVH && mesh.triangleCount() > 0)
+	{
+		wideBVH.reset(new namaste::accel::WideBVH(bvh));
+		std::vector<namaste::accel::LinearBVHNode>().swap(bvh.nodes);
+		std::vector<uint32_t>().swap(bvh.primitiveIndices);
+		if (options.verbose)
+		{
+			std::cout << "Compressed BVH: " << wideBVH->nodeCount() << " nodes, "
+				<< static_cast<double>(wideBVH->memoryBytes()) / mesh.triangleCount() << " bytes/triangle" << std::endl;
 		}
 	}
 
+	// --quick trades the final sample count, the scene's if it has a Sampler
+	// directive, for a few samples per pixel
+	namaste::sampling::SamplerSettings samplerSettings = options.quickRender ?
+		namaste::sampling::previewSettings() : namaste::sampling::productionSettings();
+	if (!options.quickRender && scene.options.samplerSpecified)
+	{
+		samplerSettings.samplesPerPixel = scene.options.pixelSamples;
+	}
+	std::unique_ptr<namaste::sampling::Sampler> sampler = namaste::sampling::createSampler(samplerSettings);
+	if (options.verbose)
+	{
+		std::cout << "Sampler: " << sampler->name() << ", " << sampler->samplesPerPixel << " samples/pixel" << std::endl;
+	}
+
+	// Until there are materials and lights, the image is the geometry lit from
+	// the eye. It's rendered progressively, or with --adaptive in passes that
+	// put the samples where the image is still noisy, and rewritten after
+	// every pass, on the image writer's thread so rendering never waits for
+	// the disk
+	std::string imageFile = options.imageFile.empty() ? scene.options.imageFile : options.imageFile;
+	if (!imageFile.empty() && mesh.triangleCount() > 0)
+	{
+		namaste::render::TileRenderer renderer(scene.options.xResolution, scene.options.yResolution, sampler->samplesPerPixel);
+		namaste::render::Film film(renderer.width, renderer.height, renderer.tileSize);
+		namaste::render::ImageWriter writer;
+		PreviewCamera camera(mesh.worldBound(), renderer.width, renderer.height);
+		auto radiance = [&](float filmX, float filmY, int, namaste::MemoryArena &, float rgb[3])
+		{
+			Ray ray = camera.generateRay(filmX, filmY);
+			namaste::shape::TriangleHit hit;
+			if (wideBVH ? mesh.intersect(*wideBVH, ray, &hit) : mesh.intersect(bvh, ray, &hit))
+			{
+				Normal n = mesh.geometricNormal(hit.triangle);
+				rgb[0] = rgb[1] = rgb[2] = absDot(n, ray.d) / n.length();
+			}
+		};
+		auto passDone = [&](int, const std::vector<float> &pixels)
+		{
+			writer.submit(imageFile, renderer.width, renderer.height, pixels);
+		};
+		if (options.adaptiveSampling)
+		{
+			// The sampler's count becomes the average; the first pass mustn't spend
+			// all of it
+			namaste::render::AdaptiveSampling adaptive;
+			adaptive.initialSamples = std::max(2, std::min(adaptive.initialSamples, sampler->samplesPerPixel / 4));
+			renderer.renderAdaptive(*namaste::parallel::globalThreadPool(), radiance, *sampler, film, adaptive, passDone);
+		}
+		else
+		{
+			renderer.renderProgressive(*namaste::parallel::globalThreadPool(), radiance, *sampler, film, std::max(1, sampler->samplesPerPixel / 8), passDone);
+		}
+		if (!writer.finish())
+		{
+			std::cerr << "Couldn't write image: " << imageFile << std::endl;
+		}
+		else if (options.verbose)
+		{
+			std::cout << "Wrote " << imageFile << ": " << writer.written() << " updates, " << writer.dropped() << " skipped" << std::endl;
+			renderer.printStats(std::cout);
+		}
+	}
+
+	if (options.verbose)
+	{
+		namaste::stats::printStats(std::cout);
+	}
+
 	pbrtCleanup();
 
     return 0;
@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace namaste {
+
+	void* allocAligned(size_t aSize, size_t aAlignment)
+	{
+		assert(aAlignment > 0 && (aAlignment & (aAlignment - 1)) == 0);
+#if defined(_WIN32)
+		void *ptr = _aligned_malloc(aSize, aAlignment);
+#else
+		void *ptr = nullptr;
+		if (posix_memalign(&ptr, std::max(aAlignment, sizeof(void*)), aSize) != 0)
+		{
+			ptr = nullptr;
+		}
+#endif
+		if (!ptr)
+		{
+			throw std::bad_alloc();
+		}
+		return ptr;
+	}
+
+	void freeAligned(void *aPointer)
+	{
+		if (!aPointer)
+		{
+			return;
+		}
+#if defined(_WIN32)
+		_aligned_free(aPointer);
+#else
+		free(aPointer);
+#endif
+	}
+
+	// ---------------------------------------------------------------
+	// Memory arena class
+	// ---------------------------------------------------------------
+	MemoryArena::MemoryArena(size_t aBlockSize) :
+		peakBytesInUse(0), bytesReserved(0), allocationCount(0), blockSize(std::max(aBlockSize, cacheLineSize)),
+		currentBlockPos(0), retiredBytesInUse(0)
+	{
+		currentBlock.data = nullptr;
+		currentBlock.size = 0;
+	}
+
+	MemoryArena::~MemoryArena()
+	{
+		freeAligned(currentBlock.data);
+		for (auto it = usedBlocks.begin(); it < usedBlocks.end(); ++it)
+		{
+			freeAligned(it->data);
+		}
+		for (auto it = availableBlocks.begin(); it < availableBlocks.end(); ++it)
+		{
+			freeAligned(it->data);
+		}
+	}
+
+	void* MemoryArena::alloc(size_t aSize, size_t aAlignment)
+	{
+		assert(aAlignment > 0 && aAlignment <= cacheLineSize && (aAlignment & (aAlignment - 1)) == 0);
+		// Blocks are cache line aligned, so aligning the offset aligns the pointer
+		size_t start = (currentBlockPos + aAlignment - 1) & ~(aAlignment - 1);
+		if (!currentBlock.data || start + aSize > currentBlock.size)
+		{
+			// Retire the current block and move on to one that is large enough,
+			// reusing a block from before the last reset if possible
+			if (currentBlock.data)
+			{
+				retiredBytesInUse += currentBlockPos;
+				usedBlocks.push_back(currentBlock);
+				currentBlock.data = nullptr;
+			}
+			for (auto it = availableBlocks.begin(); it < availableBlocks.end(); ++it)
+			{
+				if (it->size >= aSize)
+				{
+					currentBlock = *it;
+					availableBlocks.erase(it);
+					break;
+				}
+			}
+			if (!currentBlock.data)
+			{
+				currentBlock.size = std::max(aSize, blockSize);
+				currentBlock.data = static_cast<uint8_t*>(allocAligned(currentBlock.size));
+				bytesReserved += currentBlock.size;
+			}
+			start = 0;
+		}
+
+		void *ret = currentBlock.data + start;
+		currentBlockPos = start + aSize;
+		++allocationCount;
+		peakBytesInUse = std::max(peakBytesInUse, bytesInUse());
+		return ret;
+	}
+
+	void MemoryArena::reset()
+	{
+		currentBlockPos = 0;
+		retiredBytesInUse = 0;
+		availableBlocks.insert(availableBlocks.end(), usedBlocks.begin(), usedBlocks.end());
+		usedBlocks.clear();
+	}
+
+	size_t MemoryArena::bytesInUse() const
+	{
+		return retiredBytesInUse + currentBlockPos;
+	}
+
+} // namespace namaste
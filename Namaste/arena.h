@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace namaste {
+
+	static const size_t cacheLineSize = 64;
+
+	// Heap memory aligned to a power-of-two boundary, by default a cache line,
+	// so that blocks owned by different threads never share one. Release with
+	// freeAligned
+	void* allocAligned(size_t aSize, size_t aAlignment = cacheLineSize);
+	void freeAligned(void *aPointer);
+
+	// A bump-pointer allocator for short-lived temporaries, such as the BSDFs
+	// and intersection records of a single sample. Allocation just advances an
+	// offset into the current block, and everything is freed at once by
+	// reset(), which keeps the blocks for reuse: after warming up, a render
+	// doesn't touch the heap at all. Not thread-safe - give each thread its own
+	// arena. Destructors of objects placed in the arena are never run
+	class MemoryArena
+	{
+	public:
+		explicit MemoryArena(size_t aBlockSize = 256 * 1024);
+		~MemoryArena();
+
+		MemoryArena(const MemoryArena &) = delete;
+		MemoryArena& operator=(const MemoryArena &) = delete;
+
+		// aAlignment must be a power of two no greater than cacheLineSize
+		void* alloc(size_t aSize, size_t aAlignment = 16);
+
+		// Space for aCount default-constructed Ts
+		template <typename T>
+		T* alloc(size_t aCount = 1);
+
+		void reset();
+
+		size_t bytesInUse() const;
+
+		// Statistics over the lifetime of the arena
+		size_t peakBytesInUse;
+		size_t bytesReserved;
+		uint64_t allocationCount;
+	private:
+		struct Block
+		{
+			uint8_t *data;
+			size_t size;
+		};
+
+		size_t blockSize;
+		Block currentBlock;
+		size_t currentBlockPos;
+		// Bytes handed out from blocks retired since the last reset
+		size_t retiredBytesInUse;
+		std::vector<Block> usedBlocks;
+		std::vector<Block> availableBlocks;
+	};
+
+	template <typename T>
+	T* MemoryArena::alloc(size_t aCount)
+	{
+		static_assert(alignof(T) <= cacheLineSize, "Arena allocations are at most cache line aligned");
+		T *ret = static_cast<T*>(alloc(aCount * sizeof(T), alignof(T) > 16 ? alignof(T) : 16));
+		for (size_t i = 0; i < aCount; ++i)
+		{
+			new (&ret[i]) T();
+		}
+		return ret;
+	}
+
+	// Constructs a Type in an arena: ARENA_ALLOC(arena, BSDF)(args...)
+#define ARENA_ALLOC(arena, Type) new ((arena).alloc(sizeof(Type), alignof(Type) > 16 ? alignof(Type) : 16)) Type
+
+	// A free list of fixed-size records, for objects that are created and
+	// destroyed individually rather than with a whole sample. Slots are carved
+	// out of cache-line-aligned chunks that are only returned to the heap when
+	// the pool is destroyed. Not thread-safe, like MemoryArena
+	template <typename T>
+	class ObjectPool
+	{
+	public:
+		explicit ObjectPool(size_t aObjectsPerChunk = 1024);
+		~ObjectPool();
+
+		ObjectPool(const ObjectPool &) = delete;
+		ObjectPool& operator=(const ObjectPool &) = delete;
+
+		template <typename... Args>
+		T* acquire(Args&&... args);
+		void release(T *aObject);
+
+		size_t objectsInUse;
+		size_t peakObjectsInUse;
+		size_t capacity;
+	private:
+		union Slot
+		{
+			Slot *next;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		void grow();
+
+		size_t objectsPerChunk;
+		Slot *freeList;
+		std::vector<Slot*> chunks;
+	};
+
+	template <typename T>
+	ObjectPool<T>::ObjectPool(size_t aObjectsPerChunk) :
+		objectsInUse(0), peakObjectsInUse(0), capacity(0), objectsPerChunk(aObjectsPerChunk > 0 ? aObjectsPerChunk : 1), freeList(nullptr)
+	{
+	}
+
+	template <typename T>
+	ObjectPool<T>::~ObjectPool()
+	{
+		for (auto it = chunks.begin(); it < chunks.end(); ++it)
+		{
+			freeAligned(*it);
+		}
+	}
+
+	template <typename T>
+	template <typename... Args>
+	T* ObjectPool<T>::acquire(Args&&... args)
+	{
+		if (!freeList)
+		{
+			grow();
+		}
+		Slot *slot = freeList;
+		freeList = slot->next;
+		if (++objectsInUse > peakObjectsInUse)
+		{
+			peakObjectsInUse = objectsInUse;
+		}
+		return new (slot->storage) T(std::forward<Args>(args)...);
+	}
+
+	template <typename T>
+	void ObjectPool<T>::release(T *aObject)
+	{
+		if (!aObject)
+		{
+			return;
+		}
+		aObject->~T();
+		Slot *slot = reinterpret_cast<Slot*>(aObject);
+		slot->next = freeList;
+		freeList = slot;
+		--objectsInUse;
+	}
+
+	template <typename T>
+	void ObjectPool<T>::grow()
+	{
+		static_assert(alignof(Slot) <= cacheLineSize, "Pooled objects are at most cache line aligned");
+		Slot *chunk = static_cast<Slot*>(allocAligned(objectsPerChunk * sizeof(Slot)));
+		for (size_t i = 0; i < objectsPerChunk; ++i)
+		{
+			chunk[i].next = i + 1 < objectsPerChunk ? &chunk[i + 1] : freeList;
+		}
+		freeList = chunk;
+		chunks.push_back(chunk);
+		capacity += objectsPerChunk;
+	}
+
+} // namespace namaste
@@ -0,0 +1,345 @@
+#include "stdafx.h"
+#include "batch.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		namespace batch {
+
+			// ---------------------------------------------------------------
+			// Scalar kernels
+			// ---------------------------------------------------------------
+			// Written out component-wise (rather than building Vectors) so that the
+			// order of operations visibly matches the SIMD kernels below. The SIMD
+			// kernels also use these for their remainder elements
+			namespace scalar {
+
+				void normalize(float *xs, float *ys, float *zs, size_t count)
+				{
+					for (size_t i = 0; i < count; ++i)
+					{
+						float lengthSquared = xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i];
+						float inv = 1.0f / sqrtf(lengthSquared);
+						xs[i] *= inv;
+						ys[i] *= inv;
+						zs[i] *= inv;
+					}
+				}
+
+				void faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count)
+				{
+					for (size_t i = 0; i < count; ++i)
+					{
+						float d = nxs[i] * vxs[i] + nys[i] * vys[i] + nzs[i] * vzs[i];
+						if (d < 0.0f)
+						{
+							nxs[i] = -nxs[i];
+							nys[i] = -nys[i];
+							nzs[i] = -nzs[i];
+						}
+					}
+				}
+
+				void distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count)
+				{
+					for (size_t i = 0; i < count; ++i)
+					{
+						float dx = xs[i] - aPoint.x;
+						float dy = ys[i] - aPoint.y;
+						float dz = zs[i] - aPoint.z;
+						out[i] = dx * dx + dy * dy + dz * dz;
+					}
+				}
+
+				BBox bounds(const float *xs, const float *ys, const float *zs, size_t count)
+				{
+					BBox ret;
+					for (size_t i = 0; i < count; ++i)
+					{
+						ret.pMin.x = simd::minf(xs[i], ret.pMin.x);
+						ret.pMin.y = simd::minf(ys[i], ret.pMin.y);
+						ret.pMin.z = simd::minf(zs[i], ret.pMin.z);
+						ret.pMax.x = simd::maxf(xs[i], ret.pMax.x);
+						ret.pMax.y = simd::maxf(ys[i], ret.pMax.y);
+						ret.pMax.z = simd::maxf(zs[i], ret.pMax.z);
+					}
+					return ret;
+				}
+
+			} // namespace scalar
+
+#if defined(NAMASTE_SSE)
+			namespace {
+
+				// ---------------------------------------------------------------
+				// SSE kernels
+				// ---------------------------------------------------------------
+				// Each kernel handles as many whole vectors as it can and returns the
+				// number of elements processed; the caller finishes the rest in scalar
+				namespace sse {
+
+					size_t normalize(float *xs, float *ys, float *zs, size_t count)
+					{
+						const __m128 one = _mm_set1_ps(1.0f);
+						size_t i = 0;
+						for (; i + 4 <= count; i += 4)
+						{
+							__m128 x = _mm_loadu_ps(xs + i);
+							__m128 y = _mm_loadu_ps(ys + i);
+							__m128 z = _mm_loadu_ps(zs + i);
+							__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+
+							// A full-precision divide and square root rather than rsqrtps, which
+							// would be faster but wouldn't match the scalar result
+							__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+							_mm_storeu_ps(xs + i, _mm_mul_ps(x, inv));
+							_mm_storeu_ps(ys + i, _mm_mul_ps(y, inv));
+							_mm_storeu_ps(zs + i, _mm_mul_ps(z, inv));
+						}
+						return i;
+					}
+
+					size_t faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count)
+					{
+						const __m128 signBit = _mm_set1_ps(-0.0f);
+						const __m128 zero = _mm_setzero_ps();
+						size_t i = 0;
+						for (; i + 4 <= count; i += 4)
+						{
+							__m128 nx = _mm_loadu_ps(nxs + i);
+							__m128 ny = _mm_loadu_ps(nys + i);
+							__m128 nz = _mm_loadu_ps(nzs + i);
+							__m128 d = _mm_add_ps(_mm_add_ps(
+								_mm_mul_ps(nx, _mm_loadu_ps(vxs + i)),
+								_mm_mul_ps(ny, _mm_loadu_ps(vys + i))),
+								_mm_mul_ps(nz, _mm_loadu_ps(vzs + i)));
+
+							// Negate by flipping the sign bit of the lanes facing away
+							__m128 flip = _mm_and_ps(_mm_cmplt_ps(d, zero), signBit);
+							_mm_storeu_ps(nxs + i, _mm_xor_ps(nx, flip));
+							_mm_storeu_ps(nys + i, _mm_xor_ps(ny, flip));
+							_mm_storeu_ps(nzs + i, _mm_xor_ps(nz, flip));
+						}
+						return i;
+					}
+
+					size_t distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count)
+					{
+						const __m128 px = _mm_set1_ps(aPoint.x);
+						const __m128 py = _mm_set1_ps(aPoint.y);
+						const __m128 pz = _mm_set1_ps(aPoint.z);
+						size_t i = 0;
+						for (; i + 4 <= count; i += 4)
+						{
+							__m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+							__m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+							__m128 dz = _mm_sub_ps(_mm_loadu_ps(zs + i), pz);
+							_mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+						}
+						return i;
+					}
+
+					size_t bounds(const float *xs, const float *ys, const float *zs, size_t count, BBox *ret)
+					{
+						if (count < 4)
+						{
+							return 0;
+						}
+
+						__m128 minX = _mm_set1_ps(INFINITY), minY = minX, minZ = minX;
+						__m128 maxX = _mm_set1_ps(-INFINITY), maxY = maxX, maxZ = maxX;
+						size_t i = 0;
+						for (; i + 4 <= count; i += 4)
+						{
+							__m128 x = _mm_loadu_ps(xs + i);
+							__m128 y = _mm_loadu_ps(ys + i);
+							__m128 z = _mm_loadu_ps(zs + i);
+							minX = _mm_min_ps(x, minX);
+							minY = _mm_min_ps(y, minY);
+							minZ = _mm_min_ps(z, minZ);
+							maxX = _mm_max_ps(x, maxX);
+							maxY = _mm_max_ps(y, maxY);
+							maxZ = _mm_max_ps(z, maxZ);
+						}
+
+						alignas(16) float lanes[6][4];
+						_mm_store_ps(lanes[0], minX);
+						_mm_store_ps(lanes[1], minY);
+						_mm_store_ps(lanes[2], minZ);
+						_mm_store_ps(lanes[3], maxX);
+						_mm_store_ps(lanes[4], maxY);
+						_mm_store_ps(lanes[5], maxZ);
+						for (int lane = 0; lane < 4; ++lane)
+						{
+							ret->pMin.x = simd::minf(lanes[0][lane], ret->pMin.x);
+							ret->pMin.y = simd::minf(lanes[1][lane], ret->pMin.y);
+							ret->pMin.z = simd::minf(lanes[2][lane], ret->pMin.z);
+							ret->pMax.x = simd::maxf(lanes[3][lane], ret->pMax.x);
+							ret->pMax.y = simd::maxf(lanes[4][lane], ret->pMax.y);
+							ret->pMax.z = simd::maxf(lanes[5][lane], ret->pMax.z);
+						}
+						return i;
+					}
+
+				} // namespace sse
+
+				// ---------------------------------------------------------------
+				// AVX2 kernels
+				// ---------------------------------------------------------------
+				// Identical to the SSE kernels but 8 wide. Only called after checking
+				// cpuSupportsAVX2, as the rest of the program may be built without AVX
+				namespace avx2 {
+
+					NAMASTE_TARGET_AVX2 size_t normalize(float *xs, float *ys, float *zs, size_t count)
+					{
+						const __m256 one = _mm256_set1_ps(1.0f);
+						size_t i = 0;
+						for (; i + 8 <= count; i += 8)
+						{
+							__m256 x = _mm256_loadu_ps(xs + i);
+							__m256 y = _mm256_loadu_ps(ys + i);
+							__m256 z = _mm256_loadu_ps(zs + i);
+							__m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+							__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+							_mm256_storeu_ps(xs + i, _mm256_mul_ps(x, inv));
+							_mm256_storeu_ps(ys + i, _mm256_mul_ps(y, inv));
+							_mm256_storeu_ps(zs + i, _mm256_mul_ps(z, inv));
+						}
+						return i;
+					}
+
+					NAMASTE_TARGET_AVX2 size_t faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count)
+					{
+						const __m256 signBit = _mm256_set1_ps(-0.0f);
+						const __m256 zero = _mm256_setzero_ps();
+						size_t i = 0;
+						for (; i + 8 <= count; i += 8)
+						{
+							__m256 nx = _mm256_loadu_ps(nxs + i);
+							__m256 ny = _mm256_loadu_ps(nys + i);
+							__m256 nz = _mm256_loadu_ps(nzs + i);
+							__m256 d = _mm256_add_ps(_mm256_add_ps(
+								_mm256_mul_ps(nx, _mm256_loadu_ps(vxs + i)),
+								_mm256_mul_ps(ny, _mm256_loadu_ps(vys + i))),
+								_mm256_mul_ps(nz, _mm256_loadu_ps(vzs + i)));
+							__m256 flip = _mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_LT_OQ), signBit);
+							_mm256_storeu_ps(nxs + i, _mm256_xor_ps(nx, flip));
+							_mm256_storeu_ps(nys + i, _mm256_xor_ps(ny, flip));
+							_mm256_storeu_ps(nzs + i, _mm256_xor_ps(nz, flip));
+						}
+						return i;
+					}
+
+					NAMASTE_TARGET_AVX2 size_t distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count)
+					{
+						const __m256 px = _mm256_set1_ps(aPoint.x);
+						const __m256 py = _mm256_set1_ps(aPoint.y);
+						const __m256 pz = _mm256_set1_ps(aPoint.z);
+						size_t i = 0;
+						for (; i + 8 <= count; i += 8)
+						{
+							__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), px);
+							__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), py);
+							__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs + i), pz);
+							_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+						}
+						return i;
+					}
+
+					NAMASTE_TARGET_AVX2 size_t bounds(const float *xs, const float *ys, const float *zs, size_t count, BBox *ret)
+					{
+						if (count < 8)
+						{
+							return 0;
+						}
+
+						__m256 minX = _mm256_set1_ps(INFINITY), minY = minX, minZ = minX;
+						__m256 maxX = _mm256_set1_ps(-INFINITY), maxY = maxX, maxZ = maxX;
+						size_t i = 0;
+						for (; i + 8 <= count; i += 8)
+						{
+							__m256 x = _mm256_loadu_ps(xs + i);
+							__m256 y = _mm256_loadu_ps(ys + i);
+							__m256 z = _mm256_loadu_ps(zs + i);
+							minX = _mm256_min_ps(x, minX);
+							minY = _mm256_min_ps(y, minY);
+							minZ = _mm256_min_ps(z, minZ);
+							maxX = _mm256_max_ps(x, maxX);
+							maxY = _mm256_max_ps(y, maxY);
+							maxZ = _mm256_max_ps(z, maxZ);
+						}
+
+						alignas(32) float lanes[6][8];
+						_mm256_store_ps(lanes[0], minX);
+						_mm256_store_ps(lanes[1], minY);
+						_mm256_store_ps(lanes[2], minZ);
+						_mm256_store_ps(lanes[3], maxX);
+						_mm256_store_ps(lanes[4], maxY);
+						_mm256_store_ps(lanes[5], maxZ);
+						for (int lane = 0; lane < 8; ++lane)
+						{
+							ret->pMin.x = simd::minf(lanes[0][lane], ret->pMin.x);
+							ret->pMin.y = simd::minf(lanes[1][lane], ret->pMin.y);
+							ret->pMin.z = simd::minf(lanes[2][lane], ret->pMin.z);
+							ret->pMax.x = simd::maxf(lanes[3][lane], ret->pMax.x);
+							ret->pMax.y = simd::maxf(lanes[4][lane], ret->pMax.y);
+							ret->pMax.z = simd::maxf(lanes[5][lane], ret->pMax.z);
+						}
+						return i;
+					}
+
+				} // namespace avx2
+
+			} // anonymous namespace
+#endif
+
+			// ---------------------------------------------------------------
+			// Dispatch
+			// ---------------------------------------------------------------
+			void normalize(float *xs, float *ys, float *zs, size_t count)
+			{
+				size_t done = 0;
+#if defined(NAMASTE_SSE)
+				done = simd::cpuSupportsAVX2() ? avx2::normalize(xs, ys, zs, count) : sse::normalize(xs, ys, zs, count);
+#endif
+				scalar::normalize(xs + done, ys + done, zs + done, count - done);
+			}
+
+			void faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count)
+			{
+				size_t done = 0;
+#if defined(NAMASTE_SSE)
+				done = simd::cpuSupportsAVX2() ?
+					avx2::faceForward(nxs, nys, nzs, vxs, vys, vzs, count) :
+					sse::faceForward(nxs, nys, nzs, vxs, vys, vzs, count);
+#endif
+				scalar::faceForward(nxs + done, nys + done, nzs + done, vxs + done, vys + done, vzs + done, count - done);
+			}
+
+			void distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count)
+			{
+				size_t done = 0;
+#if defined(NAMASTE_SSE)
+				done = simd::cpuSupportsAVX2() ?
+					avx2::distanceSquared(xs, ys, zs, aPoint, out, count) :
+					sse::distanceSquared(xs, ys, zs, aPoint, out, count);
+#endif
+				scalar::distanceSquared(xs + done, ys + done, zs + done, aPoint, out + done, count - done);
+			}
+
+			BBox bounds(const float *xs, const float *ys, const float *zs, size_t count)
+			{
+				BBox ret;
+				size_t done = 0;
+#if defined(NAMASTE_SSE)
+				done = simd::cpuSupportsAVX2() ? avx2::bounds(xs, ys, zs, count, &ret) : sse::bounds(xs, ys, zs, count, &ret);
+#endif
+				return calcUnion(ret, scalar::bounds(xs + done, ys + done, zs + done, count - done));
+			}
+
+		} // namespace batch
+
+	} // namespace geom
+
+} // namespace namaste
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+#include "simd.h"
+#include "geometry.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		// Kernels that apply one geometric operation to whole arrays of points,
+		// vectors or normals stored in structure-of-arrays form (one array per
+		// component). Each computes exactly what the corresponding inline function
+		// in geometry.h computes per element. SSE or AVX2 is chosen at runtime,
+		// and every path - including the scalar fallback - performs the same
+		// operations in the same order, so results are bit-identical across CPUs
+		// (as long as the compiler doesn't contract multiply-adds into FMAs, which
+		// MSVC's default /fp:precise doesn't). Input and output arrays may alias
+		// only where noted
+		namespace batch {
+
+			// normalize() in place; every element must have a non-zero length
+			void normalize(float *xs, float *ys, float *zs, size_t count);
+
+			// faceForward(n, v) in place: flips each n[i] into the hemisphere of v[i]
+			void faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count);
+
+			// distanceSquared(p[i], aPoint), written to out (which may alias an input)
+			void distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count);
+
+			// calcUnion of every point with an empty box. Assumes no NaNs: as with
+			// std::min, the sign of a zero-valued bound may depend on evaluation order
+			BBox bounds(const float *xs, const float *ys, const float *zs, size_t count);
+
+			namespace scalar {
+
+				// Reference implementations, used when SIMD is unavailable
+				void normalize(float *xs, float *ys, float *zs, size_t count);
+				void faceForward(float *nxs, float *nys, float *nzs, const float *vxs, const float *vys, const float *vzs, size_t count);
+				void distanceSquared(const float *xs, const float *ys, const float *zs, const Point &aPoint, float *out, size_t count);
+				BBox bounds(const float *xs, const float *ys, const float *zs, size_t count);
+
+			} // namespace scalar
+
+		} // namespace batch
+
+	} // namespace geom
+
+} // namespace namaste
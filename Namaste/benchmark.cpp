@@ -0,0 +1,1162 @@
+#include "stdafx.h"
+#include "benchmark.h"
+#include "arena.h"
+#include "batch.h"
+#include "film.h"
+#include "instance.h"
+#include "parser.h"
+#include "raypacket.h"
+#include "renderer.h"
+#include "sampler.h"
+#include "texture.h"
+#include "transform.h"
+#include "trianglemesh.h"
+#include "widebvh.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace namaste {
+
+	namespace bench {
+
+		using namespace geom;
+		using scene::SceneGeometry;
+		using scene::MeshRange;
+
+		namespace {
+
+			const float pi = 3.14159265358979323846f;
+
+			// PCG32 (O'Neill): small, fast, and fully specified, unlike the
+			// standard library's distributions
+			class Random
+			{
+			public:
+				explicit Random(uint64_t aSeed) : state(0)
+				{
+					next();
+					state += aSeed;
+					next();
+				}
+
+				uint32_t next()
+				{
+					uint64_t old = state;
+					state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+					uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+					uint32_t rot = static_cast<uint32_t>(old >> 59);
+					return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+				}
+
+				// In [0, 1)
+				float uniform()
+				{
+					return (next() >> 8) * (1.0f / 16777216.0f);
+				}
+			private:
+				uint64_t state;
+			};
+
+			double secondsSince(std::chrono::steady_clock::time_point aStart)
+			{
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - aStart).count();
+			}
+
+			// Adds a mesh range covering everything appended since the given counts
+			void closeMesh(SceneGeometry *g, size_t aFirstVertex, size_t aFirstIndex)
+			{
+				MeshRange mesh;
+				mesh.firstVertex = static_cast<uint32_t>(aFirstVertex);
+				mesh.vertexCount = static_cast<uint32_t>(g->px.size() - aFirstVertex);
+				mesh.firstIndex = static_cast<uint32_t>(aFirstIndex);
+				mesh.indexCount = static_cast<uint32_t>(g->indices.size() - aFirstIndex);
+				mesh.hasNormals = false;
+				mesh.hasUVs = false;
+				g->meshes.push_back(mesh);
+			}
+
+			// A latitude / longitude unit sphere at the origin, as its own mesh
+			void appendSphere(SceneGeometry *g, int aResolution)
+			{
+				size_t firstVertex = g->px.size(), firstIndex = g->indices.size();
+				uint32_t base = static_cast<uint32_t>(firstVertex);
+				const int n = aResolution;
+				const float pi = 3.14159265358979323846f;
+				for (int i = 0; i <= n; ++i)
+				{
+					float theta = pi * i / n;
+					for (int j = 0; j < n; ++j)
+					{
+						float phi = 2.0f * pi * j / n;
+						g->px.push_back(sinf(theta) * cosf(phi));
+						g->py.push_back(sinf(theta) * sinf(phi));
+						g->pz.push_back(cosf(theta));
+					}
+				}
+				for (int i = 0; i < n; ++i)
+				{
+					for (int j = 0; j < n; ++j)
+					{
+						uint32_t a = base + i * n + j, b = base + i * n + (j + 1) % n;
+						uint32_t c = base + (i + 1) * n + j, d = base + (i + 1) * n + (j + 1) % n;
+						const uint32_t quad[6] = { a, c, b, b, c, d };
+						g->indices.insert(g->indices.end(), quad, quad + 6);
+					}
+				}
+				closeMesh(g, firstVertex, firstIndex);
+			}
+
+			// Moves the last mesh of g to world space
+			void transformLastMesh(SceneGeometry *g, const Transform &aTransform)
+			{
+				const MeshRange &mesh = g->meshes.back();
+				float *x = &g->px[mesh.firstVertex], *y = &g->py[mesh.firstVertex], *z = &g->pz[mesh.firstVertex];
+				aTransform.transformPoints(x, y, z, x, y, z, mesh.vertexCount);
+			}
+
+			void addSphereFlake(SceneGeometry *g, const Point &aCenter, float aRadius, int aDepth, int aResolution)
+			{
+				appendSphere(g, aResolution);
+				transformLastMesh(g, translate(Vector(aCenter)) * scale(aRadius, aRadius, aRadius));
+				if (aDepth == 0)
+				{
+					return;
+				}
+
+				// Six children around the equator and three above
+				const float pi = 3.14159265358979323846f;
+				const float childRadius = aRadius / 3.0f;
+				for (int i = 0; i < 9; ++i)
+				{
+					float phi = i < 6 ? 2.0f * pi * i / 6.0f : 2.0f * pi * (i - 6) / 3.0f + pi / 6.0f;
+					float elevation = i < 6 ? 0.0f : pi / 3.0f;
+					Vector dir(cosf(elevation) * cosf(phi), cosf(elevation) * sinf(phi), sinf(elevation));
+					addSphereFlake(g, aCenter + dir * (aRadius + childRadius), childRadius, aDepth - 1, aResolution);
+				}
+			}
+
+			// JSON Lines output
+			class Recorder
+			{
+			public:
+				Recorder(std::ostream &aOs) : os(aOs) {}
+
+				void record(const std::string &aScene, const std::string &aMetric, const std::string &aLayout, double aValue, const char *aUnit)
+				{
+					os << "{\"scene\":\"" << aScene << "\",\"metric\":\"" << aMetric << "\"";
+					if (!aLayout.empty())
+					{
+						os << ",\"layout\":\"" << aLayout << "\"";
+					}
+					os << ",\"value\":" << aValue << ",\"unit\":\"" << aUnit << "\"}" << std::endl;
+				}
+			private:
+				std::ostream &os;
+			};
+
+			// Keeps the results of timed loops alive
+			volatile float benchmarkSink;
+			void * volatile benchmarkPointerSink;
+
+			// Rate of op(i) for i in [0, aCount - 1), in millions per second. Every op
+			// returns a float, summed so that the work can't be optimized away
+			template <typename Op>
+			double opRate(size_t aCount, const Op &op)
+			{
+				float sum = 0.0f;
+				auto start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i + 1 < aCount; ++i)
+				{
+					sum += op(i);
+				}
+				benchmarkSink = benchmarkSink + sum;
+				return (aCount - 1) / secondsSince(start) * 1e-6;
+			}
+
+			// N-ray packets against one box, over the same rays as the one-at-a-time
+			// test. The rays are packed beforehand, as a packet traversal keeps them,
+			// in arena memory since the vector loads need 32-byte alignment
+			template <int N>
+			void benchmarkPacketBox(Recorder &out, const BBox &aBox, const std::vector<Ray> &aRays, const char *aLayout)
+			{
+				const size_t nPackets = aRays.size() / N;
+				MemoryArena arena(nPackets * sizeof(RayPacket<N>));
+				RayPacket<N> *packets = arena.alloc<RayPacket<N>>(nPackets);
+				for (size_t i = 0; i < nPackets * N; ++i)
+				{
+					packets[i / N].set(static_cast<int>(i % N), aRays[i]);
+				}
+
+				int hits = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < nPackets; ++i)
+				{
+					for (int mask = intersectP(aBox, packets[i], nullptr); mask; mask &= mask - 1)
+					{
+						++hits;
+					}
+				}
+				benchmarkSink = benchmarkSink + hits;
+				out.record("kernels", "ray_box", aLayout, nPackets * N / secondsSince(start) * 1e-6, "Mtests/s");
+			}
+
+			void benchmarkKernels(Recorder &out, size_t aCount)
+			{
+				Random random(7);
+				std::vector<float> x(aCount), y(aCount), z(aCount);
+				for (size_t i = 0; i < aCount; ++i)
+				{
+					x[i] = random.uniform() * 2.0f - 1.0f;
+					y[i] = random.uniform() * 2.0f - 1.0f;
+					z[i] = random.uniform() * 2.0f + 0.5f;
+				}
+				const int repeats = 8;
+
+				Transform t = translate(Vector(1.0f, 2.0f, 3.0f)) * rotate(30.0f, Vector(1.0f, 1.0f, 0.0f));
+				auto start = std::chrono::steady_clock::now();
+				for (int r = 0; r < repeats; ++r)
+				{
+					t.transformPoints(x.data(), y.data(), z.data(), x.data(), y.data(), z.data(), aCount);
+				}
+				out.record("kernels", "transform_points", "", repeats * aCount / secondsSince(start) * 1e-6, "Mpoints/s");
+
+				start = std::chrono::steady_clock::now();
+				for (int r = 0; r < repeats; ++r)
+				{
+					batch::normalize(x.data(), y.data(), z.data(), aCount);
+				}
+				out.record("kernels", "normalize", "", repeats * aCount / secondsSince(start) * 1e-6, "Mvectors/s");
+
+				start = std::chrono::steady_clock::now();
+				for (int r = 0; r < repeats; ++r)
+				{
+					benchmarkSink = benchmarkSink + batch::bounds(x.data(), y.data(), z.data(), aCount).pMax.x;
+				}
+				out.record("kernels", "bounds", "", repeats * aCount / secondsSince(start) * 1e-6, "Mpoints/s");
+
+				// One-at-a-time operations from geometry.h and transform.h, each next to
+				// the same arithmetic written out on plain floats: with the types fully
+				// inlined the two should run at the same rate
+				auto v = [&](size_t i) { return Vector(x[i], y[i], z[i]); };
+				const float *x0 = x.data(), *y0 = y.data(), *z0 = z.data();
+				out.record("kernels", "dot", "vector", opRate(aCount, [&](size_t i) { return dot(v(i), v(i + 1)); }), "Mops/s");
+				out.record("kernels", "dot", "scalar", opRate(aCount, [&](size_t i)
+				{
+					return x0[i] * x0[i + 1] + y0[i] * y0[i + 1] + z0[i] * z0[i + 1];
+				}), "Mops/s");
+
+				out.record("kernels", "cross", "vector", opRate(aCount, [&](size_t i)
+				{
+					Vector c = cross(v(i), v(i + 1));
+					return c.x + c.y + c.z;
+				}), "Mops/s");
+				out.record("kernels", "cross", "scalar", opRate(aCount, [&](size_t i)
+				{
+					float cx = y0[i] * z0[i + 1] - z0[i] * y0[i + 1];
+					float cy = z0[i] * x0[i + 1] - x0[i] * z0[i + 1];
+					float cz = x0[i] * y0[i + 1] - y0[i] * x0[i + 1];
+					return cx + cy + cz;
+				}), "Mops/s");
+
+				out.record("kernels", "length", "vector", opRate(aCount, [&](size_t i) { return v(i).length(); }), "Mops/s");
+				out.record("kernels", "length", "scalar", opRate(aCount, [&](size_t i)
+				{
+					return sqrtf(x0[i] * x0[i] + y0[i] * y0[i] + z0[i] * z0[i]);
+				}), "Mops/s");
+
+				out.record("kernels", "normalize_one", "vector", opRate(aCount, [&](size_t i)
+				{
+					Vector n = normalize(v(i));
+					return n.x + n.y + n.z;
+				}), "Mops/s");
+				out.record("kernels", "normalize_one", "scalar", opRate(aCount, [&](size_t i)
+				{
+					float invLength = 1.0f / sqrtf(x0[i] * x0[i] + y0[i] * y0[i] + z0[i] * z0[i]);
+					return x0[i] * invLength + y0[i] * invLength + z0[i] * invLength;
+				}), "Mops/s");
+
+				// Transform's operator() is out of line, so this one also shows the
+				// cost of the call
+				const Matrix4x4Data &d = t.m.data;
+				out.record("kernels", "transform_point", "vector", opRate(aCount, [&](size_t i)
+				{
+					Point p = t(Point(x0[i], y0[i], z0[i]));
+					return p.x + p.y + p.z;
+				}), "Mops/s");
+				out.record("kernels", "transform_point", "scalar", opRate(aCount, [&](size_t i)
+				{
+					float xp = d[0][0] * x0[i] + d[0][1] * y0[i] + d[0][2] * z0[i] + d[0][3];
+					float yp = d[1][0] * x0[i] + d[1][1] * y0[i] + d[1][2] * z0[i] + d[1][3];
+					float zp = d[2][0] * x0[i] + d[2][1] * y0[i] + d[2][2] * z0[i] + d[2][3];
+					return xp + yp + zp;
+				}), "Mops/s");
+
+				out.record("kernels", "transform_vector", "vector", opRate(aCount, [&](size_t i)
+				{
+					Vector w = t(v(i));
+					return w.x + w.y + w.z;
+				}), "Mops/s");
+				out.record("kernels", "transform_vector", "scalar", opRate(aCount, [&](size_t i)
+				{
+					float xw = d[0][0] * x0[i] + d[0][1] * y0[i] + d[0][2] * z0[i];
+					float yw = d[1][0] * x0[i] + d[1][1] * y0[i] + d[1][2] * z0[i];
+					float zw = d[2][0] * x0[i] + d[2][1] * y0[i] + d[2][2] * z0[i];
+					return xw + yw + zw;
+				}), "Mops/s");
+
+				BBox box(Point(-0.5f, -0.5f, -0.5f), Point(0.5f, 0.5f, 0.5f));
+				std::vector<Ray> rays;
+				rays.reserve(aCount);
+				for (size_t i = 0; i < aCount; ++i)
+				{
+					rays.push_back(Ray(Point(0.0f, 0.0f, -2.0f), Vector(x[i], y[i], z[i]), 0.0f, INFINITY, 0.0f, 0));
+				}
+				int hits = 0;
+				start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < aCount; ++i)
+				{
+					hits += box.intersectP(rays[i]);
+				}
+				benchmarkSink = benchmarkSink + hits;
+				out.record("kernels", "ray_box", "", aCount / secondsSince(start) * 1e-6, "Mtests/s");
+				benchmarkPacketBox<4>(out, box, rays, "packet4");
+				benchmarkPacketBox<8>(out, box, rays, "packet8");
+			}
+
+			// Closest-hit rays from random points around a box towards random points
+			// inside it, and shadow-like segments between two points inside
+			class RaySet
+			{
+			public:
+				RaySet(const BBox &aWorld, size_t aCount)
+				{
+					Random random(11);
+					auto randomPoint = [&](float aMargin)
+					{
+						Vector diagonal = aWorld.pMax - aWorld.pMin;
+						return aWorld.pMin + Vector((random.uniform() * (1.0f + 2.0f * aMargin) - aMargin) * diagonal.x,
+							(random.uniform() * (1.0f + 2.0f * aMargin) - aMargin) * diagonal.y,
+							(random.uniform() * (1.0f + 2.0f * aMargin) - aMargin) * diagonal.z);
+					};
+					cameraRays.reserve(aCount);
+					shadowRays.reserve(aCount);
+					for (size_t i = 0; i < aCount; ++i)
+					{
+						Point o = randomPoint(0.5f);
+						cameraRays.push_back(Ray(o, normalize(randomPoint(0.0f) - o), 0.0f, INFINITY, 0.0f, 0));
+						Point p = randomPoint(0.0f), q = randomPoint(0.0f);
+						float length = (q - p).length();
+						shadowRays.push_back(Ray(p, (q - p) / length, 0.0f, length, 0.0f, 0));
+					}
+				}
+
+				// Bounces each camera ray that hits the mesh off in a cosine-distributed
+				// direction about the surface normal: incoherent secondary rays, as a
+				// path tracer's later bounces would be
+				void addDiffuseRays(const shape::TriangleMesh &aMesh, const accel::BVHAccel &aBVH)
+				{
+					Random random(23);
+					const float epsilon = 1e-4f * (aBVH.worldBound().pMax - aBVH.worldBound().pMin).length();
+					diffuseRays.clear();
+					for (auto it = cameraRays.cbegin(); it < cameraRays.cend(); ++it)
+					{
+						Ray ray = *it;
+						shape::TriangleHit hit;
+						if (!aMesh.intersect(aBVH, ray, &hit))
+						{
+							continue;
+						}
+						Vector n(aMesh.geometricNormal(hit.triangle));
+						if (dot(n, ray.d) > 0.0f)
+						{
+							n = -n;
+						}
+						Vector s, t;
+						coordinateSystem(n, &s, &t);
+						float r = sqrtf(random.uniform()), phi = 2.0f * pi * random.uniform();
+						Vector d = r * cosf(phi) * s + r * sinf(phi) * t + sqrtf(std::max(0.0f, 1.0f - r * r)) * n;
+						diffuseRays.push_back(Ray(aMesh.hitPoint(hit), d, epsilon, INFINITY, 0.0f, 1));
+					}
+				}
+
+				// Records rays per second and the fraction that hit, for the camera rays
+				// or, with aDiffuse, for the diffuse rays
+				void closestHit(Recorder &out, const std::string &aScene, const char *aLayout, const std::function<bool(const Ray &)> &intersect, bool aDiffuse = false) const
+				{
+					const std::vector<Ray> &traced = aDiffuse ? diffuseRays : cameraRays;
+					size_t nHits = 0;
+					auto start = std::chrono::steady_clock::now();
+					for (auto it = traced.cbegin(); it < traced.cend(); ++it)
+					{
+						Ray ray = *it;
+						nHits += intersect(ray);
+					}
+					recordHits(out, aScene, aLayout, aDiffuse, traced.size(), secondsSince(start), nHits);
+				}
+
+				// The same rays in sorted streams of the default size, traced either one
+				// at a time or as a wavefront; layout "binary" is the same BVH without
+				// streams. Sorting is part of the time
+				void closestHitStream(Recorder &out, const std::string &aScene, const shape::TriangleMesh &aMesh, const accel::BVHAccel &aBVH, bool aWavefront, bool aDiffuse = false) const
+				{
+					const std::vector<Ray> &traced = aDiffuse ? diffuseRays : cameraRays;
+					accel::RayStream stream(64 * 1024, aWavefront);
+					std::vector<shape::TriangleHit> hits(stream.capacity());
+					size_t nHits = 0;
+					auto start = std::chrono::steady_clock::now();
+					for (auto it = traced.cbegin(); it < traced.cend(); )
+					{
+						stream.clear();
+						for (; it < traced.cend() && !stream.full(); ++it)
+						{
+							stream.add(*it);
+						}
+						stream.sort();
+						nHits += aMesh.intersect(aBVH, stream, hits.data());
+					}
+					recordHits(out, aScene, aWavefront ? "stream_wavefront" : "stream_single", aDiffuse, traced.size(), secondsSince(start), nHits);
+				}
+
+				void anyHit(Recorder &out, const std::string &aScene, const char *aLayout, const std::function<bool(const Ray &)> &intersectP) const
+				{
+					size_t nOccluded = 0;
+					auto start = std::chrono::steady_clock::now();
+					for (auto it = shadowRays.cbegin(); it < shadowRays.cend(); ++it)
+					{
+						nOccluded += intersectP(*it);
+					}
+					out.record(aScene, "any_hit", aLayout, shadowRays.size() / secondsSince(start) * 1e-6, "Mrays/s");
+					out.record(aScene, "any_hit_fraction", aLayout, static_cast<double>(nOccluded) / shadowRays.size(), "ratio");
+				}
+
+				std::vector<Ray> cameraRays, shadowRays, diffuseRays;
+			private:
+				static void recordHits(Recorder &out, const std::string &aScene, const char *aLayout, bool aDiffuse, size_t aRays, double aSeconds, size_t aHits)
+				{
+					out.record(aScene, aDiffuse ? "diffuse_hit" : "closest_hit", aLayout, aRays / aSeconds * 1e-6, "Mrays/s");
+					out.record(aScene, aDiffuse ? "diffuse_hit_fraction" : "closest_hit_fraction", aLayout, static_cast<double>(aHits) / aRays, "ratio");
+				}
+			};
+
+			void benchmarkScene(Recorder &out, const std::string &aName, const SceneGeometry &aGeometry, size_t aRays, parallel::ThreadPool *aPool)
+			{
+				shape::TriangleMesh mesh(aGeometry.view());
+				const size_t nTriangles = mesh.triangleCount();
+				out.record(aName, "triangles", "", static_cast<double>(nTriangles), "count");
+				out.record(aName, "geometry_memory", "", mesh.bytesPerTriangle() * nTriangles / (1024.0 * 1024.0), "MB");
+
+				auto start = std::chrono::steady_clock::now();
+				std::vector<BBox> bounds = mesh.triangleBounds();
+				accel::BVHAccel bvh(bounds, 4, aPool);
+				out.record(aName, "build", "binary", secondsSince(start), "s");
+				start = std::chrono::steady_clock::now();
+				accel::WideBVH wide(bvh, false);
+				out.record(aName, "build", "wide", secondsSince(start), "s");
+				start = std::chrono::steady_clock::now();
+				accel::WideBVH quantized(bvh, true);
+				out.record(aName, "build", "quantized", secondsSince(start), "s");
+
+				const double megabyte = 1024.0 * 1024.0;
+				out.record(aName, "bvh_memory", "binary", (bvh.nodes.size() * sizeof(accel::LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t)) / megabyte, "MB");
+				out.record(aName, "bvh_memory", "wide", wide.memoryBytes() / megabyte, "MB");
+				out.record(aName, "bvh_memory", "quantized", quantized.memoryBytes() / megabyte, "MB");
+
+				RaySet rays(bvh.worldBound(), aRays);
+				shape::TriangleHit hit;
+				rays.closestHit(out, aName, "binary", [&](const Ray &r) { return mesh.intersect(bvh, r, &hit); });
+				rays.closestHit(out, aName, "wide", [&](const Ray &r) { return mesh.intersect(wide, r, &hit); });
+				rays.closestHit(out, aName, "quantized", [&](const Ray &r) { return mesh.intersect(quantized, r, &hit); });
+				rays.closestHitStream(out, aName, mesh, bvh, false);
+				rays.closestHitStream(out, aName, mesh, bvh, true);
+				rays.addDiffuseRays(mesh, bvh);
+				rays.closestHit(out, aName, "binary", [&](const Ray &r) { return mesh.intersect(bvh, r, &hit); }, true);
+				rays.closestHitStream(out, aName, mesh, bvh, false, true);
+				rays.closestHitStream(out, aName, mesh, bvh, true, true);
+				rays.anyHit(out, aName, "binary", [&](const Ray &r) { return mesh.intersectP(bvh, r); });
+				rays.anyHit(out, aName, "wide", [&](const Ray &r) { return mesh.intersectP(wide, r); });
+				rays.anyHit(out, aName, "quantized", [&](const Ray &r) { return mesh.intersectP(quantized, r); });
+			}
+
+			// BVH build time with 1, 2, 4, ... threads up to aMaxThreads, each on a
+			// pool of its own, and the speedup over one thread. The scene has to be
+			// large enough for the cooperative top of the build to kick in
+			void benchmarkBuildScaling(Recorder &out, const SceneGeometry &aGeometry, int aMaxThreads)
+			{
+				const std::string name = "build_scaling";
+				shape::TriangleMesh mesh(aGeometry.view());
+				std::vector<BBox> bounds = mesh.triangleBounds();
+				out.record(name, "triangles", "", static_cast<double>(mesh.triangleCount()), "count");
+
+				double oneThreadSeconds = 0.0;
+				for (int n = 1; ; n = std::min(2 * n, aMaxThreads))
+				{
+					parallel::ThreadPool pool(n);
+					auto start = std::chrono::steady_clock::now();
+					accel::BVHAccel bvh(bounds, 4, &pool);
+					double seconds = secondsSince(start);
+					if (n == 1)
+					{
+						oneThreadSeconds = seconds;
+					}
+					const std::string layout = std::to_string(n) + "_threads";
+					out.record(name, "build", layout, seconds, "s");
+					out.record(name, "speedup", layout, oneThreadSeconds / seconds, "ratio");
+					if (n == aMaxThreads)
+					{
+						break;
+					}
+				}
+			}
+
+			// Parse time of aFiles generated scene files with 1, 2, 4, ... threads up
+			// to aMaxThreads, each on a pool of its own, and the speedup over one
+			// thread. Each file holds one triangle soup, so the files are parsed
+			// concurrently but merged in order
+			void benchmarkParseScaling(Recorder &out, int aFiles, size_t aTrianglesPerFile, int aMaxThreads)
+			{
+				const std::string name = "parse_scaling";
+				std::vector<std::string> fileNames;
+				uint64_t bytes = 0;
+				for (int i = 0; i < aFiles; ++i)
+				{
+					const std::string fileName = "namaste_benchmark_" + std::to_string(i) + ".pbrt";
+					std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+					if (!file)
+					{
+						continue;
+					}
+					SceneGeometry g = triangleSoup(aTrianglesPerFile, static_cast<uint32_t>(i + 1));
+					file << "Shape \"trianglemesh\"\n\"point P\" [";
+					for (size_t v = 0; v < g.px.size(); ++v)
+					{
+						file << g.px[v] << ' ' << g.py[v] << ' ' << g.pz[v] << (v % 4 == 3 ? '\n' : ' ');
+					}
+					file << "]\n\"integer indices\" [";
+					for (size_t v = 0; v < g.indices.size(); ++v)
+					{
+						file << g.indices[v] << (v % 12 == 11 ? '\n' : ' ');
+					}
+					file << "]\n";
+					bytes += static_cast<uint64_t>(file.tellp());
+					file.close();
+					fileNames.push_back(fileName);
+				}
+				out.record(name, "files", "", static_cast<double>(fileNames.size()), "count");
+				out.record(name, "file_size", "", bytes / (1024.0 * 1024.0), "MB");
+
+				double oneThreadSeconds = 0.0;
+				for (int n = 1; ; n = std::min(2 * n, aMaxThreads))
+				{
+					parallel::ThreadPool pool(n);
+					scene::Scene parsed;
+					std::ostringstream log;
+					scene::SceneParser parser(parsed, log);
+					std::vector<std::string> failed;
+					auto start = std::chrono::steady_clock::now();
+					parser.parseFiles(fileNames, pool, &failed);
+					double seconds = secondsSince(start);
+					if (n == 1)
+					{
+						oneThreadSeconds = seconds;
+						out.record(name, "triangles", "", static_cast<double>(parsed.geometry.triangleCount()), "count");
+					}
+					const std::string layout = std::to_string(n) + "_threads";
+					out.record(name, "parse", layout, seconds, "s");
+					out.record(name, "speedup", layout, oneThreadSeconds / seconds, "ratio");
+					if (n == aMaxThreads)
+					{
+						break;
+					}
+				}
+
+				for (auto it = fileNames.cbegin(); it < fileNames.cend(); ++it)
+				{
+					std::remove(it->c_str());
+				}
+			}
+
+			// The same instances of a few prototypes traced through a two-level
+			// InstancedScene and flattened into one mesh with a single BVH
+			void benchmarkInstancing(Recorder &out, int aInstancesPerSide, size_t aRays, parallel::ThreadPool *aPool)
+			{
+				const std::string name = "instances";
+				const SceneGeometry assets[] = { sphereFlake(1, 8), instancedGrid(1, 24), triangleSoup(1000, 5) };
+				const int nAssets = sizeof(assets) / sizeof(assets[0]);
+
+				auto start = std::chrono::steady_clock::now();
+				std::vector<std::unique_ptr<shape::MeshPrototype>> prototypes;
+				size_t prototypeBytes = 0;
+				for (int i = 0; i < nAssets; ++i)
+				{
+					prototypes.emplace_back(new shape::MeshPrototype(assets[i].view(), aPool));
+					prototypeBytes += prototypes.back()->memoryBytes();
+				}
+				Random random(13);
+				std::vector<shape::MeshInstance> instances;
+				std::vector<Transform> transforms;
+				std::vector<int> instanceAssets;
+				for (int i = 0; i < aInstancesPerSide; ++i)
+				{
+					for (int j = 0; j < aInstancesPerSide; ++j)
+					{
+						float s = 0.5f + 0.5f * random.uniform();
+						Transform objectToWorld = translate(Vector(2.5f * i, 2.5f * j, random.uniform())) *
+							rotate(360.0f * random.uniform(), Vector(random.uniform(), random.uniform(), 1.0f)) * scale(s, s, s);
+						int asset = static_cast<int>(random.next() % nAssets);
+						instances.push_back(shape::MeshInstance(*prototypes[asset], objectToWorld));
+						transforms.push_back(objectToWorld);
+						instanceAssets.push_back(asset);
+					}
+				}
+				shape::InstancedScene instanced(instances, aPool);
+				out.record(name, "build", "instanced", secondsSince(start), "s");
+
+				// The same placements, each moving and turning a little over the
+				// shutter interval: the top level is built over their motion bounds
+				// and every instance test interpolates the transform at the ray's time
+				start = std::chrono::steady_clock::now();
+				std::vector<shape::MeshInstance> movingInstances;
+				for (size_t i = 0; i < instances.size(); ++i)
+				{
+					Transform end = translate(Vector(random.uniform() - 0.5f, random.uniform() - 0.5f, random.uniform() - 0.5f)) *
+						transforms[i] * rotateZ(30.0f * random.uniform());
+					movingInstances.push_back(shape::MeshInstance(*instances[i].prototype, AnimatedTransform(transforms[i], 0.0f, end, 1.0f)));
+				}
+				shape::InstancedScene moving(movingInstances, aPool);
+				out.record(name, "build", "moving", secondsSince(start), "s");
+
+				start = std::chrono::steady_clock::now();
+				SceneGeometry flattened;
+				for (size_t i = 0; i < instances.size(); ++i)
+				{
+					size_t firstVertex = flattened.px.size();
+					flattened.append(assets[instanceAssets[i]]);
+					float *x = &flattened.px[firstVertex], *y = &flattened.py[firstVertex], *z = &flattened.pz[firstVertex];
+					transforms[i].transformPoints(x, y, z, x, y, z, flattened.px.size() - firstVertex);
+				}
+				shape::TriangleMesh mesh(flattened.view());
+				accel::BVHAccel bvh(mesh.triangleBounds(), 4, aPool);
+				out.record(name, "build", "flattened", secondsSince(start), "s");
+
+				const double megabyte = 1024.0 * 1024.0;
+				out.record(name, "triangles", "", static_cast<double>(instanced.triangleCount()), "count");
+				out.record(name, "memory", "instanced", (prototypeBytes + instanced.memoryBytes()) / megabyte, "MB");
+				out.record(name, "memory", "flattened", (mesh.bytesPerTriangle() * mesh.triangleCount() +
+					bvh.nodes.size() * sizeof(accel::LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t)) / megabyte, "MB");
+
+				RaySet rays(bvh.worldBound(), aRays);
+				shape::InstanceHit instanceHit;
+				shape::TriangleHit hit;
+				rays.closestHit(out, name, "instanced", [&](const Ray &r) { return instanced.intersect(r, &instanceHit); });
+				rays.closestHit(out, name, "flattened", [&](const Ray &r) { return mesh.intersect(bvh, r, &hit); });
+				rays.anyHit(out, name, "instanced", [&](const Ray &r) { return instanced.intersectP(r); });
+				rays.anyHit(out, name, "flattened", [&](const Ray &r) { return mesh.intersectP(bvh, r); });
+
+				// Moving against static instances, with the rays spread over the
+				// shutter interval; the static scene ignores their times
+				Random timeRandom(19);
+				auto timed = [&](const Ray &r)
+				{
+					Ray ray = r;
+					ray.time = timeRandom.uniform();
+					return ray;
+				};
+				rays.closestHit(out, name, "static", [&](const Ray &r) { return instanced.intersect(timed(r), &instanceHit); });
+				timeRandom = Random(19);
+				rays.closestHit(out, name, "moving", [&](const Ray &r) { return moving.intersect(timed(r), &instanceHit); });
+				timeRandom = Random(19);
+				rays.anyHit(out, name, "static", [&](const Ray &r) { return instanced.intersectP(timed(r)); });
+				timeRandom = Random(19);
+				rays.anyHit(out, name, "moving", [&](const Ray &r) { return moving.intersectP(timed(r)); });
+			}
+
+			// A sequence of frames in which a few of a grid's spheres move: the BVH is
+			// updated in place each frame, and compared with rebuilding it and with
+			// refitting all of it
+			void benchmarkAnimation(Recorder &out, int aSpheresPerSide, size_t aRays, parallel::ThreadPool *aPool)
+			{
+				const std::string name = "animation";
+				const int nFrames = 8, movingPerFrame = 4;
+				SceneGeometry g = instancedGrid(aSpheresPerSide, 12);
+				shape::TriangleMesh mesh(g.view());
+				accel::BVHAccel bvh(mesh.triangleBounds(), 4, aPool);
+				auto bound = [&](uint32_t aTriangle) { return mesh.triangleBound(aTriangle); };
+
+				// The first update indexes the tree
+				auto start = std::chrono::steady_clock::now();
+				bvh.update(std::vector<uint32_t>(1, 0), bound);
+				out.record(name, "update_index", "", secondsSince(start) * 1e3, "ms");
+
+				Random random(17);
+				double updateSeconds = 0.0;
+				size_t changedTriangles = 0, nodesRebuilt = 0;
+				for (int frame = 0; frame < nFrames; ++frame)
+				{
+					std::vector<uint32_t> changed;
+					for (int i = 0; i < movingPerFrame; ++i)
+					{
+						const MeshRange &sphere = g.meshes[random.next() % g.meshes.size()];
+						Transform move = translate(Vector(random.uniform() - 0.5f, random.uniform() - 0.5f, random.uniform() - 0.5f));
+						float *x = &g.px[sphere.firstVertex], *y = &g.py[sphere.firstVertex], *z = &g.pz[sphere.firstVertex];
+						move.transformPoints(x, y, z, x, y, z, sphere.vertexCount);
+						for (uint32_t t = sphere.firstIndex / 3; t < (sphere.firstIndex + sphere.indexCount) / 3; ++t)
+						{
+							changed.push_back(t);
+						}
+					}
+					changedTriangles += changed.size();
+
+					start = std::chrono::steady_clock::now();
+					accel::BVHUpdateStats updateStats = bvh.update(changed, bound);
+					updateSeconds += secondsSince(start);
+					nodesRebuilt += updateStats.nodesRebuilt;
+				}
+				out.record(name, "triangles", "", static_cast<double>(mesh.triangleCount()), "count");
+				out.record(name, "changed_per_frame", "", static_cast<double>(changedTriangles) / nFrames, "count");
+				out.record(name, "frame_update", "update", updateSeconds / nFrames * 1e3, "ms");
+				out.record(name, "nodes_rebuilt_per_frame", "update", static_cast<double>(nodesRebuilt) / nFrames, "count");
+
+				start = std::chrono::steady_clock::now();
+				accel::BVHAccel rebuilt(mesh.triangleBounds(), 4, aPool);
+				out.record(name, "frame_update", "rebuild", secondsSince(start) * 1e3, "ms");
+
+				// Quality of the updated tree against a fresh one
+				RaySet rays(rebuilt.worldBound(), aRays);
+				shape::TriangleHit hit;
+				rays.closestHit(out, name, "update", [&](const Ray &r) { return mesh.intersect(bvh, r, &hit); });
+				rays.closestHit(out, name, "rebuild", [&](const Ray &r) { return mesh.intersect(rebuilt, r, &hit); });
+
+				start = std::chrono::steady_clock::now();
+				bvh.refit(bound);
+				out.record(name, "frame_update", "refit", secondsSince(start) * 1e3, "ms");
+			}
+
+			// Stand-ins for the temporaries a path tracer allocates per sample: an
+			// intersection record and a BSDF
+			struct SampleRecord
+			{
+				float values[24];
+			};
+
+			struct SampleBSDF
+			{
+				float values[56];
+			};
+
+			// Where sampleTemporaries gets its memory from
+			struct HeapTemporaries
+			{
+				template <typename T>
+				void acquire(T **p) const { *p = new T; }
+				template <typename T>
+				void release(T *p) const { delete p; }
+			};
+
+			struct ArenaTemporaries
+			{
+				MemoryArena &arena;
+
+				template <typename T>
+				void acquire(T **p) const { *p = ARENA_ALLOC(arena, T); }
+				template <typename T>
+				void release(T *) const {}
+			};
+
+			struct PoolTemporaries
+			{
+				ObjectPool<SampleRecord> &records;
+				ObjectPool<SampleBSDF> &bsdfs;
+
+				void acquire(SampleRecord **p) const { *p = records.acquire(); }
+				void acquire(SampleBSDF **p) const { *p = bsdfs.acquire(); }
+				void release(SampleRecord *p) const { records.release(p); }
+				void release(SampleBSDF *p) const { bsdfs.release(p); }
+			};
+
+			// Allocates, touches and frees one sample's temporaries
+			template <typename Temporaries>
+			float sampleTemporaries(int aSample, const Temporaries &temporaries)
+			{
+				SampleRecord *records[2];
+				SampleBSDF *bsdfs[2];
+				for (int i = 0; i < 2; ++i)
+				{
+					temporaries.acquire(&records[i]);
+					temporaries.acquire(&bsdfs[i]);
+					benchmarkPointerSink = records[i];
+					benchmarkPointerSink = bsdfs[i];
+					records[i]->values[0] = static_cast<float>(aSample);
+					bsdfs[i]->values[0] = records[i]->values[0] + i;
+				}
+				float value = bsdfs[0]->values[0] + bsdfs[1]->values[0];
+				for (int i = 0; i < 2; ++i)
+				{
+					temporaries.release(records[i]);
+					temporaries.release(bsdfs[i]);
+				}
+				return value;
+			}
+
+			// Per-sample temporaries from the heap against a per-thread MemoryArena
+			// reset after every sample and per-thread ObjectPools, first on their
+			// own from every thread at once, then inside a tile render
+			void benchmarkAllocation(Recorder &out, parallel::ThreadPool *aPool, bool aQuick)
+			{
+				const std::string name = "allocation";
+				const size_t nSamples = aQuick ? 1 << 20 : 1 << 23;
+				const int allocationsPerSample = 4;
+				parallel::ThreadPool serialPool(1);
+				parallel::ThreadPool &pool = aPool ? *aPool : serialPool;
+				const int nThreads = pool.numThreads();
+
+				std::vector<std::unique_ptr<MemoryArena>> arenas;
+				std::vector<std::unique_ptr<ObjectPool<SampleRecord>>> recordPools;
+				std::vector<std::unique_ptr<ObjectPool<SampleBSDF>>> bsdfPools;
+				for (int t = 0; t < nThreads; ++t)
+				{
+					arenas.emplace_back(new MemoryArena);
+					recordPools.emplace_back(new ObjectPool<SampleRecord>);
+					bsdfPools.emplace_back(new ObjectPool<SampleBSDF>);
+				}
+
+				auto allocationRate = [&](const char *aLayout, const std::function<float(size_t)> &sample)
+				{
+					auto start = std::chrono::steady_clock::now();
+					parallel::parallelFor(pool, nSamples, 16 * 1024, [&](size_t aBegin, size_t aEnd)
+					{
+						float sum = 0.0f;
+						for (size_t i = aBegin; i < aEnd; ++i)
+						{
+							sum += sample(i);
+						}
+						benchmarkSink = benchmarkSink + sum;
+					});
+					out.record(name, "allocations", aLayout, nSamples * allocationsPerSample / secondsSince(start) * 1e-6, "Mallocs/s");
+				};
+				allocationRate("new", [](size_t i)
+				{
+					return sampleTemporaries(static_cast<int>(i), HeapTemporaries());
+				});
+				allocationRate("arena", [&](size_t i)
+				{
+					MemoryArena &arena = *arenas[pool.currentThreadIndex()];
+					float value = sampleTemporaries(static_cast<int>(i), ArenaTemporaries{ arena });
+					arena.reset();
+					return value;
+				});
+				allocationRate("pool", [&](size_t i)
+				{
+					int thread = pool.currentThreadIndex();
+					return sampleTemporaries(static_cast<int>(i), PoolTemporaries{ *recordPools[thread], *bsdfPools[thread] });
+				});
+
+				// The renderer resets each thread's arena after every sample; the heap
+				// version ignores it
+				const int size = aQuick ? 256 : 512;
+				render::TileRenderer renderer(size, size, aQuick ? 4 : 16);
+				auto renderTime = [&](const char *aLayout, bool aUseArena)
+				{
+					auto start = std::chrono::steady_clock::now();
+					renderer.render(pool, [aUseArena](float filmX, float filmY, int sampleIndex, MemoryArena &arena, float rgb[3])
+					{
+						int sample = static_cast<int>(filmX * 7.0f + filmY) + sampleIndex;
+						rgb[0] = rgb[1] = rgb[2] = aUseArena ? sampleTemporaries(sample, ArenaTemporaries{ arena }) :
+							sampleTemporaries(sample, HeapTemporaries());
+					});
+					out.record(name, "render", aLayout, secondsSince(start) * 1e3, "ms");
+				};
+				renderTime("new", false);
+				renderTime("arena", true);
+			}
+
+			// Filtered lookups into a MIP-mapped texture on a ground plane receding
+			// to the horizon, pixel by pixel in render tile order, through caches
+			// whose budgets hold the whole pyramid, a 16th and a 64th of it. MIP-
+			// mapping keeps the working set near the size of the image, so only the
+			// smallest budget is below it. The footprints come from the screen-space
+			// derivatives of (s, t), as ray differentials would give them
+			void benchmarkTextures(Recorder &out, bool aQuick)
+			{
+				const std::string name = "texture";
+				const int textureSize = aQuick ? 1024 : 4096;
+				std::vector<float> image(3 * static_cast<size_t>(textureSize) * textureSize);
+				for (int y = 0; y < textureSize; ++y)
+				{
+					for (int x = 0; x < textureSize; ++x)
+					{
+						float *texel = &image[3 * (static_cast<size_t>(y) * textureSize + x)];
+						texel[0] = ((x / 16 + y / 16) & 1) ? 1.0f : 0.2f;
+						texel[1] = static_cast<float>(x) / textureSize;
+						texel[2] = static_cast<float>(y) / textureSize;
+					}
+				}
+				const std::string fileName = "namaste_benchmark.mip";
+				if (!texture::writeMIPMapFile(fileName, textureSize, textureSize, image.data()))
+				{
+					return;
+				}
+				std::vector<float>().swap(image);
+
+				// Texture coordinates of film position (fx, fy): the horizon is just
+				// above the image, and at the bottom a pixel spans about a texel
+				const int width = aQuick ? 320 : 1280, height = aQuick ? 180 : 720;
+				auto planeUV = [&](float fx, float fy, float *u, float *v)
+				{
+					float depth = 1.0f / (0.02f + fy / height);
+					*u = (fx - 0.5f * width) * depth / textureSize;
+					*v = depth * height / textureSize;
+				};
+				const size_t pyramidBytes = static_cast<size_t>(textureSize) * textureSize * 3 * sizeof(float) * 4 / 3;
+				const double megabyte = 1024.0 * 1024.0;
+				const int budgetDivisors[] = { 1, 16, 64 };
+				for (int b = 0; b < 3; ++b)
+				{
+					texture::TextureCache cache(pyramidBytes / budgetDivisors[b]);
+					texture::MIPMap texture(cache, fileName);
+					const std::string layout = "budget_1/" + std::to_string(budgetDivisors[b]);
+					std::vector<render::Tile> tiles = render::generateTiles(width, height, 16);
+					float sum = 0.0f;
+					auto start = std::chrono::steady_clock::now();
+					for (auto it = tiles.cbegin(); it < tiles.cend(); ++it)
+					{
+						for (int y = it->y0; y < it->y1; ++y)
+						{
+							for (int x = it->x0; x < it->x1; ++x)
+							{
+								float s, t, sx, tx, sy, ty, rgb[3];
+								planeUV(x + 0.5f, y + 0.5f, &s, &t);
+								planeUV(x + 1.5f, y + 0.5f, &sx, &tx);
+								planeUV(x + 0.5f, y + 1.5f, &sy, &ty);
+								texture.lookup(s, t, sx - s, tx - t, sy - s, ty - t, rgb);
+								sum += rgb[0];
+							}
+						}
+					}
+					double seconds = secondsSince(start);
+					benchmarkSink = benchmarkSink + sum;
+
+					texture::TextureCacheStats stats = cache.stats();
+					out.record(name, "lookups", layout, static_cast<double>(width) * height / seconds * 1e-6, "Mlookups/s");
+					out.record(name, "cache_hit_rate", layout, static_cast<double>(stats.hits) / std::max<uint64_t>(stats.hits + stats.misses, 1), "ratio");
+					out.record(name, "cache_evictions", layout, static_cast<double>(stats.evictions), "count");
+					out.record(name, "cache_peak_memory", layout, stats.peakBytesInUse / megabyte, "MB");
+				}
+				out.record(name, "pyramid_memory", "", pyramidBytes / megabyte, "MB");
+				std::remove(fileName.c_str());
+			}
+
+			// Sampler throughput, and the error of estimating two integrals with
+			// known values per pixel: the area of a quarter disk, whose edge is
+			// what stratification struggles with, and a smooth 4D product that
+			// also shows up correlation between dimension pairs. The error is
+			// the RMS over many pixels, each an independent estimate
+			void benchmarkSampling(Recorder &out, bool aQuick)
+			{
+				const std::string name = "sampling";
+				const sampling::SamplerType types[] = { sampling::SamplerRandom, sampling::SamplerStratified, sampling::SamplerHalton, sampling::SamplerSobol };
+				const int dimensions = 8, pixelsPerSide = aQuick ? 16 : 48;
+				const int sampleCounts[] = { 16, 64, 256 };
+				const double quarterDisk = 3.14159265358979323846 / 4.0;
+				std::vector<float> samples;
+
+				for (int t = 0; t < 4; ++t)
+				{
+					sampling::SamplerSettings settings;
+					settings.type = types[t];
+					settings.samplesPerPixel = 64;
+					settings.dimensions = dimensions;
+					settings.seed = 7;
+					std::unique_ptr<sampling::Sampler> sampler = sampling::createSampler(settings);
+
+					samples.resize(static_cast<size_t>(settings.samplesPerPixel) * dimensions);
+					const int repeats = aQuick ? 2 : 8;
+					auto start = std::chrono::steady_clock::now();
+					for (int r = 0; r < repeats; ++r)
+					{
+						for (int p = 0; p < pixelsPerSide * pixelsPerSide; ++p)
+						{
+							sampler->generate(p % pixelsPerSide, p / pixelsPerSide + r * pixelsPerSide, 0, settings.samplesPerPixel, samples.data());
+						}
+					}
+					double seconds = secondsSince(start);
+					double generated = static_cast<double>(repeats) * pixelsPerSide * pixelsPerSide * settings.samplesPerPixel;
+					out.record(name, "throughput", sampler->name(), generated / seconds * 1e-6, "Msamples/s");
+					out.record(name, "value_throughput", sampler->name(), generated * dimensions / seconds * 1e-6, "Mvalues/s");
+
+					for (int c = 0; c < 3; ++c)
+					{
+						settings.samplesPerPixel = sampleCounts[c];
+						sampler = sampling::createSampler(settings);
+						samples.resize(static_cast<size_t>(settings.samplesPerPixel) * dimensions);
+						double diskError = 0.0, smoothError = 0.0;
+						for (int p = 0; p < pixelsPerSide * pixelsPerSide; ++p)
+						{
+							sampler->generate(p % pixelsPerSide, p / pixelsPerSide, 0, settings.samplesPerPixel, samples.data());
+							double disk = 0.0, smooth = 0.0;
+							for (int s = 0; s < settings.samplesPerPixel; ++s)
+							{
+								const float *u = &samples[s * dimensions];
+								disk += u[0] * u[0] + u[1] * u[1] < 1.0f ? 1.0 : 0.0;
+								smooth += 16.0 * u[0] * u[1] * u[2] * u[3];
+							}
+							disk = disk / settings.samplesPerPixel - quarterDisk;
+							smooth = smooth / settings.samplesPerPixel - 1.0;
+							diskError += disk * disk;
+							smoothError += smooth * smooth;
+						}
+						const double pixels = pixelsPerSide * pixelsPerSide;
+						const std::string spp = std::to_string(sampleCounts[c]) + "spp";
+						out.record(name, "rmse_disk_" + spp, sampler->name(), std::sqrt(diskError / pixels), "error");
+						out.record(name, "rmse_smooth4d_" + spp, sampler->name(), std::sqrt(smoothError / pixels), "error");
+					}
+				}
+			}
+
+			// Filtering samples into film tiles, splatting from every thread at once,
+			// resolving the film between passes, and how long handing an image to
+			// the background writer holds up the render compared with writing it
+			void benchmarkFilm(Recorder &out, parallel::ThreadPool *aPool, bool aQuick)
+			{
+				const std::string name = "film";
+				const int width = aQuick ? 640 : 1920, height = aQuick ? 360 : 1080;
+				render::Film film(width, height);
+				Random random(5);
+
+				const int samplesPerPixel = 4;
+				auto start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < film.tiles.size(); ++i)
+				{
+					render::FilmTile &tile = film.tiles[i];
+					for (int y = tile.tile.y0; y < tile.tile.y1; ++y)
+					{
+						for (int x = tile.tile.x0; x < tile.tile.x1; ++x)
+						{
+							for (int s = 0; s < samplesPerPixel; ++s)
+							{
+								const float rgb[3] = { random.uniform(), random.uniform(), random.uniform() };
+								film.addSample(tile, x + random.uniform(), y + random.uniform(), rgb);
+							}
+						}
+					}
+				}
+				const double nSamples = static_cast<double>(width) * height * samplesPerPixel;
+				out.record(name, "add_sample", "gaussian", nSamples / secondsSince(start) * 1e-6, "Msamples/s");
+
+				if (aPool)
+				{
+					const size_t nSplats = static_cast<size_t>(width) * height;
+					start = std::chrono::steady_clock::now();
+					parallel::parallelFor(*aPool, nSplats, 4096, [&](size_t aBegin, size_t aEnd)
+					{
+						Random splatRandom(aBegin);
+						for (size_t i = aBegin; i < aEnd; ++i)
+						{
+							const float rgb[3] = { 1.0f, 0.5f, 0.25f };
+							film.addSplat(width * splatRandom.uniform(), height * splatRandom.uniform(), rgb);
+						}
+					});
+					out.record(name, "splat", "atomic", nSplats / secondsSince(start) * 1e-6, "Msplats/s");
+
+					std::vector<float> pixels;
+					start = std::chrono::steady_clock::now();
+					film.resolve(*aPool, 1.0f / samplesPerPixel, &pixels);
+					out.record(name, "resolve", "", secondsSince(start) * 1e3, "ms");
+
+					// The first image allocates the writer's buffer; progressive updates
+					// after it reuse it
+					render::ImageWriter writer;
+					const std::string fileName = "namaste_benchmark.pfm";
+					writer.submit(fileName, width, height, pixels);
+					writer.finish();
+					start = std::chrono::steady_clock::now();
+					writer.submit(fileName, width, height, pixels);
+					out.record(name, "image_submit", "", secondsSince(start) * 1e3, "ms");
+					writer.finish();
+					out.record(name, "image_write", "pfm", secondsSince(start) * 1e3, "ms");
+					std::remove(fileName.c_str());
+				}
+			}
+
+		} // namespace
+
+		SceneGeometry triangleSoup(size_t aTriangles, uint32_t aSeed)
+		{
+			Random random(aSeed);
+			SceneGeometry g;
+			g.px.reserve(3 * aTriangles);
+			g.py.reserve(3 * aTriangles);
+			g.pz.reserve(3 * aTriangles);
+			g.indices.reserve(3 * aTriangles);
+			for (size_t i = 0; i < aTriangles; ++i)
+			{
+				// Sizes spread over two orders of magnitude
+				float size = 0.002f * powf(100.0f, random.uniform());
+				float cx = random.uniform(), cy = random.uniform(), cz = random.uniform();
+				for (int k = 0; k < 3; ++k)
+				{
+					g.indices.push_back(static_cast<uint32_t>(g.px.size()));
+					g.px.push_back(cx + size * (random.uniform() - 0.5f));
+					g.py.push_back(cy + size * (random.uniform() - 0.5f));
+					g.pz.push_back(cz + size * (random.uniform() - 0.5f));
+				}
+			}
+			closeMesh(&g, 0, 0);
+			return g;
+		}
+
+		SceneGeometry sphereFlake(int aDepth, int aSphereResolution)
+		{
+			SceneGeometry g;
+			addSphereFlake(&g, Point(0.0f, 0.0f, 0.0f), 1.0f, aDepth, aSphereResolution);
+			return g;
+		}
+
+		SceneGeometry instancedGrid(int aInstancesPerSide, int aSphereResolution)
+		{
+			Random random(3);
+			SceneGeometry g;
+			for (int i = 0; i < aInstancesPerSide; ++i)
+			{
+				for (int j = 0; j < aInstancesPerSide; ++j)
+				{
+					appendSphere(&g, aSphereResolution);
+					float s = 0.3f + 0.2f * random.uniform();
+					transformLastMesh(&g, translate(Vector(static_cast<float>(i), static_cast<float>(j), 0.0f)) *
+						rotate(360.0f * random.uniform(), Vector(0.0f, 0.0f, 1.0f)) * scale(s, s, 0.5f * s));
+				}
+			}
+			return g;
+		}
+
+		void runBenchmarks(std::ostream &os, parallel::ThreadPool *aPool, bool aQuick)
+		{
+			Recorder out(os);
+			const size_t rays = aQuick ? 20000 : 200000;
+			out.record("config", "threads", "", aPool ? aPool->numThreads() : 1, "count");
+			out.record("config", "rays", "", static_cast<double>(rays), "count");
+
+			benchmarkKernels(out, aQuick ? 1 << 18 : 1 << 22);
+			benchmarkScene(out, "soup", triangleSoup(aQuick ? 50000 : 500000), rays, aPool);
+			benchmarkScene(out, "sphereflake", sphereFlake(aQuick ? 2 : 3, 16), rays, aPool);
+			benchmarkScene(out, "grid", instancedGrid(aQuick ? 16 : 48, 12), rays, aPool);
+			benchmarkBuildScaling(out, triangleSoup(aQuick ? 200000 : 1000000), aPool ? aPool->numThreads() : 1);
+			benchmarkParseScaling(out, aQuick ? 8 : 32, aQuick ? 10000 : 50000, aPool ? aPool->numThreads() : 1);
+			benchmarkInstancing(out, aQuick ? 20 : 40, rays, aPool);
+			benchmarkAnimation(out, aQuick ? 24 : 60, rays, aPool);
+			benchmarkAllocation(out, aPool, aQuick);
+			benchmarkTextures(out, aQuick);
+			benchmarkSampling(out, aQuick);
+			benchmarkFilm(out, aPool, aQuick);
+		}
+
+	} // namespace bench
+
+} // namespace namaste
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+#include "scene.h"
+#include "parallel.h"
+
+namespace namaste {
+
+	namespace bench {
+
+		// Synthetic scenes for benchmarking. They are generated with a fixed
+		// integer random number generator and no library distributions, so the
+		// same arguments give exactly the same geometry on every platform and
+		// compiler, and timings can be compared run to run
+
+		// Random triangles of random sizes scattered through a unit cube
+		scene::SceneGeometry triangleSoup(size_t aTriangles, uint32_t aSeed = 1);
+
+		// Haines' sphere flake: a sphere with nine spheres a third its size around
+		// it, recursively. aDepth = 0 is a single sphere
+		scene::SceneGeometry sphereFlake(int aDepth, int aSphereResolution = 16);
+
+		// A dense aInstancesPerSide^2 grid of copies of one sphere, each placed
+		// with its own transform
+		scene::SceneGeometry instancedGrid(int aInstancesPerSide, int aSphereResolution = 16);
+
+		// Runs the benchmark suite on every synthetic scene: geometry kernel
+		// throughput, BVH build times, how building and scene file parsing scale
+		// with threads, closest and any-hit rays per second through
+		// each BVH layout, memory footprints, sampler throughput and convergence,
+		// and film accumulation and output. Results are written to os as JSON
+		// Lines, one record per measurement, e.g.
+		//   {"scene":"soup","metric":"closest_hit","layout":"binary","value":0.92,"unit":"Mrays/s"}
+		// so that runs can be diffed and tracked for regressions. aQuick shrinks
+		// the scenes and ray counts for a fast smoke test
+		void runBenchmarks(std::ostream &os, parallel::ThreadPool *aPool, bool aQuick = false);
+
+	} // namespace bench
+
+} // namespace namaste
@@ -0,0 +1,734 @@
+#include "stdafx.h"
+#include "bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <memory>
+
+namespace namaste {
+
+	namespace accel {
+
+		using geom::BBox;
+		using geom::Point;
+
+		namespace {
+
+			// Per-primitive data that only lives for the duration of the build
+			struct BuildPrimitive
+			{
+				uint32_t primitiveNumber;
+				BBox bounds;
+				Point centroid;
+			};
+
+			const int nBuckets = 12;
+
+			// Node budget of an unconstrained build
+			const size_t unlimitedNodes = std::numeric_limits<size_t>::max();
+
+			// A leaf's primitive count has to fit in LinearBVHNode::nPrimitives
+			const size_t maxLeafPrimitives = 0xffff;
+
+			// Markers in the parent array
+			const uint32_t noParent = 0xffffffff;
+			const uint32_t unusedNode = 0xfffffffe;
+
+			// Ranges at least this large are built cooperatively, with their bounds and
+			// SAH bins computed in parallel chunks; below it, a range is handed to a
+			// single thread as an independent subtree task
+			const size_t parallelThreshold = 64 * 1024;
+			const size_t parallelChunkSize = 16 * 1024;
+
+			// Primitive and centroid bounds of a range of primitives
+			struct RangeBounds
+			{
+				BBox bounds;
+				BBox centroidBounds;
+
+				void merge(const RangeBounds &rhs)
+				{
+					bounds = calcUnion(bounds, rhs.bounds);
+					centroidBounds = calcUnion(centroidBounds, rhs.centroidBounds);
+				}
+			};
+
+			// SAH bins along a single axis
+			struct Bins
+			{
+				Bins() : counts() {}
+
+				void merge(const Bins &rhs)
+				{
+					for (int b = 0; b < nBuckets; ++b)
+					{
+						counts[b] += rhs.counts[b];
+						bounds[b] = calcUnion(bounds[b], rhs.bounds[b]);
+					}
+				}
+
+				size_t counts[nBuckets];
+				BBox bounds[nBuckets];
+			};
+
+			RangeBounds computeBounds(const std::vector<BuildPrimitive> &aPrimitives, size_t aStart, size_t aEnd, parallel::ThreadPool *aPool)
+			{
+				auto accumulate = [&](size_t first, size_t last, RangeBounds &rb)
+				{
+					for (size_t i = first; i < last; ++i)
+					{
+						rb.bounds = calcUnion(rb.bounds, aPrimitives[i].bounds);
+						rb.centroidBounds = calcUnion(rb.centroidBounds, aPrimitives[i].centroid);
+					}
+				};
+
+				RangeBounds result;
+				size_t nPrimitives = aEnd - aStart;
+				if (aPool && nPrimitives >= parallelThreshold)
+				{
+					// Each chunk accumulates into its own slot, and the slots are merged in
+					// order afterwards: unions are exact, so this matches the serial result
+					std::vector<RangeBounds> chunks((nPrimitives + parallelChunkSize - 1) / parallelChunkSize);
+					parallel::parallelFor(*aPool, nPrimitives, parallelChunkSize, [&](size_t first, size_t last)
+					{
+						accumulate(aStart + first, aStart + last, chunks[first / parallelChunkSize]);
+					});
+					for (const auto &chunk : chunks)
+					{
+						result.merge(chunk);
+					}
+				}
+				else
+				{
+					accumulate(aStart, aEnd, result);
+				}
+				return result;
+			}
+
+			// Chooses a split for the range [aStart, aEnd) and partitions the primitives
+			// around it. Returns false if the range should become a leaf instead
+			bool partitionRange(std::vector<BuildPrimitive> &aPrimitives, size_t aStart, size_t aEnd, int aDepth, int aMaxPrimsInNode,
+				const RangeBounds &aRangeBounds, parallel::ThreadPool *aPool, size_t *mid, int *axis)
+			{
+				const BBox &centroidBounds = aRangeBounds.centroidBounds;
+				size_t nPrimitives = aEnd - aStart;
+				int dim = centroidBounds.maximumExtent();
+				*axis = dim;
+
+				bool degenerate = centroidBounds.pMax[dim] == centroidBounds.pMin[dim];
+				if (nPrimitives == 1 || (nPrimitives <= static_cast<size_t>(aMaxPrimsInNode) && degenerate))
+				{
+					return false;
+				}
+
+				// Fall back to splitting into two equally-sized halves for pairs, when
+				// all centroids coincide, and once the tree gets deep (this bounds the
+				// depth, and hence the traversal stack, by maxBVHDepth). Anything larger
+				// goes through the SAH, which also decides when a leaf is cheaper
+				float boundsArea = aRangeBounds.bounds.surfaceArea();
+				bool splitEqually = nPrimitives <= 2 ||
+					aDepth >= maxBVHDepth / 2 ||
+					degenerate ||
+					!(boundsArea > 0.0f);
+
+				if (!splitEqually)
+				{
+					// Binned SAH: rather than sorting, drop each centroid into one of a
+					// fixed number of buckets along the split axis and only consider splits
+					// at bucket boundaries
+					const float cMin = centroidBounds.pMin[dim];
+					const float bucketScale = nBuckets / (centroidBounds.pMax[dim] - cMin);
+					auto bucketIndex = [&](const BuildPrimitive &p)
+					{
+						return std::min(static_cast<int>((p.centroid[dim] - cMin) * bucketScale), nBuckets - 1);
+					};
+					auto accumulate = [&](size_t first, size_t last, Bins &bins)
+					{
+						for (size_t i = first; i < last; ++i)
+						{
+							int b = bucketIndex(aPrimitives[i]);
+							bins.counts[b]++;
+							bins.bounds[b] = calcUnion(bins.bounds[b], aPrimitives[i].bounds);
+						}
+					};
+
+					Bins bins;
+					if (aPool && nPrimitives >= parallelThreshold)
+					{
+						std::vector<Bins> chunks((nPrimitives + parallelChunkSize - 1) / parallelChunkSize);
+						parallel::parallelFor(*aPool, nPrimitives, parallelChunkSize, [&](size_t first, size_t last)
+						{
+							accumulate(aStart + first, aStart + last, chunks[first / parallelChunkSize]);
+						});
+						for (const auto &chunk : chunks)
+						{
+							bins.merge(chunk);
+						}
+					}
+					else
+					{
+						accumulate(aStart, aEnd, bins);
+					}
+
+					// Sweep from the right to accumulate the 'above' side of every split,
+					// then from the left, so all costs are evaluated in linear time
+					float areaAbove[nBuckets];
+					size_t countAbove[nBuckets];
+					BBox above;
+					size_t count = 0;
+					for (int b = nBuckets - 1; b > 0; --b)
+					{
+						above = calcUnion(above, bins.bounds[b]);
+						count += bins.counts[b];
+						areaAbove[b] = above.surfaceArea();
+						countAbove[b] = count;
+					}
+
+					int minCostSplitBucket = -1;
+					float minCost = INFINITY;
+					BBox below;
+					count = 0;
+					for (int b = 0; b < nBuckets - 1; ++b)
+					{
+						below = calcUnion(below, bins.bounds[b]);
+						count += bins.counts[b];
+						if (count == 0 || countAbove[b + 1] == 0)
+						{
+							continue;
+						}
+
+						// Traversal is taken to cost as much as a primitive intersection,
+						// as in pbrt-v3; any cheaper and a split always beats a leaf
+						float cost = 1.0f + (count * below.surfaceArea() + countAbove[b + 1] * areaAbove[b + 1]) / boundsArea;
+						if (cost < minCost)
+						{
+							minCost = cost;
+							minCostSplitBucket = b;
+						}
+					}
+
+					if (minCostSplitBucket == -1)
+					{
+						splitEqually = true;
+					}
+					else if (nPrimitives <= static_cast<size_t>(aMaxPrimsInNode) && minCost >= static_cast<float>(nPrimitives))
+					{
+						// Intersecting everything in a leaf is cheaper than splitting
+						return false;
+					}
+					else
+					{
+						auto pMid = std::partition(aPrimitives.begin() + aStart, aPrimitives.begin() + aEnd,
+							[&](const BuildPrimitive &p) { return bucketIndex(p) <= minCostSplitBucket; });
+						*mid = pMid - aPrimitives.begin();
+					}
+				}
+
+				if (splitEqually)
+				{
+					*mid = aStart + nPrimitives / 2;
+					std::nth_element(aPrimitives.begin() + aStart, aPrimitives.begin() + *mid, aPrimitives.begin() + aEnd,
+						[dim](const BuildPrimitive &a, const BuildPrimitive &b) { return a.centroid[dim] < b.centroid[dim]; });
+				}
+				return true;
+			}
+
+			// Serial build of the range [aStart, aEnd), appending to the given arrays.
+			// Nodes are emitted in depth-first order as we recurse, so the tree is
+			// flattened as it's built and no intermediate pointer-based tree is needed.
+			// Node and primitive offsets are relative to the start of the arrays. A
+			// node budget caps the size of the tree, when it has to fit in place of
+			// another: each split shares what's left between its children in
+			// proportion to their primitives, and ranges whose budget runs out become
+			// leaves. A leaf can't take more than maxLeafPrimitives, though: if the
+			// budget would need a larger one, the build stops, sets *aTooLarge and
+			// leaves the arrays incomplete
+			uint32_t recursiveBuild(std::vector<BuildPrimitive> &aPrimitives, size_t aStart, size_t aEnd, int aDepth, int aMaxPrimsInNode,
+				std::vector<LinearBVHNode> &nodes, std::vector<uint32_t> &primitiveIndices, size_t aNodeBudget = unlimitedNodes,
+				bool *aTooLarge = nullptr)
+			{
+				// The node array may reallocate during recursion: always refer to the
+				// node by index rather than by reference
+				uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+				nodes.emplace_back();
+
+				RangeBounds rangeBounds = computeBounds(aPrimitives, aStart, aEnd, nullptr);
+				nodes[nodeIndex].bounds = rangeBounds.bounds;
+
+				size_t mid;
+				int axis;
+				// A split takes at least three nodes
+				if (aNodeBudget < 3 || !partitionRange(aPrimitives, aStart, aEnd, aDepth, aMaxPrimsInNode, rangeBounds, nullptr, &mid, &axis))
+				{
+					// Without a budget, partitionRange only makes leaves of at most
+					// aMaxPrimsInNode primitives
+					if (aEnd - aStart > maxLeafPrimitives)
+					{
+						assert(aTooLarge);
+						*aTooLarge = true;
+						return nodeIndex;
+					}
+					LinearBVHNode &node = nodes[nodeIndex];
+					node.primitivesOffset = static_cast<uint32_t>(primitiveIndices.size());
+					node.nPrimitives = static_cast<uint16_t>(aEnd - aStart);
+					node.axis = 0;
+					for (size_t i = aStart; i < aEnd; ++i)
+					{
+						primitiveIndices.push_back(aPrimitives[i].primitiveNumber);
+					}
+					return nodeIndex;
+				}
+
+				// The first child directly follows this node in the array
+				size_t firstBudget = unlimitedNodes, secondBudget = unlimitedNodes;
+				if (aNodeBudget != unlimitedNodes)
+				{
+					firstBudget = std::max<size_t>(1, std::min(aNodeBudget - 2, (aNodeBudget - 1) * (mid - aStart) / (aEnd - aStart)));
+				}
+				recursiveBuild(aPrimitives, aStart, mid, aDepth + 1, aMaxPrimsInNode, nodes, primitiveIndices, firstBudget, aTooLarge);
+				if (aTooLarge && *aTooLarge)
+				{
+					return nodeIndex;
+				}
+				if (aNodeBudget != unlimitedNodes)
+				{
+					secondBudget = aNodeBudget - (nodes.size() - nodeIndex);
+				}
+				uint32_t secondChild = recursiveBuild(aPrimitives, mid, aEnd, aDepth + 1, aMaxPrimsInNode, nodes, primitiveIndices, secondBudget, aTooLarge);
+
+				LinearBVHNode &node = nodes[nodeIndex];
+				node.secondChildOffset = secondChild;
+				node.nPrimitives = 0;
+				node.axis = static_cast<uint8_t>(axis);
+				return nodeIndex;
+			}
+
+			// The top of the tree in a parallel build. Interior nodes are split
+			// cooperatively by all threads; each leaf is a complete subtree built
+			// serially by a single task into its own arrays
+			struct TopNode
+			{
+				BBox bounds;
+				int axis;
+				std::unique_ptr<TopNode> children[2];
+				std::vector<LinearBVHNode> subtreeNodes;
+				std::vector<uint32_t> subtreeIndices;
+			};
+
+			void parallelBuild(parallel::ThreadPool &aPool, std::vector<BuildPrimitive> &aPrimitives, size_t aStart, size_t aEnd, int aDepth,
+				int aMaxPrimsInNode, TopNode *node)
+			{
+				size_t mid;
+				int axis;
+				if (aEnd - aStart >= parallelThreshold)
+				{
+					RangeBounds rangeBounds = computeBounds(aPrimitives, aStart, aEnd, &aPool);
+					if (partitionRange(aPrimitives, aStart, aEnd, aDepth, aMaxPrimsInNode, rangeBounds, &aPool, &mid, &axis))
+					{
+						node->bounds = rangeBounds.bounds;
+						node->axis = axis;
+						node->children[0].reset(new TopNode);
+						node->children[1].reset(new TopNode);
+
+						// The two halves touch disjoint ranges of the primitive array
+						parallel::TaskGroup group(aPool);
+						group.run([&]()
+						{
+							parallelBuild(aPool, aPrimitives, aStart, mid, aDepth + 1, aMaxPrimsInNode, node->children[0].get());
+						});
+						parallelBuild(aPool, aPrimitives, mid, aEnd, aDepth + 1, aMaxPrimsInNode, node->children[1].get());
+						group.wait();
+						return;
+					}
+				}
+
+				node->subtreeNodes.reserve(2 * (aEnd - aStart) - 1);
+				recursiveBuild(aPrimitives, aStart, aEnd, aDepth, aMaxPrimsInNode, node->subtreeNodes, node->subtreeIndices);
+			}
+
+			// Appends the top of the tree and its subtrees to the final arrays in
+			// depth-first order, relocating the subtrees' relative offsets
+			void flatten(TopNode &aNode, std::vector<LinearBVHNode> &nodes, std::vector<uint32_t> &primitiveIndices)
+			{
+				if (!aNode.children[0])
+				{
+					uint32_t nodeBase = static_cast<uint32_t>(nodes.size());
+					uint32_t primitiveBase = static_cast<uint32_t>(primitiveIndices.size());
+					for (LinearBVHNode node : aNode.subtreeNodes)
+					{
+						if (node.nPrimitives > 0)
+						{
+							node.primitivesOffset += primitiveBase;
+						}
+						else
+						{
+							node.secondChildOffset += nodeBase;
+						}
+						nodes.push_back(node);
+					}
+					primitiveIndices.insert(primitiveIndices.end(), aNode.subtreeIndices.begin(), aNode.subtreeIndices.end());
+
+					// Release each subtree as soon as it's been copied
+					std::vector<LinearBVHNode>().swap(aNode.subtreeNodes);
+					std::vector<uint32_t>().swap(aNode.subtreeIndices);
+					return;
+				}
+
+				uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+				nodes.emplace_back();
+				nodes[nodeIndex].bounds = aNode.bounds;
+				nodes[nodeIndex].nPrimitives = 0;
+				nodes[nodeIndex].axis = static_cast<uint8_t>(aNode.axis);
+				flatten(*aNode.children[0], nodes, primitiveIndices);
+				nodes[nodeIndex].secondChildOffset = static_cast<uint32_t>(nodes.size());
+				flatten(*aNode.children[1], nodes, primitiveIndices);
+			}
+
+			// Leaf size and depth distributions of a flattened tree
+			void recordTreeStats(const std::vector<LinearBVHNode> &nodes)
+			{
+				if (!stats::enabled || nodes.empty())
+				{
+					return;
+				}
+
+				struct StackEntry
+				{
+					uint32_t node;
+					int depth;
+				};
+				StackEntry nodesToVisit[maxBVHDepth + 1];
+				int toVisitOffset = 0;
+				StackEntry current = { 0, 0 };
+				while (true)
+				{
+					const LinearBVHNode &node = nodes[current.node];
+					if (node.nPrimitives > 0)
+					{
+						stats::record(stats::DistributionBVHLeafSize, node.nPrimitives);
+						stats::record(stats::DistributionBVHLeafDepth, current.depth);
+						if (toVisitOffset == 0) break;
+						current = nodesToVisit[--toVisitOffset];
+					}
+					else
+					{
+						StackEntry second = { node.secondChildOffset, current.depth + 1 };
+						nodesToVisit[toVisitOffset++] = second;
+						++current.node;
+						++current.depth;
+					}
+				}
+			}
+
+		} // anonymous namespace
+
+		// ---------------------------------------------------------------
+		// BVH accelerator class
+		// ---------------------------------------------------------------
+		BVHAccel::BVHAccel(const std::vector<BBox> &aPrimitiveBounds, int aMaxPrimsInNode, parallel::ThreadPool *aPool) :
+			maxPrimsInNode(std::min(std::max(aMaxPrimsInNode, 1), 255))
+		{
+			if (aPrimitiveBounds.empty())
+			{
+				return;
+			}
+			stats::PhaseTimer timer(stats::PhaseBVHBuild);
+
+			std::vector<BuildPrimitive> primitives(aPrimitiveBounds.size());
+			auto initPrimitives = [&](size_t first, size_t last)
+			{
+				for (size_t i = first; i < last; ++i)
+				{
+					const BBox &b = aPrimitiveBounds[i];
+					primitives[i] = { static_cast<uint32_t>(i), b, 0.5f * b.pMin + 0.5f * b.pMax };
+				}
+			};
+
+			// A binary tree with n leaves has 2n - 1 nodes, so this is an upper bound
+			nodes.reserve(2 * primitives.size() - 1);
+			primitiveIndices.reserve(primitives.size());
+
+			if (aPool && primitives.size() >= parallelThreshold)
+			{
+				// Every split decision is made exactly as in the serial build, so the
+				// resulting tree is identical no matter how many threads are used
+				parallel::parallelFor(*aPool, primitives.size(), parallelChunkSize, initPrimitives);
+				TopNode root;
+				parallelBuild(*aPool, primitives, 0, primitives.size(), 0, maxPrimsInNode, &root);
+				flatten(root, nodes, primitiveIndices);
+			}
+			else
+			{
+				initPrimitives(0, primitives.size());
+				recursiveBuild(primitives, 0, primitives.size(), 0, maxPrimsInNode, nodes, primitiveIndices);
+			}
+			nodes.shrink_to_fit();
+			recordTreeStats(nodes);
+		}
+
+		BVHAccel::BVHAccel(const LinearBVHNode *aNodes, size_t aNodeCount, const uint32_t *aPrimitiveIndices, size_t aPrimitiveCount, int aMaxPrimsInNode) :
+			maxPrimsInNode(aMaxPrimsInNode), nodes(aNodes, aNodes + aNodeCount), primitiveIndices(aPrimitiveIndices, aPrimitiveIndices + aPrimitiveCount)
+		{
+			recordTreeStats(nodes);
+		}
+
+		BVHAccel::~BVHAccel()
+		{
+		}
+
+		BBox BVHAccel::worldBound() const
+		{
+			return nodes.empty() ? BBox() : nodes[0].bounds;
+		}
+
+		void BVHAccel::refit(const PrimitiveBoundFunc &primitiveBound)
+		{
+			if (nodes.empty())
+			{
+				return;
+			}
+			stats::PhaseTimer timer(stats::PhaseBVHUpdate);
+			prepareUpdates();
+
+			// Children always follow their parent, so a backwards sweep visits every
+			// node after its children
+			for (size_t i = nodes.size(); i-- > 0;)
+			{
+				LinearBVHNode &node = nodes[i];
+				if (parents[i] == unusedNode)
+				{
+					continue;
+				}
+				BBox bounds;
+				if (node.nPrimitives > 0)
+				{
+					for (uint32_t p = 0; p < node.nPrimitives; ++p)
+					{
+						bounds = calcUnion(bounds, primitiveBound(primitiveIndices[node.primitivesOffset + p]));
+					}
+				}
+				else
+				{
+					bounds = calcUnion(nodes[i + 1].bounds, nodes[node.secondChildOffset].bounds);
+				}
+				node.bounds = bounds;
+			}
+		}
+
+		BVHUpdateStats BVHAccel::update(const std::vector<uint32_t> &aChangedPrimitives, const PrimitiveBoundFunc &primitiveBound, float aMaxAreaGrowth)
+		{
+			BVHUpdateStats updateStats = { 0, 0, 0, false };
+			if (nodes.empty() || aChangedPrimitives.empty())
+			{
+				return updateStats;
+			}
+			stats::PhaseTimer timer(stats::PhaseBVHUpdate);
+			prepareUpdates();
+
+			// The leaves of the changed primitives and all their ancestors, each once
+			std::vector<uint32_t> dirtyNodes;
+			for (auto it = aChangedPrimitives.cbegin(); it < aChangedPrimitives.cend(); ++it)
+			{
+				for (uint32_t n = primitiveLeaves[*it]; n != noParent && !dirty[n]; n = parents[n])
+				{
+					dirty[n] = 1;
+					dirtyNodes.push_back(n);
+				}
+			}
+
+			// Refit from the bottom up: children always have larger indices
+			std::sort(dirtyNodes.begin(), dirtyNodes.end(), std::greater<uint32_t>());
+			for (auto it = dirtyNodes.cbegin(); it < dirtyNodes.cend(); ++it)
+			{
+				LinearBVHNode &node = nodes[*it];
+				BBox bounds;
+				if (node.nPrimitives > 0)
+				{
+					for (uint32_t p = 0; p < node.nPrimitives; ++p)
+					{
+						bounds = calcUnion(bounds, primitiveBound(primitiveIndices[node.primitivesOffset + p]));
+					}
+				}
+				else
+				{
+					bounds = calcUnion(nodes[*it + 1].bounds, nodes[node.secondChildOffset].bounds);
+				}
+				node.bounds = bounds;
+				dirty[*it] = 0;
+			}
+			updateStats.nodesRefit = dirtyNodes.size();
+
+			// Then from the top down, rebuild the subtrees of degraded interior nodes.
+			// A subtree's nodes are contiguous, so everything below a rebuilt node can
+			// be skipped. The rebuilt subtree's bounds are those it was refit to, so
+			// its ancestors stay valid
+			uint32_t skipEnd = 0;
+			for (auto it = dirtyNodes.crbegin(); it < dirtyNodes.crend(); ++it)
+			{
+				uint32_t n = *it;
+				if (n < skipEnd || nodes[n].nPrimitives > 0)
+				{
+					continue;
+				}
+				float area = nodes[n].bounds.surfaceArea();
+				if (area > aMaxAreaGrowth * builtAreas[n])
+				{
+					skipEnd = subtreeEnd(n);
+					if (!rebuildSubtree(n, primitiveBound, &updateStats.nodesRebuilt))
+					{
+						// The subtree can't be rebuilt in its nodes without a leaf too
+						// large to store: rebuild the whole tree instead
+						rebuild(primitiveBound);
+						updateStats.nodesRebuilt = nodes.size();
+						updateStats.rebuiltFully = true;
+						return updateStats;
+					}
+					++updateStats.subtreesRebuilt;
+				}
+			}
+			return updateStats;
+		}
+
+		void BVHAccel::prepareUpdates()
+		{
+			if (parents.size() == nodes.size())
+			{
+				return;
+			}
+			parents.assign(nodes.size(), unusedNode);
+			primitiveLeaves.assign(primitiveIndices.size(), noParent);
+			builtAreas.assign(nodes.size(), 0.0f);
+			dirty.assign(nodes.size(), 0);
+			parents[0] = noParent;
+			indexSubtree(0);
+		}
+
+		void BVHAccel::indexSubtree(uint32_t aRoot)
+		{
+			uint32_t nodesToVisit[maxBVHDepth + 1];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = aRoot;
+			while (true)
+			{
+				const LinearBVHNode &node = nodes[currentNodeIndex];
+				builtAreas[currentNodeIndex] = node.bounds.surfaceArea();
+				if (node.nPrimitives > 0)
+				{
+					for (uint32_t p = 0; p < node.nPrimitives; ++p)
+					{
+						primitiveLeaves[primitiveIndices[node.primitivesOffset + p]] = currentNodeIndex;
+					}
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+				else
+				{
+					parents[currentNodeIndex + 1] = currentNodeIndex;
+					parents[node.secondChildOffset] = currentNodeIndex;
+					nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+
+		uint32_t BVHAccel::subtreeEnd(uint32_t aNode) const
+		{
+			// The subtree of a first child ends where its sibling's starts; that of
+			// a second child ends where its parent's does
+			for (uint32_t n = aNode; parents[n] != noParent; n = parents[n])
+			{
+				uint32_t parent = parents[n];
+				if (n == parent + 1)
+				{
+					return nodes[parent].secondChildOffset;
+				}
+			}
+			return static_cast<uint32_t>(nodes.size());
+		}
+
+		void BVHAccel::rebuild(const PrimitiveBoundFunc &primitiveBound)
+		{
+			std::vector<BBox> primitiveBounds(primitiveIndices.size());
+			for (uint32_t i = 0; i < primitiveBounds.size(); ++i)
+			{
+				primitiveBounds[i] = primitiveBound(i);
+			}
+			// The new tree starts without update bookkeeping, so the next update
+			// indexes it afresh
+			*this = BVHAccel(primitiveBounds, maxPrimsInNode);
+		}
+
+		bool BVHAccel::rebuildSubtree(uint32_t aRoot, const PrimitiveBoundFunc &primitiveBound, size_t *nodesRebuilt)
+		{
+			// The subtree's primitives are contiguous too, since leaves are emitted
+			// in depth-first order
+			uint32_t end = subtreeEnd(aRoot);
+			uint32_t firstPrimitive = std::numeric_limits<uint32_t>::max(), nPrimitives = 0;
+			int depth = 0;
+			for (uint32_t n = aRoot; parents[n] != noParent; n = parents[n])
+			{
+				++depth;
+			}
+			uint32_t nodesToVisit[maxBVHDepth + 1];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = aRoot;
+			while (true)
+			{
+				const LinearBVHNode &node = nodes[currentNodeIndex];
+				if (node.nPrimitives > 0)
+				{
+					firstPrimitive = std::min(firstPrimitive, node.primitivesOffset);
+					nPrimitives += node.nPrimitives;
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+
+			std::vector<BuildPrimitive> primitives(nPrimitives);
+			for (uint32_t i = 0; i < nPrimitives; ++i)
+			{
+				uint32_t primitive = primitiveIndices[firstPrimitive + i];
+				BBox b = primitiveBound(primitive);
+				primitives[i] = { primitive, b, 0.5f * b.pMin + 0.5f * b.pMax };
+			}
+			std::vector<LinearBVHNode> subtreeNodes;
+			std::vector<uint32_t> subtreeIndices;
+			subtreeNodes.reserve(end - aRoot);
+			subtreeIndices.reserve(nPrimitives);
+			bool tooLarge = false;
+			recursiveBuild(primitives, 0, nPrimitives, depth, maxPrimsInNode, subtreeNodes, subtreeIndices, end - aRoot, &tooLarge);
+			if (tooLarge)
+			{
+				return false;
+			}
+
+			// Move it in place of the old one, and re-index it
+			for (size_t i = 0; i < subtreeNodes.size(); ++i)
+			{
+				LinearBVHNode node = subtreeNodes[i];
+				if (node.nPrimitives > 0)
+				{
+					node.primitivesOffset += firstPrimitive;
+				}
+				else
+				{
+					node.secondChildOffset += aRoot;
+				}
+				nodes[aRoot + i] = node;
+			}
+			std::copy(subtreeIndices.begin(), subtreeIndices.end(), primitiveIndices.begin() + firstPrimitive);
+			std::fill(parents.begin() + aRoot + 1, parents.begin() + end, unusedNode);
+			indexSubtree(aRoot);
+			*nodesRebuilt += subtreeNodes.size();
+			return true;
+		}
+
+	} // namespace accel
+
+} // namespace namaste
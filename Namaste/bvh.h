@@ -0,0 +1,271 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#include "geometry.h"
+#include "parallel.h"
+#include "stats.h"
+
+namespace namaste {
+
+	namespace accel {
+
+		// A node of the flattened BVH. Nodes are laid out in depth-first order,
+		// so the first child of an interior node always immediately follows it
+		// and only the offset of the second child needs to be stored. Exactly
+		// 32 bytes, so two nodes share a 64-byte cache line
+		struct LinearBVHNode
+		{
+			geom::BBox bounds;
+			union
+			{
+				uint32_t primitivesOffset;		// Leaf
+				uint32_t secondChildOffset;		// Interior
+			};
+			uint16_t nPrimitives;				// 0 -> interior node
+			uint8_t axis;						// Interior node split axis
+			uint8_t pad[1];
+		};
+
+		static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+		static_assert(std::is_trivially_copyable<LinearBVHNode>::value, "LinearBVHNode should be trivially copyable");
+
+		// Bounds of a primitive by its index, for updating a BVH in place
+		using PrimitiveBoundFunc = std::function<geom::BBox(uint32_t)>;
+
+		// What an incremental update did
+		struct BVHUpdateStats
+		{
+			size_t nodesRefit;
+			size_t subtreesRebuilt;
+			size_t nodesRebuilt;
+			// A subtree couldn't be rebuilt in place, so the whole tree was
+			bool rebuiltFully;
+		};
+
+		class BVHAccel
+		{
+		public:
+			// Builds a BVH over primitives given only their bounds: the accelerator
+			// never touches the primitives themselves, traversal hands the original
+			// index of each candidate primitive back to the caller. If a thread pool
+			// is given, large scenes are built in parallel on it
+			BVHAccel(const std::vector<geom::BBox> &aPrimitiveBounds, int aMaxPrimsInNode = 4, parallel::ThreadPool *aPool = nullptr);
+			// Adopts an already flattened tree, e.g. one loaded from a scene cache
+			BVHAccel(const LinearBVHNode *aNodes, size_t aNodeCount, const uint32_t *aPrimitiveIndices, size_t aPrimitiveCount, int aMaxPrimsInNode);
+			~BVHAccel();
+
+			BVHAccel(BVHAccel &&) = default;
+			BVHAccel& operator=(BVHAccel &&) = default;
+
+			geom::BBox worldBound() const;
+
+			// Closest-hit traversal: intersectPrimitive(primitiveIndex, ray) is called
+			// for every candidate primitive, and should return true and shrink
+			// ray.maxT if it found a closer hit. Since maxT shrinks as hits are found,
+			// subtrees behind the closest hit so far are culled early
+			template <typename IntersectFunc>
+			bool intersect(const geom::Ray &aRay, IntersectFunc intersectPrimitive) const;
+
+			// The same traversal, but handing whole leaves to the caller as
+			// intersectLeaf(primitiveIndices, count, ray), so that all of a leaf's
+			// primitives can be tested at once with SIMD
+			template <typename LeafFunc>
+			bool intersectLeaves(const geom::Ray &aRay, LeafFunc intersectLeaf) const;
+
+			// Any-hit traversal for occlusion queries: stops as soon as
+			// occludedLeaf(primitiveIndices, count, ray) returns true. Since maxT never
+			// shrinks and any hit will do, children are simply visited in memory
+			// order
+			template <typename LeafFunc>
+			bool intersectP(const geom::Ray &aRay, LeafFunc occludedLeaf) const;
+
+			// Refits every node's bounds bottom-up to the primitives' current bounds,
+			// keeping the topology, for when most of the scene has moved
+			void refit(const PrimitiveBoundFunc &primitiveBound);
+
+			// Updates the tree after only the given primitives moved, in time that
+			// grows with the number of changed primitives rather than with the size
+			// of the tree: only their leaves and the ancestors of those are refit. An
+			// interior node whose surface area has grown to more than aMaxAreaGrowth
+			// times its area when it was built has degraded enough that the topmost
+			// such node's subtree is rebuilt with the SAH, in place; if that would
+			// take a leaf too large to store, the whole tree is rebuilt. The first
+			// update indexes the tree, which takes time linear in its size. Any
+			// WideBVH collapsed from this tree must be collapsed again afterwards
+			BVHUpdateStats update(const std::vector<uint32_t> &aChangedPrimitives, const PrimitiveBoundFunc &primitiveBound, float aMaxAreaGrowth = 2.0f);
+
+			int maxPrimsInNode;
+			// A rebuilt subtree that needs fewer nodes than the one it replaces leaves
+			// the rest of its range unused; traversal never reaches those nodes
+			std::vector<LinearBVHNode> nodes;
+			std::vector<uint32_t> primitiveIndices;
+		private:
+			void prepareUpdates();
+			void indexSubtree(uint32_t aRoot);
+			uint32_t subtreeEnd(uint32_t aNode) const;
+			void rebuild(const PrimitiveBoundFunc &primitiveBound);
+			// Returns false, leaving the tree as it was, if the subtree can't be
+			// rebuilt in the nodes it has now
+			bool rebuildSubtree(uint32_t aRoot, const PrimitiveBoundFunc &primitiveBound, size_t *nodesRebuilt);
+
+			// Update bookkeeping, built by the first update: every node's parent
+			// (noParent for the root, unusedNode for unreachable ones), the leaf of
+			// every primitive, and every node's surface area when it was built
+			std::vector<uint32_t> parents;
+			std::vector<uint32_t> primitiveLeaves;
+			std::vector<float> builtAreas;
+			std::vector<uint8_t> dirty;
+		};
+
+		// Maximum depth of the tree, and hence the size of the traversal stack
+		static const int maxBVHDepth = 64;
+
+		// Slab test against a node's bounds using a precomputed reciprocal direction
+		// and direction signs, which pick the near and far planes directly
+		inline bool intersectP(const geom::BBox &aBBox, const geom::Ray &aRay, const geom::Vector &invDir, const int dirIsNeg[3])
+		{
+			const geom::Point &nearX = dirIsNeg[0] ? aBBox.pMax : aBBox.pMin, &farX = dirIsNeg[0] ? aBBox.pMin : aBBox.pMax;
+			const geom::Point &nearY = dirIsNeg[1] ? aBBox.pMax : aBBox.pMin, &farY = dirIsNeg[1] ? aBBox.pMin : aBBox.pMax;
+			const geom::Point &nearZ = dirIsNeg[2] ? aBBox.pMax : aBBox.pMin, &farZ = dirIsNeg[2] ? aBBox.pMin : aBBox.pMax;
+			float tMin = (nearX.x - aRay.o.x) * invDir.x;
+			float tMax = (farX.x - aRay.o.x) * invDir.x * geom::slabFarScale;
+			float tyMin = (nearY.y - aRay.o.y) * invDir.y;
+			float tyMax = (farY.y - aRay.o.y) * invDir.y * geom::slabFarScale;
+			if (tMin > tyMax || tyMin > tMax)
+			{
+				return false;
+			}
+			if (tyMin > tMin) tMin = tyMin;
+			if (tyMax < tMax) tMax = tyMax;
+
+			float tzMin = (nearZ.z - aRay.o.z) * invDir.z;
+			float tzMax = (farZ.z - aRay.o.z) * invDir.z * geom::slabFarScale;
+			if (tMin > tzMax || tzMin > tMax)
+			{
+				return false;
+			}
+			if (tzMin > tMin) tMin = tzMin;
+			if (tzMax < tMax) tMax = tzMax;
+
+			return (tMin <= aRay.maxT) && (tMax >= aRay.minT);
+		}
+
+		template <typename IntersectFunc>
+		bool BVHAccel::intersect(const geom::Ray &aRay, IntersectFunc intersectPrimitive) const
+		{
+			return intersectLeaves(aRay, [&](const uint32_t *aPrimitives, int aCount, const geom::Ray &ray)
+			{
+				bool hit = false;
+				for (int i = 0; i < aCount; ++i)
+				{
+					if (intersectPrimitive(aPrimitives[i], ray))
+					{
+						hit = true;
+					}
+				}
+				return hit;
+			});
+		}
+
+		template <typename LeafFunc>
+		bool BVHAccel::intersectLeaves(const geom::Ray &aRay, LeafFunc intersectLeaf) const
+		{
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			bool hit = false;
+			geom::Vector invDir(1.0f / aRay.d.x, 1.0f / aRay.d.y, 1.0f / aRay.d.z);
+			int dirIsNeg[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
+
+			stats::RayCounter rayStats(stats::CounterClosestHitRays, stats::DistributionNodesPerClosestHitRay);
+
+			// Short-stack traversal: visit the near child first (according to the
+			// sign of the ray direction along the split axis) and push the far one
+			uint32_t nodesToVisit[maxBVHDepth];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = 0;
+			while (true)
+			{
+				const LinearBVHNode &node = nodes[currentNodeIndex];
+				rayStats.node();
+				if (accel::intersectP(node.bounds, aRay, invDir, dirIsNeg))
+				{
+					if (node.nPrimitives > 0)
+					{
+						rayStats.primitives(node.nPrimitives);
+						if (intersectLeaf(&primitiveIndices[node.primitivesOffset], static_cast<int>(node.nPrimitives), aRay))
+						{
+							hit = true;
+						}
+						if (toVisitOffset == 0) break;
+						currentNodeIndex = nodesToVisit[--toVisitOffset];
+					}
+					else if (dirIsNeg[node.axis])
+					{
+						nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+						currentNodeIndex = node.secondChildOffset;
+					}
+					else
+					{
+						nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+						currentNodeIndex = currentNodeIndex + 1;
+					}
+				}
+				else
+				{
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+			}
+			return hit;
+		}
+
+		template <typename LeafFunc>
+		bool BVHAccel::intersectP(const geom::Ray &aRay, LeafFunc occludedLeaf) const
+		{
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			geom::Vector invDir(1.0f / aRay.d.x, 1.0f / aRay.d.y, 1.0f / aRay.d.z);
+			int dirIsNeg[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
+
+			stats::RayCounter rayStats(stats::CounterAnyHitRays, stats::DistributionNodesPerAnyHitRay);
+
+			uint32_t nodesToVisit[maxBVHDepth];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = 0;
+			while (true)
+			{
+				const LinearBVHNode &node = nodes[currentNodeIndex];
+				rayStats.node();
+				if (accel::intersectP(node.bounds, aRay, invDir, dirIsNeg))
+				{
+					if (node.nPrimitives == 0)
+					{
+						nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+						currentNodeIndex = currentNodeIndex + 1;
+						continue;
+					}
+					rayStats.primitives(node.nPrimitives);
+					if (occludedLeaf(&primitiveIndices[node.primitivesOffset], static_cast<int>(node.nPrimitives), aRay))
+					{
+						return true;
+					}
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			return false;
+		}
+
+	} // namespace accel
+
+} // namespace namaste
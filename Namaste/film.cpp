@@ -0,0 +1,391 @@
+#include "stdafx.h"
+#include "film.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+
+namespace namaste {
+
+	namespace render {
+
+		namespace {
+
+			bool hasExtension(const std::string &aFileName, const char *aExtension)
+			{
+				size_t dot = aFileName.rfind('.');
+				if (dot == std::string::npos)
+				{
+					return false;
+				}
+				std::string extension = aFileName.substr(dot + 1);
+				std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+				return extension == aExtension;
+			}
+
+			unsigned char toSRGB8(float v)
+			{
+				v = std::min(std::max(v, 0.0f), 1.0f);
+				v = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+				return static_cast<unsigned char>(v * 255.0f + 0.5f);
+			}
+
+		} // anonymous namespace
+
+		// ---------------------------------------------------------------
+		// Filter class
+		// ---------------------------------------------------------------
+		Filter::Filter(FilterType aType, float aRadius) :
+			type(aType), radius(std::min(std::max(aRadius, 0.5f), static_cast<float>(maxRadius))), invRadius(1.0f / radius)
+		{
+			// Each entry is the filter at the middle of its interval of |d|
+			const float alpha = 2.0f;
+			for (int i = 0; i < tableSize; ++i)
+			{
+				float d = (i + 0.5f) / tableSize * radius;
+				switch (type)
+				{
+				case FilterBox:
+					table[i] = 1.0f;
+					break;
+				case FilterTriangle:
+					table[i] = 1.0f - d * invRadius;
+					break;
+				case FilterGaussian:
+				default:
+					// Shifted down to reach zero at the radius
+					table[i] = std::exp(-alpha * d * d) - std::exp(-alpha * radius * radius);
+					break;
+				}
+			}
+		}
+
+		// ---------------------------------------------------------------
+		// Splat buffer class
+		// ---------------------------------------------------------------
+		SplatBuffer::SplatBuffer(int aWidth, int aHeight) :
+			width(aWidth), height(aHeight), values(new std::atomic<float>[3 * static_cast<size_t>(aWidth) * aHeight])
+		{
+			clear();
+		}
+
+		SplatBuffer::~SplatBuffer()
+		{
+		}
+
+		void SplatBuffer::add(int aX, int aY, const float rgb[3])
+		{
+			std::atomic<float> *pixel = &values[3 * (static_cast<size_t>(aY) * width + aX)];
+			for (int c = 0; c < 3; ++c)
+			{
+				if (rgb[c] == 0.0f)
+				{
+					continue;
+				}
+				float old = pixel[c].load(std::memory_order_relaxed);
+				while (!pixel[c].compare_exchange_weak(old, old + rgb[c], std::memory_order_relaxed))
+				{
+				}
+			}
+		}
+
+		void SplatBuffer::clear()
+		{
+			const size_t n = 3 * static_cast<size_t>(width) * height;
+			for (size_t i = 0; i < n; ++i)
+			{
+				values[i].store(0.0f, std::memory_order_relaxed);
+			}
+		}
+
+		// ---------------------------------------------------------------
+		// Film class
+		// ---------------------------------------------------------------
+		Film::Film(int aWidth, int aHeight, int aTileSize, const Filter &aFilter) :
+			width(aWidth), height(aHeight), tileSize(std::max(aTileSize, 1)), filter(aFilter), splats(aWidth, aHeight)
+		{
+			tilesX = (width + tileSize - 1) / tileSize;
+			tilesY = (height + tileSize - 1) / tileSize;
+
+			// A sample in pixel x reaches pixels whose centers are within the
+			// radius, i.e. as far as floor(radius + 1/2) pixels away. Resolving only
+			// looks at the adjacent tiles, so the apron can't be wider than a tile
+			apron = std::min(static_cast<int>(std::floor(filter.radius + 0.5f)), tileSize);
+
+			std::vector<Tile> bounds = generateTiles(width, height, tileSize);
+			tiles.resize(bounds.size());
+			for (size_t i = 0; i < bounds.size(); ++i)
+			{
+				FilmTile &tile = tiles[i];
+				tile.tile = bounds[i];
+				tile.bounds.x0 = std::max(bounds[i].x0 - apron, 0);
+				tile.bounds.y0 = std::max(bounds[i].y0 - apron, 0);
+				tile.bounds.x1 = std::min(bounds[i].x1 + apron, width);
+				tile.bounds.y1 = std::min(bounds[i].y1 + apron, height);
+				tile.values.assign(4 * static_cast<size_t>(tile.bounds.x1 - tile.bounds.x0) * (tile.bounds.y1 - tile.bounds.y0), 0.0f);
+			}
+		}
+
+		Film::~Film()
+		{
+		}
+
+		void Film::addSample(FilmTile &aTile, float filmX, float filmY, const float rgb[3]) const
+		{
+			// Pixel centers are at half-integer coordinates
+			const Tile &bounds = aTile.bounds;
+			const float cx = filmX - 0.5f, cy = filmY - 0.5f;
+			const int x0 = std::max(static_cast<int>(std::ceil(cx - filter.radius)), bounds.x0);
+			const int x1 = std::min(static_cast<int>(std::floor(cx + filter.radius)), bounds.x1 - 1);
+			const int y0 = std::max(static_cast<int>(std::ceil(cy - filter.radius)), bounds.y0);
+			const int y1 = std::min(static_cast<int>(std::floor(cy + filter.radius)), bounds.y1 - 1);
+			if (x0 > x1)
+			{
+				return;
+			}
+
+			// The filter is separable, so the x weights are shared by every row
+			float xWeights[2 * Filter::maxRadius + 1];
+			for (int x = x0; x <= x1; ++x)
+			{
+				xWeights[x - x0] = filter.evaluate(x - cx);
+			}
+
+			const int stride = bounds.x1 - bounds.x0;
+			for (int y = y0; y <= y1; ++y)
+			{
+				const float yWeight = filter.evaluate(y - cy);
+				float *value = &aTile.values[4 * (static_cast<size_t>(y - bounds.y0) * stride + (x0 - bounds.x0))];
+				for (int x = x0; x <= x1; ++x, value += 4)
+				{
+					const float weight = xWeights[x - x0] * yWeight;
+					value[0] += weight * rgb[0];
+					value[1] += weight * rgb[1];
+					value[2] += weight * rgb[2];
+					value[3] += weight;
+				}
+			}
+		}
+
+		void Film::addSplat(float filmX, float filmY, const float rgb[3])
+		{
+			int x = static_cast<int>(std::floor(filmX)), y = static_cast<int>(std::floor(filmY));
+			if (x >= 0 && x < width && y >= 0 && y < height)
+			{
+				splats.add(x, y, rgb);
+			}
+		}
+
+		void Film::resolve(parallel::ThreadPool &aPool, float aSplatScale, std::vector<float> *rgb) const
+		{
+			rgb->resize(3 * static_cast<size_t>(width) * height);
+			float *out = rgb->data();
+			parallel::parallelFor(aPool, tiles.size(), 1, [this, aSplatScale, out](size_t aBegin, size_t aEnd)
+			{
+				for (size_t i = aBegin; i < aEnd; ++i)
+				{
+					resolveTile(static_cast<int>(i), aSplatScale, out);
+				}
+			});
+		}
+
+		void Film::resolveTile(int aTileIndex, float aSplatScale, float *rgb) const
+		{
+			const Tile &tile = tiles[aTileIndex].tile;
+			const int tileWidth = tile.x1 - tile.x0, tileHeight = tile.y1 - tile.y0;
+			std::vector<float> sums(4 * static_cast<size_t>(tileWidth) * tileHeight, 0.0f);
+
+			// Only the tile itself and its neighbours reach its pixels
+			const int tx = aTileIndex % tilesX, ty = aTileIndex / tilesX;
+			for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, tilesY - 1); ++ny)
+			{
+				for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, tilesX - 1); ++nx)
+				{
+					const FilmTile &neighbour = tiles[ny * tilesX + nx];
+					const Tile &bounds = neighbour.bounds;
+					const int x0 = std::max(tile.x0, bounds.x0), x1 = std::min(tile.x1, bounds.x1);
+					const int y0 = std::max(tile.y0, bounds.y0), y1 = std::min(tile.y1, bounds.y1);
+					const int stride = bounds.x1 - bounds.x0;
+					for (int y = y0; y < y1; ++y)
+					{
+						const float *src = &neighbour.values[4 * (static_cast<size_t>(y - bounds.y0) * stride + (x0 - bounds.x0))];
+						float *dst = &sums[4 * (static_cast<size_t>(y - tile.y0) * tileWidth + (x0 - tile.x0))];
+						for (int i = 0; i < 4 * (x1 - x0); ++i)
+						{
+							dst[i] += src[i];
+						}
+					}
+				}
+			}
+
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				const float *sum = &sums[4 * static_cast<size_t>(y - tile.y0) * tileWidth];
+				float *dst = &rgb[3 * (static_cast<size_t>(y) * width + tile.x0)];
+				for (int x = tile.x0; x < tile.x1; ++x, sum += 4, dst += 3)
+				{
+					const float invWeight = sum[3] != 0.0f ? 1.0f / sum[3] : 0.0f;
+					for (int c = 0; c < 3; ++c)
+					{
+						dst[c] = sum[c] * invWeight + splats.value(x, y, c) * aSplatScale;
+					}
+				}
+			}
+		}
+
+		void Film::clear()
+		{
+			for (auto &tile : tiles)
+			{
+				std::fill(tile.values.begin(), tile.values.end(), 0.0f);
+			}
+			splats.clear();
+		}
+
+		bool writeImage(const std::string &aFileName, int aWidth, int aHeight, const float *rgb)
+		{
+			// Written next to the destination and renamed over it, so that anything
+			// watching the file never sees a partial image
+			std::string temporaryFile = aFileName + ".tmp";
+			{
+				std::ofstream out(temporaryFile, std::ios::binary | std::ios::trunc);
+				if (!out)
+				{
+					return false;
+				}
+				if (hasExtension(aFileName, "pfm"))
+				{
+					// Little-endian floats, bottom row first
+					out << "PF\n" << aWidth << " " << aHeight << "\n-1.0\n";
+					for (int y = aHeight - 1; y >= 0; --y)
+					{
+						out.write(reinterpret_cast<const char*>(&rgb[3 * static_cast<size_t>(y) * aWidth]), static_cast<std::streamsize>(3 * aWidth * sizeof(float)));
+					}
+				}
+				else
+				{
+					out << "P6\n" << aWidth << " " << aHeight << "\n255\n";
+					std::vector<unsigned char> row(3 * static_cast<size_t>(aWidth));
+					for (int y = 0; y < aHeight; ++y)
+					{
+						const float *src = &rgb[3 * static_cast<size_t>(y) * aWidth];
+						for (size_t i = 0; i < row.size(); ++i)
+						{
+							row[i] = toSRGB8(src[i]);
+						}
+						out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+					}
+				}
+				if (!out)
+				{
+					out.close();
+					std::remove(temporaryFile.c_str());
+					return false;
+				}
+			}
+
+			// rename() won't replace an existing file on Windows
+			std::remove(aFileName.c_str());
+			if (std::rename(temporaryFile.c_str(), aFileName.c_str()) != 0)
+			{
+				std::remove(temporaryFile.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// ---------------------------------------------------------------
+		// Image writer class
+		// ---------------------------------------------------------------
+		ImageWriter::ImageWriter() :
+			writing(false), stop(false), failed(false), nWritten(0), nDropped(0)
+		{
+			thread = std::thread(&ImageWriter::writerLoop, this);
+		}
+
+		ImageWriter::~ImageWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			condition.notify_all();
+			thread.join();
+		}
+
+		void ImageWriter::submit(const std::string &aFileName, int aWidth, int aHeight, const std::vector<float> &aPixels)
+		{
+			std::unique_ptr<Image> image;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				image = std::move(spare);
+			}
+			if (!image)
+			{
+				image.reset(new Image);
+			}
+			image->fileName = aFileName;
+			image->width = aWidth;
+			image->height = aHeight;
+			image->pixels.assign(aPixels.begin(), aPixels.end());
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (pending)
+				{
+					++nDropped;
+					spare = std::move(pending);
+				}
+				pending = std::move(image);
+			}
+			condition.notify_all();
+		}
+
+		bool ImageWriter::finish()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return !pending && !writing; });
+			return !failed;
+		}
+
+		int ImageWriter::written() const
+		{
+			return nWritten.load();
+		}
+
+		int ImageWriter::dropped() const
+		{
+			return nDropped.load();
+		}
+
+		void ImageWriter::writerLoop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;)
+			{
+				condition.wait(lock, [this]() { return pending || stop; });
+				if (!pending)
+				{
+					// Stopping, with nothing left to write
+					return;
+				}
+
+				std::unique_ptr<Image> image = std::move(pending);
+				writing = true;
+				lock.unlock();
+				bool ok = writeImage(image->fileName, image->width, image->height, image->pixels.data());
+				lock.lock();
+				writing = false;
+				failed = failed || !ok;
+				++nWritten;
+				if (!spare)
+				{
+					spare = std::move(image);
+				}
+				condition.notify_all();
+			}
+		}
+
+	} // namespace render
+
+} // namespace namaste
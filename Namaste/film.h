@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "renderer.h"
+
+namespace namaste {
+
+	namespace render {
+
+		enum FilterType
+		{
+			FilterBox,
+			FilterTriangle,
+			FilterGaussian
+		};
+
+		// A separable pixel reconstruction filter, f(dx, dy) = f(dx) f(dy). The 1D
+		// profile is tabulated once, so weighing a sample is two table lookups
+		class Filter
+		{
+		public:
+			static const int tableSize = 64;
+			// In pixels; wider filters are clamped to this
+			static const int maxRadius = 16;
+
+			explicit Filter(FilterType aType = FilterGaussian, float aRadius = 1.5f);
+
+			// f at offset d from the pixel center, for |d| <= radius
+			float evaluate(float d) const
+			{
+				int i = static_cast<int>(std::abs(d) * invRadius * tableSize);
+				return table[i < tableSize ? i : tableSize - 1];
+			}
+
+			FilterType type;
+			float radius;
+		private:
+			float invRadius;
+			float table[tableSize];
+		};
+
+		// One tile's share of the film: filtered samples reach up to the filter
+		// radius past the tile, so the buffer covers the tile plus an apron of
+		// that many pixels (clipped to the image). Each pixel holds its weighted
+		// RGB sum and the sum of its filter weights
+		struct FilmTile
+		{
+			Tile tile;			// The pixels whose samples the tile takes
+			Tile bounds;		// The pixels those samples reach
+			std::vector<float> values;
+		};
+
+		// Samples that can land anywhere on the film, such as light-tracing
+		// splats. Any thread may add to any pixel, so the components are atomic
+		// floats updated by compare-and-swap: lock-free, and threads only meet on
+		// a cache line when they splat to the same few pixels at the same time.
+		// Splats are unfiltered and unweighted, and scaled when resolved
+		class SplatBuffer
+		{
+		public:
+			SplatBuffer(int aWidth, int aHeight);
+			~SplatBuffer();
+
+			SplatBuffer(const SplatBuffer &) = delete;
+			SplatBuffer& operator=(const SplatBuffer &) = delete;
+
+			void add(int aX, int aY, const float rgb[3]);
+			void clear();
+
+			// Pixel (x, y)'s total. Only meaningful while nothing is splatting
+			float value(int aX, int aY, int aChannel) const
+			{
+				return values[3 * (static_cast<size_t>(aY) * width + aX) + aChannel].load(std::memory_order_relaxed);
+			}
+
+			int width;
+			int height;
+		private:
+			std::unique_ptr<std::atomic<float>[]> values;
+		};
+
+		// A film for progressive rendering. Its tiles match generateTiles(), and
+		// whichever thread renders a tile owns its FilmTile for the pass, so
+		// adding samples needs no synchronization. Between passes resolve()
+		// merges the tiles, again without locks: every tile writes only its own
+		// pixels, gathering them from its own buffer and from its neighbours'
+		// aprons. Nothing is shared while rendering, whatever the thread count,
+		// except the splat buffer
+		class Film
+		{
+		public:
+			Film(int aWidth, int aHeight, int aTileSize = 16, const Filter &aFilter = Filter());
+			~Film();
+
+			Film(const Film &) = delete;
+			Film& operator=(const Film &) = delete;
+
+			// Adds a sample taken at film position (filmX, filmY), which must lie in
+			// the tile, to every pixel within the filter's reach
+			void addSample(FilmTile &aTile, float filmX, float filmY, const float rgb[3]) const;
+			// Adds a splat at (filmX, filmY), anywhere on the film, from any thread
+			void addSplat(float filmX, float filmY, const float rgb[3]);
+
+			// Writes the film's image, width * height RGB triples in scanline order,
+			// to rgb: the filtered samples normalized by their weights, plus the
+			// splats times aSplatScale (typically 1 / samples per pixel). Must not
+			// overlap with adding samples
+			void resolve(parallel::ThreadPool &aPool, float aSplatScale, std::vector<float> *rgb) const;
+
+			// Drops every sample and splat
+			void clear();
+
+			int width;
+			int height;
+			int tileSize;
+			Filter filter;
+			std::vector<FilmTile> tiles;
+			SplatBuffer splats;
+		private:
+			void resolveTile(int aTileIndex, float aSplatScale, float *rgb) const;
+
+			int tilesX, tilesY;
+			int apron;
+		};
+
+		// Writes an image as a PFM (floating point, for names ending in .pfm) or
+		// as a binary sRGB PPM otherwise. Returns false if the file couldn't be
+		// written
+		bool writeImage(const std::string &aFileName, int aWidth, int aHeight, const float *rgb);
+
+		// Writes images on a thread of its own, so that rendering never waits for
+		// the disk. submit() copies the pixels and returns at once; the copy goes
+		// into the buffer of an image already written, so steady progressive
+		// updates cost a memcpy and never an allocation. An image still waiting
+		// when a newer one arrives is dropped, so a slow disk skips updates rather
+		// than piling them up. Destruction writes the last image submitted before
+		// returning
+		class ImageWriter
+		{
+		public:
+			ImageWriter();
+			~ImageWriter();
+
+			ImageWriter(const ImageWriter &) = delete;
+			ImageWriter& operator=(const ImageWriter &) = delete;
+
+			void submit(const std::string &aFileName, int aWidth, int aHeight, const std::vector<float> &aPixels);
+
+			// Waits until everything submitted so far has been written; returns
+			// false if any write failed
+			bool finish();
+
+			// Images written and dropped so far
+			int written() const;
+			int dropped() const;
+		private:
+			struct Image
+			{
+				std::string fileName;
+				int width, height;
+				std::vector<float> pixels;
+			};
+
+			void writerLoop();
+
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::unique_ptr<Image> pending;
+			std::unique_ptr<Image> spare;
+			bool writing;
+			bool stop;
+			bool failed;
+			std::atomic<int> nWritten, nDropped;
+			std::thread thread;
+		};
+
+	} // namespace render
+
+} // namespace namaste
@@ -5,405 +5,6 @@ namespace namaste {
 
 	namespace geom {
 
-		// ---------------------------------------------------------------
-		// Vector class
-		// ---------------------------------------------------------------
-		Vector::Vector() :
-			x(0.0f), y(0.0f), z(0.0f)
-		{
-		}
-
-		Vector::Vector(float aX, float aY, float aZ) :
-			x(aX), y(aY), z(aZ)
-		{
-			assert(!hasNaNs());
-		}
-
-		Vector::Vector(const Vector &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-		}
-
-		Vector::Vector(const Point &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-			// Explicit
-		}
-
-		Vector::Vector(const Normal &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-			// Explicit
-		}
-
-		Vector::Vector(float aXYZ) :
-			x(aXYZ), y(aXYZ), z(aXYZ)
-		{
-			// Explicit
-		}
-
-		Vector::~Vector()
-		{
-		}
-
-		Vector Vector::operator+(const Vector &rhs) const
-		{
-			return Vector(x + rhs.x, y + rhs.y, z + rhs.z);
-		}
-
-		Vector& Vector::operator+=(const Vector &rhs)
-		{
-			x += rhs.x;
-			y += rhs.y;
-			z += rhs.z;
-			return *this;
-		}
-
-		Vector Vector::operator-(const Vector &rhs) const
-		{
-			return Vector(x - rhs.x, y - rhs.y, z - rhs.z);
-		}
-
-		Vector& Vector::operator-=(const Vector &rhs)
-		{
-			x -= rhs.x;
-			y -= rhs.y;
-			z -= rhs.z;
-			return *this;
-		}
-
-		Vector Vector::operator*(float scalar) const
-		{
-			return Vector(x * scalar, y * scalar, z * scalar);
-		}
-
-		Vector& Vector::operator*=(float scalar)
-		{
-			x *= scalar;
-			y *= scalar;
-			z *= scalar;
-			return *this;
-		}
-
-		Vector Vector::operator/(float scalar) const
-		{
-			// Compute the scalar's reciprocal and perform three component-wise
-			// multiplications to avoid costly division operations
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			return Vector(x * inv, y * inv, z * inv);
-		}
-
-		Vector& Vector::operator/=(float scalar)
-		{
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			x *= inv;
-			y *= inv;
-			z *= inv;
-			return *this;
-		}
-
-		Vector Vector::operator-() const
-		{
-			return Vector(-x, -y, -z);
-		}
-
-		float Vector::operator[](int i) const
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		float& Vector::operator[](int i)
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		bool Vector::operator==(const Vector &rhs) const
-		{
-			return x == rhs.x && y == rhs.y && z == rhs.z;
-		}
-
-		bool Vector::operator!=(const Vector &rhs) const
-		{
-			return x != rhs.x || y != rhs.y || z != rhs.z;
-		}
-
-		float Vector::lengthSquared() const
-		{
-			return x * x + y * y + z * z;
-		}
-
-		float Vector::length() const
-		{
-			return sqrtf(lengthSquared());
-		}
-
-		bool Vector::hasNaNs() const
-		{
-			return isnan(x) || isnan(y) || isnan(z);
-		}
-
-		// ---------------------------------------------------------------
-		// Point class
-		// ---------------------------------------------------------------
-		Point::Point() :
-			x(0.0f), y(0.0f), z(0.0f)
-		{
-		}
-
-		Point::Point(float aX, float aY, float aZ) :
-			x(aX), y(aY), z(aZ)
-		{
-			assert(!hasNaNs());
-		}
-
-		Point::Point(const Point &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-		}
-
-		Point::~Point()
-		{
-		}
-
-		Point Point::operator+(const Vector &rhs) const
-		{
-			return Point(x + rhs.x, y + rhs.y, z + rhs.z);
-		}
-
-		Point& Point::operator+=(const Vector &rhs)
-		{
-			x += rhs.x;
-			y += rhs.y;
-			z += rhs.z;
-			return *this;
-		}
-
-		Point Point::operator+(const Point &rhs) const
-		{
-			// Although it doesn't make sense mathematically to add two points 
-			// together, we still allow these operations in order to be able to
-			// compute weighted sums of points
-			return Point(x + rhs.x, y + rhs.y, z + rhs.z);
-		}
-
-		Point& Point::operator+=(const Point &rhs)
-		{
-			x += rhs.x;
-			y += rhs.y;
-			z += rhs.z;
-			return *this;
-		}
-
-		Vector Point::operator-(const Point &rhs) const
-		{
-			return Vector(x - rhs.x, y - rhs.y, z - rhs.z);
-		}
-
-		Point Point::operator-(const Vector &rhs) const
-		{
-			return Point(x - rhs.x, y - rhs.y, z - rhs.z);
-		}
-
-		Point& Point::operator-=(const Vector &rhs)
-		{
-			x -= rhs.x;
-			y -= rhs.y;
-			z -= rhs.z;
-			return *this;
-		}
-
-		Point Point::operator*(float scalar) const
-		{
-			// Although it doesn't make sense mathematically to weight points 
-			// by a scalar, we still allow these operations for convenience
-			return Point(x * scalar, y * scalar, z * scalar);
-		}
-
-		Point& Point::operator*=(float scalar)
-		{
-			x *= scalar;
-			y *= scalar;
-			z *= scalar;
-			return *this;
-		}
-
-		Point Point::operator/(float scalar) const
-		{
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			return Point(x * inv, y * inv, z * inv);
-		}
-
-		Point& Point::operator/=(float scalar)
-		{
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			x *= inv;
-			y *= inv;
-			z *= inv;
-			return *this;
-		}
-
-		float Point::operator[](int i) const
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		float& Point::operator[](int i)
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		bool Point::operator==(const Point &rhs) const
-		{
-			return x == rhs.x && y == rhs.y && z == rhs.z;
-		}
-
-		bool Point::operator!=(const Point &rhs) const
-		{
-			return x != rhs.x || y != rhs.y || z != rhs.z;
-		}
-
-		bool Point::hasNaNs() const
-		{
-			return isnan(x) || isnan(y) || isnan(z);
-		}
-
-		// ---------------------------------------------------------------
-		// Normal class
-		// ---------------------------------------------------------------
-		Normal::Normal() :
-			x(0.0f), y(0.0f), z(0.0f)
-		{
-		}
-
-		Normal::Normal(float aX, float aY, float aZ) :
-			x(aX), y(aY), z(aZ)
-		{
-			assert(!hasNaNs());
-		}
-
-		Normal::Normal(const Normal &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-		}
-
-		Normal::Normal(const Vector &rhs) :
-			x(rhs.x), y(rhs.y), z(rhs.z)
-		{
-			// Explicit
-			// This means we can't accidently do things like: Normal n = v
-			// Instead, we'd have to explicitly write: Normal n = Normal(v)
-		}
-
-		Normal::~Normal()
-		{
-		}
-
-		Normal Normal::operator+(const Normal &rhs) const
-		{
-			return Normal(x + rhs.x, y + rhs.y, z + rhs.z);
-		}
-
-		Normal& Normal::operator+=(const Normal &rhs)
-		{
-			x += rhs.x;
-			y += rhs.y;
-			z += rhs.z;
-			return *this;
-		}
-
-		Normal Normal::operator-(const Normal &rhs) const
-		{
-			return Normal(x - rhs.x, y - rhs.y, z - rhs.z);
-		}
-
-		Normal& Normal::operator-=(const Normal &rhs)
-		{
-			x -= rhs.x;
-			y -= rhs.y;
-			z -= rhs.z;
-			return *this;
-		}
-
-		Normal Normal::operator*(float scalar) const
-		{
-			return Normal(x * scalar, y * scalar, z * scalar);
-		}
-
-		Normal& Normal::operator*=(float scalar)
-		{
-			x *= scalar;
-			y *= scalar;
-			z *= scalar;
-			return *this;
-		}
-
-		Normal Normal::operator/(float scalar) const
-		{
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			return Normal(x * inv, y * inv, z * inv);
-		}
-
-		Normal& Normal::operator/=(float scalar)
-		{
-			assert(scalar != 0.0f);
-			float inv = 1.0f / scalar;
-			x *= inv;
-			y *= inv;
-			z *= inv;
-			return *this;
-		}
-
-		Normal Normal::operator-() const
-		{
-			return Normal(-x, -y, -z);
-		}
-
-		float Normal::operator[](int i) const
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		float& Normal::operator[](int i)
-		{
-			assert(i >= 0 && i <= 2);
-			return (&x)[i];
-		}
-
-		bool Normal::operator==(const Normal &rhs) const
-		{
-			return x == rhs.x && y == rhs.y && z == rhs.z;
-		}
-
-		bool Normal::operator!=(const Normal &rhs) const
-		{
-			return x != rhs.x || y != rhs.y || z != rhs.z;
-		}
-
-		float Normal::lengthSquared() const
-		{
-			return x * x + y * y + z * z;
-		}
-
-		float Normal::length() const
-		{
-			return sqrtf(lengthSquared());
-		}
-
-		bool Normal::hasNaNs() const
-		{
-			return isnan(x) || isnan(y) || isnan(z);
-		}
-
 		// ---------------------------------------------------------------
 		// Ray class
 		// ---------------------------------------------------------------
@@ -499,22 +100,6 @@ namespace namaste {
 			pMax = Point(std::max(aPoint1.x, aPoint2.x), std::max(aPoint1.y, aPoint2.y), std::max(aPoint1.z, aPoint2.z));
 		}
 
-		BBox::~BBox()
-		{
-		}
-
-		const Point& BBox::operator[](int i) const
-		{
-			assert(i == 0 || i == 1);
-			return (&pMin)[i];
-		}
-
-		Point& BBox::operator[](int i)
-		{
-			assert(i == 0 || i == 1);
-			return (&pMin)[i];
-		}
-
 		bool BBox::operator==(const BBox &rhs) const
 		{
 			return pMin == rhs.pMin && pMax == rhs.pMax;
@@ -548,7 +133,7 @@ namespace namaste {
 
 		float BBox::surfaceArea() const
 		{
-			Vector d = pMax - pMax;
+			Vector d = pMax - pMin;
 			return 2.0f * (d.x * d.y +		// Front + back faces
 				d.x * d.z +		// Bottom + top faces
 				d.y * d.z);		// Left + right faces
@@ -601,6 +186,38 @@ namespace namaste {
 			*radius = inside(*center) ? distance(*center, pMax) : 0.0f;
 		}
 
+		bool BBox::intersectP(const Ray &aRay, float *hitt0, float *hitt1) const
+		{
+			// Slab test: intersect the ray with each pair of axis-aligned planes,
+			// shrinking the parametric interval [t0, t1] as we go - if it ever
+			// becomes empty, the ray misses the box
+			float t0 = aRay.minT;
+			float t1 = aRay.maxT;
+			for (int i = 0; i < 3; ++i)
+			{
+				// Pick the near and far planes by the sign of the direction rather
+				// than swapping afterwards, so that an empty box is never hit
+				float invRayDir = 1.0f / aRay.d[i];
+				float tNear = ((invRayDir < 0.0f ? pMax[i] : pMin[i]) - aRay.o[i]) * invRayDir;
+				float tFar = ((invRayDir < 0.0f ? pMin[i] : pMax[i]) - aRay.o[i]) * invRayDir * slabFarScale;
+				t0 = tNear > t0 ? tNear : t0;
+				t1 = tFar < t1 ? tFar : t1;
+				if (t0 > t1)
+				{
+					return false;
+				}
+			}
+			if (hitt0)
+			{
+				*hitt0 = t0;
+			}
+			if (hitt1)
+			{
+				*hitt1 = t1;
+			}
+			return true;
+		}
+
 		BBox calcUnion(const BBox &aBBox, const Point &aPoint)
 		{
 			// Given a bounding box and a point, compute and return a new bounding
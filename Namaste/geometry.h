@@ -4,6 +4,7 @@
 #include <cmath>
 #include <algorithm>
 #include <assert.h>
+#include <type_traits>
 
 namespace namaste {
 
@@ -16,33 +17,31 @@ namespace namaste {
 		class Vector
 		{
 		public:
-			Vector();
-			Vector(float aX, float aY, float aZ);
-			Vector(const Vector &rhs);
-			explicit Vector(const Point &rhs);
-			explicit Vector(const Normal &rhs);
-			explicit Vector(float aXYZ);
-			~Vector();
-
-			Vector operator+(const Vector &rhs) const;
+			constexpr Vector();
+			constexpr Vector(float aX, float aY, float aZ);
+			explicit constexpr Vector(const Point &rhs);
+			explicit constexpr Vector(const Normal &rhs);
+			explicit constexpr Vector(float aXYZ);
+
+			constexpr Vector operator+(const Vector &rhs) const;
 			Vector& operator+=(const Vector &rhs);
 
-			Vector operator-(const Vector &rhs) const;
+			constexpr Vector operator-(const Vector &rhs) const;
 			Vector& operator-=(const Vector &rhs);
 
-			Vector operator*(float scalar) const;
+			constexpr Vector operator*(float scalar) const;
 			Vector& operator*=(float scalar);
 
-			Vector operator/(float scalar) const;
+			constexpr Vector operator/(float scalar) const;
 			Vector& operator/=(float scalar);
 
-			Vector operator-() const;
+			constexpr Vector operator-() const;
 
-			float operator[](int i) const;
+			constexpr float operator[](int i) const;
 			float& operator[](int i);
 
-			bool operator==(const Vector &rhs) const;
-			bool operator!=(const Vector &rhs) const;
+			constexpr bool operator==(const Vector &rhs) const;
+			constexpr bool operator!=(const Vector &rhs) const;
 
 			friend std::ostream& operator<<(std::ostream &os, const Vector &v)
 			{
@@ -50,7 +49,7 @@ namespace namaste {
 				return os;
 			}
 
-			float lengthSquared() const;
+			constexpr float lengthSquared() const;
 			float length() const;
 
 			float x, y, z;
@@ -61,32 +60,30 @@ namespace namaste {
 		class Point
 		{
 		public:
-			Point();
-			Point(float aX, float aY, float aZ);
-			Point(const Point &rhs);
-			~Point();
+			constexpr Point();
+			constexpr Point(float aX, float aY, float aZ);
 
-			Point operator+(const Vector &rhs) const;
+			constexpr Point operator+(const Vector &rhs) const;
 			Point& operator+=(const Vector &rhs);
 
-			Point operator+(const Point &rhs) const;
+			constexpr Point operator+(const Point &rhs) const;
 			Point& operator+=(const Point &rhs);
 
-			Vector operator-(const Point &rhs) const;
-			Point operator-(const Vector &rhs) const;
+			constexpr Vector operator-(const Point &rhs) const;
+			constexpr Point operator-(const Vector &rhs) const;
 			Point& operator-=(const Vector &rhs);
 
-			Point operator*(float scalar) const;
+			constexpr Point operator*(float scalar) const;
 			Point& operator*=(float scalar);
 
-			Point operator/(float scalar) const;
+			constexpr Point operator/(float scalar) const;
 			Point& operator/=(float scalar);
 
-			float operator[](int i) const;
+			constexpr float operator[](int i) const;
 			float& operator[](int i);
 
-			bool operator==(const Point &rhs) const;
-			bool operator!=(const Point &rhs) const;
+			constexpr bool operator==(const Point &rhs) const;
+			constexpr bool operator!=(const Point &rhs) const;
 
 			friend std::ostream& operator<<(std::ostream &os, const Point &p)
 			{
@@ -102,31 +99,29 @@ namespace namaste {
 		class Normal
 		{
 		public:
-			Normal();
-			Normal(float aX, float aY, float aZ);
-			Normal(const Normal &rhs);
-			explicit Normal(const Vector &rhs);
-			~Normal();
+			constexpr Normal();
+			constexpr Normal(float aX, float aY, float aZ);
+			explicit constexpr Normal(const Vector &rhs);
 
-			Normal operator+(const Normal &rhs) const;
+			constexpr Normal operator+(const Normal &rhs) const;
 			Normal& operator+=(const Normal &rhs);
 
-			Normal operator-(const Normal &rhs) const;
+			constexpr Normal operator-(const Normal &rhs) const;
 			Normal& operator-=(const Normal &rhs);
 
-			Normal operator*(float scalar) const;
+			constexpr Normal operator*(float scalar) const;
 			Normal& operator*=(float scalar);
 
-			Normal operator/(float scalar) const;
+			constexpr Normal operator/(float scalar) const;
 			Normal& operator/=(float scalar);
 
-			Normal operator-() const;
+			constexpr Normal operator-() const;
 
-			float operator[](int i) const;
+			constexpr float operator[](int i) const;
 			float& operator[](int i);
 
-			bool operator==(const Normal &rhs) const;
-			bool operator!=(const Normal &rhs) const;
+			constexpr bool operator==(const Normal &rhs) const;
+			constexpr bool operator!=(const Normal &rhs) const;
 
 			friend std::ostream& operator<<(std::ostream &os, const Normal &n)
 			{
@@ -134,7 +129,7 @@ namespace namaste {
 				return os;
 			}
 
-			float lengthSquared() const;
+			constexpr float lengthSquared() const;
 			float length() const;
 
 			float x, y, z;
@@ -142,6 +137,388 @@ namespace namaste {
 			bool hasNaNs() const;
 		};
 
+		// Vector, Point and Normal are defined entirely in this header so that
+		// every operation can be inlined into the inner loops that use them. They
+		// have no user-declared copy constructors or destructors, which keeps them
+		// trivially copyable: arrays of them can be memcpy'd, and they are passed
+		// around in registers
+		static_assert(std::is_trivially_copyable<Vector>::value && std::is_trivially_destructible<Vector>::value, "Vector should be trivially copyable");
+		static_assert(std::is_trivially_copyable<Point>::value && std::is_trivially_destructible<Point>::value, "Point should be trivially copyable");
+		static_assert(std::is_trivially_copyable<Normal>::value && std::is_trivially_destructible<Normal>::value, "Normal should be trivially copyable");
+
+		// The constexpr members below are restricted to a single expression, so
+		// checks are folded in with the comma operator rather than written as
+		// separate statements
+		namespace detail {
+
+			constexpr float checkNaN(float v)
+			{
+				// NaN is the only value that compares unequal to itself
+				return assert(v == v), v;
+			}
+
+		} // namespace detail
+
+		// ---------------------------------------------------------------
+		// Vector class
+		// ---------------------------------------------------------------
+		inline constexpr Vector::Vector() :
+			x(0.0f), y(0.0f), z(0.0f)
+		{
+		}
+
+		inline constexpr Vector::Vector(float aX, float aY, float aZ) :
+			x(detail::checkNaN(aX)), y(detail::checkNaN(aY)), z(detail::checkNaN(aZ))
+		{
+		}
+
+		inline constexpr Vector::Vector(const Point &rhs) :
+			x(rhs.x), y(rhs.y), z(rhs.z)
+		{
+			// Explicit
+		}
+
+		inline constexpr Vector::Vector(const Normal &rhs) :
+			x(rhs.x), y(rhs.y), z(rhs.z)
+		{
+			// Explicit
+		}
+
+		inline constexpr Vector::Vector(float aXYZ) :
+			x(aXYZ), y(aXYZ), z(aXYZ)
+		{
+			// Explicit
+		}
+
+		inline constexpr Vector Vector::operator+(const Vector &rhs) const
+		{
+			return Vector(x + rhs.x, y + rhs.y, z + rhs.z);
+		}
+
+		inline Vector& Vector::operator+=(const Vector &rhs)
+		{
+			x += rhs.x;
+			y += rhs.y;
+			z += rhs.z;
+			return *this;
+		}
+
+		inline constexpr Vector Vector::operator-(const Vector &rhs) const
+		{
+			return Vector(x - rhs.x, y - rhs.y, z - rhs.z);
+		}
+
+		inline Vector& Vector::operator-=(const Vector &rhs)
+		{
+			x -= rhs.x;
+			y -= rhs.y;
+			z -= rhs.z;
+			return *this;
+		}
+
+		inline constexpr Vector Vector::operator*(float scalar) const
+		{
+			return Vector(x * scalar, y * scalar, z * scalar);
+		}
+
+		inline Vector& Vector::operator*=(float scalar)
+		{
+			x *= scalar;
+			y *= scalar;
+			z *= scalar;
+			return *this;
+		}
+
+		inline constexpr Vector Vector::operator/(float scalar) const
+		{
+			// Compute the scalar's reciprocal and perform three component-wise
+			// multiplications to avoid costly division operations
+			return assert(scalar != 0.0f), *this * (1.0f / scalar);
+		}
+
+		inline Vector& Vector::operator/=(float scalar)
+		{
+			assert(scalar != 0.0f);
+			float inv = 1.0f / scalar;
+			x *= inv;
+			y *= inv;
+			z *= inv;
+			return *this;
+		}
+
+		inline constexpr Vector Vector::operator-() const
+		{
+			return Vector(-x, -y, -z);
+		}
+
+		inline constexpr float Vector::operator[](int i) const
+		{
+			return assert(i >= 0 && i <= 2), (i == 0 ? x : (i == 1 ? y : z));
+		}
+
+		inline float& Vector::operator[](int i)
+		{
+			assert(i >= 0 && i <= 2);
+			return (&x)[i];
+		}
+
+		inline constexpr bool Vector::operator==(const Vector &rhs) const
+		{
+			return x == rhs.x && y == rhs.y && z == rhs.z;
+		}
+
+		inline constexpr bool Vector::operator!=(const Vector &rhs) const
+		{
+			return x != rhs.x || y != rhs.y || z != rhs.z;
+		}
+
+		inline constexpr float Vector::lengthSquared() const
+		{
+			return x * x + y * y + z * z;
+		}
+
+		inline float Vector::length() const
+		{
+			return sqrtf(lengthSquared());
+		}
+
+		inline bool Vector::hasNaNs() const
+		{
+			return std::isnan(x) || std::isnan(y) || std::isnan(z);
+		}
+
+		// ---------------------------------------------------------------
+		// Point class
+		// ---------------------------------------------------------------
+		inline constexpr Point::Point() :
+			x(0.0f), y(0.0f), z(0.0f)
+		{
+		}
+
+		inline constexpr Point::Point(float aX, float aY, float aZ) :
+			x(detail::checkNaN(aX)), y(detail::checkNaN(aY)), z(detail::checkNaN(aZ))
+		{
+		}
+
+		inline constexpr Point Point::operator+(const Vector &rhs) const
+		{
+			return Point(x + rhs.x, y + rhs.y, z + rhs.z);
+		}
+
+		inline Point& Point::operator+=(const Vector &rhs)
+		{
+			x += rhs.x;
+			y += rhs.y;
+			z += rhs.z;
+			return *this;
+		}
+
+		inline constexpr Point Point::operator+(const Point &rhs) const
+		{
+			// Although it doesn't make sense mathematically to add two points 
+			// together, we still allow these operations in order to be able to
+			// compute weighted sums of points
+			return Point(x + rhs.x, y + rhs.y, z + rhs.z);
+		}
+
+		inline Point& Point::operator+=(const Point &rhs)
+		{
+			x += rhs.x;
+			y += rhs.y;
+			z += rhs.z;
+			return *this;
+		}
+
+		inline constexpr Vector Point::operator-(const Point &rhs) const
+		{
+			return Vector(x - rhs.x, y - rhs.y, z - rhs.z);
+		}
+
+		inline constexpr Point Point::operator-(const Vector &rhs) const
+		{
+			return Point(x - rhs.x, y - rhs.y, z - rhs.z);
+		}
+
+		inline Point& Point::operator-=(const Vector &rhs)
+		{
+			x -= rhs.x;
+			y -= rhs.y;
+			z -= rhs.z;
+			return *this;
+		}
+
+		inline constexpr Point Point::operator*(float scalar) const
+		{
+			// Although it doesn't make sense mathematically to weight points 
+			// by a scalar, we still allow these operations for convenience
+			return Point(x * scalar, y * scalar, z * scalar);
+		}
+
+		inline Point& Point::operator*=(float scalar)
+		{
+			x *= scalar;
+			y *= scalar;
+			z *= scalar;
+			return *this;
+		}
+
+		inline constexpr Point Point::operator/(float scalar) const
+		{
+			return assert(scalar != 0.0f), *this * (1.0f / scalar);
+		}
+
+		inline Point& Point::operator/=(float scalar)
+		{
+			assert(scalar != 0.0f);
+			float inv = 1.0f / scalar;
+			x *= inv;
+			y *= inv;
+			z *= inv;
+			return *this;
+		}
+
+		inline constexpr float Point::operator[](int i) const
+		{
+			return assert(i >= 0 && i <= 2), (i == 0 ? x : (i == 1 ? y : z));
+		}
+
+		inline float& Point::operator[](int i)
+		{
+			assert(i >= 0 && i <= 2);
+			return (&x)[i];
+		}
+
+		inline constexpr bool Point::operator==(const Point &rhs) const
+		{
+			return x == rhs.x && y == rhs.y && z == rhs.z;
+		}
+
+		inline constexpr bool Point::operator!=(const Point &rhs) const
+		{
+			return x != rhs.x || y != rhs.y || z != rhs.z;
+		}
+
+		inline bool Point::hasNaNs() const
+		{
+			return std::isnan(x) || std::isnan(y) || std::isnan(z);
+		}
+
+		// ---------------------------------------------------------------
+		// Normal class
+		// ---------------------------------------------------------------
+		inline constexpr Normal::Normal() :
+			x(0.0f), y(0.0f), z(0.0f)
+		{
+		}
+
+		inline constexpr Normal::Normal(float aX, float aY, float aZ) :
+			x(detail::checkNaN(aX)), y(detail::checkNaN(aY)), z(detail::checkNaN(aZ))
+		{
+		}
+
+		inline constexpr Normal::Normal(const Vector &rhs) :
+			x(rhs.x), y(rhs.y), z(rhs.z)
+		{
+			// Explicit
+			// This means we can't accidently do things like: Normal n = v
+			// Instead, we'd have to explicitly write: Normal n = Normal(v)
+		}
+
+		inline constexpr Normal Normal::operator+(const Normal &rhs) const
+		{
+			return Normal(x + rhs.x, y + rhs.y, z + rhs.z);
+		}
+
+		inline Normal& Normal::operator+=(const Normal &rhs)
+		{
+			x += rhs.x;
+			y += rhs.y;
+			z += rhs.z;
+			return *this;
+		}
+
+		inline constexpr Normal Normal::operator-(const Normal &rhs) const
+		{
+			return Normal(x - rhs.x, y - rhs.y, z - rhs.z);
+		}
+
+		inline Normal& Normal::operator-=(const Normal &rhs)
+		{
+			x -= rhs.x;
+			y -= rhs.y;
+			z -= rhs.z;
+			return *this;
+		}
+
+		inline constexpr Normal Normal::operator*(float scalar) const
+		{
+			return Normal(x * scalar, y * scalar, z * scalar);
+		}
+
+		inline Normal& Normal::operator*=(float scalar)
+		{
+			x *= scalar;
+			y *= scalar;
+			z *= scalar;
+			return *this;
+		}
+
+		inline constexpr Normal Normal::operator/(float scalar) const
+		{
+			return assert(scalar != 0.0f), *this * (1.0f / scalar);
+		}
+
+		inline Normal& Normal::operator/=(float scalar)
+		{
+			assert(scalar != 0.0f);
+			float inv = 1.0f / scalar;
+			x *= inv;
+			y *= inv;
+			z *= inv;
+			return *this;
+		}
+
+		inline constexpr Normal Normal::operator-() const
+		{
+			return Normal(-x, -y, -z);
+		}
+
+		inline constexpr float Normal::operator[](int i) const
+		{
+			return assert(i >= 0 && i <= 2), (i == 0 ? x : (i == 1 ? y : z));
+		}
+
+		inline float& Normal::operator[](int i)
+		{
+			assert(i >= 0 && i <= 2);
+			return (&x)[i];
+		}
+
+		inline constexpr bool Normal::operator==(const Normal &rhs) const
+		{
+			return x == rhs.x && y == rhs.y && z == rhs.z;
+		}
+
+		inline constexpr bool Normal::operator!=(const Normal &rhs) const
+		{
+			return x != rhs.x || y != rhs.y || z != rhs.z;
+		}
+
+		inline constexpr float Normal::lengthSquared() const
+		{
+			return x * x + y * y + z * z;
+		}
+
+		inline float Normal::length() const
+		{
+			return sqrtf(lengthSquared());
+		}
+
+		inline bool Normal::hasNaNs() const
+		{
+			return std::isnan(x) || std::isnan(y) || std::isnan(z);
+		}
+
 		class Ray
 		{
 		public:
@@ -191,7 +568,6 @@ namespace namaste {
 			BBox();
 			BBox(const Point &aPoint);
 			BBox(const Point &aPoint1, const Point &aPoint2);
-			~BBox();
 
 			const Point& operator[](int i) const;
 			Point& operator[](int i);
@@ -208,6 +584,7 @@ namespace namaste {
 			Point lerp(float aTx, float aTy, float aTz) const;
 			Vector offset(const Point &aPoint) const;
 			void boundingSphere(Point *center, float *radius) const;
+			bool intersectP(const Ray &aRay, float *hitt0 = nullptr, float *hitt1 = nullptr) const;
 
 			friend BBox calcUnion(const BBox &aBBox, const Point &aPoint);
 			friend BBox calcUnion(const BBox &aBBox1, const BBox &aBBox2);
@@ -219,36 +596,59 @@ namespace namaste {
 		private:
 		};
 
+		// Inline, since slab tests index the corners in traversal inner loops
+		inline const Point& BBox::operator[](int i) const
+		{
+			assert(i == 0 || i == 1);
+			return i == 0 ? pMin : pMax;
+		}
+
+		inline Point& BBox::operator[](int i)
+		{
+			assert(i == 0 || i == 1);
+			return i == 0 ? pMin : pMax;
+		}
+
+		// Slab distances are computed with three roundings, so a far distance scaled
+		// by 1 + 2 * gamma(3) can't fall short of the exact one (pbrt-v3, 3.9.2).
+		// Without it, a ray through a box's edge or corner - or through a mesh
+		// vertex, which lies on the box of every triangle sharing it - can miss
+		// boxes it exactly touches, and then the triangles inside them too
+		static const float slabFarScale = 1.0f + 2.0f * (3.0f * 5.96046448e-8f) / (1.0f - 3.0f * 5.96046448e-8f);
+
+		// Boxes are written to scene caches and BVH files as raw bytes
+		static_assert(std::is_trivially_copyable<BBox>::value, "BBox should be trivially copyable");
+
 		// Geometry inline functions
-		inline Vector operator*(float scalar, const Vector &v) { return v * scalar; }
-		inline Point operator*(float scalar, const Point &p) { return p * scalar; }
-		inline Normal operator*(float scalar, const Normal &n) { return n * scalar; }
+		inline constexpr Vector operator*(float scalar, const Vector &v) { return v * scalar; }
+		inline constexpr Point operator*(float scalar, const Point &p) { return p * scalar; }
+		inline constexpr Normal operator*(float scalar, const Normal &n) { return n * scalar; }
 
-		inline float dot(const Vector &lhs, const Vector &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // V V
-		inline float dot(const Vector &lhs, const Normal &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // V N
-		inline float dot(const Normal &lhs, const Vector &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // N V
-		inline float dot(const Normal &lhs, const Normal &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // N N
+		inline constexpr float dot(const Vector &lhs, const Vector &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // V V
+		inline constexpr float dot(const Vector &lhs, const Normal &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // V N
+		inline constexpr float dot(const Normal &lhs, const Vector &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // N V
+		inline constexpr float dot(const Normal &lhs, const Normal &rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; } // N N
 
 		inline float absDot(const Vector &lhs, const Vector &rhs) { return fabsf(dot(lhs, rhs)); } // V V
 		inline float absDot(const Vector &lhs, const Normal &rhs) { return fabsf(dot(lhs, rhs)); } // V N
 		inline float absDot(const Normal &lhs, const Vector &rhs) { return fabsf(dot(lhs, rhs)); } // N V
 		inline float absDot(const Normal &lhs, const Normal &rhs) { return fabsf(dot(lhs, rhs)); } // N N
 
-		inline Vector cross(const Vector &lhs, const Vector &rhs)	// V V
+		inline constexpr Vector cross(const Vector &lhs, const Vector &rhs)	// V V
 		{
 			return Vector((lhs.y * rhs.z) - (lhs.z * rhs.y),
 				(lhs.z * rhs.x) - (lhs.x * rhs.z),
 				(lhs.x * rhs.y) - (lhs.y * rhs.x));
 		}
 
-		inline Vector cross(const Vector &lhs, const Normal &rhs)	// V N
+		inline constexpr Vector cross(const Vector &lhs, const Normal &rhs)	// V N
 		{
 			return Vector((lhs.y * rhs.z) - (lhs.z * rhs.y),
 				(lhs.z * rhs.x) - (lhs.x * rhs.z),
 				(lhs.x * rhs.y) - (lhs.y * rhs.x));
 		}
 
-		inline Vector cross(const Normal &lhs, const Vector &rhs)	// N V
+		inline constexpr Vector cross(const Normal &lhs, const Vector &rhs)	// N V
 		{
 			return Vector((lhs.y * rhs.z) - (lhs.z * rhs.y),
 				(lhs.z * rhs.x) - (lhs.x * rhs.z),
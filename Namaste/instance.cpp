@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include "instance.h"
+
+namespace namaste {
+
+	namespace shape {
+
+		using namespace geom;
+
+		namespace {
+
+			std::vector<BBox> instanceBounds(const std::vector<MeshInstance> &aInstances)
+			{
+				std::vector<BBox> bounds;
+				bounds.reserve(aInstances.size());
+				for (auto it = aInstances.cbegin(); it < aInstances.cend(); ++it)
+				{
+					bounds.push_back(it->worldBound);
+				}
+				return bounds;
+			}
+
+		} // anonymous namespace
+
+		// ---------------------------------------------------------------
+		// Mesh prototype class
+		// ---------------------------------------------------------------
+		MeshPrototype::MeshPrototype(const scene::GeometryView &aGeometry, parallel::ThreadPool *aPool) :
+			mesh(aGeometry), bvh(mesh.triangleBounds(), 4, aPool)
+		{
+		}
+
+		MeshPrototype::~MeshPrototype()
+		{
+		}
+
+		BBox MeshPrototype::objectBound() const
+		{
+			return bvh.worldBound();
+		}
+
+		size_t MeshPrototype::memoryBytes() const
+		{
+			return static_cast<size_t>(mesh.bytesPerTriangle() * mesh.triangleCount()) +
+				bvh.nodes.size() * sizeof(accel::LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t);
+		}
+
+		// ---------------------------------------------------------------
+		// Mesh instance class
+		// ---------------------------------------------------------------
+		MeshInstance::MeshInstance(const MeshPrototype &aPrototype, const Transform &aObjectToWorld) :
+			objectToWorld(aObjectToWorld, 0.0f, aObjectToWorld, 1.0f), worldBound(aObjectToWorld(aPrototype.objectBound())),
+			prototype(&aPrototype)
+		{
+		}
+
+		MeshInstance::MeshInstance(const MeshPrototype &aPrototype, const AnimatedTransform &aObjectToWorld) :
+			objectToWorld(aObjectToWorld), worldBound(aObjectToWorld.motionBounds(aPrototype.objectBound())),
+			prototype(&aPrototype)
+		{
+		}
+
+		Transform MeshInstance::objectToWorldAt(float time) const
+		{
+			Transform t;
+			objectToWorld.interpolate(time, &t);
+			return t;
+		}
+
+		Ray MeshInstance::worldToObject(const Ray &aRay) const
+		{
+			return inverse(objectToWorldAt(aRay.time))(aRay);
+		}
+
+		// ---------------------------------------------------------------
+		// Instanced scene class
+		// ---------------------------------------------------------------
+		InstancedScene::InstancedScene(const std::vector<MeshInstance> &aInstances, parallel::ThreadPool *aPool) :
+			instances(aInstances), topLevel(instanceBounds(aInstances), 1, aPool)
+		{
+		}
+
+		InstancedScene::~InstancedScene()
+		{
+		}
+
+		BBox InstancedScene::worldBound() const
+		{
+			return topLevel.worldBound();
+		}
+
+		size_t InstancedScene::triangleCount() const
+		{
+			size_t count = 0;
+			for (auto it = instances.cbegin(); it < instances.cend(); ++it)
+			{
+				count += it->prototype->mesh.triangleCount();
+			}
+			return count;
+		}
+
+		size_t InstancedScene::memoryBytes() const
+		{
+			return instances.size() * sizeof(MeshInstance) +
+				topLevel.nodes.size() * sizeof(accel::LinearBVHNode) + topLevel.primitiveIndices.size() * sizeof(uint32_t);
+		}
+
+		bool InstancedScene::intersect(const Ray &aRay, InstanceHit *hit) const
+		{
+			return topLevel.intersect(aRay, [&](uint32_t aInstance, const Ray &ray)
+			{
+				const MeshInstance &instance = instances[aInstance];
+				const MeshPrototype &prototype = *instance.prototype;
+				Ray objectRay = instance.worldToObject(ray);
+				TriangleHit objectHit;
+				if (!prototype.mesh.intersect(prototype.bvh, objectRay, &objectHit))
+				{
+					return false;
+				}
+				ray.maxT = objectRay.maxT;
+				hit->instance = aInstance;
+				hit->time = ray.time;
+				hit->hit = objectHit;
+				return true;
+			});
+		}
+
+		bool InstancedScene::intersectP(const Ray &aRay) const
+		{
+			return topLevel.intersectP(aRay, [&](const uint32_t *aInstances, int aCount, const Ray &ray)
+			{
+				for (int i = 0; i < aCount; ++i)
+				{
+					const MeshInstance &instance = instances[aInstances[i]];
+					Ray objectRay = instance.worldToObject(ray);
+					if (instance.prototype->mesh.intersectP(instance.prototype->bvh, objectRay))
+					{
+						return true;
+					}
+				}
+				return false;
+			});
+		}
+
+		Point InstancedScene::hitPoint(const InstanceHit &aHit) const
+		{
+			const MeshInstance &instance = instances[aHit.instance];
+			return instance.objectToWorldAt(aHit.time)(instance.prototype->mesh.hitPoint(aHit.hit));
+		}
+
+		Normal InstancedScene::geometricNormal(const InstanceHit &aHit) const
+		{
+			const MeshInstance &instance = instances[aHit.instance];
+			Normal n = instance.objectToWorldAt(aHit.time)(instance.prototype->mesh.geometricNormal(aHit.hit.triangle));
+			return normalize(n);
+		}
+
+	} // namespace shape
+
+} // namespace namaste
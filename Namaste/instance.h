@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "geometry.h"
+#include "transform.h"
+#include "scene.h"
+#include "bvh.h"
+#include "parallel.h"
+#include "trianglemesh.h"
+
+namespace namaste {
+
+	namespace shape {
+
+		// A shared asset: a mesh and its BVH, both in the asset's own object space.
+		// Built once however many times it's instanced. Like TriangleMesh, it only
+		// refers to the geometry buffers, which must outlive it
+		class MeshPrototype
+		{
+		public:
+			explicit MeshPrototype(const scene::GeometryView &aGeometry, parallel::ThreadPool *aPool = nullptr);
+			~MeshPrototype();
+
+			MeshPrototype(const MeshPrototype &) = delete;
+			MeshPrototype& operator=(const MeshPrototype &) = delete;
+
+			geom::BBox objectBound() const;
+			// Bytes of geometry and BVH
+			size_t memoryBytes() const;
+
+			const TriangleMesh mesh;
+			const accel::BVHAccel bvh;
+		};
+
+		// One placement of a prototype: just its transform, its world bounds and
+		// a pointer to the shared prototype. A moving instance's world bounds
+		// cover its whole motion, so the top-level BVH needs no per-time update
+		struct MeshInstance
+		{
+			MeshInstance(const MeshPrototype &aPrototype, const geom::Transform &aObjectToWorld);
+			MeshInstance(const MeshPrototype &aPrototype, const geom::AnimatedTransform &aObjectToWorld);
+
+			// The transforms at the ray's time
+			geom::Transform objectToWorldAt(float time) const;
+			geom::Ray worldToObject(const geom::Ray &aRay) const;
+
+			geom::AnimatedTransform objectToWorld;
+			geom::BBox worldBound;
+			const MeshPrototype *prototype;
+		};
+
+		struct InstanceHit
+		{
+			uint32_t instance;
+			float time;				// Of the ray, where the instance was hit
+			TriangleHit hit;		// In the prototype's mesh
+		};
+
+		// Two-level acceleration over instances of shared prototypes. The top-level
+		// BVH is built over the instances' world bounds; a ray reaching an instance
+		// is taken to object space through the inverse transform at the ray's time
+		// and traced through the prototype's BVH. Transforms are affine, so t is the same in both
+		// spaces and maxT carries over from one instance to the next. Memory grows
+		// with the number of instances rather than with the number of triangles
+		// they place
+		class InstancedScene
+		{
+		public:
+			explicit InstancedScene(const std::vector<MeshInstance> &aInstances, parallel::ThreadPool *aPool = nullptr);
+			~InstancedScene();
+
+			geom::BBox worldBound() const;
+			// Triangles the instances place in the world, as if flattened
+			size_t triangleCount() const;
+			// Bytes of the instances and the top-level BVH, not counting prototypes
+			size_t memoryBytes() const;
+
+			bool intersect(const geom::Ray &aRay, InstanceHit *hit) const;
+			bool intersectP(const geom::Ray &aRay) const;
+
+			// Hit geometry in world space
+			geom::Point hitPoint(const InstanceHit &aHit) const;
+			geom::Normal geometricNormal(const InstanceHit &aHit) const;
+
+			std::vector<MeshInstance> instances;
+			accel::BVHAccel topLevel;
+		};
+
+	} // namespace shape
+
+} // namespace namaste
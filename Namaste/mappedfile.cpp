@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include "mappedfile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace namaste {
+
+	// ---------------------------------------------------------------
+	// Mapped file class
+	// ---------------------------------------------------------------
+	MappedFile::MappedFile() :
+		mappedData(nullptr), mappedSize(0), opened(false)
+#if defined(_WIN32)
+		, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr)
+#endif
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::string &filename)
+	{
+		close();
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		fileHandle = file;
+		mappedSize = static_cast<size_t>(size.QuadPart);
+		opened = true;
+		if (mappedSize == 0)
+		{
+			// Empty files can't be mapped, but are perfectly valid
+			return true;
+		}
+
+		mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mappingHandle)
+		{
+			mappedData = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+		}
+#else
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		mappedSize = static_cast<size_t>(st.st_size);
+		opened = true;
+		if (mappedSize == 0)
+		{
+			::close(fd);
+			return true;
+		}
+
+		void *p = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		// The mapping keeps its own reference to the file
+		::close(fd);
+		if (p != MAP_FAILED)
+		{
+			// We read front to back, so let the kernel read ahead aggressively
+			madvise(p, mappedSize, MADV_SEQUENTIAL);
+			mappedData = static_cast<const char*>(p);
+		}
+#endif
+		if (!mappedData)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#if defined(_WIN32)
+		if (mappedData)
+		{
+			UnmapViewOfFile(mappedData);
+		}
+		if (mappingHandle)
+		{
+			CloseHandle(mappingHandle);
+		}
+		if (fileHandle != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(fileHandle);
+		}
+		mappingHandle = nullptr;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (mappedData)
+		{
+			munmap(const_cast<char*>(mappedData), mappedSize);
+		}
+#endif
+		mappedData = nullptr;
+		mappedSize = 0;
+		opened = false;
+	}
+
+	bool MappedFile::isOpen() const
+	{
+		return opened;
+	}
+
+	const char* MappedFile::data() const
+	{
+		return mappedData;
+	}
+
+	size_t MappedFile::size() const
+	{
+		return mappedSize;
+	}
+
+} // namespace namaste
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace namaste {
+
+	// A read-only memory mapping of a whole file. The contents are paged in by
+	// the OS on demand, so even multi-gigabyte files can be "opened" instantly
+	// and read without being copied into our own buffers
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile& operator=(const MappedFile &) = delete;
+
+		bool open(const std::string &filename);
+		void close();
+
+		bool isOpen() const;
+		const char* data() const;
+		size_t size() const;
+	private:
+		const char *mappedData;
+		size_t mappedSize;
+		bool opened;
+#if defined(_WIN32)
+		void *fileHandle;
+		void *mappingHandle;
+#endif
+	};
+
+} // namespace namaste
@@ -0,0 +1,239 @@
+#include "stdafx.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+namespace namaste {
+
+	namespace parallel {
+
+		int resolveThreadCount(int aNumThreads)
+		{
+			if (aNumThreads > 0)
+			{
+				return aNumThreads;
+			}
+			// hardware_concurrency() is allowed to return 0 if it can't tell
+			return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		}
+
+		namespace {
+
+			// Identifies the pool (if any) that the calling thread is a worker of
+			thread_local const ThreadPool *currentPool = nullptr;
+			thread_local int currentIndex = 0;
+
+		} // anonymous namespace
+
+		// ---------------------------------------------------------------
+		// Thread pool class
+		// ---------------------------------------------------------------
+		ThreadPool::ThreadPool(int aNumThreads) :
+			owner(std::this_thread::get_id()), queuedTasks(0), stop(false)
+		{
+			int nThreads = resolveThreadCount(aNumThreads);
+			for (int i = 0; i < nThreads; ++i)
+			{
+				queues.emplace_back(new WorkQueue);
+			}
+			for (int i = 1; i < nThreads; ++i)
+			{
+				workers.emplace_back(&ThreadPool::workerLoop, this, i);
+			}
+		}
+
+		ThreadPool::~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stop = true;
+			}
+			condition.notify_all();
+			for (auto &worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		int ThreadPool::numThreads() const
+		{
+			return static_cast<int>(queues.size());
+		}
+
+		int ThreadPool::currentThreadIndex() const
+		{
+			if (currentPool == this)
+			{
+				return currentIndex;
+			}
+			assert(std::this_thread::get_id() == owner);
+			return 0;
+		}
+
+		void ThreadPool::submit(std::function<void()> aTask)
+		{
+			WorkQueue &queue = *queues[currentThreadIndex()];
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.tasks.push_back(std::move(aTask));
+			}
+			queuedTasks.fetch_add(1);
+
+			// Take the sleep lock so the notification can't slip in between a
+			// worker checking queuedTasks and going to sleep
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+			condition.notify_one();
+		}
+
+		bool ThreadPool::findTask(int aThreadIndex, std::function<void()> *task)
+		{
+			// Newest task from our own deque first...
+			{
+				WorkQueue &own = *queues[aThreadIndex];
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (!own.tasks.empty())
+				{
+					*task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					queuedTasks.fetch_sub(1);
+					return true;
+				}
+			}
+
+			// ...then the oldest task of every other thread in turn. Old tasks tend
+			// to be the largest (e.g. the top of a recursive split), so a steal
+			// moves as much work as possible per synchronization
+			int n = numThreads();
+			for (int i = 1; i < n; ++i)
+			{
+				WorkQueue &victim = *queues[(aThreadIndex + i) % n];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty())
+				{
+					*task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					queuedTasks.fetch_sub(1);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool ThreadPool::runPendingTask()
+		{
+			std::function<void()> task;
+			if (!findTask(currentThreadIndex(), &task))
+			{
+				return false;
+			}
+			task();
+			return true;
+		}
+
+		void ThreadPool::workerLoop(int aThreadIndex)
+		{
+			currentPool = this;
+			currentIndex = aThreadIndex;
+
+			std::function<void()> task;
+			while (true)
+			{
+				if (findTask(aThreadIndex, &task))
+				{
+					task();
+					task = nullptr;
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				condition.wait(lock, [this] { return stop || queuedTasks.load() > 0; });
+				if (stop)
+				{
+					return;
+				}
+			}
+		}
+
+		// ---------------------------------------------------------------
+		// Task group class
+		// ---------------------------------------------------------------
+		TaskGroup::TaskGroup(ThreadPool &aPool) :
+			pool(aPool), pending(0)
+		{
+		}
+
+		TaskGroup::~TaskGroup()
+		{
+			wait();
+		}
+
+		void TaskGroup::run(std::function<void()> aTask)
+		{
+			pending.fetch_add(1);
+			pool.submit([this, task = std::move(aTask)]()
+			{
+				task();
+				pending.fetch_sub(1);
+			});
+		}
+
+		void TaskGroup::wait()
+		{
+			while (pending.load() > 0)
+			{
+				if (!pool.runPendingTask())
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		void parallelFor(ThreadPool &aPool, size_t aCount, size_t aChunkSize, const std::function<void(size_t, size_t)> &func)
+		{
+			aChunkSize = std::max<size_t>(aChunkSize, 1);
+			if (aCount <= aChunkSize || aPool.numThreads() == 1)
+			{
+				func(0, aCount);
+				return;
+			}
+
+			TaskGroup group(aPool);
+			for (size_t begin = aChunkSize; begin < aCount; begin += aChunkSize)
+			{
+				size_t end = std::min(begin + aChunkSize, aCount);
+				group.run([&func, begin, end]() { func(begin, end); });
+			}
+			// The calling thread takes the first chunk itself
+			func(0, aChunkSize);
+			group.wait();
+		}
+
+		// ---------------------------------------------------------------
+		// Global pool
+		// ---------------------------------------------------------------
+		namespace {
+			std::unique_ptr<ThreadPool> globalPool;
+		}
+
+		void parallelInit(int aNumThreads)
+		{
+			globalPool.reset(new ThreadPool(aNumThreads));
+		}
+
+		void parallelCleanup()
+		{
+			globalPool.reset();
+		}
+
+		ThreadPool* globalThreadPool()
+		{
+			return globalPool.get();
+		}
+
+	} // namespace parallel
+
+} // namespace namaste
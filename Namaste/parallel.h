@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace namaste {
+
+	namespace parallel {
+
+		// Returns the number of threads to use for a requested count, where 0
+		// means one per hardware thread
+		int resolveThreadCount(int aNumThreads);
+
+		// A fixed-size, work-stealing pool of threads. A pool created for n threads
+		// spawns n - 1 workers: the thread that waits on a TaskGroup executes
+		// tasks too, so it makes up the n-th. Every thread owns a deque of tasks:
+		// it pushes and pops its own work at the back (LIFO, which keeps nested
+		// work cache-hot) and, once it runs dry, steals the oldest task from the
+		// front of another thread's deque. Besides the workers, only the thread
+		// that created the pool may submit or wait on tasks: it shares slot 0
+		// with nobody, which is what keeps per-thread state race-free
+		class ThreadPool
+		{
+		public:
+			explicit ThreadPool(int aNumThreads = 0);
+			~ThreadPool();
+
+			ThreadPool(const ThreadPool &) = delete;
+			ThreadPool& operator=(const ThreadPool &) = delete;
+
+			int numThreads() const;
+
+			// Index of the calling thread within this pool, in [0, numThreads()):
+			// workers are 1..n-1 and the thread that owns the pool is 0. Useful for
+			// indexing per-thread state without locking. Asserts if called from
+			// any other thread, which would otherwise share slot 0 with the owner
+			int currentThreadIndex() const;
+
+			void submit(std::function<void()> aTask);
+
+			// Runs one task on the calling thread, stealing one if necessary
+			bool runPendingTask();
+		private:
+			struct WorkQueue
+			{
+				std::mutex mutex;
+				std::deque<std::function<void()>> tasks;
+			};
+
+			bool findTask(int aThreadIndex, std::function<void()> *task);
+			void workerLoop(int aThreadIndex);
+
+			std::vector<std::unique_ptr<WorkQueue>> queues;
+			std::vector<std::thread> workers;
+			std::thread::id owner;
+
+			// Workers only sleep when there's nothing left to steal anywhere
+			std::atomic<int> queuedTasks;
+			std::mutex sleepMutex;
+			std::condition_variable condition;
+			bool stop;
+		};
+
+		// A set of tasks that can be waited on as a whole. Waiting doesn't block:
+		// the waiting thread keeps executing tasks until the group is done, so
+		// tasks may safely spawn and wait on nested groups
+		class TaskGroup
+		{
+		public:
+			explicit TaskGroup(ThreadPool &aPool);
+			~TaskGroup();
+
+			void run(std::function<void()> aTask);
+			void wait();
+		private:
+			ThreadPool &pool;
+			std::atomic<int> pending;
+		};
+
+		// Calls func(begin, end) over [0, count) split into chunks of chunkSize
+		// elements, and returns once every chunk is done
+		void parallelFor(ThreadPool &aPool, size_t aCount, size_t aChunkSize, const std::function<void(size_t, size_t)> &func);
+
+		// The process-wide pool, sized from Options::nCores by parallelInit
+		void parallelInit(int aNumThreads);
+		void parallelCleanup();
+		ThreadPool* globalThreadPool();
+
+	} // namespace parallel
+
+} // namespace namaste
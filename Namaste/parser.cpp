@@ -0,0 +1,988 @@
+#include "stdafx.h"
+#include "parser.h"
+#include "mappedfile.h"
+#include "stats.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <iostream>
+#include <sstream>
+#include <memory>
+
+namespace namaste {
+
+	namespace scene {
+
+		using namespace geom;
+
+		namespace {
+
+			inline bool isDelimiter(char c)
+			{
+				return c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+					c == '[' || c == ']' || c == '"' || c == '#';
+			}
+
+			inline bool isDigit(char c)
+			{
+				return static_cast<unsigned>(c - '0') < 10;
+			}
+
+			// Powers of ten that are exactly representable as doubles
+			const double exactPowersOf10[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+
+			// Calls onValue for the single value or every value of the bracketed
+			// list that follows a parameter declaration. Returns false if a value
+			// was rejected or the list was cut short, after skipping to its end so
+			// parsing can carry on with the next parameter
+			template <typename ValueFunc>
+			bool readParameterValues(Tokenizer &tokenizer, ValueFunc onValue)
+			{
+				Token token;
+				if (!tokenizer.next(&token))
+				{
+					return false;
+				}
+				if (token != "[")
+				{
+					return onValue(token);
+				}
+
+				bool ok = true;
+				while (tokenizer.next(&token))
+				{
+					if (token == "]")
+					{
+						return ok;
+					}
+					if (ok)
+					{
+						ok = onValue(token);
+					}
+				}
+				return false;
+			}
+
+			std::string directoryOf(const std::string &filename)
+			{
+				size_t slash = filename.find_last_of("/\\");
+				return slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+			}
+
+			bool isAbsolutePath(const std::string &filename)
+			{
+				return !filename.empty() && (filename[0] == '/' || filename[0] == '\\' ||
+					(filename.size() > 1 && filename[1] == ':'));
+			}
+
+		} // namespace
+
+		// ---------------------------------------------------------------
+		// Token struct
+		// ---------------------------------------------------------------
+		bool Token::operator==(const char *aString) const
+		{
+			size_t n = strlen(aString);
+			return n == length && memcmp(data, aString, n) == 0;
+		}
+
+		// ---------------------------------------------------------------
+		// Tokenizer class
+		// ---------------------------------------------------------------
+		Tokenizer::Tokenizer(const char *aBegin, const char *aEnd) :
+			line(1), bytesRead(static_cast<uint64_t>(aEnd - aBegin)), pos(aBegin), end(aEnd), file(nullptr), pushedBack(false)
+		{
+		}
+
+		Tokenizer::Tokenizer(FILE *aFile, size_t aChunkSize) :
+			line(1), bytesRead(0), pos(nullptr), end(nullptr), file(aFile), buffer(aChunkSize < 64 ? 64 : aChunkSize), pushedBack(false)
+		{
+		}
+
+		Tokenizer::~Tokenizer()
+		{
+		}
+
+		bool Tokenizer::refill(const char **keep)
+		{
+			if (!file)
+			{
+				return false;
+			}
+
+			// Move the partial token (if any) to the front, and only grow the
+			// buffer if a single token fills all of it
+			size_t kept = 0;
+			if (keep)
+			{
+				kept = end - *keep;
+				memmove(buffer.data(), *keep, kept);
+			}
+			if (kept == buffer.size())
+			{
+				buffer.resize(buffer.size() * 2);
+			}
+
+			size_t n = fread(buffer.data() + kept, 1, buffer.size() - kept, file);
+			bytesRead += n;
+			if (keep)
+			{
+				*keep = buffer.data();
+			}
+			pos = buffer.data() + kept;
+			end = pos + n;
+			return n > 0;
+		}
+
+		bool Tokenizer::next(Token *token)
+		{
+			if (pushedBack)
+			{
+				pushedBack = false;
+				*token = lastToken;
+				return true;
+			}
+
+			// Skip whitespace and comments
+			for (;;)
+			{
+				if (pos == end)
+				{
+					if (!refill(nullptr))
+					{
+						return false;
+					}
+					continue;
+				}
+
+				char c = *pos;
+				if (c == '\n')
+				{
+					++line;
+					++pos;
+				}
+				else if (c == ' ' || c == '\t' || c == '\r')
+				{
+					++pos;
+				}
+				else if (c == '#')
+				{
+					// The newline itself is left for the loop above to count
+					for (;;)
+					{
+						const char *newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+						if (newline)
+						{
+							pos = newline;
+							break;
+						}
+						pos = end;
+						if (!refill(nullptr))
+						{
+							return false;
+						}
+					}
+				}
+				else
+				{
+					break;
+				}
+			}
+
+			const char *start = pos;
+			if (*start == '[' || *start == ']')
+			{
+				token->data = start;
+				token->length = 1;
+				token->isString = false;
+				++pos;
+				lastToken = *token;
+				return true;
+			}
+
+			// Scan to the end of the token, refilling if it runs off the end of the
+			// buffer (which moves it, hence working with an offset from its start)
+			bool quoted = *start == '"';
+			size_t length = quoted ? 1 : 0;
+			for (;;)
+			{
+				const char *p = start + length;
+				if (quoted)
+				{
+					while (p < end && *p != '"')
+					{
+						line += *p == '\n';
+						++p;
+					}
+				}
+				else
+				{
+					while (p < end && !isDelimiter(*p))
+					{
+						++p;
+					}
+				}
+				length = p - start;
+				if (p < end || !refill(&start))
+				{
+					break;
+				}
+			}
+
+			if (quoted)
+			{
+				token->data = start + 1;
+				token->length = length - 1;
+				token->isString = true;
+				// Skip the closing quote, unless the string was cut off by the end of the input
+				pos = start + length < end ? start + length + 1 : end;
+			}
+			else
+			{
+				token->data = start;
+				token->length = length;
+				token->isString = false;
+				pos = start + length;
+			}
+			lastToken = *token;
+			return true;
+		}
+
+		void Tokenizer::unget()
+		{
+			pushedBack = true;
+		}
+
+		// ---------------------------------------------------------------
+		// Number parsing
+		// ---------------------------------------------------------------
+		bool parseFloat(const char *begin, const char *end, float *value)
+		{
+			const char *p = begin;
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negative = *p == '-';
+				++p;
+			}
+
+			// Accumulate up to 19 significant digits, which always fit in 64 bits
+			uint64_t mantissa = 0;
+			int significantDigits = 0;
+			int exponent = 0;
+			bool anyDigits = false, truncated = false;
+			for (; p < end && isDigit(*p); ++p)
+			{
+				anyDigits = true;
+				if (significantDigits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					significantDigits += mantissa != 0;
+				}
+				else
+				{
+					truncated |= *p != '0';
+					++exponent;
+				}
+			}
+			if (p < end && *p == '.')
+			{
+				for (++p; p < end && isDigit(*p); ++p)
+				{
+					anyDigits = true;
+					if (significantDigits < 19)
+					{
+						mantissa = mantissa * 10 + (*p - '0');
+						significantDigits += mantissa != 0;
+						--exponent;
+					}
+					else
+					{
+						truncated |= *p != '0';
+					}
+				}
+			}
+			if (!anyDigits)
+			{
+				return false;
+			}
+			if (p < end && (*p == 'e' || *p == 'E'))
+			{
+				++p;
+				bool negativeExponent = false;
+				if (p < end && (*p == '-' || *p == '+'))
+				{
+					negativeExponent = *p == '-';
+					++p;
+				}
+				if (p == end || !isDigit(*p))
+				{
+					return false;
+				}
+				int e = 0;
+				for (; p < end && isDigit(*p); ++p)
+				{
+					// Saturate rather than overflow; anything this big is inf or 0 anyway
+					e = e < 100000 ? e * 10 + (*p - '0') : e;
+				}
+				exponent += negativeExponent ? -e : e;
+			}
+			if (p != end)
+			{
+				return false;
+			}
+
+			// Fast path: both the mantissa and the power of ten are exact doubles,
+			// so a single multiply or divide gives the correctly rounded double
+			if (!truncated && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+			{
+				double d = static_cast<double>(mantissa);
+				d = exponent < 0 ? d / exactPowersOf10[-exponent] : d * exactPowersOf10[exponent];
+				*value = static_cast<float>(negative ? -d : d);
+				return true;
+			}
+
+			// Rare: copy to a terminated buffer and let the C library handle it
+			char local[64];
+			std::string heap;
+			const char *s = local;
+			size_t n = end - begin;
+			if (n < sizeof(local))
+			{
+				memcpy(local, begin, n);
+				local[n] = '\0';
+			}
+			else
+			{
+				heap.assign(begin, end);
+				s = heap.c_str();
+			}
+			*value = static_cast<float>(strtod(s, nullptr));
+			return true;
+		}
+
+		bool parseInt(const char *begin, const char *end, int *value)
+		{
+			const char *p = begin;
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negative = *p == '-';
+				++p;
+			}
+			if (p == end)
+			{
+				return false;
+			}
+
+			int64_t v = 0;
+			for (; p < end; ++p)
+			{
+				if (!isDigit(*p))
+				{
+					return false;
+				}
+				v = v * 10 + (*p - '0');
+				if (v > static_cast<int64_t>(INT_MAX) + 1)
+				{
+					return false;
+				}
+			}
+			v = negative ? -v : v;
+			if (v > INT_MAX)
+			{
+				return false;
+			}
+			*value = static_cast<int>(v);
+			return true;
+		}
+
+		// ---------------------------------------------------------------
+		// Scene parser class
+		// ---------------------------------------------------------------
+		SceneParser::SceneParser(Scene &aScene, std::ostream &aLog) :
+			bytesParsed(0), parseSeconds(0.0), errorCount(0), logWarnings(true), scene(aScene), log(aLog), includeDepth(0)
+		{
+		}
+
+		SceneParser::~SceneParser()
+		{
+		}
+
+		bool SceneParser::parseFile(const std::string &filename)
+		{
+			MappedFile file;
+			if (!file.open(filename))
+			{
+				return false;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			sourceFiles.push_back(filename);
+			std::string previousFile = currentFile;
+			currentFile = filename;
+
+			Tokenizer tokenizer(file.data(), file.data() + file.size());
+			parse(tokenizer, directoryOf(filename));
+
+			currentFile = previousFile;
+			bytesParsed += tokenizer.bytesRead;
+			if (includeDepth == 0)
+			{
+				parseSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			return true;
+		}
+
+		bool SceneParser::parseStream(FILE *aFile)
+		{
+			stats::PhaseTimer timer(stats::PhaseParse);
+			auto start = std::chrono::steady_clock::now();
+			currentFile = "<stdin>";
+
+			Tokenizer tokenizer(aFile);
+			parse(tokenizer, std::string());
+
+			bytesParsed += tokenizer.bytesRead;
+			parseSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return !ferror(aFile);
+		}
+
+		void SceneParser::parseFiles(const std::vector<std::string> &filenames, parallel::ThreadPool &pool, std::vector<std::string> *failed)
+		{
+			stats::PhaseTimer timer(stats::PhaseParse);
+			auto start = std::chrono::steady_clock::now();
+
+			// Per-file results, each written by exactly one task
+			struct FileResult
+			{
+				Scene scene;
+				std::string log;
+				std::vector<std::string> sources;
+				bool opened;
+				uint64_t bytes;
+				int errors;
+			};
+			std::vector<std::unique_ptr<FileResult>> results(filenames.size());
+
+			parallel::TaskGroup group(pool);
+			bool fileWarnings = logWarnings;
+			for (size_t i = 0; i < filenames.size(); ++i)
+			{
+				group.run([&filenames, &results, i, fileWarnings]() {
+					std::unique_ptr<FileResult> result(new FileResult);
+					std::ostringstream fileLog;
+					SceneParser parser(result->scene, fileLog);
+					parser.logWarnings = fileWarnings;
+					result->opened = parser.parseFile(filenames[i]);
+					result->bytes = parser.bytesParsed;
+					result->errors = parser.errorCount;
+					result->sources = parser.sourceFiles;
+					result->log = fileLog.str();
+					results[i] = std::move(result);
+				});
+			}
+			group.wait();
+
+			// Merge in file order, releasing each file's buffers as soon as it's copied
+			for (size_t i = 0; i < filenames.size(); ++i)
+			{
+				FileResult &result = *results[i];
+				log << result.log;
+				if (!result.opened)
+				{
+					failed->push_back(filenames[i]);
+				}
+				scene.append(result.scene);
+				bytesParsed += result.bytes;
+				errorCount += result.errors;
+				sourceFiles.insert(sourceFiles.end(), result.sources.begin(), result.sources.end());
+				results[i].reset();
+			}
+
+			parseSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		void SceneParser::error(const Tokenizer &tokenizer, const std::string &message)
+		{
+			log << "Error: " << currentFile << "(" << tokenizer.line << "): " << message << std::endl;
+			++errorCount;
+		}
+
+		void SceneParser::warning(const Tokenizer &tokenizer, const std::string &message)
+		{
+			if (!logWarnings)
+			{
+				return;
+			}
+			log << "Warning: " << currentFile << "(" << tokenizer.line << "): " << message << std::endl;
+		}
+
+		void SceneParser::parse(Tokenizer &tokenizer, const std::string &directory)
+		{
+			Token token;
+			while (tokenizer.next(&token))
+			{
+				if (token.isString || token == "[" || token == "]")
+				{
+					error(tokenizer, "expected a directive, got \"" + token.str() + "\"");
+					skipParameters(tokenizer);
+					continue;
+				}
+
+				float v[16];
+				if (token == "Shape")
+				{
+					parseShape(tokenizer);
+				}
+				else if (token == "AttributeBegin" || token == "TransformBegin")
+				{
+					transformStack.push_back(ctm);
+				}
+				else if (token == "AttributeEnd" || token == "TransformEnd")
+				{
+					if (transformStack.empty())
+					{
+						error(tokenizer, "unmatched " + token.str());
+						continue;
+					}
+					ctm = transformStack.back();
+					transformStack.pop_back();
+				}
+				else if (token == "Translate")
+				{
+					if (readNumbers(tokenizer, token, v, 3))
+					{
+						ctm = ctm * translate(Vector(v[0], v[1], v[2]));
+					}
+				}
+				else if (token == "Scale")
+				{
+					if (readNumbers(tokenizer, token, v, 3))
+					{
+						ctm = ctm * scale(v[0], v[1], v[2]);
+					}
+				}
+				else if (token == "Rotate")
+				{
+					if (readNumbers(tokenizer, token, v, 4))
+					{
+						ctm = ctm * rotate(v[0], Vector(v[1], v[2], v[3]));
+					}
+				}
+				else if (token == "LookAt")
+				{
+					if (readNumbers(tokenizer, token, v, 9))
+					{
+						ctm = ctm * lookAt(Point(v[0], v[1], v[2]), Point(v[3], v[4], v[5]), Vector(v[6], v[7], v[8]));
+					}
+				}
+				else if (token == "Transform" || token == "ConcatTransform")
+				{
+					bool concatenate = token == "ConcatTransform";
+					if (readNumbers(tokenizer, token, v, 16))
+					{
+						// Matrices are given in column-major order
+						Transform t(Matrix4x4(v[0], v[4], v[8], v[12],
+							v[1], v[5], v[9], v[13],
+							v[2], v[6], v[10], v[14],
+							v[3], v[7], v[11], v[15]));
+						ctm = concatenate ? ctm * t : t;
+					}
+				}
+				else if (token == "Identity" || token == "WorldBegin")
+				{
+					ctm = Transform();
+				}
+				else if (token == "CoordinateSystem" || token == "CoordSysTransform")
+				{
+					bool define = token == "CoordinateSystem";
+					if (!tokenizer.next(&token) || !token.isString)
+					{
+						error(tokenizer, "expected a coordinate system name");
+						continue;
+					}
+					if (define)
+					{
+						namedCoordinateSystems[token.str()] = ctm;
+					}
+					else
+					{
+						auto it = namedCoordinateSystems.find(token.str());
+						if (it == namedCoordinateSystems.end())
+						{
+							warning(tokenizer, "couldn't find named coordinate system \"" + token.str() + "\"");
+							continue;
+						}
+						ctm = it->second;
+					}
+				}
+				else if (token == "Include")
+				{
+					if (!tokenizer.next(&token) || !token.isString)
+					{
+						error(tokenizer, "expected a filename after Include");
+						continue;
+					}
+					std::string included = token.str();
+					if (!isAbsolutePath(included))
+					{
+						included = directory + included;
+					}
+					++includeDepth;
+					if (!parseFile(included))
+					{
+						error(tokenizer, "couldn't open included file \"" + included + "\"");
+					}
+					--includeDepth;
+				}
+				else if (token == "Film" || token == "Sampler")
+				{
+					parseOptions(tokenizer, token == "Film");
+				}
+				else if (token == "WorldEnd")
+				{
+				}
+				else if (token == "Camera" || token == "PixelFilter" || token == "SurfaceIntegrator" ||
+					token == "VolumeIntegrator" || token == "Accelerator" || token == "Renderer" ||
+					token == "LightSource" || token == "AreaLightSource" || token == "Material" ||
+					token == "MakeNamedMaterial" || token == "NamedMaterial" || token == "Texture" ||
+					token == "Volume" || token == "ObjectBegin" || token == "ObjectEnd" ||
+					token == "ObjectInstance" || token == "ReverseOrientation" ||
+					token == "ActiveTransform" || token == "TransformTimes")
+				{
+					// Not used by the renderer yet
+					skipParameters(tokenizer);
+				}
+				else
+				{
+					error(tokenizer, "unknown directive \"" + token.str() + "\"");
+					skipParameters(tokenizer);
+				}
+			}
+		}
+
+		bool SceneParser::readNumbers(Tokenizer &tokenizer, const Token &directive, float *values, int count)
+		{
+			// Copied, since reading further tokens invalidates the directive's token
+			std::string name = directive.str();
+			Token token;
+			bool bracketed = false;
+			for (int i = 0; i < count; ++i)
+			{
+				if (!tokenizer.next(&token))
+				{
+					error(tokenizer, "unexpected end of file after " + name);
+					return false;
+				}
+				if (i == 0 && !bracketed && token == "[")
+				{
+					bracketed = true;
+					--i;
+					continue;
+				}
+				if (token.isString || !parseFloat(token.data, token.data + token.length, &values[i]))
+				{
+					error(tokenizer, name + " expects " + std::to_string(count) + " numbers");
+					tokenizer.unget();
+					skipParameters(tokenizer);
+					return false;
+				}
+			}
+			if (bracketed && (!tokenizer.next(&token) || token != "]"))
+			{
+				error(tokenizer, "expected ']' after " + name);
+				return false;
+			}
+			return true;
+		}
+
+		void SceneParser::skipParameters(Tokenizer &tokenizer)
+		{
+			// Everything up to the next bare word outside of brackets belongs to
+			// the current directive
+			Token token;
+			int depth = 0;
+			while (tokenizer.next(&token))
+			{
+				if (token == "[")
+				{
+					++depth;
+				}
+				else if (token == "]")
+				{
+					depth -= depth > 0;
+				}
+				else if (depth == 0 && !token.isString && token.length > 0 &&
+					((token.data[0] >= 'A' && token.data[0] <= 'Z') || (token.data[0] >= 'a' && token.data[0] <= 'z')))
+				{
+					tokenizer.unget();
+					return;
+				}
+			}
+		}
+
+		void SceneParser::parseShape(Tokenizer &tokenizer)
+		{
+			Token token;
+			if (!tokenizer.next(&token) || !token.isString)
+			{
+				error(tokenizer, "expected a shape type after Shape");
+				skipParameters(tokenizer);
+				return;
+			}
+			if (token != "trianglemesh")
+			{
+				warning(tokenizer, "ignoring unsupported shape \"" + token.str() + "\"");
+				skipParameters(tokenizer);
+				return;
+			}
+
+			SceneGeometry &g = scene.geometry;
+			const size_t firstVertex = g.px.size();
+			const size_t firstIndex = g.indices.size();
+			size_t nP = 0, nN = 0, nUV = 0;
+			bool ok = true;
+
+			// Values are appended to the shared vertex buffers as they're parsed;
+			// the buffers are only validated, and rolled back if need be, at the end
+			while (tokenizer.next(&token))
+			{
+				if (!token.isString)
+				{
+					tokenizer.unget();
+					break;
+				}
+
+				if (token == "point P")
+				{
+					ok &= readParameterValues(tokenizer, [&](const Token &t) {
+						float f;
+						if (t.isString || !parseFloat(t.data, t.data + t.length, &f))
+						{
+							return false;
+						}
+						switch (nP++ % 3)
+						{
+						case 0: g.px.push_back(f); break;
+						case 1: g.py.push_back(f); break;
+						default: g.pz.push_back(f); break;
+						}
+						return true;
+					});
+				}
+				else if (token == "normal N")
+				{
+					if (g.nx.size() < firstVertex)
+					{
+						g.nx.resize(firstVertex, 0.0f);
+						g.ny.resize(firstVertex, 0.0f);
+						g.nz.resize(firstVertex, 0.0f);
+					}
+					ok &= readParameterValues(tokenizer, [&](const Token &t) {
+						float f;
+						if (t.isString || !parseFloat(t.data, t.data + t.length, &f))
+						{
+							return false;
+						}
+						switch (nN++ % 3)
+						{
+						case 0: g.nx.push_back(f); break;
+						case 1: g.ny.push_back(f); break;
+						default: g.nz.push_back(f); break;
+						}
+						return true;
+					});
+				}
+				else if (token == "float uv" || token == "float st" || token == "point2 uv" || token == "point2 st")
+				{
+					if (g.u.size() < firstVertex)
+					{
+						g.u.resize(firstVertex, 0.0f);
+						g.v.resize(firstVertex, 0.0f);
+					}
+					ok &= readParameterValues(tokenizer, [&](const Token &t) {
+						float f;
+						if (t.isString || !parseFloat(t.data, t.data + t.length, &f))
+						{
+							return false;
+						}
+						(nUV++ % 2 == 0 ? g.u : g.v).push_back(f);
+						return true;
+					});
+				}
+				else if (token == "integer indices")
+				{
+					ok &= readParameterValues(tokenizer, [&](const Token &t) {
+						int i;
+						if (t.isString || !parseInt(t.data, t.data + t.length, &i) || i < 0)
+						{
+							return false;
+						}
+						g.indices.push_back(static_cast<uint32_t>(firstVertex + i));
+						return true;
+					});
+				}
+				else
+				{
+					// Materials and the like aren't supported yet
+					readParameterValues(tokenizer, [](const Token &) { return true; });
+				}
+			}
+
+			const size_t vertexCount = nP / 3;
+			const size_t indexCount = g.indices.size() - firstIndex;
+			const char *problem = nullptr;
+			if (!ok)
+			{
+				problem = "malformed parameter values";
+			}
+			else if (nP == 0 || nP % 3 != 0)
+			{
+				problem = "\"point P\" needs a non-empty multiple of 3 values";
+			}
+			else if (indexCount == 0 || indexCount % 3 != 0)
+			{
+				problem = "\"integer indices\" needs a non-empty multiple of 3 values";
+			}
+			else if (firstVertex + vertexCount > UINT32_MAX)
+			{
+				problem = "too many vertices";
+			}
+			else
+			{
+				for (size_t i = firstIndex; i < g.indices.size(); ++i)
+				{
+					if (g.indices[i] >= firstVertex + vertexCount)
+					{
+						problem = "vertex index out of range";
+						break;
+					}
+				}
+			}
+			if (problem)
+			{
+				error(tokenizer, std::string("trianglemesh: ") + problem);
+				g.truncate(firstVertex, firstIndex);
+				return;
+			}
+
+			if (nN != 0 && nN != nP)
+			{
+				warning(tokenizer, "trianglemesh: ignoring \"normal N\", which doesn't match \"point P\"");
+				g.nx.resize(firstVertex);
+				g.ny.resize(firstVertex);
+				g.nz.resize(firstVertex);
+				nN = 0;
+			}
+			if (nUV != 0 && nUV != 2 * vertexCount)
+			{
+				warning(tokenizer, "trianglemesh: ignoring uvs, which don't match \"point P\"");
+				g.u.resize(firstVertex);
+				g.v.resize(firstVertex);
+				nUV = 0;
+			}
+			// Keep the optional arrays in step with the positions once any mesh has used them
+			if (nN == 0 && !g.nx.empty())
+			{
+				g.nx.resize(g.px.size(), 0.0f);
+				g.ny.resize(g.px.size(), 0.0f);
+				g.nz.resize(g.px.size(), 0.0f);
+			}
+			if (nUV == 0 && !g.u.empty())
+			{
+				g.u.resize(g.px.size(), 0.0f);
+				g.v.resize(g.px.size(), 0.0f);
+			}
+
+			if (!ctm.isIdentity())
+			{
+				ctm.transformPoints(&g.px[firstVertex], &g.py[firstVertex], &g.pz[firstVertex],
+					&g.px[firstVertex], &g.py[firstVertex], &g.pz[firstVertex], vertexCount);
+				if (nN != 0)
+				{
+					ctm.transformNormals(&g.nx[firstVertex], &g.ny[firstVertex], &g.nz[firstVertex],
+						&g.nx[firstVertex], &g.ny[firstVertex], &g.nz[firstVertex], vertexCount);
+				}
+			}
+
+			MeshRange mesh;
+			mesh.firstVertex = static_cast<uint32_t>(firstVertex);
+			mesh.vertexCount = static_cast<uint32_t>(vertexCount);
+			mesh.firstIndex = static_cast<uint32_t>(firstIndex);
+			mesh.indexCount = static_cast<uint32_t>(indexCount);
+			mesh.hasNormals = nN != 0;
+			mesh.hasUVs = nUV != 0;
+			g.meshes.push_back(mesh);
+		}
+
+		void SceneParser::parseOptions(Tokenizer &tokenizer, bool film)
+		{
+			Token token;
+			if (!tokenizer.next(&token) || !token.isString)
+			{
+				error(tokenizer, std::string("expected a type after ") + (film ? "Film" : "Sampler"));
+				skipParameters(tokenizer);
+				return;
+			}
+
+			SceneOptions &options = scene.options;
+			(film ? options.filmSpecified : options.samplerSpecified) = true;
+			while (tokenizer.next(&token))
+			{
+				if (!token.isString)
+				{
+					tokenizer.unget();
+					break;
+				}
+
+				int *intValue = nullptr;
+				std::string *stringValue = nullptr;
+				if (film && token == "integer xresolution")
+				{
+					intValue = &options.xResolution;
+				}
+				else if (film && token == "integer yresolution")
+				{
+					intValue = &options.yResolution;
+				}
+				else if (film && token == "string filename")
+				{
+					stringValue = &options.imageFile;
+				}
+				else if (!film && token == "integer pixelsamples")
+				{
+					intValue = &options.pixelSamples;
+				}
+
+				bool first = true;
+				bool ok = readParameterValues(tokenizer, [&](const Token &t) {
+					if (first)
+					{
+						first = false;
+						if (intValue)
+						{
+							return !t.isString && parseInt(t.data, t.data + t.length, intValue);
+						}
+						if (stringValue)
+						{
+							*stringValue = t.str();
+						}
+					}
+					return true;
+				});
+				if (!ok)
+				{
+					error(tokenizer, "malformed parameter value");
+				}
+			}
+		}
+
+	} // namespace scene
+
+} // namespace namaste
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+
+#include "transform.h"
+#include "scene.h"
+#include "parallel.h"
+
+namespace namaste {
+
+	namespace scene {
+
+		// A token is just a view into the tokenizer's buffer: nothing is copied
+		// or allocated per token. Quoted strings are returned without their
+		// quotes, with isString set
+		struct Token
+		{
+			const char *data;
+			size_t length;
+			bool isString;
+
+			bool operator==(const char *aString) const;
+			bool operator!=(const char *aString) const { return !(*this == aString); }
+			std::string str() const { return std::string(data, length); }
+		};
+
+		class Tokenizer
+		{
+		public:
+			// Tokenizes an in-memory buffer, e.g. a memory-mapped file
+			Tokenizer(const char *aBegin, const char *aEnd);
+			// Streams a stdio file (e.g. stdin) through a fixed-size buffer. A token
+			// straddling two chunks is moved to the front of the buffer before the
+			// next chunk is read, so tokens are always contiguous
+			explicit Tokenizer(FILE *aFile, size_t aChunkSize = 1 << 20);
+			~Tokenizer();
+
+			// Returns false at the end of the input. The token is only valid until
+			// the next call to next()
+			bool next(Token *token);
+			// Makes the next call to next() return the most recent token again
+			void unget();
+
+			int line;
+			uint64_t bytesRead;
+		private:
+			bool refill(const char **keep);
+
+			const char *pos, *end;
+			FILE *file;
+			std::vector<char> buffer;
+			Token lastToken;
+			bool pushedBack;
+		};
+
+		// Number parsing straight from a token, without a null-terminated copy.
+		// Typical scene-file numbers (up to 19 significant digits and a decimal
+		// exponent within +-22) are converted exactly in double precision and
+		// then rounded to float; anything else falls back to strtod
+		bool parseFloat(const char *begin, const char *end, float *value);
+		bool parseInt(const char *begin, const char *end, int *value);
+
+		// Streaming parser for pbrt-style scene files. Directives are acted on as
+		// soon as they're read, and mesh parameter arrays are parsed directly into
+		// the scene's structure-of-arrays vertex buffers, so memory use stays at
+		// the size of the scene itself no matter how large the file is
+		class SceneParser
+		{
+		public:
+			// Errors and warnings go to aLog
+			explicit SceneParser(Scene &aScene, std::ostream &aLog = std::cerr);
+			~SceneParser();
+
+			// Returns false if the file couldn't be opened. Syntax errors are
+			// reported to the log and counted in errorCount, and parsing carries on
+			// with the next directive
+			bool parseFile(const std::string &filename);
+			bool parseStream(FILE *aFile);
+
+			// Parses several files concurrently on the pool. Each file is parsed by
+			// its own parser into its own scene, starting from the default graphics
+			// state, and the results are appended to this parser's scene in the
+			// order given, so the scene (and the log output) is the same however the
+			// work was scheduled. Files that couldn't be opened are added to failed
+			void parseFiles(const std::vector<std::string> &filenames, parallel::ThreadPool &pool, std::vector<std::string> *failed);
+
+			// Totals over every file parsed so far, including Included ones
+			uint64_t bytesParsed;
+			double parseSeconds;
+			int errorCount;
+			// Every file read, in order, Included ones included
+			std::vector<std::string> sourceFiles;
+			// Whether warnings are logged; errors always are
+			bool logWarnings;
+		private:
+			void parse(Tokenizer &tokenizer, const std::string &directory);
+			bool readNumbers(Tokenizer &tokenizer, const Token &directive, float *values, int count);
+			void parseShape(Tokenizer &tokenizer);
+			void parseOptions(Tokenizer &tokenizer, bool film);
+			void skipParameters(Tokenizer &tokenizer);
+			void error(const Tokenizer &tokenizer, const std::string &message);
+			void warning(const Tokenizer &tokenizer, const std::string &message);
+
+			Scene &scene;
+			std::ostream &log;
+			geom::Transform ctm;
+			std::vector<geom::Transform> transformStack;
+			std::map<std::string, geom::Transform> namedCoordinateSystems;
+			std::string currentFile;
+			int includeDepth;
+		};
+
+	} // namespace scene
+
+} // namespace namaste
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "quaternion.h"
+#include "transform.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		// ---------------------------------------------------------------
+		// Quaternion class
+		// ---------------------------------------------------------------
+		Quaternion::Quaternion() :
+			v(0.0f, 0.0f, 0.0f), w(1.0f)
+		{
+			// The identity rotation
+		}
+
+		Quaternion::Quaternion(const Vector &aV, float aW) :
+			v(aV), w(aW)
+		{
+		}
+
+		Quaternion::Quaternion(const Transform &aTransform)
+		{
+			// Extract the rotation from the upper-left 3x3 of a (pure rotation)
+			// matrix. Branch on the largest diagonal term so that we never divide
+			// by a value close to zero
+			const Matrix4x4Data &m = aTransform.m.data;
+			float trace = m[0][0] + m[1][1] + m[2][2];
+			if (trace > 0.0f)
+			{
+				float s = sqrtf(trace + 1.0f);
+				w = s / 2.0f;
+				s = 0.5f / s;
+				v = Vector((m[2][1] - m[1][2]) * s,
+					(m[0][2] - m[2][0]) * s,
+					(m[1][0] - m[0][1]) * s);
+			}
+			else
+			{
+				const int nxt[3] = { 1, 2, 0 };
+				float q[3];
+				int i = 0;
+				if (m[1][1] > m[0][0]) i = 1;
+				if (m[2][2] > m[i][i]) i = 2;
+				int j = nxt[i];
+				int k = nxt[j];
+				float s = sqrtf((m[i][i] - (m[j][j] + m[k][k])) + 1.0f);
+				q[i] = s * 0.5f;
+				if (s != 0.0f)
+				{
+					s = 0.5f / s;
+				}
+				w = (m[k][j] - m[j][k]) * s;
+				q[j] = (m[j][i] + m[i][j]) * s;
+				q[k] = (m[k][i] + m[i][k]) * s;
+				v = Vector(q[0], q[1], q[2]);
+			}
+		}
+
+		Quaternion Quaternion::operator+(const Quaternion &rhs) const
+		{
+			return Quaternion(v + rhs.v, w + rhs.w);
+		}
+
+		Quaternion& Quaternion::operator+=(const Quaternion &rhs)
+		{
+			v += rhs.v;
+			w += rhs.w;
+			return *this;
+		}
+
+		Quaternion Quaternion::operator-(const Quaternion &rhs) const
+		{
+			return Quaternion(v - rhs.v, w - rhs.w);
+		}
+
+		Quaternion& Quaternion::operator-=(const Quaternion &rhs)
+		{
+			v -= rhs.v;
+			w -= rhs.w;
+			return *this;
+		}
+
+		Quaternion Quaternion::operator*(float scalar) const
+		{
+			return Quaternion(v * scalar, w * scalar);
+		}
+
+		Quaternion& Quaternion::operator*=(float scalar)
+		{
+			v *= scalar;
+			w *= scalar;
+			return *this;
+		}
+
+		Quaternion Quaternion::operator/(float scalar) const
+		{
+			assert(scalar != 0.0f);
+			float inv = 1.0f / scalar;
+			return Quaternion(v * inv, w * inv);
+		}
+
+		Quaternion& Quaternion::operator/=(float scalar)
+		{
+			assert(scalar != 0.0f);
+			float inv = 1.0f / scalar;
+			v *= inv;
+			w *= inv;
+			return *this;
+		}
+
+		Quaternion Quaternion::operator-() const
+		{
+			return Quaternion(-v, -w);
+		}
+
+		Transform Quaternion::toTransform() const
+		{
+			float xx = v.x * v.x, yy = v.y * v.y, zz = v.z * v.z;
+			float xy = v.x * v.y, xz = v.x * v.z, yz = v.y * v.z;
+			float wx = v.x * w, wy = v.y * w, wz = v.z * w;
+
+			Matrix4x4 m(1.0f - 2.0f * (yy + zz), 2.0f * (xy - wz), 2.0f * (xz + wy), 0.0f,
+				2.0f * (xy + wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz - wx), 0.0f,
+				2.0f * (xz - wy), 2.0f * (yz + wx), 1.0f - 2.0f * (xx + yy), 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+
+			// Rotations are orthogonal, so the inverse is the transpose
+			return Transform(m, transpose(m));
+		}
+
+		Quaternion slerp(float t, const Quaternion &q1, const Quaternion &q2)
+		{
+			float cosTheta = dot(q1, q2);
+			if (cosTheta > 0.9995f)
+			{
+				// Nearly parallel: fall back to linear interpolation, which is
+				// indistinguishable here and avoids dividing by sin(theta) ~ 0
+				return normalize(q1 * (1.0f - t) + q2 * t);
+			}
+
+			// Find the quaternion orthogonal to q1 in the plane of q1 and q2, and
+			// rotate q1 towards it by a fraction t of the angle between them
+			float theta = acosf(std::max(-1.0f, std::min(cosTheta, 1.0f)));
+			float thetaP = theta * t;
+			Quaternion qPerp = normalize(q2 - q1 * cosTheta);
+			return q1 * cosf(thetaP) + qPerp * sinf(thetaP);
+		}
+
+	} // namespace geom
+
+} // namespace namaste
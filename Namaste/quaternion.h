@@ -0,0 +1,61 @@
+#pragma once
+
+#include "geometry.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		// Forward declaration: transform.h includes this header
+		class Transform;
+
+		// A unit quaternion q = (v, w) represents a rotation by 2 * acos(w) about
+		// the axis v / |v|
+		class Quaternion
+		{
+		public:
+			Quaternion();
+			Quaternion(const Vector &aV, float aW);
+			explicit Quaternion(const Transform &aTransform);
+
+			Quaternion operator+(const Quaternion &rhs) const;
+			Quaternion& operator+=(const Quaternion &rhs);
+
+			Quaternion operator-(const Quaternion &rhs) const;
+			Quaternion& operator-=(const Quaternion &rhs);
+
+			Quaternion operator*(float scalar) const;
+			Quaternion& operator*=(float scalar);
+
+			Quaternion operator/(float scalar) const;
+			Quaternion& operator/=(float scalar);
+
+			Quaternion operator-() const;
+
+			// The rotation matrix for a unit quaternion
+			Transform toTransform() const;
+
+			friend std::ostream& operator<<(std::ostream &os, const Quaternion &q)
+			{
+				os << "[" << q.v.x << ", " << q.v.y << ", " << q.v.z << ", " << q.w << "]";
+				return os;
+			}
+
+			Vector v;
+			float w;
+		private:
+		};
+
+		inline Quaternion operator*(float scalar, const Quaternion &q) { return q * scalar; }
+
+		inline float dot(const Quaternion &lhs, const Quaternion &rhs) { return dot(lhs.v, rhs.v) + lhs.w * rhs.w; }
+
+		inline Quaternion normalize(const Quaternion &q) { return q / sqrtf(dot(q, q)); }
+
+		// Spherical linear interpolation: rotates at constant angular velocity
+		// about a fixed axis as t goes from 0 to 1
+		Quaternion slerp(float t, const Quaternion &q1, const Quaternion &q2);
+
+	} // namespace geom
+
+} // namespace namaste
@@ -0,0 +1,383 @@
+#include "stdafx.h"
+#include "raypacket.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		using simd::minf;
+		using simd::maxf;
+
+		// ---------------------------------------------------------------
+		// Ray packet class
+		// ---------------------------------------------------------------
+		template <int N>
+		RayPacket<N>::RayPacket()
+		{
+			// An inactive lane has an empty parametric interval, so it
+			// can never report a hit
+			for (int i = 0; i < N; ++i)
+			{
+				ox[i] = oy[i] = oz[i] = 0.0f;
+				dx[i] = dy[i] = dz[i] = 0.0f;
+				invDx[i] = invDy[i] = invDz[i] = INFINITY;
+				minT[i] = INFINITY;
+				maxT[i] = -INFINITY;
+			}
+		}
+
+		template <int N>
+		void RayPacket<N>::set(int lane, const Ray &aRay)
+		{
+			assert(lane >= 0 && lane < N);
+			ox[lane] = aRay.o.x;
+			oy[lane] = aRay.o.y;
+			oz[lane] = aRay.o.z;
+			dx[lane] = aRay.d.x;
+			dy[lane] = aRay.d.y;
+			dz[lane] = aRay.d.z;
+			invDx[lane] = 1.0f / aRay.d.x;
+			invDy[lane] = 1.0f / aRay.d.y;
+			invDz[lane] = 1.0f / aRay.d.z;
+			minT[lane] = aRay.minT;
+			maxT[lane] = aRay.maxT;
+		}
+
+		template class RayPacket<4>;
+		template class RayPacket<8>;
+
+		// ---------------------------------------------------------------
+		// Bounding box packet class
+		// ---------------------------------------------------------------
+		template <int N>
+		BBoxPacket<N>::BBoxPacket()
+		{
+			for (int i = 0; i < N; ++i)
+			{
+				minX[i] = minY[i] = minZ[i] = INFINITY;
+				maxX[i] = maxY[i] = maxZ[i] = -INFINITY;
+			}
+		}
+
+		template <int N>
+		void BBoxPacket<N>::set(int lane, const BBox &aBBox)
+		{
+			assert(lane >= 0 && lane < N);
+			minX[lane] = aBBox.pMin.x;
+			minY[lane] = aBBox.pMin.y;
+			minZ[lane] = aBBox.pMin.z;
+			maxX[lane] = aBBox.pMax.x;
+			maxY[lane] = aBBox.pMax.y;
+			maxZ[lane] = aBBox.pMax.z;
+		}
+
+		template class BBoxPacket<4>;
+		template class BBoxPacket<8>;
+
+		// ---------------------------------------------------------------
+		// Scalar slab tests
+		// ---------------------------------------------------------------
+		// As in BBox::intersectP, the near and far planes are picked by the sign
+		// of the direction so that empty boxes (pMin > pMax) never report a hit,
+		// and far distances are scaled by slabFarScale. A NaN from 0 * inf
+		// (origin on a slab plane with a zero direction component) leaves the
+		// interval untouched
+		namespace {
+
+			template <int N>
+			int slabsOneRay(const BBoxPacket<N> &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+			{
+				const float *nearX = invDir.x < 0.0f ? aBoxes.maxX : aBoxes.minX;
+				const float *farX = invDir.x < 0.0f ? aBoxes.minX : aBoxes.maxX;
+				const float *nearY = invDir.y < 0.0f ? aBoxes.maxY : aBoxes.minY;
+				const float *farY = invDir.y < 0.0f ? aBoxes.minY : aBoxes.maxY;
+				const float *nearZ = invDir.z < 0.0f ? aBoxes.maxZ : aBoxes.minZ;
+				const float *farZ = invDir.z < 0.0f ? aBoxes.minZ : aBoxes.maxZ;
+
+				int mask = 0;
+				for (int i = 0; i < N; ++i)
+				{
+					float t0 = aRay.minT;
+					float t1 = aRay.maxT;
+					t0 = maxf((nearX[i] - aRay.o.x) * invDir.x, t0);
+					t1 = minf((farX[i] - aRay.o.x) * invDir.x * slabFarScale, t1);
+					t0 = maxf((nearY[i] - aRay.o.y) * invDir.y, t0);
+					t1 = minf((farY[i] - aRay.o.y) * invDir.y * slabFarScale, t1);
+					t0 = maxf((nearZ[i] - aRay.o.z) * invDir.z, t0);
+					t1 = minf((farZ[i] - aRay.o.z) * invDir.z * slabFarScale, t1);
+					if (tNear)
+					{
+						tNear[i] = t0;
+					}
+					mask |= (t0 <= t1) ? (1 << i) : 0;
+				}
+				return mask;
+			}
+
+			template <int N>
+			int slabsOneBox(const BBox &aBBox, const RayPacket<N> &aPacket, float *tNear)
+			{
+				int mask = 0;
+				for (int i = 0; i < N; ++i)
+				{
+					float t0 = aPacket.minT[i];
+					float t1 = aPacket.maxT[i];
+
+					float ta = (aBBox.pMin.x - aPacket.ox[i]) * aPacket.invDx[i];
+					float tb = (aBBox.pMax.x - aPacket.ox[i]) * aPacket.invDx[i];
+					bool negative = aPacket.invDx[i] < 0.0f;
+					t0 = maxf(negative ? tb : ta, t0);
+					t1 = minf((negative ? ta : tb) * slabFarScale, t1);
+
+					ta = (aBBox.pMin.y - aPacket.oy[i]) * aPacket.invDy[i];
+					tb = (aBBox.pMax.y - aPacket.oy[i]) * aPacket.invDy[i];
+					negative = aPacket.invDy[i] < 0.0f;
+					t0 = maxf(negative ? tb : ta, t0);
+					t1 = minf((negative ? ta : tb) * slabFarScale, t1);
+
+					ta = (aBBox.pMin.z - aPacket.oz[i]) * aPacket.invDz[i];
+					tb = (aBBox.pMax.z - aPacket.oz[i]) * aPacket.invDz[i];
+					negative = aPacket.invDz[i] < 0.0f;
+					t0 = maxf(negative ? tb : ta, t0);
+					t1 = minf((negative ? ta : tb) * slabFarScale, t1);
+
+					if (tNear)
+					{
+						tNear[i] = t0;
+					}
+					mask |= (t0 <= t1) ? (1 << i) : 0;
+				}
+				return mask;
+			}
+
+		} // anonymous namespace
+
+		namespace scalar {
+
+			int intersectP(const BBox4 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+			{
+				return slabsOneRay(aBoxes, aRay, invDir, tNear);
+			}
+
+			int intersectP(const BBox8 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+			{
+				return slabsOneRay(aBoxes, aRay, invDir, tNear);
+			}
+
+			int intersectP(const BBox &aBBox, const RayPacket4 &aPacket, float *tNear)
+			{
+				return slabsOneBox(aBBox, aPacket, tNear);
+			}
+
+			int intersectP(const BBox &aBBox, const RayPacket8 &aPacket, float *tNear)
+			{
+				return slabsOneBox(aBBox, aPacket, tNear);
+			}
+
+		} // namespace scalar
+
+#if defined(NAMASTE_SSE)
+		// ---------------------------------------------------------------
+		// AVX2 slab tests
+		// ---------------------------------------------------------------
+		// The 8-wide tests, only called after checking cpuSupportsAVX2 as the rest
+		// of the program may be built without AVX
+		namespace avx2 {
+
+			NAMASTE_TARGET_AVX2 int intersectP(const BBox8 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+			{
+				const float *nearX = invDir.x < 0.0f ? aBoxes.maxX : aBoxes.minX;
+				const float *farX = invDir.x < 0.0f ? aBoxes.minX : aBoxes.maxX;
+				const float *nearY = invDir.y < 0.0f ? aBoxes.maxY : aBoxes.minY;
+				const float *farY = invDir.y < 0.0f ? aBoxes.minY : aBoxes.maxY;
+				const float *nearZ = invDir.z < 0.0f ? aBoxes.maxZ : aBoxes.minZ;
+				const float *farZ = invDir.z < 0.0f ? aBoxes.minZ : aBoxes.maxZ;
+
+				const __m256 ox = _mm256_set1_ps(aRay.o.x);
+				const __m256 oy = _mm256_set1_ps(aRay.o.y);
+				const __m256 oz = _mm256_set1_ps(aRay.o.z);
+				const __m256 ix = _mm256_set1_ps(invDir.x);
+				const __m256 iy = _mm256_set1_ps(invDir.y);
+				const __m256 iz = _mm256_set1_ps(invDir.z);
+				const __m256 farScale = _mm256_set1_ps(slabFarScale);
+
+				__m256 t0 = _mm256_set1_ps(aRay.minT);
+				__m256 t1 = _mm256_set1_ps(aRay.maxT);
+				t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearX), ox), ix), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farX), ox), ix), farScale), t1);
+				t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearY), oy), iy), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farY), oy), iy), farScale), t1);
+				t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearZ), oz), iz), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farZ), oz), iz), farScale), t1);
+
+				if (tNear)
+				{
+					_mm256_storeu_ps(tNear, t0);
+				}
+				return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+			}
+
+			NAMASTE_TARGET_AVX2 int intersectP(const BBox &aBBox, const RayPacket8 &aPacket, float *tNear)
+			{
+				const __m256 zero = _mm256_setzero_ps();
+				const __m256 farScale = _mm256_set1_ps(slabFarScale);
+				__m256 t0 = _mm256_load_ps(aPacket.minT);
+				__m256 t1 = _mm256_load_ps(aPacket.maxT);
+
+				__m256 o = _mm256_load_ps(aPacket.ox);
+				__m256 inv = _mm256_load_ps(aPacket.invDx);
+				__m256 negative = _mm256_cmp_ps(inv, zero, _CMP_LT_OQ);
+				__m256 ta = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMin.x), o), inv);
+				__m256 tb = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMax.x), o), inv);
+				t0 = _mm256_max_ps(_mm256_blendv_ps(ta, tb, negative), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_blendv_ps(tb, ta, negative), farScale), t1);
+
+				o = _mm256_load_ps(aPacket.oy);
+				inv = _mm256_load_ps(aPacket.invDy);
+				negative = _mm256_cmp_ps(inv, zero, _CMP_LT_OQ);
+				ta = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMin.y), o), inv);
+				tb = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMax.y), o), inv);
+				t0 = _mm256_max_ps(_mm256_blendv_ps(ta, tb, negative), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_blendv_ps(tb, ta, negative), farScale), t1);
+
+				o = _mm256_load_ps(aPacket.oz);
+				inv = _mm256_load_ps(aPacket.invDz);
+				negative = _mm256_cmp_ps(inv, zero, _CMP_LT_OQ);
+				ta = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMin.z), o), inv);
+				tb = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aBBox.pMax.z), o), inv);
+				t0 = _mm256_max_ps(_mm256_blendv_ps(ta, tb, negative), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_blendv_ps(tb, ta, negative), farScale), t1);
+
+				if (tNear)
+				{
+					_mm256_storeu_ps(tNear, t0);
+				}
+				return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+			}
+
+		} // namespace avx2
+#endif
+
+		// ---------------------------------------------------------------
+		// SIMD slab tests
+		// ---------------------------------------------------------------
+		int intersectP(const BBox4 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+		{
+#if defined(NAMASTE_SSE)
+			// The direction signs are shared by every lane, so the near and far
+			// planes can be selected once up front rather than blended per lane
+			const float *nearX = invDir.x < 0.0f ? aBoxes.maxX : aBoxes.minX;
+			const float *farX = invDir.x < 0.0f ? aBoxes.minX : aBoxes.maxX;
+			const float *nearY = invDir.y < 0.0f ? aBoxes.maxY : aBoxes.minY;
+			const float *farY = invDir.y < 0.0f ? aBoxes.minY : aBoxes.maxY;
+			const float *nearZ = invDir.z < 0.0f ? aBoxes.maxZ : aBoxes.minZ;
+			const float *farZ = invDir.z < 0.0f ? aBoxes.minZ : aBoxes.maxZ;
+
+			const __m128 ox = _mm_set1_ps(aRay.o.x);
+			const __m128 oy = _mm_set1_ps(aRay.o.y);
+			const __m128 oz = _mm_set1_ps(aRay.o.z);
+			const __m128 ix = _mm_set1_ps(invDir.x);
+			const __m128 iy = _mm_set1_ps(invDir.y);
+			const __m128 iz = _mm_set1_ps(invDir.z);
+			const __m128 farScale = _mm_set1_ps(slabFarScale);
+
+			__m128 t0 = _mm_set1_ps(aRay.minT);
+			__m128 t1 = _mm_set1_ps(aRay.maxT);
+			t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearX), ox), ix), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farX), ox), ix), farScale), t1);
+			t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearY), oy), iy), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farY), oy), iy), farScale), t1);
+			t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearZ), oz), iz), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farZ), oz), iz), farScale), t1);
+
+			if (tNear)
+			{
+				_mm_storeu_ps(tNear, t0);
+			}
+			return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+			return scalar::intersectP(aBoxes, aRay, invDir, tNear);
+#endif
+		}
+
+		int intersectP(const BBox8 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear)
+		{
+#if defined(NAMASTE_SSE)
+			if (simd::cpuSupportsAVX2())
+			{
+				return avx2::intersectP(aBoxes, aRay, invDir, tNear);
+			}
+#endif
+			return scalar::intersectP(aBoxes, aRay, invDir, tNear);
+		}
+
+#if defined(NAMASTE_SSE)
+		namespace {
+
+			// Lane-wise select: b where mask is set, a elsewhere
+			inline __m128 select(__m128 mask, __m128 a, __m128 b)
+			{
+				return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+			}
+
+		} // anonymous namespace
+#endif
+
+		int intersectP(const BBox &aBBox, const RayPacket4 &aPacket, float *tNear)
+		{
+#if defined(NAMASTE_SSE)
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 farScale = _mm_set1_ps(slabFarScale);
+			__m128 t0 = _mm_load_ps(aPacket.minT);
+			__m128 t1 = _mm_load_ps(aPacket.maxT);
+
+			// Each lane may point in a different octant, so compute the distance to
+			// both planes and pick near / far per lane by the sign of the direction
+			__m128 o = _mm_load_ps(aPacket.ox);
+			__m128 inv = _mm_load_ps(aPacket.invDx);
+			__m128 negative = _mm_cmplt_ps(inv, zero);
+			__m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMin.x), o), inv);
+			__m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMax.x), o), inv);
+			t0 = _mm_max_ps(select(negative, ta, tb), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(select(negative, tb, ta), farScale), t1);
+
+			o = _mm_load_ps(aPacket.oy);
+			inv = _mm_load_ps(aPacket.invDy);
+			negative = _mm_cmplt_ps(inv, zero);
+			ta = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMin.y), o), inv);
+			tb = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMax.y), o), inv);
+			t0 = _mm_max_ps(select(negative, ta, tb), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(select(negative, tb, ta), farScale), t1);
+
+			o = _mm_load_ps(aPacket.oz);
+			inv = _mm_load_ps(aPacket.invDz);
+			negative = _mm_cmplt_ps(inv, zero);
+			ta = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMin.z), o), inv);
+			tb = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aBBox.pMax.z), o), inv);
+			t0 = _mm_max_ps(select(negative, ta, tb), t0);
+			t1 = _mm_min_ps(_mm_mul_ps(select(negative, tb, ta), farScale), t1);
+
+			if (tNear)
+			{
+				_mm_storeu_ps(tNear, t0);
+			}
+			return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+			return scalar::intersectP(aBBox, aPacket, tNear);
+#endif
+		}
+
+		int intersectP(const BBox &aBBox, const RayPacket8 &aPacket, float *tNear)
+		{
+#if defined(NAMASTE_SSE)
+			if (simd::cpuSupportsAVX2())
+			{
+				return avx2::intersectP(aBBox, aPacket, tNear);
+			}
+#endif
+			return scalar::intersectP(aBBox, aPacket, tNear);
+		}
+
+	} // namespace geom
+
+} // namespace namaste
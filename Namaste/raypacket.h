@@ -0,0 +1,88 @@
+#pragma once
+
+#include "simd.h"
+#include "geometry.h"
+
+namespace namaste {
+
+	namespace geom {
+
+		// A packet of N rays stored in structure-of-arrays form: lane i of each
+		// array holds the corresponding component of the i-th ray, so a single
+		// SIMD load fetches the same component of every ray in the packet. Lanes
+		// that have not been set are inactive and never report a hit
+		template <int N>
+		class RayPacket
+		{
+		public:
+			RayPacket();
+
+			void set(int lane, const Ray &aRay);
+
+			static const int width = N;
+
+			alignas(32) float ox[N];
+			alignas(32) float oy[N];
+			alignas(32) float oz[N];
+			alignas(32) float dx[N];
+			alignas(32) float dy[N];
+			alignas(32) float dz[N];
+			alignas(32) float invDx[N];
+			alignas(32) float invDy[N];
+			alignas(32) float invDz[N];
+			alignas(32) float minT[N];
+			alignas(32) float maxT[N];
+		};
+
+		using RayPacket4 = RayPacket<4>;
+		using RayPacket8 = RayPacket<8>;
+
+		// N bounding boxes stored in structure-of-arrays form, e.g. the children
+		// of a wide BVH node. Unset lanes hold the degenerate 'empty' box
+		template <int N>
+		class BBoxPacket
+		{
+		public:
+			BBoxPacket();
+
+			void set(int lane, const BBox &aBBox);
+
+			static const int width = N;
+
+			alignas(32) float minX[N];
+			alignas(32) float minY[N];
+			alignas(32) float minZ[N];
+			alignas(32) float maxX[N];
+			alignas(32) float maxY[N];
+			alignas(32) float maxZ[N];
+		};
+
+		using BBox4 = BBoxPacket<4>;
+		using BBox8 = BBoxPacket<8>;
+
+		// Packet slab tests: each returns a bit mask with bit i set if lane i hit,
+		// and writes the entry distance of every lane to tNear (which may be null).
+		// The parametric interval of each ray is clipped to [minT, maxT]
+
+		// One ray against N boxes; invDir is the component-wise reciprocal of aRay.d
+		int intersectP(const BBox4 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear);
+		int intersectP(const BBox8 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear);
+
+		// N rays against one box
+		int intersectP(const BBox &aBBox, const RayPacket4 &aPacket, float *tNear);
+		int intersectP(const BBox &aBBox, const RayPacket8 &aPacket, float *tNear);
+
+		namespace scalar {
+
+			// Reference implementations of the packet tests above: these are used when
+			// SIMD is unavailable and give bit-identical results to the vector paths
+			int intersectP(const BBox4 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear);
+			int intersectP(const BBox8 &aBoxes, const Ray &aRay, const Vector &invDir, float *tNear);
+			int intersectP(const BBox &aBBox, const RayPacket4 &aPacket, float *tNear);
+			int intersectP(const BBox &aBBox, const RayPacket8 &aPacket, float *tNear);
+
+		} // namespace scalar
+
+	} // namespace geom
+
+} // namespace namaste
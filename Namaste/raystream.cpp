@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "raystream.h"
+
+#include <utility>
+#include <algorithm>
+
+namespace namaste {
+
+	namespace accel {
+
+		using geom::BBox;
+
+		namespace {
+
+			// Spreads the low 10 bits of v out to every third bit
+			uint32_t leftShift3(uint32_t v)
+			{
+				v = (v | (v << 16)) & 0x030000FF;
+				v = (v | (v << 8)) & 0x0300F00F;
+				v = (v | (v << 4)) & 0x030C30C3;
+				v = (v | (v << 2)) & 0x09249249;
+				return v;
+			}
+
+			// Position of x within [aMin, aMax] on a 10-bit grid. A flat axis, where
+			// every origin lies on the same plane, maps to 0
+			uint32_t quantizeOffset(float x, float aMin, float aMax)
+			{
+				if (!(aMax > aMin))
+				{
+					return 0;
+				}
+				return static_cast<uint32_t>(std::min((x - aMin) / (aMax - aMin) * 1024.0f, 1023.0f));
+			}
+
+		} // namespace
+
+		// ---------------------------------------------------------------
+		// Ray stream class
+		// ---------------------------------------------------------------
+		RayStream::RayStream(size_t aCapacity, bool aWavefront) :
+			wavefront(aWavefront), maxRays(aCapacity)
+		{
+			rays.reserve(maxRays);
+			invDirs.reserve(maxRays);
+			dirSigns.reserve(maxRays);
+			order.reserve(maxRays);
+		}
+
+		RayStream::~RayStream()
+		{
+		}
+
+		uint32_t RayStream::add(const geom::Ray &aRay)
+		{
+			assert(!full());
+			uint32_t index = static_cast<uint32_t>(rays.size());
+			// Slices off any differentials
+			rays.push_back(aRay);
+			geom::Vector invDir(1.0f / aRay.d.x, 1.0f / aRay.d.y, 1.0f / aRay.d.z);
+			invDirs.push_back(invDir);
+			dirSigns.push_back(static_cast<uint8_t>((invDir.x < 0.0f ? 1 : 0) | (invDir.y < 0.0f ? 2 : 0) | (invDir.z < 0.0f ? 4 : 0)));
+			order.push_back(index);
+			return index;
+		}
+
+		void RayStream::clear()
+		{
+			rays.clear();
+			invDirs.clear();
+			dirSigns.clear();
+			order.clear();
+		}
+
+		size_t RayStream::size() const
+		{
+			return rays.size();
+		}
+
+		size_t RayStream::capacity() const
+		{
+			return maxRays;
+		}
+
+		bool RayStream::full() const
+		{
+			return rays.size() >= maxRays;
+		}
+
+		void RayStream::sort()
+		{
+			BBox originBounds;
+			for (auto it = rays.cbegin(); it < rays.cend(); ++it)
+			{
+				originBounds = calcUnion(originBounds, it->o);
+			}
+
+			// Three octant bits above a 30-bit Morton code of the origin
+			std::vector<std::pair<uint64_t, uint32_t>> keys(rays.size());
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				const geom::Ray &ray = rays[i];
+				uint64_t octant = dirSigns[i];
+				uint32_t morton = (leftShift3(quantizeOffset(ray.o.z, originBounds.pMin.z, originBounds.pMax.z)) << 2) |
+					(leftShift3(quantizeOffset(ray.o.y, originBounds.pMin.y, originBounds.pMax.y)) << 1) |
+					leftShift3(quantizeOffset(ray.o.x, originBounds.pMin.x, originBounds.pMax.x));
+				keys[i] = std::make_pair((octant << 30) | morton, static_cast<uint32_t>(i));
+			}
+			std::sort(keys.begin(), keys.end());
+
+			for (size_t i = 0; i < keys.size(); ++i)
+			{
+				order[i] = keys[i].second;
+			}
+		}
+
+	} // namespace accel
+
+} // namespace namaste
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "geometry.h"
+#include "bvh.h"
+
+namespace namaste {
+
+	namespace accel {
+
+		// A large batch of rays traced together. Rays are referred to by the index
+		// add() returned, in the order they were added; anything traversal doesn't
+		// need, such as the differentials of a RayDifferential, stays with the
+		// caller under the same index. With wavefront set, intersectStream walks
+		// the BVH once for the whole batch, filtering the rays against each node's
+		// bounds, so each node is fetched once per batch rather than once per ray;
+		// otherwise the rays are traced one at a time
+		class RayStream
+		{
+		public:
+			explicit RayStream(size_t aCapacity = 64 * 1024, bool aWavefront = true);
+			~RayStream();
+
+			// Only minT and maxT of the ray are kept up to date during traversal
+			uint32_t add(const geom::Ray &aRay);
+			void clear();
+
+			size_t size() const;
+			size_t capacity() const;
+			bool full() const;
+
+			// Reorders traversal by direction octant, then by origin along a Morton
+			// curve, so that rays which follow the same paths through the tree are
+			// traced together. Ray indices are unchanged
+			void sort();
+
+			bool wavefront;
+
+			std::vector<geom::Ray> rays;
+			std::vector<geom::Vector> invDirs;
+			// Bit i set if the direction is negative along axis i, so that slab tests
+			// and near child choices needn't work it out from invDirs at every node
+			std::vector<uint8_t> dirSigns;
+			// Traversal order, a permutation of the ray indices
+			std::vector<uint32_t> order;
+			// Working set of wavefront traversal: a stack of ray index lists
+			std::vector<uint32_t> active;
+		private:
+			size_t maxRays;
+		};
+
+		// Traces a stream through a BVH, calling intersectLeaf(primitiveIndices,
+		// count, rayIndex, ray) for every leaf a ray reaches, which should return true
+		// and shrink ray.maxT if it found a closer hit - the stream counterpart of
+		// BVHAccel::intersectLeaves
+		template <typename LeafFunc>
+		void intersectStream(const BVHAccel &aBVH, RayStream &aStream, LeafFunc intersectLeaf)
+		{
+			if (aBVH.nodes.empty() || aStream.size() == 0)
+			{
+				return;
+			}
+
+			if (!aStream.wavefront)
+			{
+				for (auto it = aStream.order.cbegin(); it < aStream.order.cend(); ++it)
+				{
+					uint32_t rayIndex = *it;
+					aBVH.intersectLeaves(aStream.rays[rayIndex], [&](const uint32_t *aPrimitives, int aCount, const geom::Ray &ray)
+					{
+						return intersectLeaf(aPrimitives, aCount, rayIndex, ray);
+					});
+				}
+				return;
+			}
+
+			const std::vector<LinearBVHNode> &nodes = aBVH.nodes;
+			auto hitsNode = [&](const LinearBVHNode &aNode, uint32_t aRayIndex)
+			{
+				uint8_t signs = aStream.dirSigns[aRayIndex];
+				int dirIsNeg[3] = { signs & 1, (signs >> 1) & 1, (signs >> 2) & 1 };
+				return intersectP(aNode.bounds, aStream.rays[aRayIndex], aStream.invDirs[aRayIndex], dirIsNeg);
+			};
+
+			// Each entry is a node and the rays that hit its parent, stored as a
+			// segment [begin, end) of the active list. Both children of a node refer
+			// to the node's segment: the near child, popped first, copies just the
+			// rays that hit it past the end of the segment, and the far child, its
+			// last user, filters it in place. Anything past a popped segment belongs
+			// to subtrees already finished. Rays are tested against a node's bounds
+			// only when it is popped, so the far child of a node is culled with the
+			// maxT left by everything in the near one
+			struct Segment
+			{
+				uint32_t node;
+				size_t begin, end;
+				bool shared;
+			};
+			Segment nodesToVisit[maxBVHDepth + 1];
+			int toVisitOffset = 0;
+
+			// Rays are counted a segment at a time; nodes per ray aren't tracked here
+			stats::count(stats::CounterClosestHitRays, aStream.size());
+
+			std::vector<uint32_t> &active = aStream.active;
+			active.assign(aStream.order.cbegin(), aStream.order.cend());
+			Segment root = { 0, 0, active.size(), false };
+			nodesToVisit[toVisitOffset++] = root;
+
+			while (toVisitOffset > 0)
+			{
+				Segment segment = nodesToVisit[--toVisitOffset];
+				const LinearBVHNode &node = nodes[segment.node];
+
+				// Keep the rays that hit the node
+				stats::count(stats::CounterRayBoxTests, segment.end - segment.begin);
+				active.resize(segment.end);
+				size_t begin = segment.end, end = segment.end;
+				if (segment.shared)
+				{
+					for (size_t i = segment.begin; i < segment.end; ++i)
+					{
+						uint32_t rayIndex = active[i];
+						if (hitsNode(node, rayIndex))
+						{
+							active.push_back(rayIndex);
+						}
+					}
+					end = active.size();
+				}
+				else
+				{
+					begin = end = segment.begin;
+					for (size_t i = segment.begin; i < segment.end; ++i)
+					{
+						uint32_t rayIndex = active[i];
+						if (hitsNode(node, rayIndex))
+						{
+							active[end++] = rayIndex;
+						}
+					}
+					active.resize(end);
+				}
+				if (end == begin)
+				{
+					continue;
+				}
+
+				if (node.nPrimitives > 0)
+				{
+					const uint32_t *primitives = &aBVH.primitiveIndices[node.primitivesOffset];
+					stats::count(stats::CounterRayPrimitiveTests, (end - begin) * node.nPrimitives);
+					for (size_t i = begin; i < end; ++i)
+					{
+						uint32_t rayIndex = active[i];
+						intersectLeaf(primitives, static_cast<int>(node.nPrimitives), rayIndex, aStream.rays[rayIndex]);
+					}
+					continue;
+				}
+
+				// Visit first the child that most of the rays see first
+				size_t nNegative = 0;
+				for (size_t i = begin; i < end; ++i)
+				{
+					nNegative += (aStream.dirSigns[active[i]] >> node.axis) & 1;
+				}
+				bool secondFirst = 2 * nNegative > end - begin;
+				Segment farSegment = { secondFirst ? segment.node + 1 : node.secondChildOffset, begin, end, false };
+				Segment nearSegment = { secondFirst ? node.secondChildOffset : segment.node + 1, begin, end, true };
+				nodesToVisit[toVisitOffset++] = farSegment;
+				nodesToVisit[toVisitOffset++] = nearSegment;
+			}
+		}
+
+	} // namespace accel
+
+} // namespace namaste
@@ -0,0 +1,465 @@
+#include "stdafx.h"
+#include "renderer.h"
+#include "film.h"
+#include "sampler.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+namespace namaste {
+
+	namespace render {
+
+		namespace {
+
+			double secondsSince(std::chrono::steady_clock::time_point aStart)
+			{
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - aStart).count();
+			}
+
+			float luminance(const float rgb[3])
+			{
+				return 0.212671f * rgb[0] + 0.715160f * rgb[1] + 0.072169f * rgb[2];
+			}
+
+		} // anonymous namespace
+
+		std::vector<Tile> generateTiles(int aWidth, int aHeight, int aTileSize)
+		{
+			std::vector<Tile> tiles;
+			for (int y = 0; y < aHeight; y += aTileSize)
+			{
+				for (int x = 0; x < aWidth; x += aTileSize)
+				{
+					tiles.push_back({ x, y, std::min(x + aTileSize, aWidth), std::min(y + aTileSize, aHeight) });
+				}
+			}
+			return tiles;
+		}
+
+		// ---------------------------------------------------------------
+		// Adaptive sampling class
+		// ---------------------------------------------------------------
+		AdaptiveSampling::AdaptiveSampling() :
+			initialSamples(8), maxSamplesPerPixel(1024), maxRelativeError(0.01f), errorFloor(0.01f), maxPasses(16)
+		{
+		}
+
+		// ---------------------------------------------------------------
+		// Pixel estimate class
+		// ---------------------------------------------------------------
+		void PixelEstimate::add(const float rgb[3])
+		{
+			sum[0] += rgb[0];
+			sum[1] += rgb[1];
+			sum[2] += rgb[2];
+			++samples;
+			float y = luminance(rgb);
+			float delta = y - luminanceMean;
+			luminanceMean += delta / samples;
+			luminanceM2 += delta * (y - luminanceMean);
+		}
+
+		float PixelEstimate::relativeError(float aErrorFloor) const
+		{
+			if (samples < 2)
+			{
+				return INFINITY;
+			}
+			float variance = luminanceM2 / (samples - 1);
+			return std::sqrt(variance / samples) / (std::abs(luminanceMean) + aErrorFloor);
+		}
+
+		// ---------------------------------------------------------------
+		// Tile renderer class
+		// ---------------------------------------------------------------
+		TileRenderer::TileRenderer(int aWidth, int aHeight, int aSamplesPerPixel, int aTileSize) :
+			width(aWidth), height(aHeight), samplesPerPixel(std::max(aSamplesPerPixel, 1)), tileSize(std::max(aTileSize, 1)),
+			passes(0), renderSeconds(0.0)
+		{
+			pixels.assign(3 * static_cast<size_t>(width) * height, 0.0f);
+			tiles = generateTiles(width, height, tileSize);
+		}
+
+		TileRenderer::~TileRenderer()
+		{
+		}
+
+		void TileRenderer::startRender(parallel::ThreadPool &aPool)
+		{
+			threadStates.clear();
+			threadStates.resize(aPool.numThreads());
+			for (auto &state : threadStates)
+			{
+				state.accumulation.resize(3 * tileSize * tileSize);
+				state.arena.reset(new MemoryArena());
+				state.busySeconds = 0.0;
+				state.tilesRendered = 0;
+			}
+			tileStats.assign(tiles.size(), TileStats());
+		}
+
+		void TileRenderer::render(parallel::ThreadPool &aPool, const RadianceFunc &radiance)
+		{
+			stats::PhaseTimer timer(stats::PhaseRender);
+			auto start = std::chrono::steady_clock::now();
+
+			startRender(aPool);
+			sampleCounts.assign(static_cast<size_t>(width) * height, samplesPerPixel);
+			passes = 1;
+
+			// One task per tile: idle threads steal tiles from busy ones, so expensive
+			// regions of the image don't leave the rest of the pool waiting
+			parallel::TaskGroup group(aPool);
+			for (size_t i = 0; i < tiles.size(); ++i)
+			{
+				group.run([this, i, &aPool, &radiance]()
+				{
+					renderTile(static_cast<int>(i), aPool.currentThreadIndex(), radiance);
+				});
+			}
+			group.wait();
+
+			renderSeconds = secondsSince(start);
+		}
+
+		void TileRenderer::renderTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance)
+		{
+			auto start = std::chrono::steady_clock::now();
+			ThreadState &state = threadStates[aThreadIndex];
+			const Tile &tile = tiles[aTileIndex];
+			const int tileWidth = tile.x1 - tile.x0;
+
+			std::fill(state.accumulation.begin(), state.accumulation.end(), 0.0f);
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				for (int x = tile.x0; x < tile.x1; ++x)
+				{
+					float *sum = &state.accumulation[3 * ((y - tile.y0) * tileWidth + (x - tile.x0))];
+					for (int s = 0; s < samplesPerPixel; ++s)
+					{
+						float rgb[3] = { 0.0f, 0.0f, 0.0f };
+						radiance(x + 0.5f, y + 0.5f, s, *state.arena, rgb);
+						state.arena->reset();
+						sum[0] += rgb[0];
+						sum[1] += rgb[1];
+						sum[2] += rgb[2];
+					}
+				}
+			}
+
+			// Tiles never overlap, so the finished tile can be written out unlocked
+			const float invSamples = 1.0f / samplesPerPixel;
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				const float *src = &state.accumulation[3 * (y - tile.y0) * tileWidth];
+				float *dst = &pixels[3 * (static_cast<size_t>(y) * width + tile.x0)];
+				for (int i = 0; i < 3 * tileWidth; ++i)
+				{
+					dst[i] = src[i] * invSamples;
+				}
+			}
+
+			double seconds = secondsSince(start);
+			tileStats[aTileIndex] = { aThreadIndex, seconds, static_cast<uint64_t>(tileWidth) * (tile.y1 - tile.y0) * samplesPerPixel };
+			state.busySeconds += seconds;
+			state.tilesRendered++;
+		}
+
+		void TileRenderer::renderAdaptive(parallel::ThreadPool &aPool, const RadianceFunc &radiance, const sampling::Sampler &aSampler, Film &film,
+			const AdaptiveSampling &aSettings, const PassFunc &aPassDone)
+		{
+			assert(film.width == width && film.height == height && film.tileSize == tileSize);
+			stats::PhaseTimer timer(stats::PhaseRender);
+			auto start = std::chrono::steady_clock::now();
+
+			startRender(aPool);
+			film.clear();
+			const size_t nPixels = static_cast<size_t>(width) * height;
+			const PixelEstimate empty = { { 0.0f, 0.0f, 0.0f }, 0.0f, 0.0f, 0 };
+			estimates.assign(nPixels, empty);
+
+			const uint32_t maxSamples = static_cast<uint32_t>(std::max(aSettings.maxSamplesPerPixel, 2));
+			const uint64_t budget = static_cast<uint64_t>(samplesPerPixel) * nPixels;
+			std::vector<uint32_t> passSamples(nPixels, std::min(static_cast<uint32_t>(std::max(aSettings.initialSamples, 2)), maxSamples));
+			std::vector<double> needed(nPixels);
+			std::vector<uint32_t> neediest;
+			uint64_t spent = 0;
+			for (passes = 0; ; )
+			{
+				// Only tiles that were given samples are rendered again
+				parallel::TaskGroup group(aPool);
+				for (size_t i = 0; i < tiles.size(); ++i)
+				{
+					const Tile &tile = tiles[i];
+					bool sampled = false;
+					for (int y = tile.y0; y < tile.y1 && !sampled; ++y)
+					{
+						for (int x = tile.x0; x < tile.x1 && !sampled; ++x)
+						{
+							sampled = passSamples[static_cast<size_t>(y) * width + x] > 0;
+						}
+					}
+					if (sampled)
+					{
+						group.run([this, i, &aPool, &radiance, &aSampler, &film, &passSamples]()
+						{
+							renderAdaptiveTile(static_cast<int>(i), aPool.currentThreadIndex(), radiance, aSampler, film, passSamples);
+						});
+					}
+				}
+				group.wait();
+				for (size_t p = 0; p < nPixels; ++p)
+				{
+					spent += passSamples[p];
+				}
+
+				// Splats are scaled by the mean number of samples per pixel
+				film.resolve(aPool, static_cast<float>(nPixels) / spent, &pixels);
+				if (aPassDone)
+				{
+					aPassDone(passes + 1, pixels);
+				}
+				if (++passes >= aSettings.maxPasses || spent >= budget)
+				{
+					break;
+				}
+
+				// The standard error falls as 1 / sqrt(n), so a pixel with relative error
+				// e after n samples needs about n * ((e / maxRelativeError)^2 - 1) more
+				double totalNeeded = 0.0;
+				for (size_t p = 0; p < nPixels; ++p)
+				{
+					const PixelEstimate &estimate = estimates[p];
+					double error = estimate.relativeError(aSettings.errorFloor) / aSettings.maxRelativeError;
+					needed[p] = error <= 1.0 || estimate.samples >= maxSamples ? 0.0 :
+						std::min(std::ceil(estimate.samples * (error * error - 1.0)), static_cast<double>(maxSamples - estimate.samples));
+					totalNeeded += needed[p];
+				}
+				if (totalNeeded == 0.0)
+				{
+					break;
+				}
+
+				// Spend at most as much as all passes so far, so that errors are
+				// re-estimated before the rest of the budget is committed, and share it
+				// out in proportion to need. Rounding down leaves part of the pass
+				// budget over, which goes a sample each to the neediest pixels, so the
+				// pass never spends more than it was given
+				const uint64_t passBudget = std::min(budget - spent, spent);
+				const double scale = std::min(1.0, passBudget / totalNeeded);
+				uint64_t allotted = 0;
+				neediest.clear();
+				for (size_t p = 0; p < nPixels; ++p)
+				{
+					passSamples[p] = static_cast<uint32_t>(needed[p] * scale);
+					allotted += passSamples[p];
+					if (needed[p] > 0.0)
+					{
+						neediest.push_back(static_cast<uint32_t>(p));
+					}
+				}
+				if (allotted < passBudget && scale < 1.0)
+				{
+					std::sort(neediest.begin(), neediest.end(), [&needed](uint32_t a, uint32_t b)
+					{
+						return needed[a] > needed[b] || (needed[a] == needed[b] && a < b);
+					});
+					for (auto it = neediest.cbegin(); it < neediest.cend() && allotted < passBudget; ++it, ++allotted)
+					{
+						passSamples[*it]++;
+					}
+				}
+			}
+
+			sampleCounts.resize(nPixels);
+			for (size_t p = 0; p < nPixels; ++p)
+			{
+				sampleCounts[p] = estimates[p].samples;
+			}
+			renderSeconds = secondsSince(start);
+		}
+
+		void TileRenderer::renderAdaptiveTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+			Film &film, const std::vector<uint32_t> &aPassSamples)
+		{
+			auto start = std::chrono::steady_clock::now();
+			ThreadState &state = threadStates[aThreadIndex];
+			const Tile &tile = tiles[aTileIndex];
+			FilmTile &filmTile = film.tiles[aTileIndex];
+			const int dimensions = aSampler.dimensions;
+
+			// Pixels belong to exactly one tile, so their estimates and the film tile
+			// are updated unlocked. The estimates only decide where samples go; the
+			// image is the filtered film
+			uint64_t nSamples = 0;
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				for (int x = tile.x0; x < tile.x1; ++x)
+				{
+					size_t p = static_cast<size_t>(y) * width + x;
+					PixelEstimate &estimate = estimates[p];
+					const uint32_t count = aPassSamples[p];
+					if (count == 0)
+					{
+						continue;
+					}
+					if (state.samples.size() < static_cast<size_t>(count) * dimensions)
+					{
+						state.samples.resize(static_cast<size_t>(count) * dimensions);
+					}
+					aSampler.generate(x, y, estimate.samples, count, state.samples.data());
+					const float *u = state.samples.data();
+					for (uint32_t s = 0; s < count; ++s, u += dimensions)
+					{
+						const float filmX = x + u[0], filmY = y + (dimensions > 1 ? u[1] : 0.5f);
+						float rgb[3] = { 0.0f, 0.0f, 0.0f };
+						radiance(filmX, filmY, static_cast<int>(estimate.samples), *state.arena, rgb);
+						state.arena->reset();
+						estimate.add(rgb);
+						film.addSample(filmTile, filmX, filmY, rgb);
+					}
+					nSamples += count;
+				}
+			}
+
+			double seconds = secondsSince(start);
+			TileStats &stats = tileStats[aTileIndex];
+			stats.thread = aThreadIndex;
+			stats.seconds += seconds;
+			stats.samples += nSamples;
+			state.busySeconds += seconds;
+			state.tilesRendered++;
+		}
+
+		void TileRenderer::renderProgressive(parallel::ThreadPool &aPool, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+			Film &film, int aSamplesPerPass, const PassFunc &aPassDone)
+		{
+			assert(film.width == width && film.height == height && film.tileSize == tileSize);
+			stats::PhaseTimer timer(stats::PhaseRender);
+			auto start = std::chrono::steady_clock::now();
+
+			startRender(aPool);
+			film.clear();
+			const uint32_t samplesPerPass = static_cast<uint32_t>(std::min(std::max(aSamplesPerPass, 1), samplesPerPixel));
+			for (auto &state : threadStates)
+			{
+				state.samples.resize(static_cast<size_t>(samplesPerPass) * aSampler.dimensions);
+			}
+
+			passes = 0;
+			for (uint32_t taken = 0; taken < static_cast<uint32_t>(samplesPerPixel); )
+			{
+				const uint32_t count = std::min(samplesPerPass, samplesPerPixel - taken);
+				parallel::TaskGroup group(aPool);
+				for (size_t i = 0; i < tiles.size(); ++i)
+				{
+					group.run([this, i, &aPool, &radiance, &aSampler, &film, taken, count]()
+					{
+						renderFilmTile(static_cast<int>(i), aPool.currentThreadIndex(), radiance, aSampler, film, taken, count);
+					});
+				}
+				group.wait();
+				taken += count;
+				++passes;
+
+				// The tiles are only read once every one of them is done with the pass
+				film.resolve(aPool, 1.0f / taken, &pixels);
+				if (aPassDone)
+				{
+					aPassDone(passes, pixels);
+				}
+			}
+
+			sampleCounts.assign(static_cast<size_t>(width) * height, samplesPerPixel);
+			renderSeconds = secondsSince(start);
+		}
+
+		void TileRenderer::renderFilmTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+			Film &film, uint32_t aFirstSample, uint32_t aCount)
+		{
+			auto start = std::chrono::steady_clock::now();
+			ThreadState &state = threadStates[aThreadIndex];
+			const Tile &tile = tiles[aTileIndex];
+			FilmTile &filmTile = film.tiles[aTileIndex];
+			const int dimensions = aSampler.dimensions;
+
+			// This thread is the only one rendering the tile, so its film tile is
+			// written unlocked
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				for (int x = tile.x0; x < tile.x1; ++x)
+				{
+					aSampler.generate(x, y, aFirstSample, aCount, state.samples.data());
+					const float *u = state.samples.data();
+					for (uint32_t s = 0; s < aCount; ++s, u += dimensions)
+					{
+						const float filmX = x + u[0], filmY = y + (dimensions > 1 ? u[1] : 0.5f);
+						float rgb[3] = { 0.0f, 0.0f, 0.0f };
+						radiance(filmX, filmY, static_cast<int>(aFirstSample + s), *state.arena, rgb);
+						state.arena->reset();
+						film.addSample(filmTile, filmX, filmY, rgb);
+					}
+				}
+			}
+
+			double seconds = secondsSince(start);
+			TileStats &stats = tileStats[aTileIndex];
+			stats.thread = aThreadIndex;
+			stats.seconds += seconds;
+			stats.samples += static_cast<uint64_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * aCount;
+			state.busySeconds += seconds;
+			state.tilesRendered++;
+		}
+
+		void TileRenderer::printStats(std::ostream &os) const
+		{
+			if (tileStats.empty())
+			{
+				return;
+			}
+
+			double minTile = INFINITY, maxTile = 0.0, totalTile = 0.0;
+			for (const auto &stats : tileStats)
+			{
+				minTile = std::min(minTile, stats.seconds);
+				maxTile = std::max(maxTile, stats.seconds);
+				totalTile += stats.seconds;
+			}
+
+			os << "Rendered " << tiles.size() << " tiles in " << renderSeconds << "s on " << threadStates.size() << " threads\n";
+			if (passes > 1 && !sampleCounts.empty())
+			{
+				uint64_t totalSamples = 0;
+				uint32_t minSamples = sampleCounts[0], maxSamples = 0;
+				for (auto it = sampleCounts.cbegin(); it < sampleCounts.cend(); ++it)
+				{
+					totalSamples += *it;
+					minSamples = std::min(minSamples, *it);
+					maxSamples = std::max(maxSamples, *it);
+				}
+				os << "  " << passes << " passes, samples per pixel min " << minSamples
+					<< ", mean " << static_cast<double>(totalSamples) / sampleCounts.size() << ", max " << maxSamples << "\n";
+			}
+			os << "  Tile time (ms): min " << minTile * 1000.0
+				<< ", mean " << totalTile * 1000.0 / tileStats.size()
+				<< ", max " << maxTile * 1000.0 << "\n";
+
+			// A thread's utilization is the fraction of the wall-clock render time it
+			// spent rendering tiles; a wide spread means the load was imbalanced
+			for (size_t i = 0; i < threadStates.size(); ++i)
+			{
+				const ThreadState &state = threadStates[i];
+				double utilization = renderSeconds > 0.0 ? state.busySeconds / renderSeconds : 0.0;
+				os << "  Thread " << i << ": " << state.tilesRendered << " tiles, "
+					<< state.busySeconds << "s busy (" << 100.0 * utilization << "%), arena peak "
+					<< state.arena->peakBytesInUse << " bytes\n";
+			}
+		}
+
+	} // namespace render
+
+} // namespace namaste
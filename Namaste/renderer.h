@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "parallel.h"
+#include "arena.h"
+
+namespace namaste {
+
+	namespace sampling {
+		class Sampler;
+	}
+
+	namespace render {
+
+		class Film;
+
+		// A rectangular bucket of pixels, [x0, x1) x [y0, y1)
+		struct Tile
+		{
+			int x0, y0;
+			int x1, y1;
+		};
+
+		// Splits an image into tiles of (at most) aTileSize x aTileSize pixels
+		std::vector<Tile> generateTiles(int aWidth, int aHeight, int aTileSize);
+
+		// Timing for a single tile, recorded by the thread that rendered it
+		struct TileStats
+		{
+			int thread;
+			double seconds;
+			uint64_t samples;
+		};
+
+		// Settings of TileRenderer::renderAdaptive
+		struct AdaptiveSampling
+		{
+			AdaptiveSampling();
+
+			// Samples every pixel takes in the first pass, before its variance is
+			// trusted
+			int initialSamples;
+			int maxSamplesPerPixel;
+			// A pixel has converged once the standard error of its mean luminance is
+			// below this fraction of the mean. errorFloor is added to the mean, so
+			// that nearly black pixels aren't held to an absurdly tight bound
+			float maxRelativeError;
+			float errorFloor;
+			int maxPasses;
+		};
+
+		// Running estimate of a pixel: the sum of its samples, and the mean and
+		// sum of squared deviations of their luminance, updated with Welford's
+		// method, which stays accurate in single precision
+		struct PixelEstimate
+		{
+			void add(const float rgb[3]);
+			// Standard error of the mean luminance, relative to the mean
+			float relativeError(float aErrorFloor) const;
+
+			float sum[3];
+			float luminanceMean;
+			float luminanceM2;
+			uint32_t samples;
+		};
+
+		// Estimates the radiance arriving at the film position (filmX, filmY) for the
+		// given sample of a pixel, writing it to rgb. Called concurrently from every
+		// thread of the pool, so it must not modify shared state. Temporaries can be
+		// allocated from the calling thread's arena, which is reset after every
+		// sample
+		using RadianceFunc = std::function<void(float filmX, float filmY, int sampleIndex, MemoryArena &arena, float rgb[3])>;
+
+		// Called after every pass of a progressive render with the image so far
+		using PassFunc = std::function<void(int pass, const std::vector<float> &pixels)>;
+
+		// Renders an image in tiles on a work-stealing thread pool. Each thread
+		// accumulates samples into its own scratch tile and only writes the
+		// finished tile to the image; tiles are disjoint, so the hot path takes
+		// no locks
+		class TileRenderer
+		{
+		public:
+			TileRenderer(int aWidth, int aHeight, int aSamplesPerPixel, int aTileSize = 16);
+			~TileRenderer();
+
+			void render(parallel::ThreadPool &aPool, const RadianceFunc &radiance);
+
+			// Renders into a film in passes with samplesPerPixel samples per pixel on
+			// average. After the first pass, which takes the same number of samples
+			// everywhere, each pass gives the pixels that haven't converged yet about
+			// as many samples as their error says they still need, so the budget goes
+			// to noisy tiles and only they are rendered again. It stops once every
+			// pixel has converged or the budget is spent. Samples come from the
+			// sampler, with consecutive indices per pixel, and are filtered into the
+			// film as by renderProgressive, which also explains aPassDone. Allocation
+			// only depends on the samples, so for a deterministic RadianceFunc the
+			// image doesn't depend on the number of threads or on scheduling
+			void renderAdaptive(parallel::ThreadPool &aPool, const RadianceFunc &radiance, const sampling::Sampler &aSampler, Film &film,
+				const AdaptiveSampling &aSettings = AdaptiveSampling(), const PassFunc &aPassDone = PassFunc());
+
+			// Renders into a film in passes of aSamplesPerPass samples per pixel,
+			// until samplesPerPixel have been taken. Samples are jittered over the
+			// pixel by the sampler's first two dimensions and filtered into the
+			// film tile of the tile being rendered. After each pass the film is
+			// resolved into pixels and aPassDone is called, e.g. to hand the image
+			// to an ImageWriter. The film must have this renderer's size and tile
+			// size
+			void renderProgressive(parallel::ThreadPool &aPool, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+				Film &film, int aSamplesPerPass, const PassFunc &aPassDone = PassFunc());
+
+			// Summarizes the per-tile timings and how busy each thread was, which
+			// shows up load imbalance on scenes whose cost is uneven across the image
+			void printStats(std::ostream &os) const;
+
+			int width;
+			int height;
+			int samplesPerPixel;
+			int tileSize;
+
+			// Final pixel values: width * height RGB triples in scanline order
+			std::vector<float> pixels;
+
+			// Indexed like the tiles returned by generateTiles
+			std::vector<Tile> tiles;
+			std::vector<TileStats> tileStats;
+
+			// Samples taken by each pixel, and the number of passes, of the last render
+			std::vector<uint32_t> sampleCounts;
+			int passes;
+		private:
+			// Per-thread state: only ever touched by its own thread during a render
+			struct ThreadState
+			{
+				std::vector<float> accumulation;
+				std::vector<float> samples;
+				std::unique_ptr<MemoryArena> arena;
+				double busySeconds;
+				uint64_t tilesRendered;
+			};
+
+			void startRender(parallel::ThreadPool &aPool);
+			void renderTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance);
+			void renderAdaptiveTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+				Film &film, const std::vector<uint32_t> &aPassSamples);
+			void renderFilmTile(int aTileIndex, int aThreadIndex, const RadianceFunc &radiance, const sampling::Sampler &aSampler,
+				Film &film, uint32_t aFirstSample, uint32_t aCount);
+
+			std::vector<ThreadState> threadStates;
+			std::vector<PixelEstimate> estimates;
+			double renderSeconds;
+		};
+
+	} // namespace render
+
+} // namespace namaste
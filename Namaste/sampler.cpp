@@ -0,0 +1,422 @@
+#include "stdafx.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace namaste {
+
+	namespace sampling {
+
+		namespace {
+
+			const uint32_t primes[HaltonSampler::maxDimensions] =
+			{
+				2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+				59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+			};
+
+			// The 64-bit MurmurHash3 finalizer
+			inline uint64_t mixBits(uint64_t v)
+			{
+				v ^= v >> 33;
+				v *= 0xff51afd7ed558ccdULL;
+				v ^= v >> 33;
+				v *= 0xc4ceb9fe1a85ec53ULL;
+				v ^= v >> 33;
+				return v;
+			}
+
+			inline uint32_t hash(uint64_t a, uint64_t b)
+			{
+				return static_cast<uint32_t>(mixBits(a ^ mixBits(b + 0x9e3779b97f4a7c15ULL)));
+			}
+
+			inline uint64_t pixelKey(int aPixelX, int aPixelY, uint32_t aSeed)
+			{
+				return mixBits((uint64_t(uint32_t(aPixelX)) << 32 | uint32_t(aPixelY)) ^ (uint64_t(aSeed) << 17));
+			}
+
+			inline float toFloat(uint32_t v)
+			{
+				return std::min(v * (1.0f / 4294967296.0f), oneMinusEpsilon);
+			}
+
+			inline uint32_t reverseBits(uint32_t v)
+			{
+				v = (v << 16) | (v >> 16);
+				v = ((v & 0x00ff00ffu) << 8) | ((v & 0xff00ff00u) >> 8);
+				v = ((v & 0x0f0f0f0fu) << 4) | ((v & 0xf0f0f0f0u) >> 4);
+				v = ((v & 0x33333333u) << 2) | ((v & 0xccccccccu) >> 2);
+				v = ((v & 0x55555555u) << 1) | ((v & 0xaaaaaaaau) >> 1);
+				return v;
+			}
+
+			// Laine and Karras' hash, which flips each bit depending only on the bits
+			// below it; on bit-reversed values that's a nested uniform (Owen)
+			// scramble. Constants from Burley (2020)
+			inline uint32_t laineKarrasPermutation(uint32_t v, uint32_t aSeed)
+			{
+				v += aSeed;
+				v ^= v * 0x6c50b47cu;
+				v ^= v * 0xb82f1e52u;
+				v ^= v * 0xc7afe638u;
+				v ^= v * 0x8d22f6e6u;
+				return v;
+			}
+
+			inline uint32_t owenScramble(uint32_t v, uint32_t aSeed)
+			{
+				return reverseBits(laineKarrasPermutation(reverseBits(v), aSeed));
+			}
+
+			// Kensler's hash-based permutation of [0, aLength): a different
+			// permutation for every aSeed, without storing any of them
+			uint32_t permute(uint32_t i, uint32_t aLength, uint32_t aSeed)
+			{
+				uint32_t w = aLength - 1;
+				w |= w >> 1;
+				w |= w >> 2;
+				w |= w >> 4;
+				w |= w >> 8;
+				w |= w >> 16;
+				do
+				{
+					i ^= aSeed; i *= 0xe170893du;
+					i ^= aSeed >> 16;
+					i ^= (i & w) >> 4;
+					i ^= aSeed >> 8; i *= 0x0929eb3fu;
+					i ^= aSeed >> 23;
+					i ^= (i & w) >> 1; i *= 1 | aSeed >> 27;
+					i *= 0x6935fa69u;
+					i ^= (i & w) >> 11; i *= 0x74dcb303u;
+					i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+					i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+					i &= w;
+					i ^= i >> 5;
+				} while (i >= aLength);
+				return (i + aSeed) % aLength;
+			}
+
+		} // anonymous namespace
+
+		// ---------------------------------------------------------------
+		// Sampler class
+		// ---------------------------------------------------------------
+		Sampler::Sampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed) :
+			samplesPerPixel(std::max(aSamplesPerPixel, 1)), dimensions(std::max(aDimensions, 1)), seed(aSeed)
+		{
+		}
+
+		Sampler::~Sampler()
+		{
+		}
+
+		// ---------------------------------------------------------------
+		// Random sampler class
+		// ---------------------------------------------------------------
+		RandomSampler::RandomSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed) :
+			Sampler(aSamplesPerPixel, aDimensions, aSeed)
+		{
+		}
+
+		RandomSampler::~RandomSampler()
+		{
+		}
+
+		void RandomSampler::generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const
+		{
+			uint64_t key = pixelKey(aPixelX, aPixelY, seed);
+			for (uint32_t s = 0; s < aCount; ++s)
+			{
+				uint64_t sampleKey = mixBits(key + aFirstSample + s);
+				for (int d = 0; d < dimensions; ++d)
+				{
+					*out++ = toFloat(hash(sampleKey, d));
+				}
+			}
+		}
+
+		const char* RandomSampler::name() const
+		{
+			return "random";
+		}
+
+		// ---------------------------------------------------------------
+		// Stratified sampler class
+		// ---------------------------------------------------------------
+		StratifiedSampler::StratifiedSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed) :
+			Sampler(aSamplesPerPixel, aDimensions, aSeed)
+		{
+			// The squarest grid of at most samplesPerPixel cells
+			strataX = std::max(static_cast<int>(std::sqrt(static_cast<double>(samplesPerPixel))), 1);
+			strataY = samplesPerPixel / strataX;
+		}
+
+		StratifiedSampler::~StratifiedSampler()
+		{
+		}
+
+		void StratifiedSampler::generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const
+		{
+			uint64_t key = pixelKey(aPixelX, aPixelY, seed);
+			uint32_t cells = strataX * strataY;
+			for (uint32_t s = 0; s < aCount; ++s)
+			{
+				uint32_t index = aFirstSample + s;
+				for (int d = 0; d < dimensions; d += 2)
+				{
+					// Past the first samplesPerPixel samples the strata are visited
+					// again, in a new order and with new jitter, every round
+					uint64_t pairKey = key + d;
+					uint32_t jitter = hash(pairKey, index);
+					if (d + 1 < dimensions)
+					{
+						uint32_t cell = permute(index % cells, cells, hash(pairKey, index / cells));
+						out[d] = std::min((cell % strataX + toFloat(jitter)) / strataX, oneMinusEpsilon);
+						out[d + 1] = std::min((cell / strataX + toFloat(hash(jitter, d))) / strataY, oneMinusEpsilon);
+					}
+					else
+					{
+						uint32_t n = static_cast<uint32_t>(samplesPerPixel);
+						uint32_t cell = permute(index % n, n, hash(pairKey, index / n));
+						out[d] = std::min((cell + toFloat(jitter)) / n, oneMinusEpsilon);
+					}
+				}
+				out += dimensions;
+			}
+		}
+
+		const char* StratifiedSampler::name() const
+		{
+			return "stratified";
+		}
+
+		// ---------------------------------------------------------------
+		// Halton sampler class
+		// ---------------------------------------------------------------
+		HaltonSampler::HaltonSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed) :
+			Sampler(aSamplesPerPixel, aDimensions, aSeed)
+		{
+			// Enough digits for any 32-bit index; each digit position gets its own
+			// permutation, so a dimension's table is base * digits entries
+			uint32_t offset = 0;
+			for (int d = 0; d < maxDimensions; ++d)
+			{
+				DimensionTable &table = tables[d];
+				table.base = primes[d];
+				table.digits = 0;
+				for (uint64_t range = 1; range <= 0xffffffffULL; range *= table.base)
+				{
+					++table.digits;
+				}
+				table.offset = offset;
+				table.weightOffset = static_cast<uint32_t>(weights.size());
+				table.scale = std::pow(static_cast<double>(table.base), -static_cast<double>(table.digits));
+				offset += table.base * table.digits;
+
+				weights.resize(weights.size() + table.digits);
+				uint64_t weight = 1;
+				for (uint32_t digit = table.digits; digit-- > 0; weight *= table.base)
+				{
+					weights[table.weightOffset + digit] = weight;
+				}
+			}
+
+			permutations.resize(offset);
+			for (int d = 0; d < std::min(dimensions, static_cast<int>(maxDimensions)); ++d)
+			{
+				const DimensionTable &table = tables[d];
+				for (uint32_t digit = 0; digit < table.digits; ++digit)
+				{
+					uint16_t *permutation = &permutations[table.offset + digit * table.base];
+					for (uint32_t i = 0; i < table.base; ++i)
+					{
+						permutation[i] = static_cast<uint16_t>(i);
+					}
+					// Fisher-Yates
+					for (uint32_t i = table.base - 1; i > 0; --i)
+					{
+						uint32_t j = hash(uint64_t(seed) << 32 | (d * 64 + digit), i) % (i + 1);
+						std::swap(permutation[i], permutation[j]);
+					}
+				}
+			}
+		}
+
+		HaltonSampler::~HaltonSampler()
+		{
+		}
+
+		void HaltonSampler::generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const
+		{
+			// The pixel's stretch of the sequence starts at a hashed offset, far
+			// enough apart that pixels don't share samples in practice
+			uint64_t key = pixelKey(aPixelX, aPixelY, seed);
+			uint32_t start = (static_cast<uint32_t>(key) & 0x3fffffffu) + aFirstSample;
+			int tabled = std::min(dimensions, static_cast<int>(maxDimensions));
+			uint32_t digits[32];
+			for (int d = 0; d < tabled; ++d)
+			{
+				const DimensionTable &table = tables[d];
+				const uint16_t *permutation = &permutations[table.offset];
+				const uint64_t *weight = &weights[table.weightOffset];
+
+				// Every digit position is permuted, trailing zeros included, so the
+				// scrambled value always has all of the table's digits
+				uint64_t reversed = 0;
+				uint32_t index = start;
+				for (uint32_t digit = 0; digit < table.digits; ++digit)
+				{
+					uint32_t next = index / table.base;
+					digits[digit] = index - next * table.base;
+					reversed += permutation[digit * table.base + digits[digit]] * weight[digit];
+					index = next;
+				}
+
+				float *value = out + d;
+				for (uint32_t s = 0; s < aCount; ++s, value += dimensions)
+				{
+					*value = std::min(static_cast<float>(reversed * table.scale), oneMinusEpsilon);
+
+					// Count up to the next index, carrying as far as needed
+					for (uint32_t digit = 0; digit < table.digits; ++digit)
+					{
+						const uint16_t *digitPermutation = permutation + digit * table.base;
+						uint32_t old = digits[digit];
+						digits[digit] = old + 1 == table.base ? 0 : old + 1;
+						reversed += (uint64_t(digitPermutation[digits[digit]]) - digitPermutation[old]) * weight[digit];
+						if (digits[digit] != 0)
+						{
+							break;
+						}
+					}
+				}
+			}
+
+			for (int d = tabled; d < dimensions; ++d)
+			{
+				float *value = out + d;
+				for (uint32_t s = 0; s < aCount; ++s, value += dimensions)
+				{
+					*value = toFloat(hash(key + start + s, d));
+				}
+			}
+		}
+
+		const char* HaltonSampler::name() const
+		{
+			return "halton";
+		}
+
+		// ---------------------------------------------------------------
+		// Sobol sampler class
+		// ---------------------------------------------------------------
+		SobolSampler::SobolSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed) :
+			Sampler(aSamplesPerPixel, aDimensions, aSeed)
+		{
+			// The first dimension's generator matrix is the identity, bit-reversed
+			// (the van der Corput sequence); the second's columns follow from the
+			// primitive polynomial x + 1 with all initial direction numbers 1
+			uint32_t directions[32][2];
+			directions[0][0] = directions[0][1] = 0x80000000u;
+			for (int bit = 1; bit < 32; ++bit)
+			{
+				directions[bit][0] = 0x80000000u >> bit;
+				directions[bit][1] = directions[bit - 1][1] ^ (directions[bit - 1][1] >> 1);
+			}
+
+			// Each entry is the XOR of the directions of the bits set in its byte
+			for (int byte = 0; byte < 4; ++byte)
+			{
+				byteTables[byte][0][0] = byteTables[byte][0][1] = 0;
+				for (int value = 1; value < 256; ++value)
+				{
+					int lowBit = 0;
+					while (!(value & (1 << lowBit)))
+					{
+						++lowBit;
+					}
+					const uint32_t *rest = byteTables[byte][value & (value - 1)];
+					byteTables[byte][value][0] = rest[0] ^ directions[byte * 8 + lowBit][0];
+					byteTables[byte][value][1] = rest[1] ^ directions[byte * 8 + lowBit][1];
+				}
+			}
+		}
+
+		SobolSampler::~SobolSampler()
+		{
+		}
+
+		void SobolSampler::generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const
+		{
+			uint64_t key = pixelKey(aPixelX, aPixelY, seed);
+			for (int d = 0; d < dimensions; d += 2)
+			{
+				uint32_t indexSeed = hash(key, d);
+				uint32_t xSeed = hash(key, d + 0x10000);
+				uint32_t ySeed = hash(key, d + 0x20000);
+				bool pair = d + 1 < dimensions;
+				float *sample = out + d;
+				for (uint32_t s = 0; s < aCount; ++s, sample += dimensions)
+				{
+					// Shuffling the index with an Owen scramble keeps every
+					// power-of-two run of samples a (0, m, 2)-net
+					uint32_t index = owenScramble(aFirstSample + s, indexSeed);
+					const uint32_t *b0 = byteTables[0][index & 0xff];
+					const uint32_t *b1 = byteTables[1][(index >> 8) & 0xff];
+					const uint32_t *b2 = byteTables[2][(index >> 16) & 0xff];
+					const uint32_t *b3 = byteTables[3][index >> 24];
+					sample[0] = toFloat(owenScramble(b0[0] ^ b1[0] ^ b2[0] ^ b3[0], xSeed));
+					if (pair)
+					{
+						sample[1] = toFloat(owenScramble(b0[1] ^ b1[1] ^ b2[1] ^ b3[1], ySeed));
+					}
+				}
+			}
+		}
+
+		const char* SobolSampler::name() const
+		{
+			return "sobol";
+		}
+
+		// ---------------------------------------------------------------
+		// Presets
+		// ---------------------------------------------------------------
+		SamplerSettings productionSettings()
+		{
+			SamplerSettings settings;
+			settings.type = SamplerSobol;
+			settings.samplesPerPixel = 64;
+			settings.dimensions = 8;
+			settings.seed = 0;
+			return settings;
+		}
+
+		SamplerSettings previewSettings()
+		{
+			SamplerSettings settings = productionSettings();
+			settings.samplesPerPixel = 4;
+			return settings;
+		}
+
+		std::unique_ptr<Sampler> createSampler(const SamplerSettings &aSettings)
+		{
+			switch (aSettings.type)
+			{
+			case SamplerRandom:
+				return std::unique_ptr<Sampler>(new RandomSampler(aSettings.samplesPerPixel, aSettings.dimensions, aSettings.seed));
+			case SamplerStratified:
+				return std::unique_ptr<Sampler>(new StratifiedSampler(aSettings.samplesPerPixel, aSettings.dimensions, aSettings.seed));
+			case SamplerHalton:
+				return std::unique_ptr<Sampler>(new HaltonSampler(aSettings.samplesPerPixel, aSettings.dimensions, aSettings.seed));
+			case SamplerSobol:
+			default:
+				return std::unique_ptr<Sampler>(new SobolSampler(aSettings.samplesPerPixel, aSettings.dimensions, aSettings.seed));
+			}
+		}
+
+	} // namespace sampling
+
+} // namespace namaste
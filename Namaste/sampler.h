@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace namaste {
+
+	namespace sampling {
+
+		// The largest float below 1, so that samples stay in [0, 1)
+		static const float oneMinusEpsilon = 0.99999994f;
+
+		// Generates the sample vectors of each pixel: for sample i of pixel
+		// (x, y), dimensions values in [0, 1). Samples are a pure function of
+		// the pixel, the sample index and the seed, so any sample can be asked for
+		// in any order from any thread, and renders are reproducible. Samples are
+		// generated in batches rather than one value per virtual call. Indices
+		// past samplesPerPixel are fine (adaptive sampling asks for them) and
+		// carry on the pixel's sequence
+		class Sampler
+		{
+		public:
+			Sampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed);
+			virtual ~Sampler();
+
+			Sampler(const Sampler &) = delete;
+			Sampler& operator=(const Sampler &) = delete;
+
+			// Writes samples [aFirstSample, aFirstSample + aCount) of pixel
+			// (aPixelX, aPixelY) to out, sample by sample: aCount * dimensions floats
+			virtual void generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const = 0;
+
+			virtual const char* name() const = 0;
+
+			const int samplesPerPixel;
+			const int dimensions;
+			const uint32_t seed;
+		};
+
+		// Independent uniform random samples, the baseline the others are
+		// measured against
+		class RandomSampler : public Sampler
+		{
+		public:
+			RandomSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed);
+			~RandomSampler();
+
+			void generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const override;
+			const char* name() const override;
+		};
+
+		// Jittered samples, one per stratum: dimensions are taken in pairs, each
+		// stratified over a grid of about sqrt(samplesPerPixel) cells a side (a
+		// lone last dimension over samplesPerPixel intervals). Every pixel and
+		// pair visits the strata in its own order, shuffled with Kensler's
+		// hash-based permutation, so pairs aren't correlated with each other and
+		// no per-pixel tables are needed
+		class StratifiedSampler : public Sampler
+		{
+		public:
+			StratifiedSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed);
+			~StratifiedSampler();
+
+			void generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const override;
+			const char* name() const override;
+		private:
+			int strataX, strataY;
+		};
+
+		// The Halton sequence, dimension d being the radical inverse in the d-th
+		// prime base with its digits scrambled by random permutations, one per
+		// digit position, which breaks up the correlation between the higher
+		// dimensions. The permutations are built once from the seed and stored
+		// contiguously per dimension, in digit order. A batch works through one
+		// dimension at a time, finding the digits of its first index and then
+		// counting up, so that most samples change a single digit and cost one
+		// table lookup instead of a division per digit. Each pixel takes its own
+		// stretch of the sequence. Dimensions beyond the table of primes are
+		// filled with random values
+		class HaltonSampler : public Sampler
+		{
+		public:
+			static const int maxDimensions = 32;
+
+			HaltonSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed);
+			~HaltonSampler();
+
+			void generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const override;
+			const char* name() const override;
+		private:
+			struct DimensionTable
+			{
+				uint32_t base;
+				uint32_t digits;
+				uint32_t offset;			// Of the first permutation in permutations
+				uint32_t weightOffset;		// Of the first digit's weight in weights
+				double scale;				// base^-digits
+			};
+
+			DimensionTable tables[maxDimensions];
+			std::vector<uint16_t> permutations;
+			std::vector<uint64_t> weights;		// base^(digits - 1 - digit) for each digit
+		};
+
+		// Owen-scrambled Sobol points, after Burley (2020): every pair of
+		// dimensions is the first two dimensions of the Sobol sequence, a (0, 2)
+		// sequence in base 2, with the sample index shuffled and each dimension
+		// nested-uniform scrambled by a hash seeded per pixel and pair. Each pair
+		// is thus as well stratified as a 2D point set can be, and pairs are
+		// independent of one another. The shuffled index is a full 32-bit value,
+		// so rather than XOR a direction vector per set bit, the generator
+		// matrices are tabulated a byte of the index at a time, both dimensions
+		// side by side: four lookups per point, 8 KB of table
+		class SobolSampler : public Sampler
+		{
+		public:
+			SobolSampler(int aSamplesPerPixel, int aDimensions, uint32_t aSeed);
+			~SobolSampler();
+
+			void generate(int aPixelX, int aPixelY, uint32_t aFirstSample, uint32_t aCount, float *out) const override;
+			const char* name() const override;
+		private:
+			uint32_t byteTables[4][256][2];		// [index byte][byte value][dimension]
+		};
+
+		enum SamplerType
+		{
+			SamplerRandom,
+			SamplerStratified,
+			SamplerHalton,
+			SamplerSobol
+		};
+
+		struct SamplerSettings
+		{
+			SamplerType type;
+			int samplesPerPixel;
+			int dimensions;
+			uint32_t seed;
+		};
+
+		// Final-quality sampling, and the low sample count preview that
+		// Options::quickRender selects
+		SamplerSettings productionSettings();
+		SamplerSettings previewSettings();
+
+		std::unique_ptr<Sampler> createSampler(const SamplerSettings &aSettings);
+
+	} // namespace sampling
+
+} // namespace namaste
@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "scene.h"
+#include "batch.h"
+
+namespace namaste {
+
+	namespace scene {
+
+		// ---------------------------------------------------------------
+		// Scene geometry class
+		// ---------------------------------------------------------------
+		SceneGeometry::SceneGeometry()
+		{
+		}
+
+		SceneGeometry::~SceneGeometry()
+		{
+		}
+
+		size_t SceneGeometry::vertexCount() const
+		{
+			return px.size();
+		}
+
+		size_t SceneGeometry::triangleCount() const
+		{
+			return indices.size() / 3;
+		}
+
+		geom::BBox SceneGeometry::worldBound() const
+		{
+			return geom::batch::bounds(px.data(), py.data(), pz.data(), px.size());
+		}
+
+		GeometryView SceneGeometry::view() const
+		{
+			GeometryView view;
+			view.px = px.data();
+			view.py = py.data();
+			view.pz = pz.data();
+			view.nx = nx.empty() ? nullptr : nx.data();
+			view.ny = ny.empty() ? nullptr : ny.data();
+			view.nz = nz.empty() ? nullptr : nz.data();
+			view.u = u.empty() ? nullptr : u.data();
+			view.v = v.empty() ? nullptr : v.data();
+			view.indices = indices.data();
+			view.meshes = meshes.data();
+			view.vertexCount = px.size();
+			view.indexCount = indices.size();
+			view.meshCount = meshes.size();
+			return view;
+		}
+
+		void SceneGeometry::truncate(size_t aVertexCount, size_t aIndexCount)
+		{
+			px.resize(aVertexCount);
+			py.resize(aVertexCount);
+			pz.resize(aVertexCount);
+			if (nx.size() > aVertexCount)
+			{
+				nx.resize(aVertexCount);
+				ny.resize(aVertexCount);
+				nz.resize(aVertexCount);
+			}
+			if (u.size() > aVertexCount)
+			{
+				u.resize(aVertexCount);
+				v.resize(aVertexCount);
+			}
+			indices.resize(aIndexCount);
+		}
+
+		void SceneGeometry::append(const SceneGeometry &other)
+		{
+			const size_t baseVertex = px.size();
+			const size_t baseIndex = indices.size();
+			const size_t otherVertices = other.px.size();
+
+			px.insert(px.end(), other.px.begin(), other.px.end());
+			py.insert(py.end(), other.py.begin(), other.py.end());
+			pz.insert(pz.end(), other.pz.begin(), other.pz.end());
+
+			// Pad whichever side lacks normals or uvs, to keep the arrays in step
+			if (!nx.empty() || !other.nx.empty())
+			{
+				nx.resize(baseVertex, 0.0f);
+				ny.resize(baseVertex, 0.0f);
+				nz.resize(baseVertex, 0.0f);
+				if (other.nx.empty())
+				{
+					nx.resize(baseVertex + otherVertices, 0.0f);
+					ny.resize(baseVertex + otherVertices, 0.0f);
+					nz.resize(baseVertex + otherVertices, 0.0f);
+				}
+				else
+				{
+					nx.insert(nx.end(), other.nx.begin(), other.nx.end());
+					ny.insert(ny.end(), other.ny.begin(), other.ny.end());
+					nz.insert(nz.end(), other.nz.begin(), other.nz.end());
+				}
+			}
+			if (!u.empty() || !other.u.empty())
+			{
+				u.resize(baseVertex, 0.0f);
+				v.resize(baseVertex, 0.0f);
+				if (other.u.empty())
+				{
+					u.resize(baseVertex + otherVertices, 0.0f);
+					v.resize(baseVertex + otherVertices, 0.0f);
+				}
+				else
+				{
+					u.insert(u.end(), other.u.begin(), other.u.end());
+					v.insert(v.end(), other.v.begin(), other.v.end());
+				}
+			}
+
+			indices.resize(baseIndex + other.indices.size());
+			for (size_t i = 0; i < other.indices.size(); ++i)
+			{
+				indices[baseIndex + i] = other.indices[i] + static_cast<uint32_t>(baseVertex);
+			}
+
+			for (auto it = other.meshes.cbegin(); it != other.meshes.cend(); ++it)
+			{
+				MeshRange mesh = *it;
+				mesh.firstVertex += static_cast<uint32_t>(baseVertex);
+				mesh.firstIndex += static_cast<uint32_t>(baseIndex);
+				meshes.push_back(mesh);
+			}
+		}
+
+		// ---------------------------------------------------------------
+		// Scene class
+		// ---------------------------------------------------------------
+		Scene::Scene()
+		{
+		}
+
+		Scene::~Scene()
+		{
+		}
+
+		void Scene::append(const Scene &other)
+		{
+			geometry.append(other.geometry);
+			if (other.options.filmSpecified)
+			{
+				options.xResolution = other.options.xResolution;
+				options.yResolution = other.options.yResolution;
+				options.imageFile = other.options.imageFile;
+				options.filmSpecified = true;
+			}
+			if (other.options.samplerSpecified)
+			{
+				options.pixelSamples = other.options.pixelSamples;
+				options.samplerSpecified = true;
+			}
+		}
+
+	} // namespace scene
+
+} // namespace namaste
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "geometry.h"
+
+namespace namaste {
+
+	namespace scene {
+
+		// Settings picked up from the Film and Sampler directives
+		struct SceneOptions
+		{
+			SceneOptions()
+			{
+				xResolution = 640;
+				yResolution = 480;
+				pixelSamples = 16;
+				imageFile = "";
+				filmSpecified = samplerSpecified = false;
+			}
+
+			int xResolution, yResolution;
+			int pixelSamples;
+			std::string imageFile;
+			// Whether the settings above came from the scene or are defaults
+			bool filmSpecified, samplerSpecified;
+		};
+
+		// One triangle mesh's slice of the shared vertex and index buffers
+		struct MeshRange
+		{
+			uint32_t firstVertex, vertexCount;
+			uint32_t firstIndex, indexCount;
+			bool hasNormals, hasUVs;
+		};
+
+		// Read-only view of a scene's geometry, wherever it lives: in a parsed
+		// SceneGeometry or straight in a memory-mapped scene cache. The normal
+		// and uv pointers are null when the scene has none
+		struct GeometryView
+		{
+			const float *px, *py, *pz;
+			const float *nx, *ny, *nz;
+			const float *u, *v;
+			const uint32_t *indices;
+			const MeshRange *meshes;
+			size_t vertexCount, indexCount, meshCount;
+
+			size_t triangleCount() const { return indexCount / 3; }
+		};
+
+		// All of the scene's triangles, already transformed to world space.
+		// Vertex attributes are kept in structure-of-arrays form, one array per
+		// component, so the parser can append straight into them and the batch
+		// kernels can process them without any repacking. Indices are global,
+		// i.e. they already include the mesh's firstVertex. The normal and uv
+		// arrays are either empty or as long as the position arrays (meshes
+		// without them are padded with zeros, see MeshRange::hasNormals/hasUVs)
+		class SceneGeometry
+		{
+		public:
+			SceneGeometry();
+			~SceneGeometry();
+
+			size_t vertexCount() const;
+			size_t triangleCount() const;
+			geom::BBox worldBound() const;
+			GeometryView view() const;
+
+			// Drops everything appended since the given vertex and index counts,
+			// used to back out of a mesh that turned out to be malformed
+			void truncate(size_t aVertexCount, size_t aIndexCount);
+
+			// Appends another scene's geometry after this one's, rebasing its
+			// indices and mesh ranges
+			void append(const SceneGeometry &other);
+
+			std::vector<float> px, py, pz;
+			std::vector<float> nx, ny, nz;
+			std::vector<float> u, v;
+			std::vector<uint32_t> indices;
+			std::vector<MeshRange> meshes;
+		};
+
+		class Scene
+		{
+		public:
+			Scene();
+			~Scene();
+
+			// Merges a scene parsed separately, as if its file had been parsed
+			// after this scene's: its geometry is appended, and its Film and
+			// Sampler settings win if it has any
+			void append(const Scene &other);
+
+			SceneOptions options;
+			SceneGeometry geometry;
+		};
+
+	} // namespace scene
+
+} // namespace namaste
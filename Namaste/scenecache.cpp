@@ -0,0 +1,435 @@
+#include "stdafx.h"
+#include "scenecache.h"
+#include "batch.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace namaste {
+
+	namespace scene {
+
+		using namespace geom;
+
+		enum CacheSection
+		{
+			SectionPX, SectionPY, SectionPZ,
+			SectionNX, SectionNY, SectionNZ,
+			SectionU, SectionV,
+			SectionIndices,
+			SectionMeshes,
+			SectionMeshBounds,
+			SectionBVHNodes,
+			SectionBVHIndices,
+			SectionInputs,		// Null-terminated file names
+			SectionSources,
+			SectionImageFile,
+			SectionCount
+		};
+
+		struct CacheSectionEntry
+		{
+			uint64_t offset, size;	// In bytes
+		};
+
+		struct SceneCacheHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t byteOrder;
+			uint64_t fileSize;
+			uint64_t sourceHash;
+			int32_t xResolution, yResolution, pixelSamples;
+			uint32_t flags;
+			int32_t bvhMaxPrimsInNode;
+			float worldBound[6];
+			uint32_t pad;
+			CacheSectionEntry sections[SectionCount];
+		};
+
+		namespace {
+
+			const char cacheMagic[8] = { 'N', 'A', 'M', 'A', 'S', 'T', 'E', 'C' };
+			const uint32_t cacheByteOrder = 0x01020304;
+			const uint64_t cacheAlignment = 64;
+
+			enum CacheFlags
+			{
+				FlagFilmSpecified = 1 << 0,
+				FlagSamplerSpecified = 1 << 1
+			};
+
+			inline uint64_t rotl(uint64_t x, int r)
+			{
+				return (x << r) | (x >> (64 - r));
+			}
+
+			inline uint64_t finalizeHash(uint64_t h)
+			{
+				h ^= h >> 33;
+				h *= 0xff51afd7ed558ccdULL;
+				h ^= h >> 33;
+				h *= 0xc4ceb9fe1a85ec53ULL;
+				h ^= h >> 33;
+				return h;
+			}
+
+			inline uint64_t mixWord(uint64_t h, uint64_t k)
+			{
+				k *= 0x87c37b91114253d5ULL;
+				k = rotl(k, 31);
+				k *= 0x4cf5ad432745937fULL;
+				return rotl(h ^ k, 27) * 5 + 0x52dce729;
+			}
+
+			// A non-cryptographic hash that consumes 32 bytes per iteration in four
+			// independent lanes, so it runs at close to memory bandwidth
+			uint64_t hashBytes(const char *data, size_t size, uint64_t seed)
+			{
+				uint64_t h[4] = { seed, seed + 1, seed + 2, seed + 3 };
+
+				size_t i = 0;
+				for (; i + 32 <= size; i += 32)
+				{
+					for (int lane = 0; lane < 4; ++lane)
+					{
+						uint64_t k;
+						memcpy(&k, data + i + 8 * lane, 8);
+						h[lane] = mixWord(h[lane], k);
+					}
+				}
+				for (; i + 8 <= size; i += 8)
+				{
+					uint64_t k;
+					memcpy(&k, data + i, 8);
+					h[0] = mixWord(h[0], k);
+				}
+				uint64_t tail = 0;
+				memcpy(&tail, data + i, size - i);
+
+				uint64_t combined = mixWord(h[0], tail) ^ rotl(h[1], 17) ^ rotl(h[2], 31) ^ rotl(h[3], 47);
+				return finalizeHash(combined ^ size);
+			}
+
+			void appendStrings(std::vector<char> *out, const std::vector<std::string> &strings)
+			{
+				for (auto it = strings.cbegin(); it != strings.cend(); ++it)
+				{
+					out->insert(out->end(), it->begin(), it->end());
+					out->push_back('\0');
+				}
+			}
+
+			std::vector<std::string> splitStrings(const char *data, uint64_t size)
+			{
+				std::vector<std::string> strings;
+				const char *end = data + size;
+				while (data < end)
+				{
+					const char *terminator = static_cast<const char*>(memchr(data, '\0', end - data));
+					if (!terminator)
+					{
+						break;
+					}
+					strings.push_back(std::string(data, terminator));
+					data = terminator + 1;
+				}
+				return strings;
+			}
+
+		} // namespace
+
+		bool hashSourceFiles(const std::vector<std::string> &files, uint64_t *hash)
+		{
+			uint64_t h = sceneCacheVersion;
+			for (auto it = files.cbegin(); it != files.cend(); ++it)
+			{
+				MappedFile source;
+				if (!source.open(*it))
+				{
+					return false;
+				}
+				h = hashBytes(it->data(), it->size(), h);
+				h = hashBytes(source.data(), source.size(), h);
+			}
+			*hash = h;
+			return true;
+		}
+
+		bool writeSceneCache(const std::string &cacheFile, const Scene &scene,
+			const std::vector<std::string> &inputs, const std::vector<std::string> &sources,
+			const accel::BVHAccel *bvh)
+		{
+			SceneCacheHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+			header.version = sceneCacheVersion;
+			header.byteOrder = cacheByteOrder;
+			if (!hashSourceFiles(sources, &header.sourceHash))
+			{
+				return false;
+			}
+
+			const SceneOptions &options = scene.options;
+			header.xResolution = options.xResolution;
+			header.yResolution = options.yResolution;
+			header.pixelSamples = options.pixelSamples;
+			header.flags = (options.filmSpecified ? FlagFilmSpecified : 0) | (options.samplerSpecified ? FlagSamplerSpecified : 0);
+
+			const SceneGeometry &g = scene.geometry;
+			BBox bound = g.worldBound();
+			const float worldBound[6] = { bound.pMin.x, bound.pMin.y, bound.pMin.z, bound.pMax.x, bound.pMax.y, bound.pMax.z };
+			memcpy(header.worldBound, worldBound, sizeof(worldBound));
+
+			std::vector<BBox> meshBounds(g.meshes.size());
+			for (size_t i = 0; i < g.meshes.size(); ++i)
+			{
+				const MeshRange &mesh = g.meshes[i];
+				meshBounds[i] = batch::bounds(&g.px[mesh.firstVertex], &g.py[mesh.firstVertex], &g.pz[mesh.firstVertex], mesh.vertexCount);
+			}
+
+			std::vector<char> inputNames, sourceNames, imageFile;
+			appendStrings(&inputNames, inputs);
+			appendStrings(&sourceNames, sources);
+			appendStrings(&imageFile, std::vector<std::string>(1, options.imageFile));
+
+			const void *data[SectionCount] = {};
+			uint64_t sizes[SectionCount] = {};
+			auto setSection = [&](int aSection, const void *aData, size_t aSize) {
+				data[aSection] = aData;
+				sizes[aSection] = aSize;
+			};
+			const size_t vertexBytes = g.px.size() * sizeof(float);
+			setSection(SectionPX, g.px.data(), vertexBytes);
+			setSection(SectionPY, g.py.data(), vertexBytes);
+			setSection(SectionPZ, g.pz.data(), vertexBytes);
+			setSection(SectionNX, g.nx.data(), g.nx.size() * sizeof(float));
+			setSection(SectionNY, g.ny.data(), g.ny.size() * sizeof(float));
+			setSection(SectionNZ, g.nz.data(), g.nz.size() * sizeof(float));
+			setSection(SectionU, g.u.data(), g.u.size() * sizeof(float));
+			setSection(SectionV, g.v.data(), g.v.size() * sizeof(float));
+			setSection(SectionIndices, g.indices.data(), g.indices.size() * sizeof(uint32_t));
+			setSection(SectionMeshes, g.meshes.data(), g.meshes.size() * sizeof(MeshRange));
+			setSection(SectionMeshBounds, meshBounds.data(), meshBounds.size() * sizeof(BBox));
+			if (bvh)
+			{
+				header.bvhMaxPrimsInNode = bvh->maxPrimsInNode;
+				setSection(SectionBVHNodes, bvh->nodes.data(), bvh->nodes.size() * sizeof(accel::LinearBVHNode));
+				setSection(SectionBVHIndices, bvh->primitiveIndices.data(), bvh->primitiveIndices.size() * sizeof(uint32_t));
+			}
+			setSection(SectionInputs, inputNames.data(), inputNames.size());
+			setSection(SectionSources, sourceNames.data(), sourceNames.size());
+			setSection(SectionImageFile, imageFile.data(), imageFile.size());
+
+			uint64_t offset = sizeof(SceneCacheHeader);
+			for (int i = 0; i < SectionCount; ++i)
+			{
+				offset = (offset + cacheAlignment - 1) & ~(cacheAlignment - 1);
+				header.sections[i].offset = offset;
+				header.sections[i].size = sizes[i];
+				offset += sizes[i];
+			}
+			header.fileSize = offset;
+
+			std::string temporaryFile = cacheFile + ".tmp";
+			{
+				std::ofstream out(temporaryFile, std::ios::binary | std::ios::trunc);
+				if (!out)
+				{
+					return false;
+				}
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				const char zeros[cacheAlignment] = {};
+				uint64_t written = sizeof(header);
+				for (int i = 0; i < SectionCount; ++i)
+				{
+					out.write(zeros, static_cast<std::streamsize>(header.sections[i].offset - written));
+					if (sizes[i])
+					{
+						out.write(static_cast<const char*>(data[i]), static_cast<std::streamsize>(sizes[i]));
+					}
+					written = header.sections[i].offset + sizes[i];
+				}
+				if (!out)
+				{
+					out.close();
+					std::remove(temporaryFile.c_str());
+					return false;
+				}
+			}
+
+			// rename() won't replace an existing file on Windows
+			std::remove(cacheFile.c_str());
+			if (std::rename(temporaryFile.c_str(), cacheFile.c_str()) != 0)
+			{
+				std::remove(temporaryFile.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// ---------------------------------------------------------------
+		// Scene cache class
+		// ---------------------------------------------------------------
+		SceneCache::SceneCache() :
+			header(nullptr)
+		{
+		}
+
+		SceneCache::~SceneCache()
+		{
+		}
+
+		bool SceneCache::open(const std::string &cacheFile)
+		{
+			close();
+			if (!file.open(cacheFile) || file.size() < sizeof(SceneCacheHeader))
+			{
+				close();
+				return false;
+			}
+
+			const SceneCacheHeader *h = reinterpret_cast<const SceneCacheHeader*>(file.data());
+			bool valid = memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+				h->version == sceneCacheVersion &&
+				h->byteOrder == cacheByteOrder &&
+				h->fileSize == file.size();
+
+			// Every section must lie within the file and be suitably aligned
+			for (int i = 0; valid && i < SectionCount; ++i)
+			{
+				const CacheSectionEntry &s = h->sections[i];
+				valid = s.offset % cacheAlignment == 0 && s.offset <= h->fileSize && s.size <= h->fileSize - s.offset;
+			}
+			if (valid)
+			{
+				const uint64_t vertexBytes = h->sections[SectionPX].size;
+				valid = vertexBytes % sizeof(float) == 0 &&
+					h->sections[SectionPY].size == vertexBytes && h->sections[SectionPZ].size == vertexBytes &&
+					(h->sections[SectionNX].size == 0 || h->sections[SectionNX].size == vertexBytes) &&
+					h->sections[SectionNY].size == h->sections[SectionNX].size && h->sections[SectionNZ].size == h->sections[SectionNX].size &&
+					(h->sections[SectionU].size == 0 || h->sections[SectionU].size == vertexBytes) &&
+					h->sections[SectionV].size == h->sections[SectionU].size &&
+					h->sections[SectionIndices].size % sizeof(uint32_t) == 0 &&
+					h->sections[SectionMeshes].size % sizeof(MeshRange) == 0 &&
+					h->sections[SectionMeshBounds].size / sizeof(BBox) == h->sections[SectionMeshes].size / sizeof(MeshRange) &&
+					h->sections[SectionBVHNodes].size % sizeof(accel::LinearBVHNode) == 0 &&
+					h->sections[SectionBVHIndices].size % sizeof(uint32_t) == 0;
+			}
+			if (!valid)
+			{
+				close();
+				return false;
+			}
+
+			header = h;
+			return true;
+		}
+
+		void SceneCache::close()
+		{
+			file.close();
+			header = nullptr;
+		}
+
+		bool SceneCache::isValidFor(const std::vector<std::string> &inputs) const
+		{
+			if (!header || inputFiles() != inputs)
+			{
+				return false;
+			}
+			uint64_t hash;
+			return hashSourceFiles(sourceFiles(), &hash) && hash == header->sourceHash;
+		}
+
+		const void* SceneCache::section(int aSection, uint64_t *size) const
+		{
+			const CacheSectionEntry &s = header->sections[aSection];
+			if (size)
+			{
+				*size = s.size;
+			}
+			return s.size ? file.data() + s.offset : nullptr;
+		}
+
+		GeometryView SceneCache::geometry() const
+		{
+			GeometryView view;
+			uint64_t vertexBytes, indexBytes, meshBytes;
+			view.px = static_cast<const float*>(section(SectionPX, &vertexBytes));
+			view.py = static_cast<const float*>(section(SectionPY));
+			view.pz = static_cast<const float*>(section(SectionPZ));
+			view.nx = static_cast<const float*>(section(SectionNX));
+			view.ny = static_cast<const float*>(section(SectionNY));
+			view.nz = static_cast<const float*>(section(SectionNZ));
+			view.u = static_cast<const float*>(section(SectionU));
+			view.v = static_cast<const float*>(section(SectionV));
+			view.indices = static_cast<const uint32_t*>(section(SectionIndices, &indexBytes));
+			view.meshes = static_cast<const MeshRange*>(section(SectionMeshes, &meshBytes));
+			view.vertexCount = static_cast<size_t>(vertexBytes / sizeof(float));
+			view.indexCount = static_cast<size_t>(indexBytes / sizeof(uint32_t));
+			view.meshCount = static_cast<size_t>(meshBytes / sizeof(MeshRange));
+			return view;
+		}
+
+		const BBox* SceneCache::meshBounds() const
+		{
+			return static_cast<const BBox*>(section(SectionMeshBounds));
+		}
+
+		BBox SceneCache::worldBound() const
+		{
+			const float *b = header->worldBound;
+			BBox bound;
+			bound.pMin = Point(b[0], b[1], b[2]);
+			bound.pMax = Point(b[3], b[4], b[5]);
+			return bound;
+		}
+
+		SceneOptions SceneCache::options() const
+		{
+			SceneOptions options;
+			options.xResolution = header->xResolution;
+			options.yResolution = header->yResolution;
+			options.pixelSamples = header->pixelSamples;
+			options.filmSpecified = (header->flags & FlagFilmSpecified) != 0;
+			options.samplerSpecified = (header->flags & FlagSamplerSpecified) != 0;
+			uint64_t size;
+			const char *imageFile = static_cast<const char*>(section(SectionImageFile, &size));
+			std::vector<std::string> strings = splitStrings(imageFile, size);
+			options.imageFile = strings.empty() ? "" : strings[0];
+			return options;
+		}
+
+		bool SceneCache::hasBVH() const
+		{
+			return header->sections[SectionBVHNodes].size != 0;
+		}
+
+		accel::BVHAccel SceneCache::loadBVH() const
+		{
+			uint64_t nodeBytes, indexBytes;
+			const accel::LinearBVHNode *nodes = static_cast<const accel::LinearBVHNode*>(section(SectionBVHNodes, &nodeBytes));
+			const uint32_t *indices = static_cast<const uint32_t*>(section(SectionBVHIndices, &indexBytes));
+			return accel::BVHAccel(nodes, static_cast<size_t>(nodeBytes / sizeof(accel::LinearBVHNode)),
+				indices, static_cast<size_t>(indexBytes / sizeof(uint32_t)), header->bvhMaxPrimsInNode);
+		}
+
+		std::vector<std::string> SceneCache::inputFiles() const
+		{
+			uint64_t size;
+			const char *names = static_cast<const char*>(section(SectionInputs, &size));
+			return splitStrings(names, size);
+		}
+
+		std::vector<std::string> SceneCache::sourceFiles() const
+		{
+			uint64_t size;
+			const char *names = static_cast<const char*>(section(SectionSources, &size));
+			return splitStrings(names, size);
+		}
+
+	} // namespace scene
+
+} // namespace namaste
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "geometry.h"
+#include "scene.h"
+#include "bvh.h"
+#include "mappedfile.h"
+
+namespace namaste {
+
+	namespace scene {
+
+		// Layout version of scene cache files. Bump it whenever the layout, or the
+		// parser's interpretation of scene files, changes
+		static const uint32_t sceneCacheVersion = 1;
+
+		// Hash of the contents (and names) of the given files, in order. Returns
+		// false if any of them can't be read
+		bool hashSourceFiles(const std::vector<std::string> &files, uint64_t *hash);
+
+		// Writes a parsed scene in the cache format: a header followed by every
+		// array exactly as it sits in memory, each starting on a 64-byte boundary.
+		// inputs are the files that were asked for and sources every file that was
+		// read (Includes too), whose contents are hashed to detect stale caches.
+		// The file is written under a temporary name and then renamed, so readers
+		// never see a partial cache
+		bool writeSceneCache(const std::string &cacheFile, const Scene &scene,
+			const std::vector<std::string> &inputs, const std::vector<std::string> &sources,
+			const accel::BVHAccel *bvh = nullptr);
+
+		struct SceneCacheHeader;
+
+		// A memory-mapped scene cache. Loading is just mapping the file and
+		// checking its header: the geometry is used in place, straight from the
+		// mapping, without any per-element work
+		class SceneCache
+		{
+		public:
+			SceneCache();
+			~SceneCache();
+
+			// Returns false if the file is missing, truncated, or from another
+			// version or byte order
+			bool open(const std::string &cacheFile);
+			void close();
+
+			// True if the cache was written for these input files, and none of the
+			// files read to produce it have changed since
+			bool isValidFor(const std::vector<std::string> &inputs) const;
+
+			// Valid for as long as the cache stays open
+			GeometryView geometry() const;
+			const geom::BBox* meshBounds() const;
+			geom::BBox worldBound() const;
+			SceneOptions options() const;
+
+			bool hasBVH() const;
+			// Builds the accelerator from the stored tree: a single copy of each array
+			accel::BVHAccel loadBVH() const;
+
+			std::vector<std::string> inputFiles() const;
+			std::vector<std::string> sourceFiles() const;
+		private:
+			const void* section(int aSection, uint64_t *size = nullptr) const;
+
+			MappedFile file;
+			const SceneCacheHeader *header;
+		};
+
+	} // namespace scene
+
+} // namespace namaste
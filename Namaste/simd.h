@@ -0,0 +1,71 @@
+#pragma once
+
+// Compile-time SIMD configuration shared by the packet and batch kernels.
+// SSE2 is part of the x64 baseline, so it is enabled whenever the target
+// guarantees it. The 8-wide kernels dispatch at runtime instead, and use
+// AVX2 on any x86 target whose CPU has it, see cpuSupportsAVX2. Define
+// NAMASTE_NO_SIMD to force every kernel down its scalar path.
+#if !defined(NAMASTE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define NAMASTE_SSE 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Marks a function that uses AVX2 intrinsics behind a runtime check. MSVC
+// lets any function use them; GCC and Clang need the target enabled per
+// function
+#if defined(NAMASTE_SSE)
+#if defined(_MSC_VER)
+#define NAMASTE_TARGET_AVX2
+#else
+#define NAMASTE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace namaste {
+
+	namespace simd {
+
+		// Scalar min / max with the same operand order semantics as minps / maxps:
+		// if either argument is NaN, the second argument is returned. Scalar
+		// fallbacks use these so that they produce bit-identical results
+		inline float minf(float a, float b) { return a < b ? a : b; }
+		inline float maxf(float a, float b) { return a > b ? a : b; }
+
+		// Whether the CPU (and OS, which has to save the wider registers) supports
+		// AVX2. Evaluated once and cached
+		inline bool cpuSupportsAVX2()
+		{
+#if defined(NAMASTE_SSE) && defined(_MSC_VER)
+			static const bool supported = []()
+			{
+				int info[4];
+				__cpuid(info, 0);
+				if (info[0] < 7)
+				{
+					return false;
+				}
+				__cpuid(info, 1);
+				bool osxsave = (info[2] & (1 << 27)) != 0;
+				bool avx = (info[2] & (1 << 28)) != 0;
+				if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+				{
+					return false;
+				}
+				__cpuidex(info, 7, 0);
+				return (info[1] & (1 << 5)) != 0;
+			}();
+			return supported;
+#elif defined(NAMASTE_SSE)
+			static const bool supported = __builtin_cpu_supports("avx2") != 0;
+			return supported;
+#else
+			return false;
+#endif
+		}
+
+	} // namespace simd
+
+} // namespace namaste
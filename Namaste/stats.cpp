@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace namaste {
+
+	namespace stats {
+
+		namespace {
+
+			const char *counterNames[CounterCount] =
+			{
+				"Closest-hit rays",
+				"Any-hit rays",
+				"Ray-box tests",
+				"Ray-primitive tests"
+			};
+
+			const char *distributionNames[DistributionCount] =
+			{
+				"BVH nodes per closest-hit ray",
+				"BVH nodes per any-hit ray",
+				"BVH leaf size",
+				"BVH leaf depth"
+			};
+
+			const char *phaseNames[PhaseCount] =
+			{
+				"Parse",
+				"BVH build",
+				"BVH update",
+				"Wide BVH build",
+				"Render"
+			};
+
+#if defined(NAMASTE_STATS)
+			// Every thread that has recorded anything and is still running, and the
+			// sum of those that have exited
+			std::mutex statsMutex;
+			std::vector<ThreadStats*> liveThreads;
+			ThreadStats retiredThreads;
+
+			struct ThreadRegistration
+			{
+				ThreadRegistration()
+				{
+					std::lock_guard<std::mutex> lock(statsMutex);
+					liveThreads.push_back(&stats);
+					currentThreadStats = &stats;
+				}
+
+				~ThreadRegistration()
+				{
+					std::lock_guard<std::mutex> lock(statsMutex);
+					retiredThreads.merge(stats);
+					liveThreads.erase(std::find(liveThreads.begin(), liveThreads.end(), &stats));
+					currentThreadStats = nullptr;
+				}
+
+				ThreadStats stats;
+			};
+#endif
+
+			void printHistogram(std::ostream &os, const char *aName, const Histogram &aHistogram)
+			{
+				if (aHistogram.count == 0)
+				{
+					return;
+				}
+				os << "  " << aName << ": mean " << static_cast<double>(aHistogram.sum) / aHistogram.count
+					<< ", min " << aHistogram.minValue << ", max " << aHistogram.maxValue << " (" << aHistogram.count << " samples)\n   ";
+				for (int b = 0; b < Histogram::bucketCount; ++b)
+				{
+					if (aHistogram.buckets[b] == 0)
+					{
+						continue;
+					}
+					uint64_t lo = b == 0 ? 0 : uint64_t(1) << (b - 1);
+					uint64_t hi = b == 0 ? 0 : (uint64_t(1) << b) - 1;
+					os << " ";
+					if (lo == hi)
+					{
+						os << lo;
+					}
+					else
+					{
+						os << lo << "-" << hi;
+					}
+					os << ": " << 100.0 * aHistogram.buckets[b] / aHistogram.count << "%";
+				}
+				os << "\n";
+			}
+
+		} // namespace
+
+		// ---------------------------------------------------------------
+		// Histogram class
+		// ---------------------------------------------------------------
+		Histogram::Histogram() :
+			count(0), sum(0), minValue(std::numeric_limits<uint64_t>::max()), maxValue(0)
+		{
+			std::fill(buckets, buckets + bucketCount, 0);
+		}
+
+		void Histogram::merge(const Histogram &other)
+		{
+			count += other.count;
+			sum += other.sum;
+			minValue = std::min(minValue, other.minValue);
+			maxValue = std::max(maxValue, other.maxValue);
+			for (int b = 0; b < bucketCount; ++b)
+			{
+				buckets[b] += other.buckets[b];
+			}
+		}
+
+		// ---------------------------------------------------------------
+		// Thread stats class
+		// ---------------------------------------------------------------
+		ThreadStats::ThreadStats()
+		{
+			std::fill(counters, counters + CounterCount, 0);
+			std::fill(phaseSeconds, phaseSeconds + PhaseCount, 0.0);
+		}
+
+		void ThreadStats::merge(const ThreadStats &other)
+		{
+			for (int i = 0; i < CounterCount; ++i)
+			{
+				counters[i] += other.counters[i];
+			}
+			for (int i = 0; i < DistributionCount; ++i)
+			{
+				distributions[i].merge(other.distributions[i]);
+			}
+			for (int i = 0; i < PhaseCount; ++i)
+			{
+				phaseSeconds[i] += other.phaseSeconds[i];
+			}
+		}
+
+#if defined(NAMASTE_STATS)
+		thread_local ThreadStats *currentThreadStats = nullptr;
+
+		ThreadStats& registerThread()
+		{
+			// Constructed on the thread's first call, and destroyed when it exits
+			thread_local ThreadRegistration registration;
+			return registration.stats;
+		}
+#endif
+
+		ThreadStats gatherStats()
+		{
+			ThreadStats total;
+#if defined(NAMASTE_STATS)
+			std::lock_guard<std::mutex> lock(statsMutex);
+			total.merge(retiredThreads);
+			for (auto it = liveThreads.cbegin(); it < liveThreads.cend(); ++it)
+			{
+				total.merge(**it);
+			}
+#endif
+			return total;
+		}
+
+		void printStats(std::ostream &os)
+		{
+			if (!enabled)
+			{
+				return;
+			}
+
+			ThreadStats total = gatherStats();
+			os << "Statistics:\n";
+			for (int i = 0; i < PhaseCount; ++i)
+			{
+				if (total.phaseSeconds[i] > 0.0)
+				{
+					os << "  " << phaseNames[i] << " time: " << total.phaseSeconds[i] << " s\n";
+				}
+			}
+			for (int i = 0; i < CounterCount; ++i)
+			{
+				os << "  " << counterNames[i] << ": " << total.counters[i] << "\n";
+			}
+			uint64_t rays = total.counters[CounterClosestHitRays] + total.counters[CounterAnyHitRays];
+			if (rays > 0)
+			{
+				os << "  Per ray: " << static_cast<double>(total.counters[CounterRayBoxTests]) / rays << " box tests, "
+					<< static_cast<double>(total.counters[CounterRayPrimitiveTests]) / rays << " primitive tests\n";
+			}
+			for (int i = 0; i < DistributionCount; ++i)
+			{
+				printHistogram(os, distributionNames[i], total.distributions[i]);
+			}
+		}
+
+	} // namespace stats
+
+} // namespace namaste
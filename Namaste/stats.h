@@ -0,0 +1,200 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+// Statistics are gathered unless NAMASTE_NO_STATS is defined, in which case
+// every counter, histogram and timer below is an empty inline function and
+// compiles to nothing
+#if !defined(NAMASTE_NO_STATS)
+#define NAMASTE_STATS 1
+#endif
+
+namespace namaste {
+
+	namespace stats {
+
+#if defined(NAMASTE_STATS)
+		static const bool enabled = true;
+#else
+		static const bool enabled = false;
+#endif
+
+		enum Counter
+		{
+			CounterClosestHitRays,
+			CounterAnyHitRays,
+			CounterRayBoxTests,			// A 4-wide node test counts as one per child
+			CounterRayPrimitiveTests,
+			CounterCount
+		};
+
+		enum Distribution
+		{
+			DistributionNodesPerClosestHitRay,
+			DistributionNodesPerAnyHitRay,
+			DistributionBVHLeafSize,
+			DistributionBVHLeafDepth,
+			DistributionCount
+		};
+
+		// Wall-clock time of the phases of a run, timed on the thread that drives
+		// them
+		enum Phase
+		{
+			PhaseParse,
+			PhaseBVHBuild,
+			PhaseBVHUpdate,
+			PhaseWideBVHBuild,
+			PhaseRender,
+			PhaseCount
+		};
+
+		// Counts of values in power-of-two buckets: bucket 0 holds zeros and bucket
+		// b > 0 holds [2^(b-1), 2^b), so a handful of buckets cover any range
+		struct Histogram
+		{
+			static const int bucketCount = 32;
+
+			Histogram();
+
+			void add(uint64_t aValue)
+			{
+				++count;
+				sum += aValue;
+				if (aValue < minValue) minValue = aValue;
+				if (aValue > maxValue) maxValue = aValue;
+				int bucket = 0;
+				for (uint64_t v = aValue; v != 0 && bucket < bucketCount - 1; v >>= 1)
+				{
+					++bucket;
+				}
+				++buckets[bucket];
+			}
+
+			void merge(const Histogram &other);
+
+			uint64_t count, sum;
+			uint64_t minValue, maxValue;
+			uint64_t buckets[bucketCount];
+		};
+
+		// Everything one thread has gathered. Threads only ever write their own,
+		// without atomics or locks; they are summed when stats are reported, and
+		// a thread's totals are folded into the report when it exits
+		struct ThreadStats
+		{
+			ThreadStats();
+
+			void merge(const ThreadStats &other);
+
+			uint64_t counters[CounterCount];
+			Histogram distributions[DistributionCount];
+			double phaseSeconds[PhaseCount];
+		};
+
+		// Sums the stats of every thread, running or finished. Threads that are
+		// still gathering may be read mid-update, so call this between phases
+		ThreadStats gatherStats();
+
+		// Writes gatherStats() in a readable form; prints nothing if stats are
+		// compiled out
+		void printStats(std::ostream &os);
+
+#if defined(NAMASTE_STATS)
+		// The calling thread's stats, null until it first records something
+		extern thread_local ThreadStats *currentThreadStats;
+		ThreadStats& registerThread();
+
+		inline ThreadStats& threadStats()
+		{
+			ThreadStats *threadStats = currentThreadStats;
+			return threadStats ? *threadStats : registerThread();
+		}
+
+		inline void count(Counter aCounter, uint64_t n = 1)
+		{
+			threadStats().counters[aCounter] += n;
+		}
+
+		inline void record(Distribution aDistribution, uint64_t aValue)
+		{
+			threadStats().distributions[aDistribution].add(aValue);
+		}
+
+		// Adds the time until it goes out of scope to a phase
+		class PhaseTimer
+		{
+		public:
+			explicit PhaseTimer(Phase aPhase) :
+				phase(aPhase), start(std::chrono::steady_clock::now())
+			{
+			}
+
+			~PhaseTimer()
+			{
+				threadStats().phaseSeconds[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+		private:
+			Phase phase;
+			std::chrono::steady_clock::time_point start;
+		};
+
+		// Counts the work done by one ray's traversal in locals and records it
+		// once, when it goes out of scope, so the hot loop never touches
+		// thread-local storage
+		class RayCounter
+		{
+		public:
+			RayCounter(Counter aRays, Distribution aNodesPerRay) :
+				rays(aRays), nodesPerRay(aNodesPerRay), nodes(0), boxTests(0), primitiveTests(0)
+			{
+			}
+
+			~RayCounter()
+			{
+				ThreadStats &threadStats = stats::threadStats();
+				++threadStats.counters[rays];
+				threadStats.counters[CounterRayBoxTests] += boxTests;
+				threadStats.counters[CounterRayPrimitiveTests] += primitiveTests;
+				threadStats.distributions[nodesPerRay].add(nodes);
+			}
+
+			void node(int aBoxTests = 1)
+			{
+				++nodes;
+				boxTests += aBoxTests;
+			}
+
+			void primitives(int aCount)
+			{
+				primitiveTests += aCount;
+			}
+		private:
+			Counter rays;
+			Distribution nodesPerRay;
+			uint32_t nodes, boxTests, primitiveTests;
+		};
+#else
+		inline void count(Counter, uint64_t = 1) {}
+		inline void record(Distribution, uint64_t) {}
+
+		class PhaseTimer
+		{
+		public:
+			explicit PhaseTimer(Phase) {}
+		};
+
+		class RayCounter
+		{
+		public:
+			RayCounter(Counter, Distribution) {}
+			void node(int = 1) {}
+			void primitives(int) {}
+		};
+#endif
+
+	} // namespace stats
+
+} // namespace namaste
@@ -0,0 +1,373 @@
+#include "stdafx.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace namaste {
+
+	namespace texture {
+
+		struct MIPMapFileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t byteOrder;
+			uint32_t width, height;
+			uint32_t levels;
+			uint32_t tileSize;
+		};
+
+		struct MIPMapFileLevel
+		{
+			uint32_t width, height;
+			uint32_t tilesX, tilesY;
+			uint64_t offset;		// Of the level's first tile, in bytes
+		};
+
+		namespace {
+
+			const char mipMapMagic[8] = { 'N', 'A', 'M', 'A', 'S', 'T', 'E', 'T' };
+			const uint32_t mipMapByteOrder = 0x01020304;
+			const size_t tileFloats = 3 * textureTileStride * textureTileStride;
+			const size_t tileBytes = tileFloats * sizeof(float);
+
+			// Non-negative remainder, for wrapping texel coordinates
+			inline int wrap(int a, int b)
+			{
+				int r = a % b;
+				return r < 0 ? r + b : r;
+			}
+
+			inline uint64_t tileKey(uint32_t aTexture, int aLevel, int aTileX, int aTileY)
+			{
+				return (static_cast<uint64_t>(aTexture) << 40) | (static_cast<uint64_t>(aLevel) << 34) |
+					(static_cast<uint64_t>(aTileY) << 17) | static_cast<uint64_t>(aTileX);
+			}
+
+			// Spreads neighbouring tiles over different shards
+			inline int shardOf(uint64_t aKey, int aShards)
+			{
+				aKey ^= aKey >> 33;
+				aKey *= 0xff51afd7ed558ccdULL;
+				aKey ^= aKey >> 33;
+				return static_cast<int>(aKey % static_cast<uint64_t>(aShards));
+			}
+
+			std::atomic<uint32_t> nextTextureId(0);
+
+		} // namespace
+
+		bool writeMIPMapFile(const std::string &filename, int width, int height, const float *rgb)
+		{
+			if (width <= 0 || height <= 0 || width > (textureTileSize << 17) || height > (textureTileSize << 17))
+			{
+				return false;
+			}
+
+			// Each level halves the one above, rounding up, down to a single texel
+			std::vector<std::vector<float>> images(1, std::vector<float>(rgb, rgb + 3 * static_cast<size_t>(width) * height));
+			std::vector<MIPMapFileLevel> levels;
+			MIPMapFileLevel level0 = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, 0, 0 };
+			levels.push_back(level0);
+			while (levels.back().width > 1 || levels.back().height > 1)
+			{
+				const MIPMapFileLevel &above = levels.back();
+				const std::vector<float> &src = images.back();
+				int w = static_cast<int>(above.width), h = static_cast<int>(above.height);
+				int w2 = std::max(1, (w + 1) / 2), h2 = std::max(1, (h + 1) / 2);
+				std::vector<float> dst(3 * static_cast<size_t>(w2) * h2);
+				for (int y = 0; y < h2; ++y)
+				{
+					for (int x = 0; x < w2; ++x)
+					{
+						int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+						int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+						for (int c = 0; c < 3; ++c)
+						{
+							dst[3 * (static_cast<size_t>(y) * w2 + x) + c] = 0.25f *
+								(src[3 * (static_cast<size_t>(y0) * w + x0) + c] + src[3 * (static_cast<size_t>(y0) * w + x1) + c] +
+								 src[3 * (static_cast<size_t>(y1) * w + x0) + c] + src[3 * (static_cast<size_t>(y1) * w + x1) + c]);
+						}
+					}
+				}
+				MIPMapFileLevel next = { static_cast<uint32_t>(w2), static_cast<uint32_t>(h2), 0, 0, 0 };
+				levels.push_back(next);
+				images.push_back(std::move(dst));
+			}
+
+			MIPMapFileHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, mipMapMagic, sizeof(mipMapMagic));
+			header.version = mipMapFileVersion;
+			header.byteOrder = mipMapByteOrder;
+			header.width = static_cast<uint32_t>(width);
+			header.height = static_cast<uint32_t>(height);
+			header.levels = static_cast<uint32_t>(levels.size());
+			header.tileSize = textureTileSize;
+
+			uint64_t offset = sizeof(MIPMapFileHeader) + levels.size() * sizeof(MIPMapFileLevel);
+			for (auto it = levels.begin(); it < levels.end(); ++it)
+			{
+				it->tilesX = (it->width + textureTileSize - 1) / textureTileSize;
+				it->tilesY = (it->height + textureTileSize - 1) / textureTileSize;
+				it->offset = offset;
+				offset += static_cast<uint64_t>(it->tilesX) * it->tilesY * tileBytes;
+			}
+
+			std::string temporaryFile = filename + ".tmp";
+			{
+				std::ofstream out(temporaryFile, std::ios::binary | std::ios::trunc);
+				if (!out)
+				{
+					return false;
+				}
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				out.write(reinterpret_cast<const char*>(levels.data()), static_cast<std::streamsize>(levels.size() * sizeof(MIPMapFileLevel)));
+
+				std::vector<float> tile(tileFloats);
+				for (size_t l = 0; l < levels.size(); ++l)
+				{
+					const MIPMapFileLevel &level = levels[l];
+					const std::vector<float> &image = images[l];
+					int w = static_cast<int>(level.width), h = static_cast<int>(level.height);
+					for (uint32_t ty = 0; ty < level.tilesY; ++ty)
+					{
+						for (uint32_t tx = 0; tx < level.tilesX; ++tx)
+						{
+							for (int y = 0; y < textureTileStride; ++y)
+							{
+								size_t row = static_cast<size_t>(wrap(static_cast<int>(ty) * textureTileSize + y, h)) * w;
+								for (int x = 0; x < textureTileStride; ++x)
+								{
+									const float *texel = &image[3 * (row + wrap(static_cast<int>(tx) * textureTileSize + x, w))];
+									float *dst = &tile[3 * (y * textureTileStride + x)];
+									dst[0] = texel[0];
+									dst[1] = texel[1];
+									dst[2] = texel[2];
+								}
+							}
+							out.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tileBytes));
+						}
+					}
+				}
+				if (!out)
+				{
+					out.close();
+					std::remove(temporaryFile.c_str());
+					return false;
+				}
+			}
+
+			std::remove(filename.c_str());
+			if (std::rename(temporaryFile.c_str(), filename.c_str()) != 0)
+			{
+				std::remove(temporaryFile.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// ---------------------------------------------------------------
+		// Texture cache class
+		// ---------------------------------------------------------------
+		TextureCache::TextureCache(size_t aBudgetBytes) :
+			budgetBytes(aBudgetBytes)
+		{
+		}
+
+		TextureCache::~TextureCache()
+		{
+		}
+
+		std::shared_ptr<const TextureTile> TextureCache::tile(const MIPMap &aTexture, int aLevel, int aTileX, int aTileY)
+		{
+			uint64_t key = tileKey(aTexture.id, aLevel, aTileX, aTileY);
+			Shard &shard = shards[shardOf(key, nShards)];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			auto found = shard.tiles.find(key);
+			if (found != shard.tiles.end())
+			{
+				++shard.hits;
+				shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+				return found->second->second;
+			}
+
+			// Loading under the shard's lock keeps two threads from reading the same
+			// tile; other shards carry on meanwhile
+			++shard.misses;
+			std::shared_ptr<TextureTile> loaded = std::make_shared<TextureTile>();
+			aTexture.loadTile(aLevel, aTileX, aTileY, loaded.get());
+			shard.lru.push_front(std::make_pair(key, std::shared_ptr<const TextureTile>(loaded)));
+			shard.tiles[key] = shard.lru.begin();
+			shard.bytesInUse += tileBytes;
+			shard.peakBytesInUse = std::max(shard.peakBytesInUse, shard.bytesInUse);
+
+			// Always keep the tile just loaded, even if the budget is tiny
+			const size_t shardBudget = budgetBytes / nShards;
+			while (shard.bytesInUse > shardBudget && shard.lru.size() > 1)
+			{
+				shard.tiles.erase(shard.lru.back().first);
+				shard.lru.pop_back();
+				shard.bytesInUse -= tileBytes;
+				++shard.evictions;
+			}
+			return loaded;
+		}
+
+		TextureCacheStats TextureCache::stats() const
+		{
+			TextureCacheStats ret = { 0, 0, 0, 0, 0 };
+			for (int i = 0; i < nShards; ++i)
+			{
+				const Shard &shard = shards[i];
+				std::lock_guard<std::mutex> lock(shard.mutex);
+				ret.hits += shard.hits;
+				ret.misses += shard.misses;
+				ret.evictions += shard.evictions;
+				ret.bytesInUse += shard.bytesInUse;
+				// An upper bound: the shards needn't have peaked at the same time
+				ret.peakBytesInUse += shard.peakBytesInUse;
+			}
+			return ret;
+		}
+
+		// ---------------------------------------------------------------
+		// MIP-map class
+		// ---------------------------------------------------------------
+		MIPMap::MIPMap(TextureCache &aCache, const std::string &filename) :
+			id(nextTextureId++), cache(aCache)
+		{
+			if (!file.open(filename))
+			{
+				std::cerr << "Couldn't open texture: " << filename << std::endl;
+				return;
+			}
+
+			MIPMapFileHeader header;
+			bool valid = file.size() >= sizeof(header);
+			if (valid)
+			{
+				memcpy(&header, file.data(), sizeof(header));
+				valid = memcmp(header.magic, mipMapMagic, sizeof(mipMapMagic)) == 0 && header.version == mipMapFileVersion &&
+					header.byteOrder == mipMapByteOrder && header.tileSize == textureTileSize && header.levels > 0 && header.levels <= 32 &&
+					file.size() >= sizeof(header) + header.levels * sizeof(MIPMapFileLevel);
+			}
+			for (uint32_t l = 0; valid && l < header.levels; ++l)
+			{
+				MIPMapFileLevel level;
+				memcpy(&level, file.data() + sizeof(header) + l * sizeof(MIPMapFileLevel), sizeof(level));
+				valid = level.width > 0 && level.height > 0 && level.tilesX <= (1u << 17) && level.tilesY <= (1u << 17) &&
+					level.offset + static_cast<uint64_t>(level.tilesX) * level.tilesY * tileBytes <= file.size();
+				Level entry = { static_cast<int>(level.width), static_cast<int>(level.height),
+					static_cast<int>(level.tilesX), static_cast<int>(level.tilesY), level.offset };
+				pyramid.push_back(entry);
+			}
+			if (!valid)
+			{
+				std::cerr << "Not a MIP-map file, or from another version: " << filename << std::endl;
+				pyramid.clear();
+				file.close();
+			}
+		}
+
+		MIPMap::~MIPMap()
+		{
+		}
+
+		bool MIPMap::isValid() const
+		{
+			return !pyramid.empty();
+		}
+
+		int MIPMap::width() const
+		{
+			return pyramid.empty() ? 0 : pyramid[0].width;
+		}
+
+		int MIPMap::height() const
+		{
+			return pyramid.empty() ? 0 : pyramid[0].height;
+		}
+
+		int MIPMap::levels() const
+		{
+			return static_cast<int>(pyramid.size());
+		}
+
+		void MIPMap::loadTile(int aLevel, int aTileX, int aTileY, TextureTile *aTile) const
+		{
+			const Level &level = pyramid[aLevel];
+			const char *src = file.data() + level.offset + (static_cast<uint64_t>(aTileY) * level.tilesX + aTileX) * tileBytes;
+			aTile->texels.resize(tileFloats);
+			memcpy(aTile->texels.data(), src, tileBytes);
+		}
+
+		void MIPMap::bilerp(int aLevel, float s, float t, float rgb[3]) const
+		{
+			if (pyramid.empty())
+			{
+				rgb[0] = rgb[1] = rgb[2] = 0.0f;
+				return;
+			}
+
+			const Level &level = pyramid[aLevel];
+			float x = s * level.width - 0.5f, y = t * level.height - 0.5f;
+			float fx = std::floor(x), fy = std::floor(y);
+			float dx = x - fx, dy = y - fy;
+			int x0 = wrap(static_cast<int>(fx), level.width), y0 = wrap(static_cast<int>(fy), level.height);
+
+			// The tile's extra row and column hold the wrapped neighbours
+			std::shared_ptr<const TextureTile> tile = cache.tile(*this, aLevel, x0 / textureTileSize, y0 / textureTileSize);
+			const float *t00 = &tile->texels[3 * ((y0 % textureTileSize) * textureTileStride + x0 % textureTileSize)];
+			const float *t10 = t00 + 3;
+			const float *t01 = t00 + 3 * textureTileStride;
+			const float *t11 = t01 + 3;
+			for (int c = 0; c < 3; ++c)
+			{
+				rgb[c] = (1.0f - dy) * ((1.0f - dx) * t00[c] + dx * t10[c]) + dy * ((1.0f - dx) * t01[c] + dx * t11[c]);
+			}
+		}
+
+		void MIPMap::lookup(float s, float t, float aWidth, float rgb[3]) const
+		{
+			// The level whose texel spacing matches the filter width, blending the two
+			// nearest levels
+			int nLevels = levels();
+			float level = nLevels - 1 + std::log2(std::max(aWidth, 1e-8f));
+			if (level <= 0.0f)
+			{
+				bilerp(0, s, t, rgb);
+			}
+			else if (level >= nLevels - 1)
+			{
+				bilerp(std::max(nLevels - 1, 0), s, t, rgb);
+			}
+			else
+			{
+				int iLevel = static_cast<int>(std::floor(level));
+				float delta = level - iLevel;
+				float rgb0[3], rgb1[3];
+				bilerp(iLevel, s, t, rgb0);
+				bilerp(iLevel + 1, s, t, rgb1);
+				for (int c = 0; c < 3; ++c)
+				{
+					rgb[c] = (1.0f - delta) * rgb0[c] + delta * rgb1[c];
+				}
+			}
+		}
+
+		void MIPMap::lookup(float s, float t, float dsdx, float dtdx, float dsdy, float dtdy, float rgb[3]) const
+		{
+			float width = 2.0f * std::max(std::max(std::fabs(dsdx), std::fabs(dtdx)), std::max(std::fabs(dsdy), std::fabs(dtdy)));
+			lookup(s, t, width, rgb);
+		}
+
+	} // namespace texture
+
+} // namespace namaste
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mappedfile.h"
+
+namespace namaste {
+
+	namespace texture {
+
+		// Layout version of MIP-map files
+		static const uint32_t mipMapFileVersion = 1;
+
+		// Texels along each side of a tile. Tiles also store one extra row and
+		// column duplicated from their neighbours (wrapping around the texture),
+		// so a bilinear lookup never needs more than one tile
+		static const int textureTileSize = 32;
+		static const int textureTileStride = textureTileSize + 1;
+
+		// Builds the MIP-map pyramid of an RGB image (width * height float
+		// triples in scanline order), each level a 2x2 box filter of the one
+		// above, and writes it tiled. Like scene caches, the file is written under
+		// a temporary name and then renamed
+		bool writeMIPMapFile(const std::string &filename, int width, int height, const float *rgb);
+
+		// A tile of one level of a MIP-map: textureTileStride^2 RGB texels
+		struct TextureTile
+		{
+			std::vector<float> texels;
+		};
+
+		class MIPMap;
+
+		struct TextureCacheStats
+		{
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t evictions;
+			size_t bytesInUse;
+			size_t peakBytesInUse;
+		};
+
+		// Tiles of any number of MIP-maps, paged in from their files on demand and
+		// kept within a fixed memory budget by evicting the least recently used
+		// ones. Memory use is thus set by the working set of a render rather than
+		// by the size of the textures. The cache is split into shards, each with
+		// its own lock, LRU list and share of the budget, so threads looking up
+		// different tiles rarely contend. Tiles are reference counted: one stays
+		// valid for whoever holds it even if it's evicted meanwhile
+		class TextureCache
+		{
+		public:
+			explicit TextureCache(size_t aBudgetBytes = 256 * 1024 * 1024);
+			~TextureCache();
+
+			TextureCache(const TextureCache &) = delete;
+			TextureCache& operator=(const TextureCache &) = delete;
+
+			std::shared_ptr<const TextureTile> tile(const MIPMap &aTexture, int aLevel, int aTileX, int aTileY);
+
+			TextureCacheStats stats() const;
+
+			size_t budgetBytes;
+		private:
+			static const int nShards = 16;
+
+			struct Shard
+			{
+				Shard() : hits(0), misses(0), evictions(0), bytesInUse(0), peakBytesInUse(0) {}
+
+				typedef std::list<std::pair<uint64_t, std::shared_ptr<const TextureTile>>> LRUList;
+
+				mutable std::mutex mutex;
+				LRUList lru;		// Most recently used first
+				std::unordered_map<uint64_t, LRUList::iterator> tiles;
+				uint64_t hits, misses, evictions;
+				size_t bytesInUse, peakBytesInUse;
+			};
+
+			Shard shards[nShards];
+		};
+
+		// A MIP-mapped RGB texture read through a TextureCache. Lookups are
+		// trilinearly filtered, with the filter width taken from the screen-space
+		// derivatives of the texture coordinates (see
+		// TriangleMesh::uvDifferentials), and wrap around at the edges
+		class MIPMap
+		{
+		public:
+			MIPMap(TextureCache &aCache, const std::string &filename);
+			~MIPMap();
+
+			MIPMap(const MIPMap &) = delete;
+			MIPMap& operator=(const MIPMap &) = delete;
+
+			// False if the file couldn't be read as a MIP-map; the constructor has
+			// reported why
+			bool isValid() const;
+
+			int width() const;
+			int height() const;
+			int levels() const;
+
+			// Filtered lookup at (s, t) over a footprint with the given derivatives
+			void lookup(float s, float t, float dsdx, float dtdx, float dsdy, float dtdy, float rgb[3]) const;
+			// Lookup with a filter of the given width, in texture space
+			void lookup(float s, float t, float aWidth, float rgb[3]) const;
+			// Bilinearly interpolated texel of a single level
+			void bilerp(int aLevel, float s, float t, float rgb[3]) const;
+
+			// Copies a tile out of the file; called by the cache on a miss
+			void loadTile(int aLevel, int aTileX, int aTileY, TextureTile *aTile) const;
+
+			// Distinguishes this texture's tiles from those of others in the cache
+			const uint32_t id;
+		private:
+			struct Level
+			{
+				int width, height;
+				int tilesX, tilesY;
+				uint64_t offset;
+			};
+
+			TextureCache &cache;
+			MappedFile file;
+			std::vector<Level> pyramid;
+		};
+
+	} // namespace texture
+
+} // namespace namaste
@@ -1,10 +1,22 @@
 #include "stdafx.h"
 #include "transform.h"
+#include "simd.h"
 
 namespace namaste {
 
 	namespace geom {
 
+		namespace {
+
+			const float pi = 3.14159265358979323846f;
+
+			inline float radians(float degrees)
+			{
+				return (pi / 180.0f) * degrees;
+			}
+
+		} // anonymous namespace
+
 		// ---------------------------------------------------------------
 		// Matrix class
 		// ---------------------------------------------------------------
@@ -20,10 +32,232 @@ namespace namaste {
 			}
 		}
 
+		Matrix4x4::Matrix4x4(const float aData[4][4])
+		{
+			for (size_t i = 0; i < data.size(); ++i)
+			{
+				for (size_t j = 0; j < data[0].size(); ++j)
+				{
+					data[i][j] = aData[i][j];
+				}
+			}
+		}
+
+		Matrix4x4::Matrix4x4(float t00, float t01, float t02, float t03,
+			float t10, float t11, float t12, float t13,
+			float t20, float t21, float t22, float t23,
+			float t30, float t31, float t32, float t33)
+		{
+			data[0] = { t00, t01, t02, t03 };
+			data[1] = { t10, t11, t12, t13 };
+			data[2] = { t20, t21, t22, t23 };
+			data[3] = { t30, t31, t32, t33 };
+		}
+
 		Matrix4x4::~Matrix4x4() 
 		{
 		}
 
+		Matrix4x4 Matrix4x4::operator*(const Matrix4x4 &rhs) const
+		{
+			Matrix4x4 ret;
+#if defined(NAMASTE_SSE)
+			// Each row of the result is a linear combination of the rows of rhs,
+			// weighted by the elements of the corresponding row of this matrix
+			const __m128 r0 = _mm_load_ps(rhs.data[0].data());
+			const __m128 r1 = _mm_load_ps(rhs.data[1].data());
+			const __m128 r2 = _mm_load_ps(rhs.data[2].data());
+			const __m128 r3 = _mm_load_ps(rhs.data[3].data());
+			for (size_t i = 0; i < 4; ++i)
+			{
+				__m128 row = _mm_mul_ps(_mm_set1_ps(data[i][0]), r0);
+				row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(data[i][1]), r1));
+				row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(data[i][2]), r2));
+				row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(data[i][3]), r3));
+				_mm_store_ps(ret.data[i].data(), row);
+			}
+#else
+			for (size_t i = 0; i < 4; ++i)
+			{
+				for (size_t j = 0; j < 4; ++j)
+				{
+					ret.data[i][j] = data[i][0] * rhs.data[0][j] +
+						data[i][1] * rhs.data[1][j] +
+						data[i][2] * rhs.data[2][j] +
+						data[i][3] * rhs.data[3][j];
+				}
+			}
+#endif
+			return ret;
+		}
+
+		bool Matrix4x4::operator==(const Matrix4x4 &rhs) const
+		{
+			return data == rhs.data;
+		}
+
+		bool Matrix4x4::operator!=(const Matrix4x4 &rhs) const
+		{
+			return data != rhs.data;
+		}
+
+		bool Matrix4x4::isIdentity() const
+		{
+			return *this == Matrix4x4();
+		}
+
+		bool Matrix4x4::isAffine() const
+		{
+			return data[3][0] == 0.0f && data[3][1] == 0.0f && data[3][2] == 0.0f && data[3][3] == 1.0f;
+		}
+
+		Matrix4x4 transpose(const Matrix4x4 &m)
+		{
+			return Matrix4x4(m.data[0][0], m.data[1][0], m.data[2][0], m.data[3][0],
+				m.data[0][1], m.data[1][1], m.data[2][1], m.data[3][1],
+				m.data[0][2], m.data[1][2], m.data[2][2], m.data[3][2],
+				m.data[0][3], m.data[1][3], m.data[2][3], m.data[3][3]);
+		}
+
+#if defined(NAMASTE_SSE)
+		namespace {
+
+			// Shuffle helpers for the block-wise inverse below. A 2x2 matrix is held
+			// in one register as (m00, m01, m10, m11)
+			#define NAMASTE_SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+
+			inline __m128 swizzle(__m128 v, int mask)
+			{
+				return _mm_castsi128_ps(_mm_shuffle_epi32(_mm_castps_si128(v), mask));
+			}
+
+			// A * B
+			inline __m128 mat2Mul(__m128 a, __m128 b)
+			{
+				return _mm_add_ps(_mm_mul_ps(a, swizzle(b, NAMASTE_SHUFFLE_MASK(0, 3, 0, 3))),
+					_mm_mul_ps(swizzle(a, NAMASTE_SHUFFLE_MASK(1, 0, 3, 2)), swizzle(b, NAMASTE_SHUFFLE_MASK(2, 1, 2, 1))));
+			}
+
+			// adj(A) * B
+			inline __m128 mat2AdjMul(__m128 a, __m128 b)
+			{
+				return _mm_sub_ps(_mm_mul_ps(swizzle(a, NAMASTE_SHUFFLE_MASK(3, 3, 0, 0)), b),
+					_mm_mul_ps(swizzle(a, NAMASTE_SHUFFLE_MASK(1, 1, 2, 2)), swizzle(b, NAMASTE_SHUFFLE_MASK(2, 3, 0, 1))));
+			}
+
+			// A * adj(B)
+			inline __m128 mat2MulAdj(__m128 a, __m128 b)
+			{
+				return _mm_sub_ps(_mm_mul_ps(a, swizzle(b, NAMASTE_SHUFFLE_MASK(3, 0, 3, 0))),
+					_mm_mul_ps(swizzle(a, NAMASTE_SHUFFLE_MASK(1, 0, 3, 2)), swizzle(b, NAMASTE_SHUFFLE_MASK(2, 1, 2, 1))));
+			}
+
+		} // anonymous namespace
+#endif
+
+		Matrix4x4 inverse(const Matrix4x4 &m)
+		{
+			Matrix4x4 ret;
+#if defined(NAMASTE_SSE)
+			// Block-wise inverse: split the matrix into 2x2 blocks
+			//     M = | A B |
+			//         | C D |
+			// and build the inverse from their adjugates and determinants, which
+			// fit naturally into SSE registers and need no pivoting or branches
+			const __m128 r0 = _mm_load_ps(m.data[0].data());
+			const __m128 r1 = _mm_load_ps(m.data[1].data());
+			const __m128 r2 = _mm_load_ps(m.data[2].data());
+			const __m128 r3 = _mm_load_ps(m.data[3].data());
+
+			__m128 a = _mm_movelh_ps(r0, r1);
+			__m128 b = _mm_movehl_ps(r1, r0);
+			__m128 c = _mm_movelh_ps(r2, r3);
+			__m128 d = _mm_movehl_ps(r3, r2);
+
+			// Determinants of the four blocks: (|A|, |B|, |C|, |D|)
+			__m128 detSub = _mm_sub_ps(
+				_mm_mul_ps(_mm_shuffle_ps(r0, r2, NAMASTE_SHUFFLE_MASK(0, 2, 0, 2)), _mm_shuffle_ps(r1, r3, NAMASTE_SHUFFLE_MASK(1, 3, 1, 3))),
+				_mm_mul_ps(_mm_shuffle_ps(r0, r2, NAMASTE_SHUFFLE_MASK(1, 3, 1, 3)), _mm_shuffle_ps(r1, r3, NAMASTE_SHUFFLE_MASK(0, 2, 0, 2))));
+			__m128 detA = swizzle(detSub, NAMASTE_SHUFFLE_MASK(0, 0, 0, 0));
+			__m128 detB = swizzle(detSub, NAMASTE_SHUFFLE_MASK(1, 1, 1, 1));
+			__m128 detC = swizzle(detSub, NAMASTE_SHUFFLE_MASK(2, 2, 2, 2));
+			__m128 detD = swizzle(detSub, NAMASTE_SHUFFLE_MASK(3, 3, 3, 3));
+
+			__m128 dc = mat2AdjMul(d, c);
+			__m128 ab = mat2AdjMul(a, b);
+
+			// Adjugates of the blocks of the inverse, up to the 1 / |M| scale
+			__m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), mat2Mul(b, dc));
+			__m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), mat2Mul(c, ab));
+			__m128 y = _mm_sub_ps(_mm_mul_ps(detB, c), mat2MulAdj(d, ab));
+			__m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), mat2MulAdj(a, dc));
+
+			// |M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C)
+			__m128 tr = _mm_mul_ps(ab, swizzle(dc, NAMASTE_SHUFFLE_MASK(0, 2, 1, 3)));
+			tr = _mm_add_ps(tr, swizzle(tr, NAMASTE_SHUFFLE_MASK(2, 3, 0, 1)));
+			tr = _mm_add_ps(tr, swizzle(tr, NAMASTE_SHUFFLE_MASK(1, 0, 3, 2)));
+			__m128 detM = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+			assert(_mm_cvtss_f32(detM) != 0.0f);
+
+			// Fold the adjugate's sign pattern into the reciprocal determinant
+			__m128 rDetM = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), detM);
+			x = _mm_mul_ps(x, rDetM);
+			y = _mm_mul_ps(y, rDetM);
+			z = _mm_mul_ps(z, rDetM);
+			w = _mm_mul_ps(w, rDetM);
+
+			// Take the adjugates and scatter the blocks back into rows in one shuffle
+			_mm_store_ps(ret.data[0].data(), _mm_shuffle_ps(x, y, NAMASTE_SHUFFLE_MASK(3, 1, 3, 1)));
+			_mm_store_ps(ret.data[1].data(), _mm_shuffle_ps(x, y, NAMASTE_SHUFFLE_MASK(2, 0, 2, 0)));
+			_mm_store_ps(ret.data[2].data(), _mm_shuffle_ps(z, w, NAMASTE_SHUFFLE_MASK(3, 1, 3, 1)));
+			_mm_store_ps(ret.data[3].data(), _mm_shuffle_ps(z, w, NAMASTE_SHUFFLE_MASK(2, 0, 2, 0)));
+
+			#undef NAMASTE_SHUFFLE_MASK
+#else
+			// Cofactor expansion, using the 2x2 sub-determinants of the top two and
+			// bottom two rows
+			const Matrix4x4Data &a = m.data;
+			float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+			float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+			float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+			float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+			float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+			float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+
+			float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+			float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+			float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+			float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+			float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+			float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+
+			float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+			assert(det != 0.0f);
+			float invDet = 1.0f / det;
+
+			ret.data[0][0] = (a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * invDet;
+			ret.data[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * invDet;
+			ret.data[0][2] = (a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * invDet;
+			ret.data[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * invDet;
+
+			ret.data[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * invDet;
+			ret.data[1][1] = (a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * invDet;
+			ret.data[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * invDet;
+			ret.data[1][3] = (a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * invDet;
+
+			ret.data[2][0] = (a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * invDet;
+			ret.data[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * invDet;
+			ret.data[2][2] = (a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * invDet;
+			ret.data[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * invDet;
+
+			ret.data[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * invDet;
+			ret.data[3][1] = (a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * invDet;
+			ret.data[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * invDet;
+			ret.data[3][3] = (a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * invDet;
+#endif
+			return ret;
+		}
+
 		std::ostream& operator<<(std::ostream &os, const Matrix4x4 &m)
 		{
 			for (size_t i = 0; i < m.data.size(); ++i)
@@ -48,12 +282,632 @@ namespace namaste {
 		// ---------------------------------------------------------------
 		Transform::Transform()
 		{
+			// Both matrices default to the identity
+		}
+
+		Transform::Transform(const Matrix4x4 &aM) :
+			m(aM), mInv(inverse(aM))
+		{
+		}
+
+		Transform::Transform(const Matrix4x4 &aM, const Matrix4x4 &aMInv) :
+			m(aM), mInv(aMInv)
+		{
+			// Used when the inverse is known analytically (e.g. for a translation),
+			// which is both cheaper and more accurate than computing it
 		}
 
 		Transform::~Transform()
 		{
 		}
 
+		Transform Transform::operator*(const Transform &rhs) const
+		{
+			// (AB)^-1 = B^-1 A^-1
+			return Transform(m * rhs.m, rhs.mInv * mInv);
+		}
+
+		bool Transform::operator==(const Transform &rhs) const
+		{
+			return m == rhs.m && mInv == rhs.mInv;
+		}
+
+		bool Transform::operator!=(const Transform &rhs) const
+		{
+			return m != rhs.m || mInv != rhs.mInv;
+		}
+
+		bool Transform::isIdentity() const
+		{
+			return m.isIdentity();
+		}
+
+		bool Transform::swapsHandedness() const
+		{
+			// A transform flips the handedness of the coordinate system if the
+			// determinant of its upper-left 3x3 submatrix is negative
+			const Matrix4x4Data &d = m.data;
+			float det = d[0][0] * (d[1][1] * d[2][2] - d[1][2] * d[2][1]) -
+				d[0][1] * (d[1][0] * d[2][2] - d[1][2] * d[2][0]) +
+				d[0][2] * (d[1][0] * d[2][1] - d[1][1] * d[2][0]);
+			return det < 0.0f;
+		}
+
+		Point Transform::operator()(const Point &aPoint) const
+		{
+			// Points are treated as homogeneous column vectors [x y z 1]^T
+			const Matrix4x4Data &d = m.data;
+			float xp = d[0][0] * aPoint.x + d[0][1] * aPoint.y + d[0][2] * aPoint.z + d[0][3];
+			float yp = d[1][0] * aPoint.x + d[1][1] * aPoint.y + d[1][2] * aPoint.z + d[1][3];
+			float zp = d[2][0] * aPoint.x + d[2][1] * aPoint.y + d[2][2] * aPoint.z + d[2][3];
+			float wp = d[3][0] * aPoint.x + d[3][1] * aPoint.y + d[3][2] * aPoint.z + d[3][3];
+			assert(wp != 0.0f);
+			if (wp == 1.0f)
+			{
+				return Point(xp, yp, zp);
+			}
+			return Point(xp, yp, zp) / wp;
+		}
+
+		Vector Transform::operator()(const Vector &aVector) const
+		{
+			// Vectors are directions, [x y z 0]^T, so translation doesn't apply
+			const Matrix4x4Data &d = m.data;
+			return Vector(d[0][0] * aVector.x + d[0][1] * aVector.y + d[0][2] * aVector.z,
+				d[1][0] * aVector.x + d[1][1] * aVector.y + d[1][2] * aVector.z,
+				d[2][0] * aVector.x + d[2][1] * aVector.y + d[2][2] * aVector.z);
+		}
+
+		Normal Transform::operator()(const Normal &aNormal) const
+		{
+			// Normals must be transformed by the inverse transpose to stay
+			// perpendicular to their surface; index mInv transposed rather than
+			// building the transpose
+			const Matrix4x4Data &d = mInv.data;
+			return Normal(d[0][0] * aNormal.x + d[1][0] * aNormal.y + d[2][0] * aNormal.z,
+				d[0][1] * aNormal.x + d[1][1] * aNormal.y + d[2][1] * aNormal.z,
+				d[0][2] * aNormal.x + d[1][2] * aNormal.y + d[2][2] * aNormal.z);
+		}
+
+		Ray Transform::operator()(const Ray &aRay) const
+		{
+			// Copies minT, maxT, time and depth from the original ray
+			Ray ret = aRay;
+			ret.o = (*this)(aRay.o);
+			ret.d = (*this)(aRay.d);
+			return ret;
+		}
+
+		RayDifferential Transform::operator()(const RayDifferential &aRay) const
+		{
+			RayDifferential ret = aRay;
+			ret.o = (*this)(aRay.o);
+			ret.d = (*this)(aRay.d);
+			ret.rxOrigin = (*this)(aRay.rxOrigin);
+			ret.ryOrigin = (*this)(aRay.ryOrigin);
+			ret.rxDirection = (*this)(aRay.rxDirection);
+			ret.ryDirection = (*this)(aRay.ryDirection);
+			return ret;
+		}
+
+		BBox Transform::operator()(const BBox &aBBox) const
+		{
+			if (aBBox.pMin.x > aBBox.pMax.x || aBBox.pMin.y > aBBox.pMax.y || aBBox.pMin.z > aBBox.pMax.z)
+			{
+				// Keep empty boxes empty (their infinite extents would otherwise turn
+				// into an infinite box)
+				return BBox();
+			}
+
+			if (!m.isAffine())
+			{
+				// A projective transform doesn't map boxes to parallelepipeds, so fall
+				// back to transforming all eight corners and bounding the results
+				const Transform &t = *this;
+				BBox ret(t(Point(aBBox.pMin.x, aBBox.pMin.y, aBBox.pMin.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMax.x, aBBox.pMin.y, aBBox.pMin.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMin.x, aBBox.pMax.y, aBBox.pMin.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMin.x, aBBox.pMin.y, aBBox.pMax.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMin.x, aBBox.pMax.y, aBBox.pMax.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMax.x, aBBox.pMax.y, aBBox.pMin.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMax.x, aBBox.pMin.y, aBBox.pMax.z)));
+				ret = calcUnion(ret, t(Point(aBBox.pMax.x, aBBox.pMax.y, aBBox.pMax.z)));
+				return ret;
+			}
+
+			// Arvo's method: each coordinate of the transformed box is the translation
+			// plus a sum of terms m[i][j] * p[j], and each term is minimized (or
+			// maximized) independently by picking p[j] from pMin or pMax. That's 18
+			// multiplies instead of the 72 it takes to transform eight corners
+			const Matrix4x4Data &d = m.data;
+#if defined(NAMASTE_SSE)
+			// Work on columns, so that one register holds the x, y and z terms
+			__m128 lo = _mm_setr_ps(d[0][3], d[1][3], d[2][3], 0.0f);
+			__m128 hi = lo;
+			for (int j = 0; j < 3; ++j)
+			{
+				__m128 column = _mm_setr_ps(d[0][j], d[1][j], d[2][j], 0.0f);
+				__m128 a = _mm_mul_ps(column, _mm_set1_ps(aBBox.pMin[j]));
+				__m128 b = _mm_mul_ps(column, _mm_set1_ps(aBBox.pMax[j]));
+				lo = _mm_add_ps(lo, _mm_min_ps(a, b));
+				hi = _mm_add_ps(hi, _mm_max_ps(a, b));
+			}
+
+			alignas(16) float pMin[4];
+			alignas(16) float pMax[4];
+			_mm_store_ps(pMin, lo);
+			_mm_store_ps(pMax, hi);
+			BBox ret;
+			ret.pMin = Point(pMin[0], pMin[1], pMin[2]);
+			ret.pMax = Point(pMax[0], pMax[1], pMax[2]);
+			return ret;
+#else
+			BBox ret;
+			ret.pMin = Point(d[0][3], d[1][3], d[2][3]);
+			ret.pMax = ret.pMin;
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					float a = d[i][j] * aBBox.pMin[j];
+					float b = d[i][j] * aBBox.pMax[j];
+					ret.pMin[i] += std::min(a, b);
+					ret.pMax[i] += std::max(a, b);
+				}
+			}
+			return ret;
+#endif
+		}
+
+		namespace {
+
+			// Shared by the three batch transforms: computes
+			//     out = M[0..2][0..2] * in + translation (+ divide by w if projective)
+			// over structure-of-arrays buffers, 4 elements at a time. The rows are
+			// passed in explicitly so that normals can use the transposed inverse
+			void transformBatch(const float rows[4][4], bool divideByW,
+				const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count)
+			{
+				size_t i = 0;
+#if defined(NAMASTE_SSE)
+				__m128 m[4][4];
+				for (int r = 0; r < 4; ++r)
+				{
+					for (int c = 0; c < 4; ++c)
+					{
+						m[r][c] = _mm_set1_ps(rows[r][c]);
+					}
+				}
+
+				const __m128 one = _mm_set1_ps(1.0f);
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 x = _mm_loadu_ps(xs + i);
+					__m128 y = _mm_loadu_ps(ys + i);
+					__m128 z = _mm_loadu_ps(zs + i);
+					__m128 xp = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], x), _mm_mul_ps(m[0][1], y)), _mm_mul_ps(m[0][2], z)), m[0][3]);
+					__m128 yp = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1][0], x), _mm_mul_ps(m[1][1], y)), _mm_mul_ps(m[1][2], z)), m[1][3]);
+					__m128 zp = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2][0], x), _mm_mul_ps(m[2][1], y)), _mm_mul_ps(m[2][2], z)), m[2][3]);
+					if (divideByW)
+					{
+						__m128 wp = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3][0], x), _mm_mul_ps(m[3][1], y)), _mm_mul_ps(m[3][2], z)), m[3][3]);
+						__m128 invW = _mm_div_ps(one, wp);
+						xp = _mm_mul_ps(xp, invW);
+						yp = _mm_mul_ps(yp, invW);
+						zp = _mm_mul_ps(zp, invW);
+					}
+					_mm_storeu_ps(outXs + i, xp);
+					_mm_storeu_ps(outYs + i, yp);
+					_mm_storeu_ps(outZs + i, zp);
+				}
+#endif
+				for (; i < count; ++i)
+				{
+					float x = xs[i], y = ys[i], z = zs[i];
+					float xp = rows[0][0] * x + rows[0][1] * y + rows[0][2] * z + rows[0][3];
+					float yp = rows[1][0] * x + rows[1][1] * y + rows[1][2] * z + rows[1][3];
+					float zp = rows[2][0] * x + rows[2][1] * y + rows[2][2] * z + rows[2][3];
+					if (divideByW)
+					{
+						float invW = 1.0f / (rows[3][0] * x + rows[3][1] * y + rows[3][2] * z + rows[3][3]);
+						xp *= invW;
+						yp *= invW;
+						zp *= invW;
+					}
+					outXs[i] = xp;
+					outYs[i] = yp;
+					outZs[i] = zp;
+				}
+			}
+
+		} // anonymous namespace
+
+		void Transform::transformPoints(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const
+		{
+			float rows[4][4];
+			for (int r = 0; r < 4; ++r)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					rows[r][c] = m.data[r][c];
+				}
+			}
+			// The projective divide is only needed when the bottom row isn't (0, 0, 0, 1),
+			// which is decided once for the whole buffer rather than per point
+			transformBatch(rows, !m.isAffine(), xs, ys, zs, outXs, outYs, outZs, count);
+		}
+
+		void Transform::transformVectors(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const
+		{
+			float rows[4][4] = {};
+			for (int r = 0; r < 3; ++r)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					rows[r][c] = m.data[r][c];
+				}
+			}
+			transformBatch(rows, false, xs, ys, zs, outXs, outYs, outZs, count);
+		}
+
+		void Transform::transformNormals(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const
+		{
+			float rows[4][4] = {};
+			for (int r = 0; r < 3; ++r)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					rows[r][c] = mInv.data[c][r];
+				}
+			}
+			transformBatch(rows, false, xs, ys, zs, outXs, outYs, outZs, count);
+		}
+
+		Transform inverse(const Transform &t)
+		{
+			// Swapping the matrices is free, since the inverse is already cached
+			return Transform(t.mInv, t.m);
+		}
+
+		Transform transpose(const Transform &t)
+		{
+			return Transform(transpose(t.m), transpose(t.mInv));
+		}
+
+		// ---------------------------------------------------------------
+		// Instance bounds class
+		// ---------------------------------------------------------------
+		InstanceBounds::InstanceBounds()
+		{
+		}
+
+		InstanceBounds::InstanceBounds(const BBox &aObjectBound, const Transform &aObjectToWorld) :
+			objectToWorld(aObjectToWorld), objectBBox(aObjectBound), worldBBox(aObjectToWorld(aObjectBound))
+		{
+		}
+
+		InstanceBounds::~InstanceBounds()
+		{
+		}
+
+		void InstanceBounds::setTransform(const Transform &aObjectToWorld)
+		{
+			// Setting the same transform again is common (e.g. the static parts of
+			// an animated scene), and doesn't need the bounds to be recomputed
+			if (aObjectToWorld == objectToWorld)
+			{
+				return;
+			}
+			objectToWorld = aObjectToWorld;
+			worldBBox = objectToWorld(objectBBox);
+		}
+
+		void InstanceBounds::setObjectBound(const BBox &aObjectBound)
+		{
+			objectBBox = aObjectBound;
+			worldBBox = objectToWorld(objectBBox);
+		}
+
+		const Transform& InstanceBounds::transform() const
+		{
+			return objectToWorld;
+		}
+
+		const BBox& InstanceBounds::objectBound() const
+		{
+			return objectBBox;
+		}
+
+		const BBox& InstanceBounds::worldBound() const
+		{
+			return worldBBox;
+		}
+
+		// ---------------------------------------------------------------
+		// Animated transform class
+		// ---------------------------------------------------------------
+		AnimatedTransform::AnimatedTransform(const Transform &aStartTransform, float aStartTime, const Transform &aEndTransform, float aEndTime) :
+			startTransform(aStartTransform), endTransform(aEndTransform), startTime(aStartTime), endTime(aEndTime),
+			actuallyAnimated(aStartTransform != aEndTransform && aEndTime > aStartTime), rotationAngle(0.0f)
+		{
+			decompose(startTransform.m, &T[0], &R[0], &S[0]);
+			decompose(endTransform.m, &T[1], &R[1], &S[1]);
+
+			// q and -q are the same rotation: pick the one that makes slerp take
+			// the shorter way around
+			if (dot(R[0], R[1]) < 0.0f)
+			{
+				R[1] = -R[1];
+			}
+			rotationAngle = 2.0f * acosf(std::min(dot(R[0], R[1]), 1.0f));
+		}
+
+		AnimatedTransform::~AnimatedTransform()
+		{
+		}
+
+		void AnimatedTransform::decompose(const Matrix4x4 &aM, Vector *T, Quaternion *R, Matrix4x4 *S)
+		{
+			// The translation is the last column
+			*T = Vector(aM.data[0][3], aM.data[1][3], aM.data[2][3]);
+
+			// What remains is the upper-left 3x3
+			Matrix4x4 M = aM;
+			for (int i = 0; i < 3; ++i)
+			{
+				M.data[i][3] = M.data[3][i] = 0.0f;
+			}
+			M.data[3][3] = 1.0f;
+
+			// Polar decomposition M = RS: repeatedly averaging a matrix with its
+			// inverse transpose converges to the closest rotation
+			Matrix4x4 rotation = M;
+			float norm;
+			int count = 0;
+			do
+			{
+				Matrix4x4 invTranspose = inverse(transpose(rotation));
+				Matrix4x4 next;
+				norm = 0.0f;
+				for (int i = 0; i < 4; ++i)
+				{
+					float rowDifference = 0.0f;
+					for (int j = 0; j < 4; ++j)
+					{
+						next.data[i][j] = 0.5f * (rotation.data[i][j] + invTranspose.data[i][j]);
+						rowDifference += fabsf(next.data[i][j] - rotation.data[i][j]);
+					}
+					norm = std::max(norm, rowDifference);
+				}
+				rotation = next;
+			} while (++count < 100 && norm > 0.0001f);
+
+			*R = Quaternion(Transform(rotation, transpose(rotation)));
+			*S = inverse(rotation) * M;
+		}
+
+		void AnimatedTransform::interpolate(float time, Transform *t) const
+		{
+			if (!actuallyAnimated || time <= startTime)
+			{
+				*t = startTransform;
+				return;
+			}
+			if (time >= endTime)
+			{
+				*t = endTransform;
+				return;
+			}
+
+			float dt = (time - startTime) / (endTime - startTime);
+			Vector trans = (1.0f - dt) * T[0] + dt * T[1];
+			Quaternion rotate = slerp(dt, R[0], R[1]);
+			Matrix4x4 scale;
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					scale.data[i][j] = ::lerp(dt, S[0].data[i][j], S[1].data[i][j]);
+				}
+			}
+			*t = translate(trans) * rotate.toTransform() * Transform(scale);
+		}
+
+		Point AnimatedTransform::operator()(float time, const Point &aPoint) const
+		{
+			Transform t;
+			interpolate(time, &t);
+			return t(aPoint);
+		}
+
+		Vector AnimatedTransform::operator()(float time, const Vector &aVector) const
+		{
+			Transform t;
+			interpolate(time, &t);
+			return t(aVector);
+		}
+
+		Ray AnimatedTransform::operator()(const Ray &aRay) const
+		{
+			if (!actuallyAnimated || aRay.time <= startTime)
+			{
+				return startTransform(aRay);
+			}
+			if (aRay.time >= endTime)
+			{
+				return endTransform(aRay);
+			}
+			Transform t;
+			interpolate(aRay.time, &t);
+			return t(aRay);
+		}
+
+		BBox AnimatedTransform::motionBounds(const BBox &aBBox) const
+		{
+			return motionBounds(aBBox, startTime, endTime);
+		}
+
+		BBox AnimatedTransform::motionBounds(const BBox &aBBox, float time0, float time1) const
+		{
+			if (!actuallyAnimated)
+			{
+				return startTransform(aBBox);
+			}
+			if (aBBox.pMin.x > aBBox.pMax.x || aBBox.pMin.y > aBBox.pMax.y || aBBox.pMin.z > aBBox.pMax.z)
+			{
+				return BBox();
+			}
+
+			// Bound the box at a number of evenly spaced times
+			const int nSteps = 16;
+			time0 = std::max(time0, startTime);
+			time1 = std::min(time1, endTime);
+			BBox ret;
+			for (int i = 0; i <= nSteps; ++i)
+			{
+				Transform t;
+				interpolate(::lerp(static_cast<float>(i) / nSteps, time0, time1), &t);
+				ret = calcUnion(ret, t(aBBox));
+			}
+
+			// Sampling alone could miss a corner bulging out between two samples,
+			// so pad the result. A corner p follows c(u) = T(u) + R(u) S(u) p over
+			// normalized time u, with T and S linear in u and R turning about a
+			// fixed axis at a constant rate w. Hence
+			//     |c''| <= w^2 |S(u) p| + 2 w |(S1 - S0) p| = K
+			// and a curve with |c''| <= K strays at most K h^2 / 8 from the chord
+			// between samples h apart. The chord lies inside the union of the two
+			// sampled boxes, so growing the union by that much is conservative
+			auto applyScale = [](const Matrix4x4 &s, const Point &p)
+			{
+				const Matrix4x4Data &d = s.data;
+				return Vector(d[0][0] * p.x + d[0][1] * p.y + d[0][2] * p.z,
+					d[1][0] * p.x + d[1][1] * p.y + d[1][2] * p.z,
+					d[2][0] * p.x + d[2][1] * p.y + d[2][2] * p.z);
+			};
+
+			const float w = rotationAngle;
+			float maxK = 0.0f;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				Point p(aBBox[corner & 1].x, aBBox[(corner >> 1) & 1].y, aBBox[(corner >> 2) & 1].z);
+				Vector v0 = applyScale(S[0], p);
+				Vector v1 = applyScale(S[1], p);
+				float K = w * w * std::max(v0.length(), v1.length()) + 2.0f * w * (v1 - v0).length();
+				maxK = std::max(maxK, K);
+			}
+
+			// A little slack covers the near-parallel case, where slerp falls back to
+			// a normalized lerp whose rate isn't quite constant
+			float h = (time1 - time0) / (endTime - startTime) / nSteps;
+			ret.expand(1.01f * maxK * h * h / 8.0f);
+			return ret;
+		}
+
+		bool AnimatedTransform::isAnimated() const
+		{
+			return actuallyAnimated;
+		}
+
+		// ---------------------------------------------------------------
+		// Transform factories
+		// ---------------------------------------------------------------
+		Transform translate(const Vector &delta)
+		{
+			Matrix4x4 m(1.0f, 0.0f, 0.0f, delta.x,
+				0.0f, 1.0f, 0.0f, delta.y,
+				0.0f, 0.0f, 1.0f, delta.z,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			Matrix4x4 mInv(1.0f, 0.0f, 0.0f, -delta.x,
+				0.0f, 1.0f, 0.0f, -delta.y,
+				0.0f, 0.0f, 1.0f, -delta.z,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, mInv);
+		}
+
+		Transform scale(float x, float y, float z)
+		{
+			Matrix4x4 m(x, 0.0f, 0.0f, 0.0f,
+				0.0f, y, 0.0f, 0.0f,
+				0.0f, 0.0f, z, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			Matrix4x4 mInv(1.0f / x, 0.0f, 0.0f, 0.0f,
+				0.0f, 1.0f / y, 0.0f, 0.0f,
+				0.0f, 0.0f, 1.0f / z, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, mInv);
+		}
+
+		// Rotation matrices are orthogonal, so their inverse is their transpose
+		Transform rotateX(float degrees)
+		{
+			float sinTheta = sinf(radians(degrees));
+			float cosTheta = cosf(radians(degrees));
+			Matrix4x4 m(1.0f, 0.0f, 0.0f, 0.0f,
+				0.0f, cosTheta, -sinTheta, 0.0f,
+				0.0f, sinTheta, cosTheta, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, transpose(m));
+		}
+
+		Transform rotateY(float degrees)
+		{
+			float sinTheta = sinf(radians(degrees));
+			float cosTheta = cosf(radians(degrees));
+			Matrix4x4 m(cosTheta, 0.0f, sinTheta, 0.0f,
+				0.0f, 1.0f, 0.0f, 0.0f,
+				-sinTheta, 0.0f, cosTheta, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, transpose(m));
+		}
+
+		Transform rotateZ(float degrees)
+		{
+			float sinTheta = sinf(radians(degrees));
+			float cosTheta = cosf(radians(degrees));
+			Matrix4x4 m(cosTheta, -sinTheta, 0.0f, 0.0f,
+				sinTheta, cosTheta, 0.0f, 0.0f,
+				0.0f, 0.0f, 1.0f, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, transpose(m));
+		}
+
+		Transform rotate(float degrees, const Vector &axis)
+		{
+			// Rotation about an arbitrary axis
+			Vector a = normalize(axis);
+			float s = sinf(radians(degrees));
+			float c = cosf(radians(degrees));
+			Matrix4x4 m(a.x * a.x + (1.0f - a.x * a.x) * c,
+				a.x * a.y * (1.0f - c) - a.z * s,
+				a.x * a.z * (1.0f - c) + a.y * s,
+				0.0f,
+				a.x * a.y * (1.0f - c) + a.z * s,
+				a.y * a.y + (1.0f - a.y * a.y) * c,
+				a.y * a.z * (1.0f - c) - a.x * s,
+				0.0f,
+				a.x * a.z * (1.0f - c) - a.y * s,
+				a.y * a.z * (1.0f - c) + a.x * s,
+				a.z * a.z + (1.0f - a.z * a.z) * c,
+				0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(m, transpose(m));
+		}
+
+		Transform lookAt(const Point &pos, const Point &look, const Vector &up)
+		{
+			// Build the camera-to-world matrix from an orthonormal basis, then
+			// invert it to get the world-to-camera transform
+			Vector dir = normalize(look - pos);
+			Vector left = normalize(cross(normalize(up), dir));
+			Vector newUp = cross(dir, left);
+			Matrix4x4 camToWorld(left.x, newUp.x, dir.x, pos.x,
+				left.y, newUp.y, dir.y, pos.y,
+				left.z, newUp.z, dir.z, pos.z,
+				0.0f, 0.0f, 0.0f, 1.0f);
+			return Transform(inverse(camToWorld), camToWorld);
+		}
+
 	} // namespace geom
 
 } // namespace namaste
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 
 #include "geometry.h"
+#include "quaternion.h"
 
 namespace namaste {
 
@@ -10,12 +12,33 @@ namespace namaste {
 
 		using Matrix4x4Data = std::array<std::array<float, 4>, 4>;
 
-		class Matrix4x4
+		// A row-major 4x4 matrix. Aligned to 16 bytes so that each row can be
+		// loaded straight into an SSE register
+		class alignas(16) Matrix4x4
 		{
 		public:
 			Matrix4x4();
+			explicit Matrix4x4(const float aData[4][4]);
+			Matrix4x4(float t00, float t01, float t02, float t03,
+				float t10, float t11, float t12, float t13,
+				float t20, float t21, float t22, float t23,
+				float t30, float t31, float t32, float t33);
 			~Matrix4x4();
 
+			Matrix4x4 operator*(const Matrix4x4 &rhs) const;
+
+			bool operator==(const Matrix4x4 &rhs) const;
+			bool operator!=(const Matrix4x4 &rhs) const;
+
+			bool isIdentity() const;
+
+			// Whether the bottom row is (0, 0, 0, 1), i.e. points never need to be
+			// divided through by w
+			bool isAffine() const;
+
+			friend Matrix4x4 transpose(const Matrix4x4 &m);
+			friend Matrix4x4 inverse(const Matrix4x4 &m);
+
 			friend std::ostream& operator<<(std::ostream &os, const Matrix4x4 &m);
 
 			Matrix4x4Data data;
@@ -26,10 +49,121 @@ namespace namaste {
 		{
 		public:
 			Transform();
+			explicit Transform(const Matrix4x4 &aM);
+			Transform(const Matrix4x4 &aM, const Matrix4x4 &aMInv);
 			~Transform();
+
+			Transform operator*(const Transform &rhs) const;
+
+			bool operator==(const Transform &rhs) const;
+			bool operator!=(const Transform &rhs) const;
+
+			bool isIdentity() const;
+			bool swapsHandedness() const;
+
+			// Applying a transform
+			Point operator()(const Point &aPoint) const;
+			Vector operator()(const Vector &aVector) const;
+			Normal operator()(const Normal &aNormal) const;
+			Ray operator()(const Ray &aRay) const;
+			RayDifferential operator()(const RayDifferential &aRay) const;
+			BBox operator()(const BBox &aBBox) const;	// Arvo's method for affine transforms
+
+			// Batch versions for whole structure-of-arrays vertex buffers, e.g. when
+			// loading or instancing a mesh. The output arrays may be the same as the
+			// input arrays to transform in place
+			void transformPoints(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const;
+			void transformVectors(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const;
+			void transformNormals(const float *xs, const float *ys, const float *zs, float *outXs, float *outYs, float *outZs, size_t count) const;
+
+			friend Transform inverse(const Transform &t);
+			friend Transform transpose(const Transform &t);
+
+			friend std::ostream& operator<<(std::ostream &os, const Transform &t)
+			{
+				os << t.m;
+				return os;
+			}
+
+			// The inverse is computed once when the transform is created, since
+			// normals (and every inverse transform) need it
+			Matrix4x4 m;
+			Matrix4x4 mInv;
 		private:
 		};
 
+		// The world-space bounds of an object-space box placed by a transform, e.g.
+		// for an instance of some shared geometry. The world bounds are cached and
+		// only recomputed when the transform or the object bounds actually change
+		class InstanceBounds
+		{
+		public:
+			InstanceBounds();
+			InstanceBounds(const BBox &aObjectBound, const Transform &aObjectToWorld);
+			~InstanceBounds();
+
+			void setTransform(const Transform &aObjectToWorld);
+			void setObjectBound(const BBox &aObjectBound);
+
+			const Transform& transform() const;
+			const BBox& objectBound() const;
+			const BBox& worldBound() const;
+		private:
+			Transform objectToWorld;
+			BBox objectBBox;
+			BBox worldBBox;
+		};
+
+		// Interpolates between two keyframe transforms over [startTime, endTime] for
+		// motion blur, using each ray's time. Each keyframe is decomposed into a
+		// translation, a rotation and a scale, which are interpolated separately
+		// (the rotation with slerp) so that rigid motion stays rigid in between
+		class AnimatedTransform
+		{
+		public:
+			AnimatedTransform(const Transform &aStartTransform, float aStartTime, const Transform &aEndTransform, float aEndTime);
+			~AnimatedTransform();
+
+			// Decomposes M = T * R * S, where S is a general (symmetric) scale
+			static void decompose(const Matrix4x4 &aM, Vector *T, Quaternion *R, Matrix4x4 *S);
+
+			void interpolate(float time, Transform *t) const;
+
+			Point operator()(float time, const Point &aPoint) const;
+			Vector operator()(float time, const Vector &aVector) const;
+			Ray operator()(const Ray &aRay) const;
+
+			// Conservative bounds of a box over [time0, time1], or over the whole
+			// animation. Computed once per primitive when the scene is built, so an
+			// accelerator built over them never evaluates the motion per node
+			BBox motionBounds(const BBox &aBBox) const;
+			BBox motionBounds(const BBox &aBBox, float time0, float time1) const;
+
+			bool isAnimated() const;
+
+			Transform startTransform;
+			Transform endTransform;
+			float startTime;
+			float endTime;
+		private:
+			bool actuallyAnimated;
+			Vector T[2];
+			Quaternion R[2];
+			Matrix4x4 S[2];
+
+			// The slerp turns at a constant rate: this is the total angle in radians
+			float rotationAngle;
+		};
+
+		// Transform factories
+		Transform translate(const Vector &delta);
+		Transform scale(float x, float y, float z);
+		Transform rotateX(float degrees);
+		Transform rotateY(float degrees);
+		Transform rotateZ(float degrees);
+		Transform rotate(float degrees, const Vector &axis);
+		Transform lookAt(const Point &pos, const Point &look, const Vector &up);
+
 	} // namespace geom
 
-} // namespace namaste
\ No newline at end of file
+} // namespace namaste
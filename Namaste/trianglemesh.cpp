@@ -0,0 +1,642 @@
+#include "stdafx.h"
+#include "trianglemesh.h"
+#include "simd.h"
+
+#include <climits>
+
+namespace namaste {
+
+	namespace shape {
+
+		using namespace geom;
+
+		namespace {
+
+			// The position arrays in the ray's permuted axis order, so that the
+			// permutation costs nothing per vertex
+			struct PermutedVertices
+			{
+				const float *x, *y, *z;
+			};
+
+			inline PermutedVertices permute(const scene::GeometryView &aGeometry, const WatertightRay &aRay)
+			{
+				const float *p[3] = { aGeometry.px, aGeometry.py, aGeometry.pz };
+				PermutedVertices ret = { p[aRay.kx], p[aRay.ky], p[aRay.kz] };
+				return ret;
+			}
+
+			// The watertight test for one triangle. The SIMD kernels below perform
+			// exactly the same operations in the same order, so their results are
+			// bit-identical; they only hand lanes back to this function when an edge
+			// function is exactly zero and needs the double precision recomputation
+			bool intersectTriangle(const PermutedVertices &p, uint32_t i0, uint32_t i1, uint32_t i2,
+				const WatertightRay &r, float minT, float maxT, float *t, float *b0, float *b1, float *b2)
+			{
+				// Translate the vertices to the ray origin, then shear in x and y
+				float x0 = p.x[i0] - r.ox, y0 = p.y[i0] - r.oy, z0 = p.z[i0] - r.oz;
+				float x1 = p.x[i1] - r.ox, y1 = p.y[i1] - r.oy, z1 = p.z[i1] - r.oz;
+				float x2 = p.x[i2] - r.ox, y2 = p.y[i2] - r.oy, z2 = p.z[i2] - r.oz;
+				x0 = x0 + r.sx * z0;
+				y0 = y0 + r.sy * z0;
+				x1 = x1 + r.sx * z1;
+				y1 = y1 + r.sy * z1;
+				x2 = x2 + r.sx * z2;
+				y2 = y2 + r.sy * z2;
+
+				float e0 = x1 * y2 - y1 * x2;
+				float e1 = x2 * y0 - y2 * x0;
+				float e2 = x0 * y1 - y0 * x1;
+				if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)
+				{
+					// The ray passes exactly through an edge or vertex in single
+					// precision, so the sign of the edge function decides which of the
+					// neighbouring triangles is hit: get it right in double precision
+					e0 = static_cast<float>(static_cast<double>(x1) * y2 - static_cast<double>(y1) * x2);
+					e1 = static_cast<float>(static_cast<double>(x2) * y0 - static_cast<double>(y2) * x0);
+					e2 = static_cast<float>(static_cast<double>(x0) * y1 - static_cast<double>(y0) * x1);
+				}
+				if ((e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) && (e0 > 0.0f || e1 > 0.0f || e2 > 0.0f))
+				{
+					return false;
+				}
+				float det = e0 + e1 + e2;
+				if (det == 0.0f)
+				{
+					return false;
+				}
+
+				z0 = z0 * r.sz;
+				z1 = z1 * r.sz;
+				z2 = z2 * r.sz;
+				float tScaled = e0 * z0 + e1 * z1 + e2 * z2;
+				float invDet = 1.0f / det;
+				float tHit = tScaled * invDet;
+				if (!(tHit > minT && tHit < maxT))
+				{
+					return false;
+				}
+
+				*t = tHit;
+				*b0 = e0 * invDet;
+				*b1 = e1 * invDet;
+				*b2 = e2 * invDet;
+				return true;
+			}
+
+			// Per-lane results of a SIMD kernel
+			struct LaneHits
+			{
+				alignas(32) float t[8];
+				alignas(32) float b0[8];
+				alignas(32) float b1[8];
+				alignas(32) float b2[8];
+			};
+
+#if defined(NAMASTE_SSE)
+			// ---------------------------------------------------------------
+			// SSE kernel
+			// ---------------------------------------------------------------
+			// Tests four triangles against one ray. Returns the mask of lanes that
+			// hit, and sets fallbackMask to the lanes that must be redone in scalar
+			namespace sse {
+
+				int intersect4(const PermutedVertices &p, const uint32_t *indices, const uint32_t aTriangles[4],
+					const WatertightRay &r, float minT, float maxT, LaneHits *hits, int *fallbackMask)
+				{
+					alignas(16) float vx[3][4], vy[3][4], vz[3][4];
+					for (int lane = 0; lane < 4; ++lane)
+					{
+						const uint32_t *v = indices + 3 * static_cast<size_t>(aTriangles[lane]);
+						for (int k = 0; k < 3; ++k)
+						{
+							vx[k][lane] = p.x[v[k]];
+							vy[k][lane] = p.y[v[k]];
+							vz[k][lane] = p.z[v[k]];
+						}
+					}
+
+					const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+					const __m128 sx = _mm_set1_ps(r.sx), sy = _mm_set1_ps(r.sy), sz = _mm_set1_ps(r.sz);
+					__m128 x0 = _mm_sub_ps(_mm_load_ps(vx[0]), ox), y0 = _mm_sub_ps(_mm_load_ps(vy[0]), oy), z0 = _mm_sub_ps(_mm_load_ps(vz[0]), oz);
+					__m128 x1 = _mm_sub_ps(_mm_load_ps(vx[1]), ox), y1 = _mm_sub_ps(_mm_load_ps(vy[1]), oy), z1 = _mm_sub_ps(_mm_load_ps(vz[1]), oz);
+					__m128 x2 = _mm_sub_ps(_mm_load_ps(vx[2]), ox), y2 = _mm_sub_ps(_mm_load_ps(vy[2]), oy), z2 = _mm_sub_ps(_mm_load_ps(vz[2]), oz);
+					x0 = _mm_add_ps(x0, _mm_mul_ps(sx, z0));
+					y0 = _mm_add_ps(y0, _mm_mul_ps(sy, z0));
+					x1 = _mm_add_ps(x1, _mm_mul_ps(sx, z1));
+					y1 = _mm_add_ps(y1, _mm_mul_ps(sy, z1));
+					x2 = _mm_add_ps(x2, _mm_mul_ps(sx, z2));
+					y2 = _mm_add_ps(y2, _mm_mul_ps(sy, z2));
+
+					__m128 e0 = _mm_sub_ps(_mm_mul_ps(x1, y2), _mm_mul_ps(y1, x2));
+					__m128 e1 = _mm_sub_ps(_mm_mul_ps(x2, y0), _mm_mul_ps(y2, x0));
+					__m128 e2 = _mm_sub_ps(_mm_mul_ps(x0, y1), _mm_mul_ps(y0, x1));
+
+					const __m128 zero = _mm_setzero_ps();
+					__m128 onEdge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(e0, zero), _mm_cmpeq_ps(e1, zero)), _mm_cmpeq_ps(e2, zero));
+					__m128 anyNegative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)), _mm_cmplt_ps(e2, zero));
+					__m128 anyPositive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)), _mm_cmpgt_ps(e2, zero));
+					__m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+					__m128 valid = _mm_andnot_ps(_mm_and_ps(anyNegative, anyPositive), _mm_cmpneq_ps(det, zero));
+
+					z0 = _mm_mul_ps(z0, sz);
+					z1 = _mm_mul_ps(z1, sz);
+					z2 = _mm_mul_ps(z2, sz);
+					__m128 tScaled = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, z0), _mm_mul_ps(e1, z1)), _mm_mul_ps(e2, z2));
+					__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+					__m128 t = _mm_mul_ps(tScaled, invDet);
+					valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(minT)), _mm_cmplt_ps(t, _mm_set1_ps(maxT))));
+
+					_mm_store_ps(hits->t, t);
+					_mm_store_ps(hits->b0, _mm_mul_ps(e0, invDet));
+					_mm_store_ps(hits->b1, _mm_mul_ps(e1, invDet));
+					_mm_store_ps(hits->b2, _mm_mul_ps(e2, invDet));
+					*fallbackMask = _mm_movemask_ps(onEdge);
+					return _mm_movemask_ps(valid) & ~*fallbackMask;
+				}
+
+			} // namespace sse
+
+			// ---------------------------------------------------------------
+			// AVX2 kernel
+			// ---------------------------------------------------------------
+			// The same for eight triangles, with the vertices fetched by gathers.
+			// Only called after checking cpuSupportsAVX2, and only for meshes whose
+			// indices fit the gathers' signed 32-bit offsets
+			namespace avx2 {
+
+				NAMASTE_TARGET_AVX2
+				int intersect8(const PermutedVertices &p, const uint32_t *indices, const uint32_t aTriangles[8],
+					const WatertightRay &r, float minT, float maxT, LaneHits *hits, int *fallbackMask)
+				{
+					const int *indexBase = reinterpret_cast<const int*>(indices);
+					__m256i first = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(aTriangles)), _mm256_set1_epi32(3));
+					__m256i v0 = _mm256_i32gather_epi32(indexBase, first, 4);
+					__m256i v1 = _mm256_i32gather_epi32(indexBase, _mm256_add_epi32(first, _mm256_set1_epi32(1)), 4);
+					__m256i v2 = _mm256_i32gather_epi32(indexBase, _mm256_add_epi32(first, _mm256_set1_epi32(2)), 4);
+
+					const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+					const __m256 sx = _mm256_set1_ps(r.sx), sy = _mm256_set1_ps(r.sy), sz = _mm256_set1_ps(r.sz);
+					__m256 x0 = _mm256_sub_ps(_mm256_i32gather_ps(p.x, v0, 4), ox);
+					__m256 y0 = _mm256_sub_ps(_mm256_i32gather_ps(p.y, v0, 4), oy);
+					__m256 z0 = _mm256_sub_ps(_mm256_i32gather_ps(p.z, v0, 4), oz);
+					__m256 x1 = _mm256_sub_ps(_mm256_i32gather_ps(p.x, v1, 4), ox);
+					__m256 y1 = _mm256_sub_ps(_mm256_i32gather_ps(p.y, v1, 4), oy);
+					__m256 z1 = _mm256_sub_ps(_mm256_i32gather_ps(p.z, v1, 4), oz);
+					__m256 x2 = _mm256_sub_ps(_mm256_i32gather_ps(p.x, v2, 4), ox);
+					__m256 y2 = _mm256_sub_ps(_mm256_i32gather_ps(p.y, v2, 4), oy);
+					__m256 z2 = _mm256_sub_ps(_mm256_i32gather_ps(p.z, v2, 4), oz);
+					x0 = _mm256_add_ps(x0, _mm256_mul_ps(sx, z0));
+					y0 = _mm256_add_ps(y0, _mm256_mul_ps(sy, z0));
+					x1 = _mm256_add_ps(x1, _mm256_mul_ps(sx, z1));
+					y1 = _mm256_add_ps(y1, _mm256_mul_ps(sy, z1));
+					x2 = _mm256_add_ps(x2, _mm256_mul_ps(sx, z2));
+					y2 = _mm256_add_ps(y2, _mm256_mul_ps(sy, z2));
+
+					__m256 e0 = _mm256_sub_ps(_mm256_mul_ps(x1, y2), _mm256_mul_ps(y1, x2));
+					__m256 e1 = _mm256_sub_ps(_mm256_mul_ps(x2, y0), _mm256_mul_ps(y2, x0));
+					__m256 e2 = _mm256_sub_ps(_mm256_mul_ps(x0, y1), _mm256_mul_ps(y0, x1));
+
+					const __m256 zero = _mm256_setzero_ps();
+					__m256 onEdge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_EQ_OQ), _mm256_cmp_ps(e1, zero, _CMP_EQ_OQ)), _mm256_cmp_ps(e2, zero, _CMP_EQ_OQ));
+					__m256 anyNegative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_LT_OQ), _mm256_cmp_ps(e1, zero, _CMP_LT_OQ)), _mm256_cmp_ps(e2, zero, _CMP_LT_OQ));
+					__m256 anyPositive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ), _mm256_cmp_ps(e1, zero, _CMP_GT_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GT_OQ));
+					__m256 det = _mm256_add_ps(_mm256_add_ps(e0, e1), e2);
+					__m256 valid = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+
+					z0 = _mm256_mul_ps(z0, sz);
+					z1 = _mm256_mul_ps(z1, sz);
+					z2 = _mm256_mul_ps(z2, sz);
+					__m256 tScaled = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e0, z0), _mm256_mul_ps(e1, z1)), _mm256_mul_ps(e2, z2));
+					__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+					__m256 t = _mm256_mul_ps(tScaled, invDet);
+					valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(minT), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(maxT), _CMP_LT_OQ)));
+
+					_mm256_store_ps(hits->t, t);
+					_mm256_store_ps(hits->b0, _mm256_mul_ps(e0, invDet));
+					_mm256_store_ps(hits->b1, _mm256_mul_ps(e1, invDet));
+					_mm256_store_ps(hits->b2, _mm256_mul_ps(e2, invDet));
+					*fallbackMask = _mm256_movemask_ps(onEdge);
+					return _mm256_movemask_ps(valid) & ~*fallbackMask;
+				}
+
+			} // namespace avx2
+#endif
+
+		} // namespace
+
+		// ---------------------------------------------------------------
+		// Watertight ray struct
+		// ---------------------------------------------------------------
+		WatertightRay::WatertightRay(const Ray &aRay)
+		{
+			float ax = fabsf(aRay.d.x), ay = fabsf(aRay.d.y), az = fabsf(aRay.d.z);
+			kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+			kx = kz == 2 ? 0 : kz + 1;
+			ky = kx == 2 ? 0 : kx + 1;
+
+			ox = aRay.o[kx];
+			oy = aRay.o[ky];
+			oz = aRay.o[kz];
+			sx = -aRay.d[kx] / aRay.d[kz];
+			sy = -aRay.d[ky] / aRay.d[kz];
+			sz = 1.0f / aRay.d[kz];
+		}
+
+		// ---------------------------------------------------------------
+		// Triangle mesh class
+		// ---------------------------------------------------------------
+		TriangleMesh::TriangleMesh(const scene::GeometryView &aGeometry) :
+			geometry(aGeometry)
+		{
+		}
+
+		TriangleMesh::~TriangleMesh()
+		{
+		}
+
+		void TriangleMesh::vertexIndices(uint32_t aTriangle, uint32_t *i0, uint32_t *i1, uint32_t *i2) const
+		{
+			const uint32_t *v = geometry.indices + 3 * static_cast<size_t>(aTriangle);
+			*i0 = v[0];
+			*i1 = v[1];
+			*i2 = v[2];
+		}
+
+		size_t TriangleMesh::triangleCount() const
+		{
+			return geometry.triangleCount();
+		}
+
+		BBox TriangleMesh::triangleBound(uint32_t aTriangle) const
+		{
+			uint32_t i0, i1, i2;
+			vertexIndices(aTriangle, &i0, &i1, &i2);
+			const scene::GeometryView &g = geometry;
+			return calcUnion(BBox(Point(g.px[i0], g.py[i0], g.pz[i0]), Point(g.px[i1], g.py[i1], g.pz[i1])),
+				Point(g.px[i2], g.py[i2], g.pz[i2]));
+		}
+
+		std::vector<BBox> TriangleMesh::triangleBounds() const
+		{
+			std::vector<BBox> bounds(triangleCount());
+			for (size_t i = 0; i < bounds.size(); ++i)
+			{
+				bounds[i] = triangleBound(static_cast<uint32_t>(i));
+			}
+			return bounds;
+		}
+
+		BBox TriangleMesh::worldBound() const
+		{
+			BBox ret;
+			for (size_t i = 0; i < triangleCount(); ++i)
+			{
+				ret = calcUnion(ret, triangleBound(static_cast<uint32_t>(i)));
+			}
+			return ret;
+		}
+
+		bool TriangleMesh::intersect(uint32_t aTriangle, const WatertightRay &aWatertightRay, const Ray &aRay, TriangleHit *hit) const
+		{
+			uint32_t i0, i1, i2;
+			vertexIndices(aTriangle, &i0, &i1, &i2);
+			if (!intersectTriangle(permute(geometry, aWatertightRay), i0, i1, i2, aWatertightRay, aRay.minT, aRay.maxT,
+				&hit->t, &hit->b0, &hit->b1, &hit->b2))
+			{
+				return false;
+			}
+			hit->triangle = aTriangle;
+			return true;
+		}
+
+		bool TriangleMesh::intersect(const uint32_t *aTriangles, int aCount, const WatertightRay &aWatertightRay, const Ray &aRay, TriangleHit *hit) const
+		{
+			bool found = false;
+			int i = 0;
+#if defined(NAMASTE_SSE)
+			const PermutedVertices p = permute(geometry, aWatertightRay);
+			const bool gatherable = simd::cpuSupportsAVX2() &&
+				geometry.indexCount <= static_cast<size_t>(INT_MAX) && geometry.vertexCount <= static_cast<size_t>(INT_MAX);
+			while (i < aCount)
+			{
+				// Eight lanes only pay off for leaves with more than four triangles.
+				// A partial group repeats its last triangle in the unused lanes
+				const int width = gatherable && aCount - i > 4 ? 8 : 4;
+				const int n = std::min(width, aCount - i);
+				uint32_t triangles[8];
+				for (int lane = 0; lane < width; ++lane)
+				{
+					triangles[lane] = aTriangles[i + std::min(lane, n - 1)];
+				}
+
+				LaneHits lanes;
+				int fallbackMask;
+				int hitMask = width == 8 ?
+					avx2::intersect8(p, geometry.indices, triangles, aWatertightRay, aRay.minT, aRay.maxT, &lanes, &fallbackMask) :
+					sse::intersect4(p, geometry.indices, triangles, aWatertightRay, aRay.minT, aRay.maxT, &lanes, &fallbackMask);
+
+				// Resolve the lanes in order, so ties go to the earlier triangle just
+				// as they would testing one at a time
+				for (int lane = 0; lane < n; ++lane)
+				{
+					if (fallbackMask & (1 << lane))
+					{
+						if (intersect(triangles[lane], aWatertightRay, aRay, hit))
+						{
+							aRay.maxT = hit->t;
+							found = true;
+						}
+					}
+					else if ((hitMask & (1 << lane)) && lanes.t[lane] < aRay.maxT)
+					{
+						hit->triangle = triangles[lane];
+						hit->t = lanes.t[lane];
+						hit->b0 = lanes.b0[lane];
+						hit->b1 = lanes.b1[lane];
+						hit->b2 = lanes.b2[lane];
+						aRay.maxT = hit->t;
+						found = true;
+					}
+				}
+				i += n;
+			}
+#endif
+			for (; i < aCount; ++i)
+			{
+				if (intersect(aTriangles[i], aWatertightRay, aRay, hit))
+				{
+					aRay.maxT = hit->t;
+					found = true;
+				}
+			}
+			return found;
+		}
+
+		bool TriangleMesh::intersect(const accel::BVHAccel &aBVH, const Ray &aRay, TriangleHit *hit) const
+		{
+			const WatertightRay watertightRay(aRay);
+			return aBVH.intersectLeaves(aRay, [&](const uint32_t *aTriangles, int aCount, const Ray &ray)
+			{
+				return intersect(aTriangles, aCount, watertightRay, ray, hit);
+			});
+		}
+
+		bool TriangleMesh::intersect(const accel::WideBVH &aBVH, const Ray &aRay, TriangleHit *hit) const
+		{
+			const WatertightRay watertightRay(aRay);
+			return aBVH.intersectLeaves(aRay, [&](const uint32_t *aTriangles, int aCount, const Ray &ray)
+			{
+				return intersect(aTriangles, aCount, watertightRay, ray, hit);
+			});
+		}
+
+		size_t TriangleMesh::intersect(const accel::BVHAccel &aBVH, accel::RayStream &aStream, TriangleHit *hits) const
+		{
+			std::vector<WatertightRay> watertightRays;
+			watertightRays.reserve(aStream.size());
+			for (size_t i = 0; i < aStream.size(); ++i)
+			{
+				watertightRays.push_back(WatertightRay(aStream.rays[i]));
+				hits[i].triangle = invalidTriangle;
+			}
+
+			accel::intersectStream(aBVH, aStream, [&](const uint32_t *aTriangles, int aCount, uint32_t aRayIndex, const Ray &ray)
+			{
+				return intersect(aTriangles, aCount, watertightRays[aRayIndex], ray, &hits[aRayIndex]);
+			});
+
+			size_t nHits = 0;
+			for (size_t i = 0; i < aStream.size(); ++i)
+			{
+				nHits += hits[i].triangle != invalidTriangle;
+			}
+			return nHits;
+		}
+
+		bool TriangleMesh::intersectP(uint32_t aTriangle, const WatertightRay &aWatertightRay, const Ray &aRay) const
+		{
+			uint32_t i0, i1, i2;
+			vertexIndices(aTriangle, &i0, &i1, &i2);
+			float t, b0, b1, b2;
+			return intersectTriangle(permute(geometry, aWatertightRay), i0, i1, i2, aWatertightRay, aRay.minT, aRay.maxT, &t, &b0, &b1, &b2);
+		}
+
+		bool TriangleMesh::intersectP(const uint32_t *aTriangles, int aCount, const WatertightRay &aWatertightRay, const Ray &aRay) const
+		{
+			int i = 0;
+#if defined(NAMASTE_SSE)
+			const PermutedVertices p = permute(geometry, aWatertightRay);
+			const bool gatherable = simd::cpuSupportsAVX2() &&
+				geometry.indexCount <= static_cast<size_t>(INT_MAX) && geometry.vertexCount <= static_cast<size_t>(INT_MAX);
+			while (i < aCount)
+			{
+				const int width = gatherable && aCount - i > 4 ? 8 : 4;
+				const int n = std::min(width, aCount - i);
+				uint32_t triangles[8];
+				for (int lane = 0; lane < width; ++lane)
+				{
+					triangles[lane] = aTriangles[i + std::min(lane, n - 1)];
+				}
+
+				LaneHits lanes;
+				int fallbackMask;
+				int hitMask = width == 8 ?
+					avx2::intersect8(p, geometry.indices, triangles, aWatertightRay, aRay.minT, aRay.maxT, &lanes, &fallbackMask) :
+					sse::intersect4(p, geometry.indices, triangles, aWatertightRay, aRay.minT, aRay.maxT, &lanes, &fallbackMask);
+				if (hitMask != 0)
+				{
+					return true;
+				}
+				for (int lane = 0; lane < n; ++lane)
+				{
+					if ((fallbackMask & (1 << lane)) && intersectP(triangles[lane], aWatertightRay, aRay))
+					{
+						return true;
+					}
+				}
+				i += n;
+			}
+#endif
+			for (; i < aCount; ++i)
+			{
+				if (intersectP(aTriangles[i], aWatertightRay, aRay))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool TriangleMesh::intersectP(const accel::BVHAccel &aBVH, const Ray &aRay) const
+		{
+			const WatertightRay watertightRay(aRay);
+			return aBVH.intersectP(aRay, [&](const uint32_t *aTriangles, int aCount, const Ray &ray)
+			{
+				return intersectP(aTriangles, aCount, watertightRay, ray);
+			});
+		}
+
+		bool TriangleMesh::intersectP(const accel::WideBVH &aBVH, const Ray &aRay) const
+		{
+			const WatertightRay watertightRay(aRay);
+			return aBVH.intersectP(aRay, [&](const uint32_t *aTriangles, int aCount, const Ray &ray)
+			{
+				return intersectP(aTriangles, aCount, watertightRay, ray);
+			});
+		}
+
+		Point TriangleMesh::hitPoint(const TriangleHit &aHit) const
+		{
+			uint32_t i0, i1, i2;
+			vertexIndices(aHit.triangle, &i0, &i1, &i2);
+			const scene::GeometryView &g = geometry;
+			return Point(aHit.b0 * g.px[i0] + aHit.b1 * g.px[i1] + aHit.b2 * g.px[i2],
+				aHit.b0 * g.py[i0] + aHit.b1 * g.py[i1] + aHit.b2 * g.py[i2],
+				aHit.b0 * g.pz[i0] + aHit.b1 * g.pz[i1] + aHit.b2 * g.pz[i2]);
+		}
+
+		Normal TriangleMesh::geometricNormal(uint32_t aTriangle) const
+		{
+			uint32_t i0, i1, i2;
+			vertexIndices(aTriangle, &i0, &i1, &i2);
+			const scene::GeometryView &g = geometry;
+			Point p0(g.px[i0], g.py[i0], g.pz[i0]);
+			Point p1(g.px[i1], g.py[i1], g.pz[i1]);
+			Point p2(g.px[i2], g.py[i2], g.pz[i2]);
+			return Normal(normalize(cross(p0 - p2, p1 - p2)));
+		}
+
+		Normal TriangleMesh::shadingNormal(const TriangleHit &aHit) const
+		{
+			const scene::GeometryView &g = geometry;
+			if (g.nx)
+			{
+				uint32_t i0, i1, i2;
+				vertexIndices(aHit.triangle, &i0, &i1, &i2);
+				Normal n(aHit.b0 * g.nx[i0] + aHit.b1 * g.nx[i1] + aHit.b2 * g.nx[i2],
+					aHit.b0 * g.ny[i0] + aHit.b1 * g.ny[i1] + aHit.b2 * g.ny[i2],
+					aHit.b0 * g.nz[i0] + aHit.b1 * g.nz[i1] + aHit.b2 * g.nz[i2]);
+				// Meshes without normals are padded with zeros in the shared buffers
+				if (n.lengthSquared() > 0.0f)
+				{
+					return normalize(n);
+				}
+			}
+			return geometricNormal(aHit.triangle);
+		}
+
+		void TriangleMesh::uv(const TriangleHit &aHit, float *u, float *v) const
+		{
+			const scene::GeometryView &g = geometry;
+			if (g.u)
+			{
+				uint32_t i0, i1, i2;
+				vertexIndices(aHit.triangle, &i0, &i1, &i2);
+				*u = aHit.b0 * g.u[i0] + aHit.b1 * g.u[i1] + aHit.b2 * g.u[i2];
+				*v = aHit.b0 * g.v[i0] + aHit.b1 * g.v[i1] + aHit.b2 * g.v[i2];
+			}
+			else
+			{
+				// The default parameterization: (0, 0), (1, 0) and (1, 1)
+				*u = aHit.b1 + aHit.b2;
+				*v = aHit.b2;
+			}
+		}
+
+		void TriangleMesh::uvDifferentials(const TriangleHit &aHit, const RayDifferential &aRay,
+			float *dudx, float *dvdx, float *dudy, float *dvdy) const
+		{
+			*dudx = *dvdx = *dudy = *dvdy = 0.0f;
+			if (!aRay.hasDifferentials)
+			{
+				return;
+			}
+
+			uint32_t i0, i1, i2;
+			vertexIndices(aHit.triangle, &i0, &i1, &i2);
+			const scene::GeometryView &g = geometry;
+			Point p0(g.px[i0], g.py[i0], g.pz[i0]);
+			Point p1(g.px[i1], g.py[i1], g.pz[i1]);
+			Point p2(g.px[i2], g.py[i2], g.pz[i2]);
+			float uv[3][2] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f } };
+			if (g.u)
+			{
+				const uint32_t v[3] = { i0, i1, i2 };
+				for (int k = 0; k < 3; ++k)
+				{
+					uv[k][0] = g.u[v[k]];
+					uv[k][1] = g.v[v[k]];
+				}
+			}
+
+			// Partial derivatives of the position with respect to u and v
+			float du02 = uv[0][0] - uv[2][0], du12 = uv[1][0] - uv[2][0];
+			float dv02 = uv[0][1] - uv[2][1], dv12 = uv[1][1] - uv[2][1];
+			float determinant = du02 * dv12 - dv02 * du12;
+			if (determinant == 0.0f)
+			{
+				return;
+			}
+			float invDet = 1.0f / determinant;
+			Vector dp02 = p0 - p2, dp12 = p1 - p2;
+			Vector dpdu = (dv12 * dp02 - dv02 * dp12) * invDet;
+			Vector dpdv = (du02 * dp12 - du12 * dp02) * invDet;
+
+			// Offsets to where the differential rays meet the triangle's plane
+			Point p = hitPoint(aHit);
+			Vector n = cross(dp02, dp12);
+			float d = dot(n, Vector(p));
+			float denomX = dot(n, aRay.rxDirection), denomY = dot(n, aRay.ryDirection);
+			if (denomX == 0.0f || denomY == 0.0f)
+			{
+				return;
+			}
+			Vector dpdx = aRay.rxOrigin + ((d - dot(n, Vector(aRay.rxOrigin))) / denomX) * aRay.rxDirection - p;
+			Vector dpdy = aRay.ryOrigin + ((d - dot(n, Vector(aRay.ryOrigin))) / denomY) * aRay.ryDirection - p;
+
+			// Solve dp = du * dpdu + dv * dpdv in the two coordinates the normal is
+			// least aligned with, which leaves the best conditioned system
+			int ax0, ax1;
+			if (fabsf(n.x) > fabsf(n.y) && fabsf(n.x) > fabsf(n.z))
+			{
+				ax0 = 1;
+				ax1 = 2;
+			}
+			else if (fabsf(n.y) > fabsf(n.z))
+			{
+				ax0 = 0;
+				ax1 = 2;
+			}
+			else
+			{
+				ax0 = 0;
+				ax1 = 1;
+			}
+			float a00 = dpdu[ax0], a01 = dpdv[ax0], a10 = dpdu[ax1], a11 = dpdv[ax1];
+			float det = a00 * a11 - a01 * a10;
+			if (det == 0.0f)
+			{
+				return;
+			}
+			float invA = 1.0f / det;
+			*dudx = (a11 * dpdx[ax0] - a01 * dpdx[ax1]) * invA;
+			*dvdx = (a00 * dpdx[ax1] - a10 * dpdx[ax0]) * invA;
+			*dudy = (a11 * dpdy[ax0] - a01 * dpdy[ax1]) * invA;
+			*dvdy = (a00 * dpdy[ax1] - a10 * dpdy[ax0]) * invA;
+		}
+
+		double TriangleMesh::bytesPerTriangle() const
+		{
+			if (triangleCount() == 0)
+			{
+				return 0.0;
+			}
+			size_t floatsPerVertex = 3 + (geometry.nx ? 3 : 0) + (geometry.u ? 2 : 0);
+			size_t bytes = geometry.vertexCount * floatsPerVertex * sizeof(float) + geometry.indexCount * sizeof(uint32_t);
+			return static_cast<double>(bytes) / triangleCount();
+		}
+
+	} // namespace shape
+
+} // namespace namaste
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "geometry.h"
+#include "scene.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "raystream.h"
+
+namespace namaste {
+
+	namespace shape {
+
+		// A ray set up for the watertight ray-triangle test of Woop, Benthin and
+		// Wald (2013). The ray is translated to the origin and sheared so that it
+		// points down +z, which reduces the test to 2D edge functions. Triangles
+		// that share an edge evaluate it on exactly the same transformed
+		// vertices, so no ray can slip through the crack between them
+		struct WatertightRay
+		{
+			explicit WatertightRay(const geom::Ray &aRay);
+
+			float ox, oy, oz;		// Origin, permuted
+			int kx, ky, kz;			// kz is the dominant axis of the direction
+			float sx, sy, sz;		// Shear
+		};
+
+		// The triangle of a hit record that never hit anything
+		static const uint32_t invalidTriangle = 0xffffffff;
+
+		struct TriangleHit
+		{
+			uint32_t triangle;
+			float t;
+			float b0, b1, b2;		// Barycentric coordinates of the hit point
+		};
+
+		// All of a scene's triangles. Vertices, normals and uvs live once in the
+		// scene's shared structure-of-arrays buffers (parsed or memory-mapped) and
+		// triangles are just triples of indices into them, referred to by their
+		// index: there are no per-triangle objects. The buffers must outlive the
+		// mesh
+		class TriangleMesh
+		{
+		public:
+			explicit TriangleMesh(const scene::GeometryView &aGeometry);
+			~TriangleMesh();
+
+			size_t triangleCount() const;
+			geom::BBox triangleBound(uint32_t aTriangle) const;
+			std::vector<geom::BBox> triangleBounds() const;
+			geom::BBox worldBound() const;
+
+			// A single triangle. Only hits with ray.minT < t < ray.maxT count, and
+			// the ray isn't modified
+			bool intersect(uint32_t aTriangle, const WatertightRay &aWatertightRay, const geom::Ray &aRay, TriangleHit *hit) const;
+			// The closest hit among a BVH leaf's triangles, tested four (SSE) or eight
+			// (AVX2) at a time, shrinking ray.maxT if there is one. The result is
+			// exactly that of testing the triangles one by one
+			bool intersect(const uint32_t *aTriangles, int aCount, const WatertightRay &aWatertightRay, const geom::Ray &aRay, TriangleHit *hit) const;
+			// The closest hit through a BVH built over triangleBounds(), or a wide BVH
+			// collapsed from one
+			bool intersect(const accel::BVHAccel &aBVH, const geom::Ray &aRay, TriangleHit *hit) const;
+			bool intersect(const accel::WideBVH &aBVH, const geom::Ray &aRay, TriangleHit *hit) const;
+			// The closest hits of a whole stream of rays, written to hits[rayIndex].
+			// Rays that hit nothing are left with triangle == invalidTriangle. Returns
+			// the number of rays that hit
+			size_t intersect(const accel::BVHAccel &aBVH, accel::RayStream &aStream, TriangleHit *hits) const;
+
+			// Occlusion queries: whether anything lies strictly between ray.minT and
+			// ray.maxT. They stop at the first hit found and compute no hit record
+			bool intersectP(uint32_t aTriangle, const WatertightRay &aWatertightRay, const geom::Ray &aRay) const;
+			bool intersectP(const uint32_t *aTriangles, int aCount, const WatertightRay &aWatertightRay, const geom::Ray &aRay) const;
+			bool intersectP(const accel::BVHAccel &aBVH, const geom::Ray &aRay) const;
+			bool intersectP(const accel::WideBVH &aBVH, const geom::Ray &aRay) const;
+
+			geom::Point hitPoint(const TriangleHit &aHit) const;
+			geom::Normal geometricNormal(uint32_t aTriangle) const;
+			// Interpolated vertex normal, or the geometric normal if there are none
+			geom::Normal shadingNormal(const TriangleHit &aHit) const;
+			// Interpolated uvs, or the triangle's barycentric (b1, b2) if there are none
+			void uv(const TriangleHit &aHit, float *u, float *v) const;
+			// Screen-space derivatives of the uvs at a hit, from where the ray's
+			// differentials meet the triangle's plane, for choosing texture filter
+			// widths. All zero if the ray has no differentials
+			void uvDifferentials(const TriangleHit &aHit, const geom::RayDifferential &aRay,
+				float *dudx, float *dvdx, float *dudy, float *dvdy) const;
+
+			// Vertex, normal, uv and index bytes per triangle, not counting any BVH
+			double bytesPerTriangle() const;
+
+			scene::GeometryView geometry;
+		private:
+			void vertexIndices(uint32_t aTriangle, uint32_t *i0, uint32_t *i1, uint32_t *i2) const;
+		};
+
+	} // namespace shape
+
+} // namespace namaste
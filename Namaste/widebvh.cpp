@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "widebvh.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace namaste {
+
+	namespace accel {
+
+		using geom::BBox;
+
+		namespace {
+
+			BBox childBBox(const WideBVHNode &aNode, int i)
+			{
+				const geom::BBox4 &b = aNode.childBounds;
+				return BBox(geom::Point(b.minX[i], b.minY[i], b.minZ[i]), geom::Point(b.maxX[i], b.maxY[i], b.maxZ[i]));
+			}
+
+			// Quantizes a full-precision node on a grid spanning the union of its
+			// children. The initial guesses are nudged until decoding them brackets the
+			// child, which always succeeds: q = 0 decodes to the grid origin and
+			// q = 255 to at least the far side of the node
+			QuantizedBVHNode quantize(const WideBVHNode &aNode)
+			{
+				QuantizedBVHNode q;
+				std::memset(&q, 0, sizeof(q));
+				q.childCount = aNode.childCount;
+
+				BBox bounds;
+				for (int i = 0; i < aNode.childCount; ++i)
+				{
+					bounds = calcUnion(bounds, childBBox(aNode, i));
+				}
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					float origin = bounds.pMin[axis];
+					float extent = bounds.pMax[axis] - origin;
+					int exponent = 0;
+					if (extent > 0.0f)
+					{
+						// extent / 255 < 2^exponent, so 255 steps cover the node
+						std::frexp(extent / 255.0f, &exponent);
+					}
+					exponent = std::min(std::max(exponent, -126), 127);
+					float scale = quantizationScale(exponent);
+					q.origin[axis] = origin;
+					q.exponent[axis] = static_cast<int8_t>(exponent);
+
+					for (int i = 0; i < wideBVHWidth; ++i)
+					{
+						if (i >= aNode.childCount)
+						{
+							// Never tested: traversal masks off the unused slots
+							q.qMin[axis][i] = 255;
+							q.qMax[axis][i] = 0;
+							continue;
+						}
+
+						BBox child = childBBox(aNode, i);
+						float lo = std::floor((child.pMin[axis] - origin) / scale);
+						float hi = std::ceil((child.pMax[axis] - origin) / scale);
+						int qMin = static_cast<int>(std::min(std::max(lo, 0.0f), 255.0f));
+						int qMax = static_cast<int>(std::min(std::max(hi, 0.0f), 255.0f));
+						while (qMin > 0 && dequantize(origin, exponent, static_cast<uint8_t>(qMin)) > child.pMin[axis])
+						{
+							--qMin;
+						}
+						while (qMax < 255 && dequantize(origin, exponent, static_cast<uint8_t>(qMax)) < child.pMax[axis])
+						{
+							++qMax;
+						}
+						assert(dequantize(origin, exponent, static_cast<uint8_t>(qMin)) <= child.pMin[axis]);
+						assert(dequantize(origin, exponent, static_cast<uint8_t>(qMax)) >= child.pMax[axis]);
+						q.qMin[axis][i] = static_cast<uint8_t>(qMin);
+						q.qMax[axis][i] = static_cast<uint8_t>(qMax);
+					}
+				}
+
+				for (int i = 0; i < wideBVHWidth; ++i)
+				{
+					q.children[i] = aNode.children[i];
+					q.nPrimitives[i] = aNode.nPrimitives[i];
+				}
+				return q;
+			}
+
+		} // namespace
+
+		// ---------------------------------------------------------------
+		// Wide BVH class
+		// ---------------------------------------------------------------
+		WideBVH::WideBVH(const BVHAccel &aBVH, bool aQuantized) :
+			quantized(aQuantized), bounds(aBVH.worldBound()), primitiveIndices(aBVH.primitiveIndices)
+		{
+			if (aBVH.nodes.empty())
+			{
+				return;
+			}
+
+			// Every binary interior node below a wide node is absorbed into it, so
+			// there are at most half as many wide nodes as binary ones
+			stats::PhaseTimer timer(stats::PhaseWideBVHBuild);
+			nodes.reserve(aBVH.nodes.size() / 2 + 1);
+			collapse(aBVH, 0);
+
+			if (quantized)
+			{
+				quantizedNodes.reserve(nodes.size());
+				for (auto it = nodes.cbegin(); it < nodes.cend(); ++it)
+				{
+					quantizedNodes.push_back(quantize(*it));
+				}
+				std::vector<WideBVHNode>().swap(nodes);
+			}
+		}
+
+		WideBVH::~WideBVH()
+		{
+		}
+
+		BBox WideBVH::worldBound() const
+		{
+			return bounds;
+		}
+
+		size_t WideBVH::nodeCount() const
+		{
+			return quantized ? quantizedNodes.size() : nodes.size();
+		}
+
+		size_t WideBVH::memoryBytes() const
+		{
+			return nodes.size() * sizeof(WideBVHNode) + quantizedNodes.size() * sizeof(QuantizedBVHNode) +
+				primitiveIndices.size() * sizeof(uint32_t);
+		}
+
+		// Emits the wide node for a binary subtree and returns its index. Starting
+		// from the subtree's children, the interior child with the largest surface
+		// area - the one most likely to be hit - is replaced by its own two children
+		// until the node is full, so each wide node absorbs up to three binary ones
+		uint32_t WideBVH::collapse(const BVHAccel &aBVH, uint32_t aNodeIndex)
+		{
+			const std::vector<LinearBVHNode> &binary = aBVH.nodes;
+			uint32_t open[wideBVHWidth];
+			int count = 0;
+			if (binary[aNodeIndex].nPrimitives > 0)
+			{
+				// Only for a tree that is a single leaf
+				open[count++] = aNodeIndex;
+			}
+			else
+			{
+				open[count++] = aNodeIndex + 1;
+				open[count++] = binary[aNodeIndex].secondChildOffset;
+			}
+
+			while (count < wideBVHWidth)
+			{
+				int best = -1;
+				float bestArea = -1.0f;
+				for (int i = 0; i < count; ++i)
+				{
+					const LinearBVHNode &child = binary[open[i]];
+					if (child.nPrimitives == 0 && child.bounds.surfaceArea() > bestArea)
+					{
+						best = i;
+						bestArea = child.bounds.surfaceArea();
+					}
+				}
+				if (best < 0) break;
+				uint32_t expanded = open[best];
+				open[best] = expanded + 1;
+				open[count++] = binary[expanded].secondChildOffset;
+			}
+
+			uint32_t index = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			nodes[index].childCount = static_cast<uint8_t>(count);
+			std::fill(nodes[index].pad, nodes[index].pad + sizeof(nodes[index].pad), 0);
+			for (int i = 0; i < wideBVHWidth; ++i)
+			{
+				nodes[index].children[i] = 0;
+				nodes[index].nPrimitives[i] = 0;
+			}
+
+			for (int i = 0; i < count; ++i)
+			{
+				const LinearBVHNode &child = binary[open[i]];
+				// Note that recursing may reallocate nodes
+				uint32_t childIndex = child.nPrimitives > 0 ? child.primitivesOffset : collapse(aBVH, open[i]);
+				WideBVHNode &node = nodes[index];
+				node.childBounds.set(i, child.bounds);
+				node.children[i] = childIndex;
+				node.nPrimitives[i] = child.nPrimitives;
+			}
+			return index;
+		}
+
+	} // namespace accel
+
+} // namespace namaste
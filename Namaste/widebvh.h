@@ -0,0 +1,293 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "simd.h"
+#include "geometry.h"
+#include "raypacket.h"
+#include "bvh.h"
+
+namespace namaste {
+
+	namespace accel {
+
+		// Children per node of the wide BVH: one SSE slab test covers them all
+		static const int wideBVHWidth = 4;
+
+		// A node of the wide BVH with full-precision child bounds. Children are
+		// packed into the first childCount slots; a child with nPrimitives > 0 is
+		// a leaf whose primitives start at children[i] in the primitive index
+		// array, otherwise children[i] is the index of its node. 128 bytes
+		struct WideBVHNode
+		{
+			geom::BBox4 childBounds;
+			uint32_t children[wideBVHWidth];
+			uint16_t nPrimitives[wideBVHWidth];	// 0 -> interior child
+			uint8_t childCount;
+			uint8_t pad[7];
+		};
+
+		// The same node with its child bounds quantized to 8 bits per plane on a
+		// per-axis grid spanning the node's own bounds: plane q lies at
+		// origin + q * 2^exponent. The scale is a power of two so that decoding
+		// rounds only once, and minima are rounded down and maxima up so that a
+		// decoded box always contains the child. 64 bytes, one cache line
+		struct QuantizedBVHNode
+		{
+			float origin[3];
+			int8_t exponent[3];
+			uint8_t childCount;
+			uint8_t qMin[3][wideBVHWidth];		// [axis][child]
+			uint8_t qMax[3][wideBVHWidth];
+			uint32_t children[wideBVHWidth];
+			uint16_t nPrimitives[wideBVHWidth];
+		};
+
+		static_assert(sizeof(QuantizedBVHNode) == 64, "QuantizedBVHNode should be 64 bytes");
+		static_assert(std::is_trivially_copyable<QuantizedBVHNode>::value, "QuantizedBVHNode should be trivially copyable");
+
+		// A 4-wide BVH collapsed from a binary BVHAccel, sharing its leaves and
+		// primitive order. Each node is tested with one packet slab test against
+		// all its children, roughly a third as many nodes are visited, and with
+		// quantized bounds the tree takes about half of the binary tree's
+		// memory. Traversal has the same interface as BVHAccel's
+		class WideBVH
+		{
+		public:
+			explicit WideBVH(const BVHAccel &aBVH, bool aQuantized = true);
+			~WideBVH();
+
+			WideBVH(WideBVH &&) = default;
+			WideBVH& operator=(WideBVH &&) = default;
+
+			geom::BBox worldBound() const;
+			size_t nodeCount() const;
+			// Bytes taken by nodes and primitive indices
+			size_t memoryBytes() const;
+
+			template <typename LeafFunc>
+			bool intersectLeaves(const geom::Ray &aRay, LeafFunc intersectLeaf) const;
+			template <typename LeafFunc>
+			bool intersectP(const geom::Ray &aRay, LeafFunc occludedLeaf) const;
+
+			bool quantized;
+			geom::BBox bounds;
+			std::vector<WideBVHNode> nodes;				// Full-precision layout
+			std::vector<QuantizedBVHNode> quantizedNodes;	// Quantized layout
+			std::vector<uint32_t> primitiveIndices;
+		private:
+			uint32_t collapse(const BVHAccel &aBVH, uint32_t aNodeIndex);
+
+			template <typename Node, typename LeafFunc>
+			bool traverse(const std::vector<Node> &aNodes, const geom::Ray &aRay, LeafFunc intersectLeaf) const;
+			template <typename Node, typename LeafFunc>
+			bool traverseAnyHit(const std::vector<Node> &aNodes, const geom::Ray &aRay, LeafFunc occludedLeaf) const;
+		};
+
+		// Each node pushes at most three more children than it pops
+		static const int maxWideBVHStack = 3 * maxBVHDepth + 1;
+
+		// 2^exponent, built directly from its bits; exponent is kept in [-126, 127]
+		inline float quantizationScale(int aExponent)
+		{
+			uint32_t bits = static_cast<uint32_t>(aExponent + 127) << 23;
+			float scale;
+			std::memcpy(&scale, &bits, sizeof(float));
+			return scale;
+		}
+
+		// Position of a quantized plane. q * 2^exponent is exact, so with or without
+		// a fused multiply-add, scalar or SIMD, this is rounded exactly once and
+		// always gives the same result
+		inline float dequantize(float aOrigin, int aExponent, uint8_t q)
+		{
+			return aOrigin + static_cast<float>(q) * quantizationScale(aExponent);
+		}
+
+		// Child bounds of a node, decoded into aScratch if need be
+		inline const geom::BBox4& childBounds(const WideBVHNode &aNode, geom::BBox4 * /*aScratch*/)
+		{
+			return aNode.childBounds;
+		}
+
+		inline const geom::BBox4& childBounds(const QuantizedBVHNode &aNode, geom::BBox4 *aScratch)
+		{
+			float *mins[3] = { aScratch->minX, aScratch->minY, aScratch->minZ };
+			float *maxs[3] = { aScratch->maxX, aScratch->maxY, aScratch->maxZ };
+#if defined(NAMASTE_SSE)
+			const __m128i zero = _mm_setzero_si128();
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const __m128 origin = _mm_set1_ps(aNode.origin[axis]);
+				const __m128 scale = _mm_set1_ps(quantizationScale(aNode.exponent[axis]));
+				int32_t qMin, qMax;
+				std::memcpy(&qMin, aNode.qMin[axis], sizeof(int32_t));
+				std::memcpy(&qMax, aNode.qMax[axis], sizeof(int32_t));
+				__m128i lo = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(qMin), zero), zero);
+				__m128i hi = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(qMax), zero), zero);
+				_mm_store_ps(mins[axis], _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale)));
+				_mm_store_ps(maxs[axis], _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale)));
+			}
+#else
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (int i = 0; i < wideBVHWidth; ++i)
+				{
+					mins[axis][i] = dequantize(aNode.origin[axis], aNode.exponent[axis], aNode.qMin[axis][i]);
+					maxs[axis][i] = dequantize(aNode.origin[axis], aNode.exponent[axis], aNode.qMax[axis][i]);
+				}
+			}
+#endif
+			return *aScratch;
+		}
+
+		template <typename LeafFunc>
+		bool WideBVH::intersectLeaves(const geom::Ray &aRay, LeafFunc intersectLeaf) const
+		{
+			return quantized ? traverse(quantizedNodes, aRay, intersectLeaf) : traverse(nodes, aRay, intersectLeaf);
+		}
+
+		template <typename Node, typename LeafFunc>
+		bool WideBVH::traverse(const std::vector<Node> &aNodes, const geom::Ray &aRay, LeafFunc intersectLeaf) const
+		{
+			if (aNodes.empty())
+			{
+				return false;
+			}
+
+			bool hit = false;
+			geom::Vector invDir(1.0f / aRay.d.x, 1.0f / aRay.d.y, 1.0f / aRay.d.z);
+			geom::BBox4 scratch;
+
+			// Leaf children are intersected as soon as their node is, nearest first, so
+			// that they shrink maxT early; interior children are pushed far to near and
+			// skipped when popped if a closer hit has been found meanwhile
+			struct StackEntry
+			{
+				uint32_t node;
+				float tNear;
+			};
+			StackEntry nodesToVisit[maxWideBVHStack];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = 0;
+			stats::RayCounter rayStats(stats::CounterClosestHitRays, stats::DistributionNodesPerClosestHitRay);
+			while (true)
+			{
+				const Node &node = aNodes[currentNodeIndex];
+				rayStats.node(node.childCount);
+				alignas(16) float tNear[wideBVHWidth];
+				int hitMask = geom::intersectP(childBounds(node, &scratch), aRay, invDir, tNear) & ((1 << node.childCount) - 1);
+
+				// Sort the children that were hit by entry distance
+				int order[wideBVHWidth];
+				int nHit = 0;
+				for (int i = 0; i < node.childCount; ++i)
+				{
+					if (hitMask & (1 << i))
+					{
+						int j = nHit++;
+						for (; j > 0 && tNear[order[j - 1]] > tNear[i]; --j)
+						{
+							order[j] = order[j - 1];
+						}
+						order[j] = i;
+					}
+				}
+
+				int firstPush = toVisitOffset;
+				for (int k = 0; k < nHit; ++k)
+				{
+					int i = order[k];
+					if (node.nPrimitives[i] > 0)
+					{
+						if (tNear[i] <= aRay.maxT)
+						{
+							rayStats.primitives(node.nPrimitives[i]);
+							if (intersectLeaf(&primitiveIndices[node.children[i]], static_cast<int>(node.nPrimitives[i]), aRay))
+							{
+								hit = true;
+							}
+						}
+					}
+					else
+					{
+						nodesToVisit[toVisitOffset].node = node.children[i];
+						nodesToVisit[toVisitOffset].tNear = tNear[i];
+						++toVisitOffset;
+					}
+				}
+				// Reverse the pushed children, so the nearest is popped first
+				for (int a = firstPush, b = toVisitOffset - 1; a < b; ++a, --b)
+				{
+					StackEntry tmp = nodesToVisit[a];
+					nodesToVisit[a] = nodesToVisit[b];
+					nodesToVisit[b] = tmp;
+				}
+
+				while (toVisitOffset > 0 && nodesToVisit[toVisitOffset - 1].tNear > aRay.maxT)
+				{
+					--toVisitOffset;
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset].node;
+			}
+			return hit;
+		}
+
+		template <typename LeafFunc>
+		bool WideBVH::intersectP(const geom::Ray &aRay, LeafFunc occludedLeaf) const
+		{
+			return quantized ? traverseAnyHit(quantizedNodes, aRay, occludedLeaf) : traverseAnyHit(nodes, aRay, occludedLeaf);
+		}
+
+		// Any hit ends the query, so there is no sorting by distance: leaf children
+		// are tested straight away and interior ones pushed in slot order
+		template <typename Node, typename LeafFunc>
+		bool WideBVH::traverseAnyHit(const std::vector<Node> &aNodes, const geom::Ray &aRay, LeafFunc occludedLeaf) const
+		{
+			if (aNodes.empty())
+			{
+				return false;
+			}
+
+			geom::Vector invDir(1.0f / aRay.d.x, 1.0f / aRay.d.y, 1.0f / aRay.d.z);
+			geom::BBox4 scratch;
+
+			uint32_t nodesToVisit[maxWideBVHStack];
+			int toVisitOffset = 0;
+			uint32_t currentNodeIndex = 0;
+			stats::RayCounter rayStats(stats::CounterAnyHitRays, stats::DistributionNodesPerAnyHitRay);
+			while (true)
+			{
+				const Node &node = aNodes[currentNodeIndex];
+				rayStats.node(node.childCount);
+				int hitMask = geom::intersectP(childBounds(node, &scratch), aRay, invDir, nullptr) & ((1 << node.childCount) - 1);
+				for (int i = 0; i < node.childCount; ++i)
+				{
+					if (!(hitMask & (1 << i)))
+					{
+						continue;
+					}
+					if (node.nPrimitives[i] == 0)
+					{
+						nodesToVisit[toVisitOffset++] = node.children[i];
+						continue;
+					}
+					rayStats.primitives(node.nPrimitives[i]);
+					if (occludedLeaf(&primitiveIndices[node.children[i]], static_cast<int>(node.nPrimitives[i]), aRay))
+					{
+						return true;
+					}
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			return false;
+		}
+
+	} // namespace accel
+
+} // namespace namaste